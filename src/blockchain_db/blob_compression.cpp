@@ -0,0 +1,182 @@
+// Copyright (c) 2014-2022, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdexcept>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#include "misc_log_ex.h"
+#include "blob_compression.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "blockchain.db"
+
+// a blob can't decompress to more than this, so corrupt data can't make us
+// allocate an unbounded amount of memory
+#define MAX_DECOMPRESSED_SIZE (256 * 1024 * 1024)
+
+namespace cryptonote
+{
+#ifdef HAVE_ZSTD
+  namespace
+  {
+    struct zstd_contexts
+    {
+      ZSTD_CCtx *cctx;
+      ZSTD_DCtx *dctx;
+      zstd_contexts(): cctx(ZSTD_createCCtx()), dctx(ZSTD_createDCtx())
+      {
+        if (!cctx || !dctx)
+          throw std::runtime_error("Failed to create zstd contexts");
+      }
+      ~zstd_contexts() { ZSTD_freeCCtx(cctx); ZSTD_freeDCtx(dctx); }
+    };
+
+    zstd_contexts &get_contexts()
+    {
+      static thread_local zstd_contexts contexts;
+      return contexts;
+    }
+  }
+
+  struct blob_compressor::impl
+  {
+    int level;
+    ZSTD_CDict *cdict;
+    ZSTD_DDict *ddict;
+
+    impl(const std::string &dictionary, int level): level(level), cdict(NULL), ddict(NULL)
+    {
+      if (dictionary.empty())
+        return;
+      cdict = ZSTD_createCDict(dictionary.data(), dictionary.size(), level);
+      ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+      if (!cdict || !ddict)
+      {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        throw std::runtime_error("Failed to load zstd dictionary");
+      }
+    }
+    ~impl() { ZSTD_freeCDict(cdict); ZSTD_freeDDict(ddict); }
+  };
+#else
+  struct blob_compressor::impl {};
+#endif
+
+  blob_compressor::blob_compressor(const std::string &dictionary, int level)
+  {
+#ifdef HAVE_ZSTD
+    m_impl.reset(new impl(dictionary, level));
+#else
+    throw std::runtime_error("This build was made without zstd support");
+#endif
+  }
+
+  blob_compressor::~blob_compressor()
+  {
+  }
+
+  bool blob_compressor::is_supported()
+  {
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  std::string blob_compressor::train_dictionary(const std::vector<std::string> &samples, size_t max_size)
+  {
+#ifdef HAVE_ZSTD
+    std::string buffer;
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    for (const std::string &sample: samples)
+    {
+      buffer += sample;
+      sizes.push_back(sample.size());
+    }
+    std::string dictionary(max_size, '\0');
+    const size_t size = ZDICT_trainFromBuffer(&dictionary[0], dictionary.size(), buffer.data(), sizes.data(), sizes.size());
+    if (ZDICT_isError(size))
+    {
+      MWARNING("Failed to train a compression dictionary on " << samples.size() << " samples: " << ZDICT_getErrorName(size));
+      return std::string();
+    }
+    dictionary.resize(size);
+    return dictionary;
+#else
+    return std::string();
+#endif
+  }
+
+  bool blob_compressor::compress(const void *data, size_t size, std::string &out) const
+  {
+#ifdef HAVE_ZSTD
+    zstd_contexts &contexts = get_contexts();
+    out.resize(ZSTD_compressBound(size));
+    const size_t result = m_impl->cdict ?
+      ZSTD_compress_usingCDict(contexts.cctx, &out[0], out.size(), data, size, m_impl->cdict) :
+      ZSTD_compressCCtx(contexts.cctx, &out[0], out.size(), data, size, m_impl->level);
+    if (ZSTD_isError(result))
+    {
+      MERROR("Failed to compress blob: " << ZSTD_getErrorName(result));
+      return false;
+    }
+    out.resize(result);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool blob_compressor::decompress(const void *data, size_t size, std::string &out) const
+  {
+#ifdef HAVE_ZSTD
+    const unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+    if (content_size == ZSTD_CONTENTSIZE_ERROR || content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size > MAX_DECOMPRESSED_SIZE)
+      return false;
+    zstd_contexts &contexts = get_contexts();
+    const size_t offset = out.size();
+    out.resize(offset + content_size);
+    const size_t result = m_impl->ddict ?
+      ZSTD_decompress_usingDDict(contexts.dctx, &out[offset], content_size, data, size, m_impl->ddict) :
+      ZSTD_decompressDCtx(contexts.dctx, &out[offset], content_size, data, size);
+    if (ZSTD_isError(result) || result != content_size)
+    {
+      out.resize(offset);
+      return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2014-2022, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cryptonote
+{
+  /**
+   * @brief zstd compression of the blobs kept in the blockchain database
+   *
+   * A compressor may use a dictionary trained on samples of the data it will
+   * see, which makes a large difference for small values like transactions.
+   * Compressing and decompressing are safe to call from several threads at
+   * once, each thread uses its own zstd contexts.
+   *
+   * Without zstd support in the build, is_supported() returns false and the
+   * constructor throws.
+   */
+  class blob_compressor
+  {
+  public:
+    static const int DEFAULT_LEVEL = 3;
+    static const size_t DEFAULT_DICTIONARY_SIZE = 112640;
+
+    blob_compressor(const std::string &dictionary, int level = DEFAULT_LEVEL);
+    ~blob_compressor();
+
+    static bool is_supported();
+
+    /**
+     * @brief trains a dictionary on samples of the data to compress
+     *
+     * @return the dictionary, or an empty string if there were too few samples
+     */
+    static std::string train_dictionary(const std::vector<std::string> &samples, size_t max_size = DEFAULT_DICTIONARY_SIZE);
+
+    //! replaces out with the compressed data, returns false on error
+    bool compress(const void *data, size_t size, std::string &out) const;
+
+    //! appends the decompressed data to out, returns false if the data is not valid
+    bool decompress(const void *data, size_t size, std::string &out) const;
+
+  private:
+    struct impl;
+    std::unique_ptr<impl> m_impl;
+  };
+}
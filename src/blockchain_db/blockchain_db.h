@@ -187,6 +187,47 @@ struct txpool_tx_meta_t
   }
 };
 
+/**
+ * @brief how a database table uses its pages, see get_db_stats
+ */
+struct db_table_stats
+{
+  std::string name;
+  uint64_t entries;
+  uint32_t depth;            //!< depth of the table's btree
+  uint64_t branch_pages;
+  uint64_t leaf_pages;
+  uint64_t overflow_pages;   //!< pages of values too large for a leaf page
+};
+
+/**
+ * @brief how the database uses its pages, see get_db_stats
+ */
+struct db_stats
+{
+  uint64_t page_size;
+  uint64_t map_size;
+  uint64_t file_size;
+  uint64_t used_pages;       //!< pages up to the last one used, free or not
+  uint64_t free_pages;       //!< pages on the free list, which are reused before the file grows
+  uint32_t readers;
+  uint32_t max_readers;
+  std::vector<db_table_stats> tables;
+};
+
+/**
+ * @brief the state of a compaction, see start_compaction
+ */
+struct db_compaction_status
+{
+  enum state_t { idle, copying, ready, done, failed };
+
+  state_t state;
+  uint64_t size_before;      //!< the database file size when the compaction started
+  uint64_t size_after;       //!< the size of the compacted copy, once made
+  unsigned attempts;         //!< the copies made, one is redone if the blockchain changed meanwhile
+  std::string error;         //!< why the compaction failed
+};
 
 #define DBF_SAFE       1
 #define DBF_FAST       2
@@ -194,6 +235,19 @@ struct txpool_tx_meta_t
 #define DBF_RDONLY     8
 #define DBF_SALVAGE 0x10
 
+// tables whose values may be stored compressed, see set_blob_compression
+#define DB_COMPRESS_BLOCKS        1
+#define DB_COMPRESS_TXS_PRUNED    2
+#define DB_COMPRESS_TXS_PRUNABLE  4
+#define DB_COMPRESS_ALL           (DB_COMPRESS_BLOCKS | DB_COMPRESS_TXS_PRUNED | DB_COMPRESS_TXS_PRUNABLE)
+// a table is only compressed once it has enough values to train its dictionary on
+#define DEFAULT_BLOB_COMPRESSION_MIN_VALUES 16384
+
+// tables whose old values may be moved to cold storage, see set_cold_storage
+#define DB_COLD_BLOCKS            DB_COMPRESS_BLOCKS
+#define DB_COLD_TXS_PRUNABLE      DB_COMPRESS_TXS_PRUNABLE
+#define DB_COLD_ALL               (DB_COLD_BLOCKS | DB_COLD_TXS_PRUNABLE)
+
 /***********************************
  * Exception Definitions
  ***********************************/
@@ -573,6 +627,12 @@ protected:
   mutable uint64_t time_tx_exists = 0;  //!< a performance metric
   uint64_t time_commit1 = 0;  //!< a performance metric
   bool m_auto_remove_logs = true;  //!< whether or not to automatically remove old logs
+  unsigned m_spent_key_filter_bits = 0;  //!< bits per key image in the spent key filter, set by the daemon
+  int m_blob_compression = -1;  //!< DB_COMPRESS_* tables to compress, or -1 to keep the database's own setting
+  uint64_t m_blob_compression_min_values = DEFAULT_BLOB_COMPRESSION_MIN_VALUES;  //!< values a table needs before it is compressed
+  std::string m_cold_storage_path;  //!< where old data goes, empty to use the one the database was set up with
+  uint64_t m_cold_storage_depth = 0;  //!< how many top blocks keep their data in the main database
+  unsigned m_cold_storage_tables = 0;  //!< DB_COLD_* tables whose old values are moved
 
   HardFork* m_hardfork;
 
@@ -1489,6 +1549,21 @@ public:
    * @param outputs return-by-reference a list of outputs' metadata
    */
   virtual void get_output_key(const epee::span<const uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs, bool allow_partial = false) const = 0;
+
+  /**
+   * @brief gets outputs' data for a batch of (amount, index) pairs
+   *
+   * Unlike get_output_key, the requests may be in any order and may contain
+   * duplicates. The subclass should look each distinct output up once, in
+   * key order, so that requests close to each other in the database are
+   * cheap to resolve. Outputs which do not exist are not an error, they are
+   * reported by the found flags instead.
+   *
+   * @param amount_indices a list of (amount, amount-specific index) pairs
+   * @param outputs return-by-reference the outputs' metadata, one per request
+   * @param found return-by-reference whether each requested output exists
+   */
+  virtual void get_output_keys(const epee::span<const std::pair<uint64_t, uint64_t>> &amount_indices, std::vector<output_data_t> &outputs, std::vector<bool> &found) const = 0;
   
   /*
    * FIXME: Need to check with git blame and ask what this does to
@@ -1584,6 +1659,16 @@ public:
    */
   virtual cryptonote::blobdata get_txpool_tx_blob(const crypto::hash& txid, relay_category tx_category) const = 0;
 
+  /**
+   * @brief write out any txpool changes the database holds back
+   *
+   * A database may keep txpool additions and metadata updates in memory
+   * for a short while, to write many of them in one transaction. They are
+   * visible to readers at once, but are only durable once written out.
+   * Removals are never held back.
+   */
+  virtual void flush_txpool_updates() = 0;
+
   /**
    * @brief Check if `tx_hash` relay status is in `category`.
    *
@@ -1626,6 +1711,78 @@ public:
    */
   virtual bool check_pruning() = 0;
 
+  /**
+   * @brief prunes part of the blockchain, so it can be pruned while in use
+   *
+   * Each call commits its work and picks up where the previous one stopped,
+   * across restarts too. The blockchain is reported as pruned from the
+   * first call, and blocks added meanwhile are pruned as usual by
+   * update_pruning.
+   *
+   * @param pruning_seed the seed to use, 0 for default (highly recommended)
+   * @param max_bytes roughly how many bytes of prunable data to go through
+   *
+   * @return true if pruning is complete, false if there is more to do
+   */
+  virtual bool prune_blockchain_incremental(uint32_t pruning_seed, uint64_t max_bytes) = 0;
+
+  /**
+   * @brief gets how far incremental pruning went
+   *
+   * @param height return-by-reference the height pruning resumes from
+   *
+   * @return true if incremental pruning is under way, false otherwise
+   */
+  virtual bool get_pruning_progress(uint64_t &height) const = 0;
+
+  /**
+   * @brief moves part of the old data to cold storage, see set_cold_storage
+   *
+   * Each call commits its work and picks up where the previous one stopped.
+   * Prunable data is not moved once the blockchain is pruned.
+   *
+   * @param max_bytes roughly how many bytes of data to move
+   *
+   * @return true if all the data deep enough is in cold storage, false if there is more to move
+   */
+  virtual bool move_to_cold_storage(uint64_t max_bytes) = 0;
+
+  /**
+   * @brief gets how the database and each of its tables use their pages
+   *
+   * @param stats return-by-reference the page statistics
+   */
+  virtual void get_db_stats(db_stats &stats) const = 0;
+
+  /**
+   * @brief starts writing a compacted copy of the database in the background
+   *
+   * The copy leaves out the free pages. The database stays usable while it
+   * is made, and finish_compaction swaps it in once it is ready. Having to
+   * resize the database fails the compaction.
+   *
+   * @return false if a compaction is under way or could not be started
+   */
+  virtual bool start_compaction() = 0;
+
+  /**
+   * @brief swaps the compacted copy in for the database, if it is ready
+   *
+   * This must be called while nothing writes to the database. Changes made to
+   * the txpool and alt blocks since the copy was made are carried over. If
+   * anything else changed, the copy is discarded and a new one is started.
+   *
+   * @return true if the compacted copy is now the database
+   */
+  virtual bool finish_compaction() = 0;
+
+  /**
+   * @brief gets the state of the last compaction
+   *
+   * @return the compaction state
+   */
+  virtual db_compaction_status get_compaction_status() const = 0;
+
   /**
    * @brief get the max block size
    */
@@ -1677,6 +1834,61 @@ public:
    */
   virtual void drop_alt_blocks() = 0;
 
+  /**
+   * @brief replace the stored RingCT verification cache entries
+   *
+   * The entries are opaque hashes of a transaction and its ring, see
+   * ver_rct_non_semantics_simple_cached. They are kept in the given order.
+   *
+   * @param entries the entries to store, oldest first
+   */
+  virtual void set_rct_ver_cache(const std::vector<crypto::hash> &entries) = 0;
+
+  /**
+   * @brief get the stored RingCT verification cache entries
+   *
+   * @return the entries, in the order they were stored
+   */
+  virtual std::vector<crypto::hash> get_rct_ver_cache() const = 0;
+
+  /**
+   * @brief store the proof of work hash of a block
+   *
+   * A block's PoW hash only depends on the block, including the chain it
+   * builds on, so it may be stored for main chain and alternative blocks
+   * alike, and stays valid if the block is popped. Storing a hash which is
+   * already stored is not an error.
+   *
+   * This needs a write transaction to be active.
+   *
+   * @param height the height of the block
+   * @param blk_hash the hash of the block
+   * @param pow the block's PoW hash
+   */
+  virtual void add_block_pow(uint64_t height, const crypto::hash &blk_hash, const crypto::hash &pow) = 0;
+
+  /**
+   * @brief get the stored proof of work hash of a block
+   *
+   * @param height the height of the block
+   * @param blk_hash the hash of the block
+   * @param pow return-by-reference the block's PoW hash
+   *
+   * @return true if the PoW hash was found, false otherwise
+   */
+  virtual bool get_block_pow(uint64_t height, const crypto::hash &blk_hash, crypto::hash &pow) const = 0;
+
+  /**
+   * @brief remove stored proof of work hashes, lowest heights first
+   *
+   * This needs a write transaction to be active.
+   *
+   * @param max_entries the number of PoW hashes to keep
+   *
+   * @return the number of PoW hashes removed
+   */
+  virtual uint64_t trim_block_pow(uint64_t max_entries) = 0;
+
   /**
    * @brief runs a function over all txpool transactions
    *
@@ -1828,6 +2040,22 @@ public:
    */
   virtual std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff, uint64_t min_count) const = 0;
 
+  /**
+   * @brief return the cumulative per block count of outputs of a non-zero amount
+   *
+   * Each entry counts all outputs of that amount up to and including its
+   * block, so the first one includes the outputs below from_height. Those
+   * are also returned in base, as for the rct distribution, so the first
+   * block's own outputs are distribution[0] - base.
+   *
+   * @param amount the amount
+   * @param from_height the height of the first entry
+   * @param to_height the height of the last entry, or 0 for the top block
+   * @param distribution return-by-reference the cumulative output counts
+   * @param base return-by-reference the number of outputs below from_height
+   *
+   * @return false if the range is outside the chain, true otherwise
+   */
   virtual bool get_output_distribution(uint64_t amount, uint64_t from_height, uint64_t to_height, std::vector<uint64_t> &distribution, uint64_t &base) const = 0;
 
   /**
@@ -1861,6 +2089,58 @@ public:
    */
   void set_auto_remove_logs(bool auto_remove) { m_auto_remove_logs = auto_remove; }
 
+  /**
+   * @brief set the size of the in-memory filter over spent key images
+   *
+   * The filter lets has_key_image answer most lookups of unspent key images
+   * without reading the database. More bits per key image cost more memory
+   * and give fewer false positives. This must be called before open. It is
+   * off unless set, so tools which open the database don't spend time and
+   * memory building one.
+   *
+   * @param bits_per_key_image bits of filter per spent key image, 0 to disable
+   */
+  void set_spent_key_filter_bits(unsigned bits_per_key_image) { m_spent_key_filter_bits = bits_per_key_image; }
+
+  /**
+   * @brief choose which blob tables are stored compressed
+   *
+   * When the database is opened, any listed table which is stored raw is
+   * converted to compressed form, and any table not listed which is stored
+   * compressed is converted back. Reading blobs is the same either way.
+   * Without a call to this, the database keeps whatever it was set to.
+   * This must be called before open.
+   *
+   * A table's dictionary is trained on its values, so a table with fewer
+   * than min_values values, such as on a new database, is left raw until
+   * the database is opened again with enough of them.
+   *
+   * @param tables a combination of the DB_COMPRESS_* flags
+   * @param min_values how many values a table needs before it is compressed
+   */
+  void set_blob_compression(unsigned tables, uint64_t min_values = DEFAULT_BLOB_COMPRESSION_MIN_VALUES) { m_blob_compression = tables & DB_COMPRESS_ALL; m_blob_compression_min_values = min_values; }
+
+  /**
+   * @brief get which blob tables are stored compressed
+   *
+   * @return a combination of the DB_COMPRESS_* flags
+   */
+  virtual unsigned get_blob_compression() const { return 0; }
+
+  /**
+   * @brief move old data to a second database, which may be on slower storage
+   *
+   * move_to_cold_storage moves the listed tables' values for blocks deeper
+   * than depth to a database at path. Getters read them from there as if
+   * they had not moved. Data which was moved stays in cold storage, even if
+   * a later open lists fewer tables. This must be called before open.
+   *
+   * @param path the cold storage directory, empty to use the one set before
+   * @param depth how many top blocks keep their data in the main database
+   * @param tables a combination of the DB_COLD_* flags
+   */
+  void set_cold_storage(const std::string &path, uint64_t depth, unsigned tables) { m_cold_storage_path = path; m_cold_storage_depth = depth; m_cold_storage_tables = tables & DB_COLD_ALL; }
+
   bool m_open;  //!< Whether or not the BlockchainDB is open/ready for use
   mutable epee::critical_section m_synchronization_lock;  //!< A lock, currently for when BlockchainLMDB needs to resize the backing db file
 
@@ -31,6 +31,11 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/format.hpp>
 #include <boost/circular_buffer.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <chrono>
 #include <memory>  // std::unique_ptr
 #include <cstring>  // memcpy
 
@@ -58,7 +63,40 @@ using epee::string_tools::pod_to_hex;
 using namespace crypto;
 
 // Increase when the DB structure changes
-#define VERSION 5
+#define VERSION 6
+
+// How far get_output_keys steps along an amount's outputs before it
+// prefers a fresh lookup
+#define OUTPUT_KEYS_MAX_STEPS 16
+
+// How many values of a blob table a compression dictionary is trained on,
+// and how many values are converted per transaction
+#define BLOB_DICTIONARY_SAMPLES 16384
+#define BLOB_DICTIONARY_MAX_SAMPLE_SIZE 131072
+#define BLOB_CONVERSION_BATCH_SIZE 1000
+
+// How many of the top blocks' block_info records are kept in memory
+#define BLOCK_INFO_CACHE_SIZE 4096
+
+// How many compacted copies are made before giving up on a database which
+// keeps changing, and how long the swap waits for readers to finish
+#define COMPACTION_MAX_ATTEMPTS 5
+#define COMPACTION_SWAP_TIMEOUT_MS 1000
+
+// How long a compacted copy waits to be swapped in before it's made again,
+// and how much the database may grow while it's made
+#define COMPACTION_READY_TIMEOUT 120
+#define COMPACTION_MAP_ROOM (1ull << 30)
+
+// How much room left in the map lets a resize wait for a compaction to be
+// over, rather than have the resizing thread wait for its copy
+#define COMPACTION_RESIZE_MARGIN (1ull << 28)
+
+// How long txpool additions and metadata updates may stay in memory, and
+// how many or how large they may get, before they're written to the db
+#define TXPOOL_CACHE_FLUSH_INTERVAL 2
+#define TXPOOL_CACHE_MAX_ENTRIES 1000
+#define TXPOOL_CACHE_MAX_BYTES (4 * 1024 * 1024)
 
 namespace
 {
@@ -200,6 +238,7 @@ namespace
  *
  * output_txs       output ID    {txn hash, local index}
  * output_amounts   amount       [{amount output index, metadata}...]
+ * output_distribution amount    [{block height, num outputs}...]
  *
  * spent_keys       input hash   -
  *
@@ -208,13 +247,29 @@ namespace
  *
  * alt_blocks       block hash   {block data, block blob}
  *
+ * rct_ver_cache    index        RingCT verification cache entry hash
+ *
+ * block_pow        block height {block hash, PoW hash}
+ *
+ * The values of blocks, txs_pruned and txs_prunable may each be stored as
+ * zstd frames, see the blob_compression entry in properties.
+ *
+ * While the blockchain is being pruned online, the pruning_progress entry
+ * in properties says where pruning resumes.
+ *
+ * Old values of blocks and txs_prunable may be moved to tables of the same
+ * name in a second environment, the cold storage, where they are stored
+ * raw. The cold_storage entry in properties has, for each blob table, the
+ * key below which values were moved, and cold_storage_path where they are.
+ *
  * Note: where the data items are of uniform size, DUPFIXED tables have
  * been used to save space. In most of these cases, a dummy "zerokval"
  * key is used when accessing the table; the Key listed above will be
  * attached as a prefix on the Data to serve as the DUPSORT key.
  * (DUPFIXED saves 8 bytes per record.)
  *
- * The output_amounts table doesn't use a dummy key, but uses DUPSORT.
+ * The output_amounts and output_distribution tables don't use a dummy key,
+ * but use DUPSORT.
  */
 const char* const LMDB_BLOCKS = "blocks";
 const char* const LMDB_BLOCK_HEIGHTS = "block_heights";
@@ -230,6 +285,7 @@ const char* const LMDB_TX_OUTPUTS = "tx_outputs";
 
 const char* const LMDB_OUTPUT_TXS = "output_txs";
 const char* const LMDB_OUTPUT_AMOUNTS = "output_amounts";
+const char* const LMDB_OUTPUT_DISTRIBUTION = "output_distribution";
 const char* const LMDB_SPENT_KEYS = "spent_keys";
 
 const char* const LMDB_TXPOOL_META = "txpool_meta";
@@ -242,6 +298,36 @@ const char* const LMDB_HF_VERSIONS = "hf_versions";
 
 const char* const LMDB_PROPERTIES = "properties";
 
+const char* const LMDB_RCT_VER_CACHE = "rct_ver_cache";
+
+const char* const LMDB_BLOCK_POW = "block_pow";
+
+// in blob_table order
+const char* const blob_table_names[] = { LMDB_BLOCKS, LMDB_TXS_PRUNED, LMDB_TXS_PRUNABLE };
+
+// properties entry kept while a blob table is being converted: values with
+// keys below next_key are in the new form, the rest in the old one
+struct blob_conversion_progress
+{
+  uint32_t table;
+  uint32_t compress;
+  uint64_t next_key;
+};
+
+// blocks below height are pruned, as are the txs below tx_id in the pruned
+// stripes starting at height
+struct pruning_progress
+{
+  uint64_t height;
+  uint64_t tx_id;
+};
+
+// properties entry of the cold storage, in blob_table order
+struct cold_storage_state
+{
+  uint64_t boundaries[3];
+};
+
 const char zerokey[8] = {0};
 const MDB_val zerokval = { sizeof(zerokey), (void *)zerokey };
 
@@ -257,6 +343,22 @@ inline void lmdb_db_open(MDB_txn* txn, const char* name, int flags, MDB_dbi& dbi
     throw0(cryptonote::DB_OPEN_FAILURE((lmdb_error(error_string + " : ", res) + std::string(" - you may want to start with --db-salvage")).c_str()));
 }
 
+// the records of the main table, which describe the other tables. Any change
+// to a table gives it a new root page, and so a new record.
+int read_main_table(MDB_txn *txn, std::map<std::string, std::string> &records)
+{
+  MDB_dbi main_dbi;
+  MDB_cursor *cur;
+  int result;
+  if ((result = mdb_dbi_open(txn, NULL, 0, &main_dbi)) || (result = mdb_cursor_open(txn, main_dbi, &cur)))
+    return result;
+  MDB_val k, v;
+  while (!(result = mdb_cursor_get(cur, &k, &v, MDB_NEXT)))
+    records[std::string((const char*)k.mv_data, k.mv_size)] = std::string((const char*)v.mv_data, v.mv_size);
+  mdb_cursor_close(cur);
+  return result == MDB_NOTFOUND ? 0 : result;
+}
+
 
 }  // anonymous namespace
 
@@ -337,6 +439,11 @@ typedef struct blk_height {
     uint64_t bh_height;
 } blk_height;
 
+typedef struct blk_pow {
+    crypto::hash bp_hash;
+    crypto::hash bp_pow;
+} blk_pow;
+
 typedef struct pre_rct_outkey {
     uint64_t amount_index;
     uint64_t output_id;
@@ -349,24 +456,387 @@ typedef struct outkey {
     output_data_t data;
 } outkey;
 
+// for each non zero amount, one record per block which added outputs of
+// that amount, with the number of them up to and including that block
+typedef struct outdist {
+    uint64_t height;
+    uint64_t num_outputs;
+} outdist;
+
 typedef struct outtx {
     uint64_t output_id;
     crypto::hash tx_hash;
     uint64_t local_index;
 } outtx;
 
+struct BlockchainLMDB::block_info_cache
+{
+  block_info_cache(): committed(BLOCK_INFO_CACHE_SIZE), pending(BLOCK_INFO_CACHE_SIZE) {}
+
+  bool get(uint64_t height, mdb_block_info &bi)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex);
+    if (committed.empty() || height < committed.front().bi_height || height > committed.back().bi_height)
+      return false;
+    bi = committed[height - committed.front().bi_height];
+    return true;
+  }
+
+  // the write txn added a block on top of the chain
+  void add(const mdb_block_info &bi)
+  {
+    pending.push_back(bi);
+  }
+
+  // the write txn removed the top block of the chain
+  void remove(uint64_t height)
+  {
+    if (!pending.empty())
+    {
+      pending.pop_back();
+      return;
+    }
+    boost::unique_lock<boost::shared_mutex> lock(mutex);
+    while (!committed.empty() && committed.back().bi_height >= height)
+      committed.pop_back();
+  }
+
+  void commit()
+  {
+    if (pending.empty())
+      return;
+    boost::unique_lock<boost::shared_mutex> lock(mutex);
+    // more blocks than fit may have been added since the last commit
+    if (!committed.empty() && committed.back().bi_height + 1 != pending.front().bi_height)
+      committed.clear();
+    for (const mdb_block_info &bi: pending)
+      committed.push_back(bi);
+    pending.clear();
+  }
+
+  void abort()
+  {
+    pending.clear();
+  }
+
+  void clear()
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex);
+    committed.clear();
+    pending.clear();
+  }
+
+  boost::shared_mutex mutex;
+  boost::circular_buffer<mdb_block_info> committed; // consecutive heights, guarded by mutex
+  boost::circular_buffer<mdb_block_info> pending; // only used by the writer thread
+};
+
+// the id of the oldest snapshot a reader of env holds, or the largest id if
+// none holds one. LMDB only lists its reader slots as text, one per line
+// after a header, as "pid thread txnid", with "-" for a slot without a txn.
+static uint64_t get_oldest_snapshot(MDB_env *env)
+{
+  uint64_t oldest = std::numeric_limits<uint64_t>::max();
+  mdb_reader_list(env, [](const char *msg, void *ctx) -> int {
+    uint64_t &oldest = *(uint64_t*)ctx;
+    int pid;
+    unsigned long long thread, txnid;
+    if (sscanf(msg, "%d %llx %llu", &pid, &thread, &txnid) == 3 && txnid < oldest)
+      oldest = txnid;
+    return 0;
+  }, &oldest);
+  return oldest;
+}
+
+struct BlockchainLMDB::txpool_cache
+{
+  struct entry
+  {
+    txpool_tx_meta_t meta;
+    bool removed; // only in pending, hides the committed entry
+    bool in_db; // the tx is in the txpool tables, with older metadata
+    bool has_blob; // the tx was added since the last flush, so its blob is only here
+    cryptonote::blobdata blob;
+  };
+
+  // what a reader sees of a tx, with the blob being null if it's in the db
+  struct view
+  {
+    const txpool_tx_meta_t *meta;
+    const cryptonote::blobdata *blob;
+    bool in_db;
+  };
+
+  // false if the tx has no unwritten change, else removed tells whether
+  // it's gone. pending is only looked at by the writer thread. snapshot is
+  // the id of the read txn the reader keeps open, if any, and if it's older
+  // than the last flush, what was flushed is still unwritten to it.
+  bool get(const crypto::hash &txid, bool writer, view &v, bool &removed, uint64_t snapshot = 0) const
+  {
+    auto c = committed.find(txid);
+    const auto p = writer ? pending.find(txid) : pending.end();
+    removed = false;
+    if (p != pending.end())
+    {
+      removed = p->second.removed;
+      v.meta = &p->second.meta;
+      v.in_db = p->second.in_db;
+      v.blob = p->second.has_blob ? &p->second.blob : c != committed.end() && c->second.has_blob ? &c->second.blob : nullptr;
+      return true;
+    }
+    if (c == committed.end() && snapshot && snapshot < flushed_txnid)
+    {
+      c = flushed.find(txid);
+      if (c == flushed.end())
+        return false;
+    }
+    else if (c == committed.end())
+      return false;
+    v.meta = &c->second.meta;
+    v.in_db = c->second.in_db;
+    v.blob = c->second.has_blob ? &c->second.blob : nullptr;
+    return true;
+  }
+
+  // copies of the txes with unwritten changes which weren't removed, as
+  // removals are already in the db. has_blob is false unless blobs are
+  // asked for.
+  void get_all(bool writer, std::unordered_map<crypto::hash, entry> &all, bool with_blobs, uint64_t snapshot = 0) const
+  {
+    auto copy = [&](const crypto::hash &txid) {
+      bool removed;
+      view v;
+      if (!get(txid, writer, v, removed, snapshot) || removed)
+        return;
+      entry &e = all[txid];
+      e.meta = *v.meta;
+      e.removed = false;
+      e.in_db = v.in_db;
+      e.has_blob = with_blobs && v.blob;
+      if (e.has_blob)
+        e.blob = *v.blob;
+    };
+    for (const auto &e: committed)
+      copy(e.first);
+    if (snapshot && snapshot < flushed_txnid)
+      for (const auto &e: flushed)
+        copy(e.first);
+    if (writer)
+      for (const auto &e: pending)
+        copy(e.first);
+  }
+
+  // the write txn added a tx, which is in neither the cache nor the db
+  void add(const crypto::hash &txid, const txpool_tx_meta_t &meta, const cryptonote::blobdata_ref &blob)
+  {
+    entry &e = pending[txid];
+    e.meta = meta;
+    e.removed = false;
+    e.in_db = false;
+    e.has_blob = true;
+    e.blob.assign(blob.data(), blob.size());
+  }
+
+  // the write txn updated the metadata of a tx which exists
+  void update(const crypto::hash &txid, const txpool_tx_meta_t &meta, bool in_db)
+  {
+    auto i = pending.find(txid);
+    if (i == pending.end())
+    {
+      entry &e = pending[txid];
+      e.removed = false;
+      e.in_db = in_db;
+      e.has_blob = false;
+      i = pending.find(txid);
+    }
+    i->second.meta = meta;
+  }
+
+  // the write txn removed a tx from the db
+  void remove(const crypto::hash &txid)
+  {
+    if (committed.find(txid) == committed.end() && flushed.find(txid) == flushed.end())
+    {
+      pending.erase(txid);
+      return;
+    }
+    entry &e = pending[txid];
+    e.removed = true;
+    e.has_blob = false;
+    e.blob.clear();
+  }
+
+  // whether commit() changes what readers see, and so needs the lock
+  bool dirty() const
+  {
+    return written || !pending.empty() || !flushed.empty();
+  }
+
+  // whether the write txn should get the cache before it's committed
+  bool due() const
+  {
+    if (committed.empty() && pending.empty())
+      return false;
+    if (flush_requested || committed.size() + pending.size() >= TXPOOL_CACHE_MAX_ENTRIES || bytes >= TXPOOL_CACHE_MAX_BYTES)
+      return true;
+    return !committed.empty() && std::chrono::steady_clock::now() - dirty_since >= std::chrono::seconds(TXPOOL_CACHE_FLUSH_INTERVAL);
+  }
+
+  // called with the lock held when the write txn, whose id is txnid, was
+  // committed. Readers with an older snapshot don't have what it flushed,
+  // so that is kept for them, until no reader of env is that old.
+  void commit(uint64_t txnid, MDB_env *env)
+  {
+    flush_requested = false;
+    if (!flushed.empty() && get_oldest_snapshot(env) >= flushed_txnid)
+      flushed.clear();
+    if (committed.empty() && !pending.empty())
+      dirty_since = std::chrono::steady_clock::now();
+    for (auto &e: pending)
+    {
+      if (e.second.removed)
+      {
+        const auto i = committed.find(e.first);
+        if (i != committed.end())
+        {
+          bytes -= std::min<uint64_t>(bytes, sizeof(txpool_tx_meta_t) + i->second.blob.size());
+          committed.erase(i);
+        }
+        flushed.erase(e.first);
+        continue;
+      }
+      const auto inserted = committed.emplace(e.first, entry());
+      entry &c = inserted.first->second;
+      if (inserted.second)
+        bytes += sizeof(txpool_tx_meta_t);
+      if (e.second.has_blob)
+      {
+        bytes -= std::min<uint64_t>(bytes, c.blob.size());
+        c.has_blob = true;
+        c.blob = std::move(e.second.blob);
+        bytes += c.blob.size();
+      }
+      c.meta = e.second.meta;
+      c.in_db = e.second.in_db;
+    }
+    pending.clear();
+    if (written)
+    {
+      for (auto &e: committed)
+        flushed[e.first] = std::move(e.second);
+      flushed_txnid = txnid;
+      committed.clear();
+      bytes = 0;
+      written = false;
+    }
+  }
+
+  void abort()
+  {
+    pending.clear();
+    written = false;
+    flush_requested = false;
+  }
+
+  void clear()
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex);
+    committed.clear();
+    pending.clear();
+    flushed.clear();
+    bytes = 0;
+    written = false;
+    flush_requested = false;
+  }
+
+  boost::shared_mutex mutex; // held by readers across the cache and the db, and by the writer while committing
+  std::unordered_map<crypto::hash, entry> committed; // guarded by mutex
+  std::unordered_map<crypto::hash, entry> pending; // only used by the writer thread
+  std::unordered_map<crypto::hash, entry> flushed; // what recent flushes wrote, guarded by mutex
+  uint64_t flushed_txnid = 0; // the txn of the last flush, snapshots from it on have flushed in the db
+  uint64_t bytes = 0; // roughly what committed holds
+  std::chrono::steady_clock::time_point dirty_since; // when committed stopped being empty
+  bool written = false; // the write txn has all of the cache, so committing it empties the cache
+  bool flush_requested = false; // set by flush_txpool_updates
+};
+
+struct BlockchainLMDB::compaction
+{
+  boost::thread thread;
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  db_compaction_status status{};
+  bool release = false; // tells the thread to end its snapshot
+  bool swapping = false; // finish_compaction is using the snapshot
+  std::map<std::string, std::string> tables; // records of the main table at the snapshot
+};
+
 std::atomic<uint64_t> mdb_txn_safe::num_active_txns{0};
 std::atomic_flag mdb_txn_safe::creation_gate = ATOMIC_FLAG_INIT;
 
+mdb_threadinfo::mdb_threadinfo(const std::shared_ptr<mdb_threadinfo_registry> &registry): m_ti_rtxn(NULL), m_ti_cold_rtxn(NULL), m_ti_registry(registry)
+{
+  memset(&m_ti_rcursors, 0, sizeof(m_ti_rcursors));
+  memset(&m_ti_rflags, 0, sizeof(m_ti_rflags));
+  boost::lock_guard<boost::mutex> lock(m_ti_registry->m_lock);
+  m_ti_registry->m_infos.insert(this);
+}
+
 mdb_threadinfo::~mdb_threadinfo()
+{
+  boost::lock_guard<boost::mutex> lock(m_ti_registry->m_lock);
+  m_ti_registry->m_infos.erase(this);
+  end();
+}
+
+void mdb_threadinfo::end()
 {
   MDB_cursor **cur = &m_ti_rcursors.m_txc_blocks;
   unsigned i;
   for (i=0; i<sizeof(mdb_txn_cursors)/sizeof(MDB_cursor *); i++)
+  {
     if (cur[i])
       mdb_cursor_close(cur[i]);
+    cur[i] = NULL;
+  }
+  end_cold();
   if (m_ti_rtxn)
     mdb_txn_abort(m_ti_rtxn);
+  m_ti_rtxn = NULL;
+  memset(&m_ti_rflags, 0, sizeof(m_ti_rflags));
+}
+
+void mdb_threadinfo::end_cold()
+{
+  if (m_ti_cold_rtxn)
+    mdb_txn_abort(m_ti_cold_rtxn);
+  m_ti_cold_rtxn = NULL;
+  m_ti_rflags.m_rf_cold_txn = false;
+}
+
+void mdb_threadinfo::reset()
+{
+  if (m_ti_rflags.m_rf_txn)
+    mdb_txn_reset(m_ti_rtxn);
+  if (m_ti_rflags.m_rf_cold_txn)
+    mdb_txn_reset(m_ti_cold_rtxn);
+  memset(&m_ti_rflags, 0, sizeof(m_ti_rflags));
+}
+
+// the threads notice their txn is gone and start a new one in block_rtxn_start.
+// None of them may be using theirs meanwhile.
+void mdb_threadinfo_registry::end_all()
+{
+  boost::lock_guard<boost::mutex> lock(m_lock);
+  for (mdb_threadinfo *tinfo: m_infos)
+    tinfo->end();
+}
+
+void mdb_threadinfo_registry::end_all_cold()
+{
+  boost::lock_guard<boost::mutex> lock(m_lock);
+  for (mdb_threadinfo *tinfo: m_infos)
+    tinfo->end_cold();
 }
 
 mdb_txn_safe::mdb_txn_safe(const bool check) : m_txn(NULL), m_tinfo(NULL), m_check(check)
@@ -386,8 +856,7 @@ mdb_txn_safe::~mdb_txn_safe()
   LOG_PRINT_L3("mdb_txn_safe: destructor");
   if (m_tinfo != nullptr)
   {
-    mdb_txn_reset(m_tinfo->m_ti_rtxn);
-    memset(&m_tinfo->m_ti_rflags, 0, sizeof(m_tinfo->m_ti_rflags));
+    m_tinfo->reset();
   } else if (m_txn != nullptr)
   {
     if (m_batch_txn) // this is a batch txn and should have been handled before this point for safety
@@ -459,6 +928,15 @@ void mdb_txn_safe::wait_no_active_txns()
   while (num_active_txns > 0);
 }
 
+bool mdb_txn_safe::wait_no_active_txns(unsigned int timeout_ms)
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (num_active_txns > 0)
+    if (std::chrono::steady_clock::now() >= deadline)
+      return false;
+  return true;
+}
+
 void mdb_txn_safe::allow_new_txns()
 {
   creation_gate.clear();
@@ -480,6 +958,14 @@ void mdb_txn_safe::increment_txns(int i)
       throw0(DB_ERROR(lmdb_error(std::string("Failed to create a transaction for the db in ")+__FUNCTION__+": ", mdb_res).c_str())); \
   } \
 
+// readers which aren't the writer see m_txpool_cache and the db together,
+// so the lock is taken before the read txn
+#define TXPOOL_CACHE_LOCK_RDONLY() \
+  const bool txpool_writer = in_write_txn(); \
+  const uint64_t txpool_snapshot = txpool_writer ? 0 : get_kept_snapshot(); \
+  boost::shared_lock<boost::shared_mutex> txpool_cache_lock(m_txpool_cache->mutex, boost::defer_lock); \
+  if (!txpool_writer) txpool_cache_lock.lock()
+
 #define TXN_PREFIX_RDONLY() \
   MDB_txn *m_txn; \
   mdb_txn_cursors *m_cursors; \
@@ -593,6 +1079,25 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
 
   new_mapsize += (new_mapsize % mst.ms_psize);
 
+  // the map can't move under a compaction's txns, and finish_compaction
+  // needs the lock our caller holds, so the compaction has to give way.
+  // Its copy can't be stopped though, so while there is room enough the
+  // resize is put off until the compaction is over, instead of holding up
+  // the caller until the copy is made.
+  const uint64_t size_used = (uint64_t)mst.ms_psize * mei.me_last_pgno;
+  const uint64_t room = mei.me_mapsize > size_used ? mei.me_mapsize - size_used : 0;
+  if (room >= std::max<uint64_t>(increase_size, COMPACTION_RESIZE_MARGIN))
+  {
+    boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+    const db_compaction_status::state_t state = m_compaction->status.state;
+    if (state == db_compaction_status::copying || state == db_compaction_status::ready)
+    {
+      MINFO("Putting off a database resize until the compaction is over, " << room / (1024 * 1024) << " MiB left");
+      return;
+    }
+  }
+  cancel_compaction("The database had to be resized");
+
   mdb_txn_safe::prevent_new_txns();
 
   if (m_write_txn != nullptr)
@@ -810,7 +1315,8 @@ void BlockchainLMDB::add_block(const block& blk, size_t block_weight, uint64_t l
 
   // this call to mdb_cursor_put will change height()
   cryptonote::blobdata block_blob(block_to_blob(blk));
-  MDB_val_sized(blob, block_blob);
+  std::string buffer;
+  MDB_val blob = encode_blob(blob_table_blocks, block_blob.data(), block_blob.size(), buffer);
   result = mdb_cursor_put(m_cur_blocks, &key, &blob, MDB_APPEND);
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add block blob to db transaction: ", result).c_str()));
@@ -844,6 +1350,8 @@ void BlockchainLMDB::add_block(const block& blk, size_t block_weight, uint64_t l
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add block height by hash to db transaction: ", result).c_str()));
 
+  m_block_info_cache->add(bi);
+
   // we use weight as a proxy for size, since we don't have size but weight is >= size
   // and often actually equal
   m_cum_size += block_weight;
@@ -860,6 +1368,8 @@ void BlockchainLMDB::remove_block()
 
   if (m_height == 0)
     throw0(BLOCK_DNE ("Attempting to remove block from an empty blockchain"));
+  if (is_cold(blob_table_blocks, m_height - 1))
+    throw0(DB_ERROR("Attempting to remove a block which was moved to cold storage"));
 
   mdb_txn_cursors *m_cursors = &m_wcursors;
   CURSOR(block_info)
@@ -885,6 +1395,8 @@ void BlockchainLMDB::remove_block()
 
   if ((result = mdb_cursor_del(m_cur_block_info, 0)))
       throw1(DB_ERROR(lmdb_error("Failed to add removal of block info to db transaction: ", result).c_str()));
+
+  m_block_info_cache->remove(m_height - 1);
 }
 
 uint64_t BlockchainLMDB::add_transaction_data(const crypto::hash& blk_hash, const std::pair<transaction, blobdata_ref>& txp, const crypto::hash& tx_hash, const crypto::hash& tx_prunable_hash)
@@ -943,12 +1455,13 @@ uint64_t BlockchainLMDB::add_transaction_data(const crypto::hash& blk_hash, cons
   if (unprunable_size > blob.size())
     throw0(DB_ERROR("pruned tx size is larger than tx size"));
 
-  MDB_val pruned_blob = {unprunable_size, (void*)blob.data()};
+  std::string buffer;
+  MDB_val pruned_blob = encode_blob(blob_table_txs_pruned, blob.data(), unprunable_size, buffer);
   result = mdb_cursor_put(m_cur_txs_pruned, &val_tx_id, &pruned_blob, MDB_APPEND);
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add pruned tx blob to db transaction: ", result).c_str()));
 
-  MDB_val prunable_blob = {blob.size() - unprunable_size, (void*)(blob.data() + unprunable_size)};
+  MDB_val prunable_blob = encode_blob(blob_table_txs_prunable, blob.data() + unprunable_size, blob.size() - unprunable_size, buffer);
   result = mdb_cursor_put(m_cur_txs_prunable, &val_tx_id, &prunable_blob, MDB_APPEND);
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add prunable tx blob to db transaction: ", result).c_str()));
@@ -995,6 +1508,8 @@ void BlockchainLMDB::remove_transaction_data(const crypto::hash& tx_hash, const
       throw1(TX_DNE("Attempting to remove transaction that isn't in the db"));
   txindex *tip = (txindex *)val_h.mv_data;
   MDB_val_set(val_tx_id, tip->data.tx_id);
+  if (is_cold(blob_table_txs_prunable, tip->data.tx_id))
+      throw1(DB_ERROR("Attempting to remove a transaction which was moved to cold storage"));
 
   if ((result = mdb_cursor_get(m_cur_txs_pruned, &val_tx_id, NULL, MDB_SET)))
       throw1(DB_ERROR(lmdb_error("Failed to locate pruned tx for removal: ", result).c_str()));
@@ -1114,6 +1629,24 @@ uint64_t BlockchainLMDB::add_output(const crypto::hash& tx_hash,
   if ((result = mdb_cursor_put(m_cur_output_amounts, &val_amount, &data, MDB_APPENDDUP)))
       throw0(DB_ERROR(lmdb_error("Failed to add output pubkey to db transaction: ", result).c_str()));
 
+  if (tx_output.amount != 0)
+  {
+    // count the output in this block's record, adding it for the first output
+    CURSOR(output_distribution)
+    outdist od = {m_height, ok.amount_index + 1};
+    MDB_val_set(vod, od);
+    MDB_val last;
+    result = mdb_cursor_get(m_cur_output_distribution, &val_amount, &last, MDB_SET);
+    if (!result)
+      result = mdb_cursor_get(m_cur_output_distribution, &val_amount, &last, MDB_LAST_DUP);
+    if (!result && ((const outdist *)last.mv_data)->height == m_height)
+      result = mdb_cursor_put(m_cur_output_distribution, &val_amount, &vod, MDB_CURRENT);
+    else if (!result || result == MDB_NOTFOUND)
+      result = mdb_cursor_put(m_cur_output_distribution, &val_amount, &vod, MDB_APPENDDUP);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to add output distribution to db transaction: ", result).c_str()));
+  }
+
   return ok.amount_index;
 }
 
@@ -1181,6 +1714,7 @@ void BlockchainLMDB::remove_output(const uint64_t amount, const uint64_t& out_in
     throw0(DB_ERROR(lmdb_error("DB error attempting to get an output", result).c_str()));
 
   const pre_rct_outkey *ok = (const pre_rct_outkey *)v.mv_data;
+  const uint64_t height = ok->data.height, amount_index = ok->amount_index;
   MDB_val_set(otxk, ok->output_id);
   result = mdb_cursor_get(m_cur_output_txs, (MDB_val *)&zerokval, &otxk, MDB_GET_BOTH);
   if (result == MDB_NOTFOUND)
@@ -1199,6 +1733,53 @@ void BlockchainLMDB::remove_output(const uint64_t amount, const uint64_t& out_in
   result = mdb_cursor_del(m_cur_output_amounts, 0);
   if (result)
     throw0(DB_ERROR(lmdb_error(std::string("Error deleting amount for output index ").append(boost::lexical_cast<std::string>(out_index).append(": ")).c_str(), result).c_str()));
+
+  if (amount != 0)
+    remove_output_distribution(amount, height, amount_index);
+}
+
+void BlockchainLMDB::remove_output_distribution(uint64_t amount, uint64_t height, uint64_t amount_index)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  mdb_txn_cursors *m_cursors = &m_wcursors;
+  CURSOR(output_distribution)
+
+  // outputs go in reverse order, so this one is counted in the last record
+  MDB_val_set(k, amount);
+  MDB_val v;
+  auto get_last = [&]() {
+    int result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_SET);
+    if (!result)
+      result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_LAST_DUP);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to find output distribution for removal: ", result).c_str()));
+    const outdist *od = (const outdist *)v.mv_data;
+    if (od->height != height || od->num_outputs != amount_index + 1)
+      throw0(DB_ERROR("Unexpected output distribution record for removal"));
+  };
+  get_last();
+
+  // the record goes if the block has no more outputs of that amount
+  uint64_t previous_num_outputs = 0;
+  int result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_PREV_DUP);
+  if (!result)
+    previous_num_outputs = ((const outdist *)v.mv_data)->num_outputs;
+  else if (result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to get output distribution: ", result).c_str()));
+  get_last();
+
+  if (previous_num_outputs == amount_index)
+  {
+    result = mdb_cursor_del(m_cur_output_distribution, 0);
+  }
+  else
+  {
+    outdist od = {height, amount_index};
+    MDB_val_set(vod, od);
+    result = mdb_cursor_put(m_cur_output_distribution, &k, &vod, MDB_CURRENT);
+  }
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to remove output from distribution: ", result).c_str()));
 }
 
 void BlockchainLMDB::prune_outputs(uint64_t amount)
@@ -1243,6 +1824,16 @@ void BlockchainLMDB::prune_outputs(uint64_t amount)
   if (result)
     throw0(DB_ERROR(lmdb_error("Error deleting outputs: ", result).c_str()));
 
+  if (amount != 0)
+  {
+    CURSOR(output_distribution)
+    result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_SET);
+    if (!result)
+      result = mdb_cursor_del(m_cur_output_distribution, MDB_NODUPDATA);
+    if (result && result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Error deleting output distribution: ", result).c_str()));
+  }
+
   for (uint64_t output_id: output_ids)
   {
     MDB_val_set(v, output_id);
@@ -1263,6 +1854,11 @@ void BlockchainLMDB::add_spent_key(const crypto::key_image& k_image)
 
   CURSOR(spent_keys)
 
+  // before the write, so the filter never misses a key image a reader may see
+  const std::shared_ptr<tools::bloom_filter<crypto::key_image>> filter = std::atomic_load(&m_spent_keys_filter);
+  if (filter)
+    filter->add(k_image);
+
   MDB_val k = {sizeof(k_image), (void *)&k_image};
   if (auto result = mdb_cursor_put(m_cur_spent_keys, (MDB_val *)&zerokval, &k, MDB_NODUPDATA)) {
     if (result == MDB_KEYEXIST)
@@ -1270,6 +1866,16 @@ void BlockchainLMDB::add_spent_key(const crypto::key_image& k_image)
     else
       throw1(DB_ERROR(lmdb_error("Error adding spent key image to db transaction: ", result).c_str()));
   }
+
+  // a full filter lets through more and more unspent key images, so it is
+  // replaced by a larger one, built from this txn so it has this key image
+  // and every one a reader may see
+  if (filter && filter->get_num_values() > filter->get_max_values())
+  {
+    std::shared_ptr<tools::bloom_filter<crypto::key_image>> larger = build_spent_keys_filter(*m_write_txn);
+    MINFO("Spent key image filter grown to " << larger->get_num_values() << " key images, " << larger->get_memory_usage() / 1048576.f << " MB");
+    std::atomic_store(&m_spent_keys_filter, std::move(larger));
+  }
 }
 
 void BlockchainLMDB::remove_spent_key(const crypto::key_image& k_image)
@@ -1314,6 +1920,14 @@ BlockchainLMDB::BlockchainLMDB(bool batch_transactions): BlockchainDB()
   m_folder = "thishsouldnotexistbecauseitisgibberish";
 
   m_batch_transactions = batch_transactions;
+  m_block_info_cache.reset(new block_info_cache());
+  m_txpool_cache.reset(new txpool_cache());
+  m_tinfo_registry = std::make_shared<mdb_threadinfo_registry>();
+  m_env_flags = 0;
+  m_compaction.reset(new compaction());
+  m_cold_env = nullptr;
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+    m_cold_boundaries[table] = 0;
   m_write_txn = nullptr;
   m_write_batch_txn = nullptr;
   m_batch_active = false;
@@ -1373,6 +1987,89 @@ static bool disable_ntfs_compression(const boost::filesystem::path& filepath)
 }
 #endif
 
+void BlockchainLMDB::open_tables(MDB_txn *txn, bool read_only)
+{
+  int result;
+
+  // open necessary databases, and set properties as needed
+  // uses macros to avoid having to change things too many places
+  // also change blockchain_prune.cpp to match
+  lmdb_db_open(txn, LMDB_BLOCKS, MDB_INTEGERKEY | MDB_CREATE, m_blocks, "Failed to open db handle for m_blocks");
+
+  lmdb_db_open(txn, LMDB_BLOCK_INFO, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_info, "Failed to open db handle for m_block_info");
+  lmdb_db_open(txn, LMDB_BLOCK_HEIGHTS, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_heights, "Failed to open db handle for m_block_heights");
+
+  lmdb_db_open(txn, LMDB_TXS, MDB_INTEGERKEY | MDB_CREATE, m_txs, "Failed to open db handle for m_txs");
+  lmdb_db_open(txn, LMDB_TXS_PRUNED, MDB_INTEGERKEY | MDB_CREATE, m_txs_pruned, "Failed to open db handle for m_txs_pruned");
+  lmdb_db_open(txn, LMDB_TXS_PRUNABLE, MDB_INTEGERKEY | MDB_CREATE, m_txs_prunable, "Failed to open db handle for m_txs_prunable");
+  lmdb_db_open(txn, LMDB_TXS_PRUNABLE_HASH, MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE, m_txs_prunable_hash, "Failed to open db handle for m_txs_prunable_hash");
+  if (!read_only)
+    lmdb_db_open(txn, LMDB_TXS_PRUNABLE_TIP, MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE, m_txs_prunable_tip, "Failed to open db handle for m_txs_prunable_tip");
+  lmdb_db_open(txn, LMDB_TX_INDICES, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_tx_indices, "Failed to open db handle for m_tx_indices");
+  lmdb_db_open(txn, LMDB_TX_OUTPUTS, MDB_INTEGERKEY | MDB_CREATE, m_tx_outputs, "Failed to open db handle for m_tx_outputs");
+
+  lmdb_db_open(txn, LMDB_OUTPUT_TXS, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_output_txs, "Failed to open db handle for m_output_txs");
+  lmdb_db_open(txn, LMDB_OUTPUT_AMOUNTS, MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE, m_output_amounts, "Failed to open db handle for m_output_amounts");
+  // new in version 6, so a read-only DB which still needs migrating lacks it
+  bool has_output_distribution = true;
+  if (!read_only)
+    lmdb_db_open(txn, LMDB_OUTPUT_DISTRIBUTION, MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE, m_output_distribution, "Failed to open db handle for m_output_distribution");
+  else if ((result = mdb_dbi_open(txn, LMDB_OUTPUT_DISTRIBUTION, MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED, &m_output_distribution)))
+  {
+    if (result != MDB_NOTFOUND)
+      throw0(DB_OPEN_FAILURE(lmdb_error("Failed to open db handle for m_output_distribution: ", result).c_str()));
+    has_output_distribution = false;
+  }
+
+  lmdb_db_open(txn, LMDB_SPENT_KEYS, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_spent_keys, "Failed to open db handle for m_spent_keys");
+
+  lmdb_db_open(txn, LMDB_TXPOOL_META, MDB_CREATE, m_txpool_meta, "Failed to open db handle for m_txpool_meta");
+  lmdb_db_open(txn, LMDB_TXPOOL_BLOB, MDB_CREATE, m_txpool_blob, "Failed to open db handle for m_txpool_blob");
+
+  lmdb_db_open(txn, LMDB_ALT_BLOCKS, MDB_CREATE, m_alt_blocks, "Failed to open db handle for m_alt_blocks");
+
+  // this subdb is dropped on sight, so it may not be present when we open the DB.
+  // Since we use MDB_CREATE, we'll get an exception if we open read-only and it does not exist.
+  // So we don't open for read-only, and also not drop below. It is not used elsewhere.
+  if (!read_only)
+    lmdb_db_open(txn, LMDB_HF_STARTING_HEIGHTS, MDB_CREATE, m_hf_starting_heights, "Failed to open db handle for m_hf_starting_heights");
+
+  lmdb_db_open(txn, LMDB_HF_VERSIONS, MDB_INTEGERKEY | MDB_CREATE, m_hf_versions, "Failed to open db handle for m_hf_versions");
+
+  lmdb_db_open(txn, LMDB_PROPERTIES, MDB_CREATE, m_properties, "Failed to open db handle for m_properties");
+
+  // not chain data, and added after the last DB version change, so it may not
+  // exist in a DB we open read-only. get_rct_ver_cache handles that case.
+  if (!read_only)
+    lmdb_db_open(txn, LMDB_RCT_VER_CACHE, MDB_INTEGERKEY | MDB_CREATE, m_rct_ver_cache, "Failed to open db handle for m_rct_ver_cache");
+  // likewise, get_block_pow handles this one missing
+  if (!read_only)
+    lmdb_db_open(txn, LMDB_BLOCK_POW, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_pow, "Failed to open db handle for m_block_pow");
+
+  mdb_set_dupsort(txn, m_spent_keys, compare_hash32);
+  mdb_set_dupsort(txn, m_block_heights, compare_hash32);
+  mdb_set_dupsort(txn, m_tx_indices, compare_hash32);
+  mdb_set_dupsort(txn, m_output_amounts, compare_uint64);
+  if (has_output_distribution)
+    mdb_set_dupsort(txn, m_output_distribution, compare_uint64);
+  mdb_set_dupsort(txn, m_output_txs, compare_uint64);
+  mdb_set_dupsort(txn, m_block_info, compare_uint64);
+  if (!read_only)
+    mdb_set_dupsort(txn, m_txs_prunable_tip, compare_uint64);
+  mdb_set_compare(txn, m_txs_prunable, compare_uint64);
+  mdb_set_dupsort(txn, m_txs_prunable_hash, compare_uint64);
+
+  mdb_set_compare(txn, m_txpool_meta, compare_hash32);
+  mdb_set_compare(txn, m_txpool_blob, compare_hash32);
+  mdb_set_compare(txn, m_alt_blocks, compare_hash32);
+  mdb_set_compare(txn, m_properties, compare_string);
+  if (!read_only)
+  {
+    mdb_set_compare(txn, m_rct_ver_cache, compare_uint64);
+    mdb_set_dupsort(txn, m_block_pow, compare_hash32);
+  }
+}
+
 void BlockchainLMDB::open(const std::string& filename, const int db_flags)
 {
   int result;
@@ -1450,6 +2147,7 @@ void BlockchainLMDB::open(const std::string& filename, const int db_flags)
 
   if (auto result = mdb_env_open(m_env, filename.c_str(), mdb_flags, 0644))
     throw0(DB_ERROR(lmdb_error("Failed to open lmdb environment: ", result).c_str()));
+  m_env_flags = mdb_flags;
 
   MDB_envinfo mei;
   mdb_env_info(m_env, &mei);
@@ -1479,58 +2177,7 @@ void BlockchainLMDB::open(const std::string& filename, const int db_flags)
   if (auto mdb_res = mdb_txn_begin(m_env, NULL, txn_flags, txn))
     throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", mdb_res).c_str()));
 
-  // open necessary databases, and set properties as needed
-  // uses macros to avoid having to change things too many places
-  // also change blockchain_prune.cpp to match
-  lmdb_db_open(txn, LMDB_BLOCKS, MDB_INTEGERKEY | MDB_CREATE, m_blocks, "Failed to open db handle for m_blocks");
-
-  lmdb_db_open(txn, LMDB_BLOCK_INFO, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_info, "Failed to open db handle for m_block_info");
-  lmdb_db_open(txn, LMDB_BLOCK_HEIGHTS, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_heights, "Failed to open db handle for m_block_heights");
-
-  lmdb_db_open(txn, LMDB_TXS, MDB_INTEGERKEY | MDB_CREATE, m_txs, "Failed to open db handle for m_txs");
-  lmdb_db_open(txn, LMDB_TXS_PRUNED, MDB_INTEGERKEY | MDB_CREATE, m_txs_pruned, "Failed to open db handle for m_txs_pruned");
-  lmdb_db_open(txn, LMDB_TXS_PRUNABLE, MDB_INTEGERKEY | MDB_CREATE, m_txs_prunable, "Failed to open db handle for m_txs_prunable");
-  lmdb_db_open(txn, LMDB_TXS_PRUNABLE_HASH, MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE, m_txs_prunable_hash, "Failed to open db handle for m_txs_prunable_hash");
-  if (!(mdb_flags & MDB_RDONLY))
-    lmdb_db_open(txn, LMDB_TXS_PRUNABLE_TIP, MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE, m_txs_prunable_tip, "Failed to open db handle for m_txs_prunable_tip");
-  lmdb_db_open(txn, LMDB_TX_INDICES, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_tx_indices, "Failed to open db handle for m_tx_indices");
-  lmdb_db_open(txn, LMDB_TX_OUTPUTS, MDB_INTEGERKEY | MDB_CREATE, m_tx_outputs, "Failed to open db handle for m_tx_outputs");
-
-  lmdb_db_open(txn, LMDB_OUTPUT_TXS, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_output_txs, "Failed to open db handle for m_output_txs");
-  lmdb_db_open(txn, LMDB_OUTPUT_AMOUNTS, MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE, m_output_amounts, "Failed to open db handle for m_output_amounts");
-
-  lmdb_db_open(txn, LMDB_SPENT_KEYS, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_spent_keys, "Failed to open db handle for m_spent_keys");
-
-  lmdb_db_open(txn, LMDB_TXPOOL_META, MDB_CREATE, m_txpool_meta, "Failed to open db handle for m_txpool_meta");
-  lmdb_db_open(txn, LMDB_TXPOOL_BLOB, MDB_CREATE, m_txpool_blob, "Failed to open db handle for m_txpool_blob");
-
-  lmdb_db_open(txn, LMDB_ALT_BLOCKS, MDB_CREATE, m_alt_blocks, "Failed to open db handle for m_alt_blocks");
-
-  // this subdb is dropped on sight, so it may not be present when we open the DB.
-  // Since we use MDB_CREATE, we'll get an exception if we open read-only and it does not exist.
-  // So we don't open for read-only, and also not drop below. It is not used elsewhere.
-  if (!(mdb_flags & MDB_RDONLY))
-    lmdb_db_open(txn, LMDB_HF_STARTING_HEIGHTS, MDB_CREATE, m_hf_starting_heights, "Failed to open db handle for m_hf_starting_heights");
-
-  lmdb_db_open(txn, LMDB_HF_VERSIONS, MDB_INTEGERKEY | MDB_CREATE, m_hf_versions, "Failed to open db handle for m_hf_versions");
-
-  lmdb_db_open(txn, LMDB_PROPERTIES, MDB_CREATE, m_properties, "Failed to open db handle for m_properties");
-
-  mdb_set_dupsort(txn, m_spent_keys, compare_hash32);
-  mdb_set_dupsort(txn, m_block_heights, compare_hash32);
-  mdb_set_dupsort(txn, m_tx_indices, compare_hash32);
-  mdb_set_dupsort(txn, m_output_amounts, compare_uint64);
-  mdb_set_dupsort(txn, m_output_txs, compare_uint64);
-  mdb_set_dupsort(txn, m_block_info, compare_uint64);
-  if (!(mdb_flags & MDB_RDONLY))
-    mdb_set_dupsort(txn, m_txs_prunable_tip, compare_uint64);
-  mdb_set_compare(txn, m_txs_prunable, compare_uint64);
-  mdb_set_dupsort(txn, m_txs_prunable_hash, compare_uint64);
-
-  mdb_set_compare(txn, m_txpool_meta, compare_hash32);
-  mdb_set_compare(txn, m_txpool_blob, compare_hash32);
-  mdb_set_compare(txn, m_alt_blocks, compare_hash32);
-  mdb_set_compare(txn, m_properties, compare_string);
+  open_tables(txn, mdb_flags & MDB_RDONLY);
 
   if (!(mdb_flags & MDB_RDONLY))
   {
@@ -1577,6 +2224,10 @@ void BlockchainLMDB::open(const std::string& filename, const int db_flags)
       txn.commit();
       m_open = true;
       migrate(db_version);
+      init_blob_compression();
+      init_cold_storage();
+      init_spent_keys_filter();
+      init_block_info_cache();
       return;
     }
 #endif
@@ -1623,9 +2274,673 @@ void BlockchainLMDB::open(const std::string& filename, const int db_flags)
   txn.commit();
 
   m_open = true;
+  init_blob_compression();
+  init_cold_storage();
+  init_spent_keys_filter();
+  init_block_info_cache();
   // from here, init should be finished
 }
 
+void BlockchainLMDB::init_spent_keys_filter()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  std::atomic_store(&m_spent_keys_filter, std::shared_ptr<tools::bloom_filter<crypto::key_image>>());
+  // nothing is added to a read only database, so lookups are few enough
+  if (m_spent_key_filter_bits == 0 || is_read_only())
+    return;
+
+  TXN_PREFIX_RDONLY();
+  std::shared_ptr<tools::bloom_filter<crypto::key_image>> filter = build_spent_keys_filter(m_txn);
+  TXN_POSTFIX_RDONLY();
+
+  MINFO("Spent key image filter: " << filter->get_num_values() << " key images, " << filter->get_memory_usage() / 1048576.f << " MB");
+  std::atomic_store(&m_spent_keys_filter, std::move(filter));
+}
+
+std::shared_ptr<tools::bloom_filter<crypto::key_image>> BlockchainLMDB::build_spent_keys_filter(MDB_txn *txn) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+
+  MDB_stat db_stats;
+  int result = mdb_stat(txn, m_spent_keys, &db_stats);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to query m_spent_keys: ", result).c_str()));
+
+  // leave room for as many key images again, so the false positive rate
+  // stays close to the configured one for a good while
+  const uint64_t max_key_images = std::max<uint64_t>(db_stats.ms_entries * 2, 1 << 20);
+  std::shared_ptr<tools::bloom_filter<crypto::key_image>> filter = std::make_shared<tools::bloom_filter<crypto::key_image>>(max_key_images, m_spent_key_filter_bits);
+
+  MDB_cursor *cur;
+  result = mdb_cursor_open(txn, m_spent_keys, &cur);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor on m_spent_keys: ", result).c_str()));
+
+  // spent_keys is DUPFIXED, so key images can be read a page at a time
+  MDB_val k, v;
+  result = mdb_cursor_get(cur, &k, &v, MDB_FIRST);
+  if (result == 0)
+    result = mdb_cursor_get(cur, &k, &v, MDB_GET_MULTIPLE);
+  while (result == 0)
+  {
+    const crypto::key_image *key_images = (const crypto::key_image*)v.mv_data;
+    for (size_t i = 0; i < v.mv_size / sizeof(crypto::key_image); ++i)
+      filter->add(key_images[i]);
+    result = mdb_cursor_get(cur, &k, &v, MDB_NEXT_MULTIPLE);
+  }
+  mdb_cursor_close(cur);
+  if (result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to enumerate spent key images: ", result).c_str()));
+
+  return filter;
+}
+
+void BlockchainLMDB::init_block_info_cache()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  m_block_info_cache->clear();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(block_info);
+
+  const uint64_t h = height();
+  if (h == 0)
+    return;
+  uint64_t start_height = h - std::min<uint64_t>(h, BLOCK_INFO_CACHE_SIZE);
+  MDB_val_set(v, start_height);
+  int result = mdb_cursor_get(m_cur_block_info, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
+  boost::unique_lock<boost::shared_mutex> lock(m_block_info_cache->mutex);
+  while (result == 0)
+  {
+    m_block_info_cache->committed.push_back(*(const mdb_block_info*)v.mv_data);
+    MDB_val k;
+    result = mdb_cursor_get(m_cur_block_info, &k, &v, MDB_NEXT_DUP);
+  }
+  if (result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to enumerate block info: ", result).c_str()));
+
+  TXN_POSTFIX_RDONLY();
+}
+
+void BlockchainLMDB::init_blob_compression()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  for (auto &compressor: m_blob_compressors)
+    compressor.reset();
+
+  const MDB_dbi dbis[num_blob_tables] = { m_blocks, m_txs_pruned, m_txs_prunable };
+  uint32_t compressed = 0, pending = 0;
+  uint64_t n_values[num_blob_tables];
+  blob_conversion_progress progress;
+  bool converting = false;
+  {
+    mdb_txn_safe txn;
+    int result = mdb_txn_begin(m_env, NULL, MDB_RDONLY, txn);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+    MDB_val_str(k, "blob_compression");
+    MDB_val v;
+    result = mdb_get(txn, m_properties, &k, &v);
+    if (result == 0)
+    {
+      if (v.mv_size != sizeof(compressed))
+        throw0(DB_ERROR("Unexpected blob_compression value size"));
+      memcpy(&compressed, v.mv_data, sizeof(compressed));
+    }
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to read blob compression setting: ", result).c_str()));
+    MDB_val_str(pk, "blob_compression_progress");
+    result = mdb_get(txn, m_properties, &pk, &v);
+    if (result == 0)
+    {
+      if (v.mv_size != sizeof(progress))
+        throw0(DB_ERROR("Unexpected blob_compression_progress value size"));
+      memcpy(&progress, v.mv_data, sizeof(progress));
+      converting = true;
+    }
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to read blob compression progress: ", result).c_str()));
+    MDB_val_str(dk, "blob_compression_pending");
+    result = mdb_get(txn, m_properties, &dk, &v);
+    if (result == 0)
+    {
+      if (v.mv_size != sizeof(pending))
+        throw0(DB_ERROR("Unexpected blob_compression_pending value size"));
+      memcpy(&pending, v.mv_data, sizeof(pending));
+    }
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to read pending blob compression: ", result).c_str()));
+    for (unsigned table = 0; table < num_blob_tables; ++table)
+    {
+      MDB_stat db_stats;
+      if ((result = mdb_stat(txn, dbis[table], &db_stats)))
+        throw0(DB_ERROR(lmdb_error("Failed to query blob table: ", result).c_str()));
+      n_values[table] = db_stats.ms_entries;
+    }
+    txn.abort();
+  }
+
+  // tables asked for before they had enough values stay wanted until they do
+  const uint32_t wanted = m_blob_compression >= 0 ? (uint32_t)m_blob_compression : (compressed | pending);
+  const bool change = wanted != compressed || (pending & ~wanted);
+  if (converting || change)
+  {
+    if (is_read_only())
+    {
+      if (converting)
+        throw0(DB_ERROR("The database was being compressed or decompressed, run wownerod once to finish"));
+      if (m_blob_compression >= 0)
+        MWARNING("Blob compression can't be changed on a read-only database, ignored");
+    }
+    else
+    {
+      if (converting)
+      {
+        if (progress.table >= num_blob_tables)
+          throw0(DB_ERROR("Invalid blob table in blob_compression_progress"));
+        convert_blob_table(progress.table, progress.compress);
+        if (progress.compress)
+          compressed |= 1u << progress.table;
+        else
+          compressed &= ~(1u << progress.table);
+      }
+      uint32_t still_pending = 0;
+      for (unsigned table = 0; table < num_blob_tables; ++table)
+      {
+        const uint32_t flag = 1u << table;
+        if ((wanted & flag) == (compressed & flag))
+          continue;
+        if (wanted & flag)
+        {
+          if (!blob_compressor::is_supported())
+            throw0(DB_ERROR("This build can't compress the database, it was made without zstd support"));
+          if (n_values[table] < m_blob_compression_min_values)
+          {
+            MGINFO("Table " << blob_table_names[table] << " has " << n_values[table] << " values, it will be compressed on the first start after it has "
+                << m_blob_compression_min_values << " to train a dictionary on");
+            still_pending |= flag;
+            continue;
+          }
+        }
+        convert_blob_table(table, wanted & flag);
+        compressed ^= flag;
+      }
+      if (still_pending != pending)
+      {
+        mdb_txn_safe txn;
+        int result = mdb_txn_begin(m_env, NULL, 0, txn);
+        if (result)
+          throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+        MDB_val_str(k, "blob_compression_pending");
+        if (still_pending)
+        {
+          MDB_val v = {sizeof(still_pending), (void*)&still_pending};
+          result = mdb_put(txn, m_properties, &k, &v, 0);
+        }
+        else
+          result = mdb_del(txn, m_properties, &k, NULL);
+        if (result)
+          throw0(DB_ERROR(lmdb_error("Failed to save pending blob compression: ", result).c_str()));
+        txn.commit();
+      }
+    }
+  }
+
+  if (!compressed)
+    return;
+  if (!blob_compressor::is_supported())
+    throw0(DB_ERROR("The database is compressed, but this build was made without zstd support"));
+
+  mdb_txn_safe txn;
+  int result = mdb_txn_begin(m_env, NULL, MDB_RDONLY, txn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+  {
+    if (!(compressed & (1u << table)))
+      continue;
+    const std::string dict_key = std::string("blob_dict_") + blob_table_names[table];
+    MDB_val k = {dict_key.size() + 1, (void*)dict_key.c_str()};
+    MDB_val v;
+    result = mdb_get(txn, m_properties, &k, &v);
+    if (result)
+      throw0(DB_ERROR(lmdb_error(std::string("Failed to read the compression dictionary for ") + blob_table_names[table] + ": ", result).c_str()));
+    try
+    {
+      m_blob_compressors[table].reset(new blob_compressor(std::string((const char*)v.mv_data, v.mv_size)));
+    }
+    catch (const std::exception &e)
+    {
+      throw0(DB_ERROR((std::string("Failed to set up compression for ") + blob_table_names[table] + ": " + e.what()).c_str()));
+    }
+    MINFO("Table " << blob_table_names[table] << " is compressed, " << v.mv_size << " byte dictionary");
+  }
+  txn.abort();
+}
+
+void BlockchainLMDB::convert_blob_table(unsigned table, bool compress)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+
+  const MDB_dbi dbis[num_blob_tables] = { m_blocks, m_txs_pruned, m_txs_prunable };
+  const MDB_dbi dbi = dbis[table];
+  const char *name = blob_table_names[table];
+  const std::string dict_key = std::string("blob_dict_") + name;
+  MDB_val dk = {dict_key.size() + 1, (void*)dict_key.c_str()};
+  MDB_val_str(pk, "blob_compression_progress");
+  MDB_val k, v;
+
+  if (need_resize())
+  {
+    LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+    do_resize();
+  }
+
+  mdb_txn_safe txn;
+  int result = mdb_txn_begin(m_env, NULL, 0, txn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+
+  blob_conversion_progress progress;
+  result = mdb_get(txn, m_properties, &pk, &v);
+  if (result == 0)
+  {
+    memcpy(&progress, v.mv_data, sizeof(progress));
+    if (progress.table != table || !progress.compress != !compress)
+      throw0(DB_ERROR("A different blob table conversion is in progress"));
+    MGINFO((compress ? "Resuming compression of " : "Resuming decompression of ") << name << " at " << progress.next_key);
+  }
+  else if (result == MDB_NOTFOUND)
+  {
+    progress = {table, compress, 0};
+    MGINFO((compress ? "Compressing " : "Decompressing ") << name << ", this may take a while...");
+    if (compress)
+    {
+      // train a dictionary on values spread evenly over the table
+      MDB_cursor *cur;
+      if ((result = mdb_cursor_open(txn, dbi, &cur)))
+        throw0(DB_ERROR(lmdb_error("Failed to open a cursor: ", result).c_str()));
+      std::vector<std::string> samples;
+      uint64_t last_key = 0;
+      result = mdb_cursor_get(cur, &k, &v, MDB_LAST);
+      if (result == 0)
+        memcpy(&last_key, k.mv_data, sizeof(last_key));
+      else if (result != MDB_NOTFOUND)
+        throw0(DB_ERROR(lmdb_error("Failed to enumerate blobs: ", result).c_str()));
+      if (result == 0)
+      {
+        const uint64_t n_samples = std::min<uint64_t>(last_key + 1, BLOB_DICTIONARY_SAMPLES);
+        samples.reserve(n_samples);
+        for (uint64_t i = 0; i < n_samples; ++i)
+        {
+          uint64_t key = last_key * i / n_samples;
+          k = {sizeof(key), (void*)&key};
+          if (mdb_cursor_get(cur, &k, &v, MDB_SET_RANGE))
+            break;
+          samples.emplace_back((const char*)v.mv_data, std::min<size_t>(v.mv_size, BLOB_DICTIONARY_MAX_SAMPLE_SIZE));
+        }
+      }
+      mdb_cursor_close(cur);
+      const std::string dictionary = blob_compressor::train_dictionary(samples);
+      MGINFO("Trained a " << dictionary.size() << " byte dictionary on " << samples.size() << " " << name << " values");
+      v = {dictionary.size(), (void*)dictionary.data()};
+      if ((result = mdb_put(txn, m_properties, &dk, &v, 0)))
+        throw0(DB_ERROR(lmdb_error("Failed to save compression dictionary: ", result).c_str()));
+    }
+    v = {sizeof(progress), (void*)&progress};
+    if ((result = mdb_put(txn, m_properties, &pk, &v, 0)))
+      throw0(DB_ERROR(lmdb_error("Failed to save blob conversion progress: ", result).c_str()));
+  }
+  else
+    throw0(DB_ERROR(lmdb_error("Failed to read blob conversion progress: ", result).c_str()));
+
+  std::unique_ptr<blob_compressor> compressor;
+  result = mdb_get(txn, m_properties, &dk, &v);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to read compression dictionary: ", result).c_str()));
+  try
+  {
+    compressor.reset(new blob_compressor(std::string((const char*)v.mv_data, v.mv_size)));
+  }
+  catch (const std::exception &e)
+  {
+    throw0(DB_ERROR((std::string("Failed to set up compression: ") + e.what()).c_str()));
+  }
+
+  MDB_stat db_stats;
+  if ((result = mdb_stat(txn, dbi, &db_stats)))
+    throw0(DB_ERROR(lmdb_error("Failed to query blob table: ", result).c_str()));
+  const uint64_t n_total = db_stats.ms_entries;
+  txn.commit();
+
+  uint64_t n_converted = 0;
+  uint64_t bytes_in = 0, bytes_out = 0;
+  std::string buffer;
+  while (1)
+  {
+    if (need_resize())
+    {
+      LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+      do_resize();
+    }
+    if ((result = mdb_txn_begin(m_env, NULL, 0, txn)))
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+    MDB_cursor *cur;
+    if ((result = mdb_cursor_open(txn, dbi, &cur)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor: ", result).c_str()));
+
+    bool done = false;
+    k = {sizeof(progress.next_key), (void*)&progress.next_key};
+    MDB_cursor_op op = MDB_SET_RANGE;
+    for (size_t n = 0; n < BLOB_CONVERSION_BATCH_SIZE; ++n)
+    {
+      result = mdb_cursor_get(cur, &k, &v, op);
+      op = MDB_NEXT;
+      if (result == MDB_NOTFOUND)
+      {
+        done = true;
+        break;
+      }
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to enumerate blobs: ", result).c_str()));
+      uint64_t key;
+      memcpy(&key, k.mv_data, sizeof(key));
+      bytes_in += v.mv_size;
+      buffer.clear();
+      if (compress ? !compressor->compress(v.mv_data, v.mv_size, buffer) : !compressor->decompress(v.mv_data, v.mv_size, buffer))
+        throw0(DB_ERROR((std::string("Failed to convert ") + name + " value " + std::to_string(key)).c_str()));
+      bytes_out += buffer.size();
+      MDB_val nv = {buffer.size(), (void*)buffer.data()};
+      if ((result = mdb_cursor_put(cur, &k, &nv, MDB_CURRENT)))
+        throw0(DB_ERROR(lmdb_error("Failed to write converted blob: ", result).c_str()));
+      progress.next_key = key + 1;
+      ++n_converted;
+    }
+    mdb_cursor_close(cur);
+
+    if (done)
+    {
+      uint32_t compressed = 0;
+      MDB_val_str(ck, "blob_compression");
+      result = mdb_get(txn, m_properties, &ck, &v);
+      if (result == 0)
+        memcpy(&compressed, v.mv_data, sizeof(compressed));
+      else if (result != MDB_NOTFOUND)
+        throw0(DB_ERROR(lmdb_error("Failed to read blob compression setting: ", result).c_str()));
+      if (compress)
+        compressed |= 1u << table;
+      else
+        compressed &= ~(1u << table);
+      v = {sizeof(compressed), (void*)&compressed};
+      if ((result = mdb_put(txn, m_properties, &ck, &v, 0)))
+        throw0(DB_ERROR(lmdb_error("Failed to save blob compression setting: ", result).c_str()));
+      if (!compress && (result = mdb_del(txn, m_properties, &dk, NULL)))
+        throw0(DB_ERROR(lmdb_error("Failed to delete compression dictionary: ", result).c_str()));
+      if ((result = mdb_del(txn, m_properties, &pk, NULL)))
+        throw0(DB_ERROR(lmdb_error("Failed to delete blob conversion progress: ", result).c_str()));
+      txn.commit();
+      break;
+    }
+
+    v = {sizeof(progress), (void*)&progress};
+    if ((result = mdb_put(txn, m_properties, &pk, &v, 0)))
+      throw0(DB_ERROR(lmdb_error("Failed to save blob conversion progress: ", result).c_str()));
+    txn.commit();
+    if (n_converted % (BLOB_CONVERSION_BATCH_SIZE * 100) == 0)
+      MGINFO(name << ": " << n_converted << "/" << n_total << " values converted");
+  }
+
+  MGINFO((compress ? "Compressed " : "Decompressed ") << n_converted << " " << name << " values, " << bytes_in << " bytes to " << bytes_out << " bytes");
+}
+
+void BlockchainLMDB::decode_blob(unsigned table, const MDB_val &v, cryptonote::blobdata &bd, bool append) const
+{
+  if (!append)
+    bd.clear();
+  const blob_compressor *compressor = m_blob_compressors[table].get();
+  if (!compressor)
+    bd.append(reinterpret_cast<const char*>(v.mv_data), v.mv_size);
+  else if (!compressor->decompress(v.mv_data, v.mv_size, bd))
+    throw0(DB_ERROR((std::string("Failed to decompress a value from ") + blob_table_names[table]).c_str()));
+}
+
+cryptonote::blobdata_ref BlockchainLMDB::decode_blob_ref(unsigned table, const MDB_val &v, cryptonote::blobdata &buffer) const
+{
+  if (!m_blob_compressors[table])
+    return cryptonote::blobdata_ref{reinterpret_cast<const char*>(v.mv_data), v.mv_size};
+  decode_blob(table, v, buffer);
+  return cryptonote::blobdata_ref{buffer.data(), buffer.size()};
+}
+
+MDB_val BlockchainLMDB::encode_blob(unsigned table, const void *data, size_t size, std::string &buffer) const
+{
+  const blob_compressor *compressor = m_blob_compressors[table].get();
+  if (!compressor)
+    return MDB_val{size, const_cast<void*>(data)};
+  if (!compressor->compress(data, size, buffer))
+    throw0(DB_ERROR((std::string("Failed to compress a value for ") + blob_table_names[table]).c_str()));
+  return MDB_val{buffer.size(), (void*)buffer.data()};
+}
+
+void BlockchainLMDB::init_cold_storage()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  close_cold_storage();
+
+  static_assert(sizeof(cold_storage_state::boundaries) / sizeof(uint64_t) == num_blob_tables, "cold_storage_state does not match the blob tables");
+  cold_storage_state state = {};
+  std::string stored_path;
+  {
+    mdb_txn_safe txn;
+    int result = mdb_txn_begin(m_env, NULL, MDB_RDONLY, txn);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+    MDB_val_str(k, "cold_storage");
+    MDB_val v;
+    result = mdb_get(txn, m_properties, &k, &v);
+    if (result == 0)
+    {
+      if (v.mv_size != sizeof(state))
+        throw0(DB_ERROR("Unexpected cold_storage value size"));
+      memcpy(&state, v.mv_data, sizeof(state));
+    }
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to read cold storage state: ", result).c_str()));
+    MDB_val_str(pk, "cold_storage_path");
+    result = mdb_get(txn, m_properties, &pk, &v);
+    if (result == 0)
+      stored_path.assign((const char*)v.mv_data, v.mv_size);
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to read cold storage path: ", result).c_str()));
+    txn.abort();
+  }
+
+  bool moved = false;
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+    moved |= state.boundaries[table] != 0;
+  if (!moved && !m_cold_storage_tables)
+    return;
+
+  const bool read_only = is_read_only();
+  const std::string path = m_cold_storage_path.empty() ? stored_path : m_cold_storage_path;
+  if (path.empty())
+  {
+    if (moved)
+      throw0(DB_ERROR("The database has data in cold storage, but no cold storage path is set"));
+    MWARNING("No cold storage path is set, nothing will be moved to cold storage");
+    return;
+  }
+  if (!moved && read_only)
+    return;
+
+  if (!read_only)
+  {
+    try
+    {
+      boost::filesystem::create_directories(path);
+    }
+    catch (const std::exception &e)
+    {
+      throw0(DB_ERROR((std::string("Failed to create the cold storage directory: ") + e.what()).c_str()));
+    }
+  }
+
+  int result;
+  if ((result = mdb_env_create(&m_cold_env)))
+    throw0(DB_ERROR(lmdb_error("Failed to create cold storage lmdb environment: ", result).c_str()));
+  if ((result = mdb_env_set_maxdbs(m_cold_env, num_blob_tables)))
+    throw0(DB_ERROR(lmdb_error("Failed to set max number of cold storage dbs: ", result).c_str()));
+  int threads = tools::get_max_concurrency();
+  if (threads > 110 &&
+    (result = mdb_env_set_maxreaders(m_cold_env, threads+16)))
+    throw0(DB_ERROR(lmdb_error("Failed to set max number of cold storage readers: ", result).c_str()));
+  // opened like the main environment, except that a salvaged db's previous
+  // snapshot would not match the cold storage's
+  if ((result = mdb_env_open(m_cold_env, path.c_str(), m_env_flags & ~MDB_PREVSNAPSHOT, 0644)))
+  {
+    mdb_env_close(m_cold_env);
+    m_cold_env = nullptr;
+    throw0(DB_ERROR(lmdb_error("Failed to open cold storage lmdb environment at " + path + ": ", result).c_str()));
+  }
+
+  MDB_envinfo mei;
+  mdb_env_info(m_cold_env, &mei);
+  if ((uint64_t)mei.me_mapsize < DEFAULT_MAPSIZE)
+    if ((result = mdb_env_set_mapsize(m_cold_env, DEFAULT_MAPSIZE)))
+      throw0(DB_ERROR(lmdb_error("Failed to set cold storage memory map size: ", result).c_str()));
+
+  mdb_txn_safe txn;
+  if ((result = mdb_txn_begin(m_cold_env, NULL, read_only ? MDB_RDONLY : 0, txn)))
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the cold storage: ", result).c_str()));
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+  {
+    // a read-only cold storage only has the tables something was moved to
+    if (read_only && !state.boundaries[table])
+      continue;
+    if ((result = mdb_dbi_open(txn, blob_table_names[table], MDB_INTEGERKEY | (read_only ? 0 : MDB_CREATE), &m_cold_dbis[table])))
+      throw0(DB_ERROR(lmdb_error(std::string("Failed to open cold storage db handle for ") + blob_table_names[table] + ": ", result).c_str()));
+  }
+  txn.commit();
+
+  if (!read_only && path != stored_path)
+  {
+    mdb_txn_safe wtxn;
+    if ((result = lmdb_txn_begin(m_env, NULL, 0, wtxn)))
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+    MDB_val_str(pk, "cold_storage_path");
+    MDB_val v = {path.size(), (void*)path.data()};
+    if ((result = mdb_put(wtxn, m_properties, &pk, &v, 0)))
+      throw0(DB_ERROR(lmdb_error("Failed to save cold storage path: ", result).c_str()));
+    wtxn.commit();
+  }
+
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+  {
+    m_cold_boundaries[table].store(state.boundaries[table], std::memory_order_release);
+    if (state.boundaries[table] && !(m_cold_storage_tables & (1u << table)))
+      MWARNING("Old " << blob_table_names[table] << " data stays in cold storage, it can't be moved back");
+  }
+  MINFO("Cold storage at " << path << ", " << state.boundaries[blob_table_blocks] << " blocks and "
+      << state.boundaries[blob_table_txs_prunable] << " prunable txs moved");
+}
+
+void BlockchainLMDB::close_cold_storage()
+{
+  for (auto &boundary: m_cold_boundaries)
+    boundary.store(0, std::memory_order_release);
+  if (m_cold_env)
+  {
+    m_tinfo_registry->end_all_cold();
+    mdb_env_close(m_cold_env);
+    m_cold_env = nullptr;
+  }
+}
+
+bool BlockchainLMDB::get_cold_blob(unsigned table, uint64_t key, cryptonote::blobdata &bd, bool append) const
+{
+  if (!m_cold_env)
+    return false;
+  MDB_val_set(k, key);
+  MDB_val v;
+  int result;
+  mdb_txn_safe txn;
+  // a thread in a read txn keeps one cold storage txn until that ends,
+  // so a cursor over cold data does not start a txn for every value
+  mdb_threadinfo *tinfo = m_tinfo.get();
+  if (tinfo && tinfo->m_ti_rflags.m_rf_txn)
+  {
+    for (int tries = 0; ; ++tries)
+    {
+      if (!tinfo->m_ti_rflags.m_rf_cold_txn)
+      {
+        if (!tinfo->m_ti_cold_rtxn)
+          result = lmdb_txn_begin(m_cold_env, NULL, MDB_RDONLY, &tinfo->m_ti_cold_rtxn);
+        else
+          result = lmdb_txn_renew(tinfo->m_ti_cold_rtxn);
+        if (result)
+          throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the cold storage: ", result).c_str()));
+        tinfo->m_ti_rflags.m_rf_cold_txn = true;
+      }
+      result = mdb_get(tinfo->m_ti_cold_rtxn, m_cold_dbis[table], &k, &v);
+      // the value may have been moved after the txn started
+      if (result != MDB_NOTFOUND || tries > 0)
+        break;
+      mdb_txn_reset(tinfo->m_ti_cold_rtxn);
+      tinfo->m_ti_rflags.m_rf_cold_txn = false;
+    }
+  }
+  else
+  {
+    if ((result = lmdb_txn_begin(m_cold_env, NULL, MDB_RDONLY, txn)))
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the cold storage: ", result).c_str()));
+    result = mdb_get(txn, m_cold_dbis[table], &k, &v);
+  }
+  if (result == MDB_NOTFOUND)
+    return false;
+  if (result)
+    throw0(DB_ERROR(lmdb_error(std::string("Failed to read ") + blob_table_names[table] + " from cold storage: ", result).c_str()));
+  if (!append)
+    bd.clear();
+  bd.append(reinterpret_cast<const char*>(v.mv_data), v.mv_size);
+  return true;
+}
+
+void BlockchainLMDB::resize_cold_storage(uint64_t size)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  CRITICAL_REGION_LOCAL(m_synchronization_lock);
+
+  MDB_envinfo mei;
+  mdb_env_info(m_cold_env, &mei);
+  MDB_stat mst;
+  mdb_env_stat(m_cold_env, &mst);
+
+  // leave room for the pages the btree needs on top of the values
+  const uint64_t used = ((uint64_t)mei.me_last_pgno + 1) * mst.ms_psize;
+  if (used + 2 * size < (uint64_t)mei.me_mapsize)
+    return;
+
+  uint64_t new_mapsize = (uint64_t)mei.me_mapsize + 2 * size + (1LL << 30);
+  new_mapsize += (new_mapsize % mst.ms_psize);
+
+  mdb_txn_safe::prevent_new_txns();
+  mdb_txn_safe::wait_no_active_txns();
+  const int result = mdb_env_set_mapsize(m_cold_env, new_mapsize);
+  mdb_txn_safe::allow_new_txns();
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to set new cold storage mapsize: ", result).c_str()));
+
+  MGINFO("LMDB cold storage mapsize increased." << "  Old: " << mei.me_mapsize / (1024 * 1024) << "MiB" << ", New: " << new_mapsize / (1024 * 1024) << "MiB");
+}
+
 void BlockchainLMDB::close()
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -1634,8 +2949,23 @@ void BlockchainLMDB::close()
     LOG_PRINT_L3("close() first calling batch_abort() due to active batch transaction");
     BlockchainLMDB::batch_abort();
   }
+  if (!BlockchainLMDB::is_read_only())
+  {
+    try { BlockchainLMDB::flush_txpool_updates(); }
+    catch (const std::exception &e) { MERROR("Failed to write txpool changes on close: " << e.what()); }
+  }
   BlockchainLMDB::sync();
+
+  cancel_compaction("The database was closed");
+
   m_tinfo.reset();
+  m_tinfo_registry->end_all();
+  std::atomic_store(&m_spent_keys_filter, std::shared_ptr<tools::bloom_filter<crypto::key_image>>());
+  m_block_info_cache->clear();
+  m_txpool_cache->clear();
+  for (auto &compressor: m_blob_compressors)
+    compressor.reset();
+  close_cold_storage();
 
   // FIXME: not yet thread safe!!!  Use with care.
   mdb_env_close(m_env);
@@ -1695,6 +3025,8 @@ void BlockchainLMDB::reset()
     throw0(DB_ERROR(lmdb_error("Failed to drop m_output_txs: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_output_amounts, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_output_amounts: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_output_distribution, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_output_distribution: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_spent_keys, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_spent_keys: ", result).c_str()));
   (void)mdb_drop(txn, m_hf_starting_heights, 0); // this one is dropped in new code
@@ -1702,6 +3034,10 @@ void BlockchainLMDB::reset()
     throw0(DB_ERROR(lmdb_error("Failed to drop m_hf_versions: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_properties, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_properties: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_rct_ver_cache, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_rct_ver_cache: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_block_pow, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_block_pow: ", result).c_str()));
 
   // init with current version
   MDB_val_str(k, "version");
@@ -1710,8 +3046,24 @@ void BlockchainLMDB::reset()
     throw0(DB_ERROR(lmdb_error("Failed to write version to database: ", result).c_str()));
 
   txn.commit();
+
+  if (m_cold_env)
+  {
+    mdb_txn_safe cold_txn;
+    if (auto result = lmdb_txn_begin(m_cold_env, NULL, 0, cold_txn))
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the cold storage: ", result).c_str()));
+    for (unsigned table = 0; table < num_blob_tables; ++table)
+      if (auto result = mdb_drop(cold_txn, m_cold_dbis[table], 0))
+        throw0(DB_ERROR(lmdb_error(std::string("Failed to drop cold storage ") + blob_table_names[table] + ": ", result).c_str()));
+    cold_txn.commit();
+  }
+
   m_cum_size = 0;
   m_cum_count = 0;
+  init_blob_compression();
+  init_cold_storage();
+  init_spent_keys_filter();
+  init_block_info_cache();
 }
 
 std::vector<std::string> BlockchainLMDB::get_filenames() const
@@ -1752,6 +3104,17 @@ std::string BlockchainLMDB::get_db_name() const
   return std::string("lmdb");
 }
 
+unsigned BlockchainLMDB::get_blob_compression() const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+
+  unsigned tables = 0;
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+    if (m_blob_compressors[table])
+      tables |= 1u << table;
+  return tables;
+}
+
 // TODO: this?
 bool BlockchainLMDB::lock()
 {
@@ -1800,23 +3163,26 @@ void BlockchainLMDB::add_txpool_tx(const crypto::hash &txid, const cryptonote::b
   mdb_txn_cursors *m_cursors = &m_wcursors;
 
   CURSOR(txpool_meta)
-  CURSOR(txpool_blob)
 
-  MDB_val k = {sizeof(txid), (void *)&txid};
-  MDB_val v = {sizeof(meta), (void *)&meta};
-  if (auto result = mdb_cursor_put(m_cur_txpool_meta, &k, &v, MDB_NODUPDATA)) {
-    if (result == MDB_KEYEXIST)
+  txpool_cache::view cached;
+  bool removed;
+  if (m_txpool_cache->get(txid, true, cached, removed))
+  {
+    if (!removed)
       throw1(DB_ERROR("Attempting to add txpool tx metadata that's already in the db"));
-    else
-      throw1(DB_ERROR(lmdb_error("Error adding txpool tx metadata to db transaction: ", result).c_str()));
   }
-  MDB_val_sized(blob_val, blob);
-  if (auto result = mdb_cursor_put(m_cur_txpool_blob, &k, &blob_val, MDB_NODUPDATA)) {
-    if (result == MDB_KEYEXIST)
-      throw1(DB_ERROR("Attempting to add txpool tx blob that's already in the db"));
-    else
-      throw1(DB_ERROR(lmdb_error("Error adding txpool tx blob to db transaction: ", result).c_str()));
+  else
+  {
+    MDB_val k = {sizeof(txid), (void *)&txid};
+    auto result = mdb_cursor_get(m_cur_txpool_meta, &k, NULL, MDB_SET);
+    if (result == 0)
+      throw1(DB_ERROR("Attempting to add txpool tx metadata that's already in the db"));
+    if (result != MDB_NOTFOUND)
+      throw1(DB_ERROR(lmdb_error("Error finding txpool tx meta: ", result).c_str()));
   }
+
+  // the tables get it with the next flush, see write_txpool_cache
+  m_txpool_cache->add(txid, meta, blob);
 }
 
 void BlockchainLMDB::update_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta)
@@ -1826,23 +3192,25 @@ void BlockchainLMDB::update_txpool_tx(const crypto::hash &txid, const txpool_tx_
   mdb_txn_cursors *m_cursors = &m_wcursors;
 
   CURSOR(txpool_meta)
-  CURSOR(txpool_blob)
 
-  MDB_val k = {sizeof(txid), (void *)&txid};
-  MDB_val v;
-  auto result = mdb_cursor_get(m_cur_txpool_meta, &k, &v, MDB_SET);
-  if (result != 0)
-    throw1(DB_ERROR(lmdb_error("Error finding txpool tx meta to update: ", result).c_str()));
-  result = mdb_cursor_del(m_cur_txpool_meta, 0);
-  if (result)
-    throw1(DB_ERROR(lmdb_error("Error adding removal of txpool tx metadata to db transaction: ", result).c_str()));
-  v = MDB_val({sizeof(meta), (void *)&meta});
-  if ((result = mdb_cursor_put(m_cur_txpool_meta, &k, &v, MDB_NODUPDATA)) != 0) {
-    if (result == MDB_KEYEXIST)
-      throw1(DB_ERROR("Attempting to add txpool tx metadata that's already in the db"));
-    else
-      throw1(DB_ERROR(lmdb_error("Error adding txpool tx metadata to db transaction: ", result).c_str()));
+  txpool_cache::view cached;
+  bool removed;
+  bool in_db = true;
+  if (m_txpool_cache->get(txid, true, cached, removed))
+  {
+    if (removed)
+      throw1(DB_ERROR(lmdb_error("Error finding txpool tx meta to update: ", MDB_NOTFOUND).c_str()));
+    in_db = cached.in_db;
   }
+  else
+  {
+    MDB_val k = {sizeof(txid), (void *)&txid};
+    auto result = mdb_cursor_get(m_cur_txpool_meta, &k, NULL, MDB_SET);
+    if (result != 0)
+      throw1(DB_ERROR(lmdb_error("Error finding txpool tx meta to update: ", result).c_str()));
+  }
+
+  m_txpool_cache->update(txid, meta, in_db);
 }
 
 uint64_t BlockchainLMDB::get_txpool_tx_count(relay_category category) const
@@ -1853,8 +3221,12 @@ uint64_t BlockchainLMDB::get_txpool_tx_count(relay_category category) const
   int result;
   uint64_t num_entries = 0;
 
+  TXPOOL_CACHE_LOCK_RDONLY();
   TXN_PREFIX_RDONLY();
 
+  std::unordered_map<crypto::hash, txpool_cache::entry> cached;
+  m_txpool_cache->get_all(txpool_writer, cached, false, txpool_snapshot);
+
   if (category == relay_category::all)
   {
     // No filtering, we can get the number of tx the "fast" way
@@ -1880,13 +3252,18 @@ uint64_t BlockchainLMDB::get_txpool_tx_count(relay_category category) const
         break;
       if (result)
         throw0(DB_ERROR(lmdb_error("Failed to enumerate txpool tx metadata: ", result).c_str()));
-      const txpool_tx_meta_t &meta = *(const txpool_tx_meta_t*)v.mv_data;
+      const auto i = cached.find(*(const crypto::hash*)k.mv_data);
+      const txpool_tx_meta_t &meta = i != cached.end() ? i->second.meta : *(const txpool_tx_meta_t*)v.mv_data;
       if (meta.matches(category))
         ++num_entries;
     }
   }
   TXN_POSTFIX_RDONLY();
 
+  for (const auto &e: cached)
+    if (!e.second.in_db && e.second.meta.matches(category))
+      ++num_entries;
+
   return num_entries;
 }
 
@@ -1895,6 +3272,12 @@ bool BlockchainLMDB::txpool_has_tx(const crypto::hash& txid, relay_category tx_c
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  TXPOOL_CACHE_LOCK_RDONLY();
+  txpool_cache::view cached;
+  bool removed;
+  if (m_txpool_cache->get(txid, txpool_writer, cached, removed, txpool_snapshot))
+    return !removed && cached.meta->matches(tx_category);
+
   TXN_PREFIX_RDONLY();
   RCURSOR(txpool_meta)
 
@@ -1944,6 +3327,10 @@ void BlockchainLMDB::remove_txpool_tx(const crypto::hash& txid)
     if (result)
       throw1(DB_ERROR(lmdb_error("Error adding removal of txpool tx blob to db transaction: ", result).c_str()));
   }
+
+  // unlike additions and updates, a removal is committed with whatever
+  // caused it, so a mined or dropped tx can't come back after a crash
+  m_txpool_cache->remove(txid);
 }
 
 bool BlockchainLMDB::get_txpool_tx_meta(const crypto::hash& txid, txpool_tx_meta_t &meta) const
@@ -1951,6 +3338,17 @@ bool BlockchainLMDB::get_txpool_tx_meta(const crypto::hash& txid, txpool_tx_meta
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  TXPOOL_CACHE_LOCK_RDONLY();
+  txpool_cache::view cached;
+  bool removed;
+  if (m_txpool_cache->get(txid, txpool_writer, cached, removed, txpool_snapshot))
+  {
+    if (removed)
+      return false;
+    meta = *cached.meta;
+    return true;
+  }
+
   TXN_PREFIX_RDONLY();
   RCURSOR(txpool_meta)
 
@@ -1972,6 +3370,21 @@ bool BlockchainLMDB::get_txpool_tx_blob(const crypto::hash& txid, cryptonote::bl
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  TXPOOL_CACHE_LOCK_RDONLY();
+  txpool_cache::view cached;
+  bool removed;
+  const bool is_cached = m_txpool_cache->get(txid, txpool_writer, cached, removed, txpool_snapshot);
+  if (is_cached)
+  {
+    if (removed || !cached.meta->matches(tx_category))
+      return false;
+    if (cached.blob)
+    {
+      bd = *cached.blob;
+      return true;
+    }
+  }
+
   TXN_PREFIX_RDONLY();
   RCURSOR(txpool_blob)
 
@@ -1979,7 +3392,7 @@ bool BlockchainLMDB::get_txpool_tx_blob(const crypto::hash& txid, cryptonote::bl
   MDB_val v;
 
   // if filtering, make sure those requirements are met before copying blob
-  if (tx_category != relay_category::all)
+  if (tx_category != relay_category::all && !is_cached)
   {
     RCURSOR(txpool_meta)
     auto result = mdb_cursor_get(m_cur_txpool_meta, &k, &v, MDB_SET);
@@ -1993,23 +3406,108 @@ bool BlockchainLMDB::get_txpool_tx_blob(const crypto::hash& txid, cryptonote::bl
       return false;
   }
 
-  auto result = mdb_cursor_get(m_cur_txpool_blob, &k, &v, MDB_SET);
-  if (result == MDB_NOTFOUND)
-    return false;
-  if (result != 0)
-      throw1(DB_ERROR(lmdb_error("Error finding txpool tx blob: ", result).c_str()));
+  auto result = mdb_cursor_get(m_cur_txpool_blob, &k, &v, MDB_SET);
+  if (result == MDB_NOTFOUND)
+    return false;
+  if (result != 0)
+      throw1(DB_ERROR(lmdb_error("Error finding txpool tx blob: ", result).c_str()));
+
+  bd.assign(reinterpret_cast<const char*>(v.mv_data), v.mv_size);
+  TXN_POSTFIX_RDONLY();
+  return true;
+}
+
+cryptonote::blobdata BlockchainLMDB::get_txpool_tx_blob(const crypto::hash& txid, relay_category tx_category) const
+{
+  cryptonote::blobdata bd;
+  if (!get_txpool_tx_blob(txid, bd, tx_category))
+    throw1(DB_ERROR("Tx not found in txpool: "));
+  return bd;
+}
+
+bool BlockchainLMDB::in_write_txn() const
+{
+  return m_write_txn && m_writer == boost::this_thread::get_id();
+}
+
+bool BlockchainLMDB::block_info_cache_usable() const
+{
+  // The cache only holds committed records, and the writer evicts the ones
+  // it pops (or clears them all) before it commits, so it never has a record
+  // the latest snapshot disagrees with. That is what a fresh read txn would
+  // read, and the writer's own txn differs from it only by its pending
+  // records, which are not served. A read txn this thread keeps open may be
+  // older, and may have been reorganized away since, so it reads the db.
+  if (in_write_txn())
+    return true;
+  const mdb_threadinfo *tinfo = m_tinfo.get();
+  return !tinfo || !tinfo->m_ti_rflags.m_rf_txn;
+}
+
+uint64_t BlockchainLMDB::get_kept_snapshot() const
+{
+  const mdb_threadinfo *tinfo = m_tinfo.get();
+  if (!tinfo || !tinfo->m_ti_rflags.m_rf_txn || mdb_txn_env(tinfo->m_ti_rtxn) != m_env)
+    return 0;
+  return mdb_txn_id(tinfo->m_ti_rtxn);
+}
+
+void BlockchainLMDB::write_txpool_cache()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  mdb_txn_cursors *m_cursors = &m_wcursors;
 
-  bd.assign(reinterpret_cast<const char*>(v.mv_data), v.mv_size);
-  TXN_POSTFIX_RDONLY();
-  return true;
+  CURSOR(txpool_meta)
+  CURSOR(txpool_blob)
+
+  auto write = [&](const crypto::hash &txid) {
+    txpool_cache::view cached;
+    bool removed;
+    if (!m_txpool_cache->get(txid, true, cached, removed) || removed)
+      return;
+    MDB_val k = {sizeof(txid), (void *)&txid};
+    MDB_val v = {sizeof(*cached.meta), (void *)cached.meta};
+    if (auto result = mdb_cursor_put(m_cur_txpool_meta, &k, &v, 0))
+      throw1(DB_ERROR(lmdb_error("Error adding txpool tx metadata to db transaction: ", result).c_str()));
+    if (cached.blob)
+    {
+      MDB_val_sized(blob_val, (*cached.blob));
+      if (auto result = mdb_cursor_put(m_cur_txpool_blob, &k, &blob_val, 0))
+        throw1(DB_ERROR(lmdb_error("Error adding txpool tx blob to db transaction: ", result).c_str()));
+    }
+  };
+  for (const auto &e: m_txpool_cache->committed)
+    if (m_txpool_cache->pending.find(e.first) == m_txpool_cache->pending.end())
+      write(e.first);
+  for (const auto &e: m_txpool_cache->pending)
+    write(e.first);
+  m_txpool_cache->written = true;
 }
 
-cryptonote::blobdata BlockchainLMDB::get_txpool_tx_blob(const crypto::hash& txid, relay_category tx_category) const
+void BlockchainLMDB::flush_txpool_updates()
 {
-  cryptonote::blobdata bd;
-  if (!get_txpool_tx_blob(txid, bd, tx_category))
-    throw1(DB_ERROR("Tx not found in txpool: "));
-  return bd;
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  {
+    boost::shared_lock<boost::shared_mutex> lock(m_txpool_cache->mutex);
+    if (m_txpool_cache->committed.empty())
+      return;
+  }
+
+  block_wtxn_start();
+  try
+  {
+    // block_wtxn_stop writes the cache, unless a batch is active, in which
+    // case the batch's commit does
+    m_txpool_cache->flush_requested = true;
+    block_wtxn_stop();
+  }
+  catch (...)
+  {
+    block_wtxn_abort();
+    throw;
+  }
 }
 
 uint32_t BlockchainLMDB::get_blockchain_pruning_seed() const
@@ -2034,7 +3532,7 @@ uint32_t BlockchainLMDB::get_blockchain_pruning_seed() const
   return pruning_seed;
 }
 
-static bool is_v1_tx(MDB_cursor *c_txs_pruned, MDB_val *tx_id)
+static bool is_v1_tx(MDB_cursor *c_txs_pruned, MDB_val *tx_id, const blob_compressor *compressor)
 {
   MDB_val v;
   int ret = mdb_cursor_get(c_txs_pruned, tx_id, &v, MDB_SET);
@@ -2042,6 +3540,13 @@ static bool is_v1_tx(MDB_cursor *c_txs_pruned, MDB_val *tx_id)
     throw0(DB_ERROR(lmdb_error("Failed to find transaction pruned data: ", ret).c_str()));
   if (v.mv_size == 0)
     throw0(DB_ERROR("Invalid transaction pruned data"));
+  if (compressor)
+  {
+    cryptonote::blobdata bd;
+    if (!compressor->decompress(v.mv_data, v.mv_size, bd) || bd.empty())
+      throw0(DB_ERROR("Invalid transaction pruned data"));
+    return cryptonote::is_v1_tx(bd);
+  }
   return cryptonote::is_v1_tx(cryptonote::blobdata_ref{(const char*)v.mv_data, v.mv_size});
 }
 
@@ -2151,7 +3656,7 @@ bool BlockchainLMDB::prune_worker(int mode, uint32_t pruning_seed)
       if (block_height + CRYPTONOTE_PRUNING_TIP_BLOCKS < blockchain_height)
       {
         ++n_total_records;
-        if (!tools::has_unpruned_block(block_height, blockchain_height, pruning_seed) && !is_v1_tx(c_txs_pruned, &k))
+        if (!tools::has_unpruned_block(block_height, blockchain_height, pruning_seed) && !is_v1_tx(c_txs_pruned, &k, m_blob_compressors[blob_table_txs_pruned].get()))
         {
           ++n_prunable_records;
           result = mdb_cursor_get(c_txs_prunable, &k, &v, MDB_SET);
@@ -2237,7 +3742,7 @@ bool BlockchainLMDB::prune_worker(int mode, uint32_t pruning_seed)
         }
       }
       MDB_val_set(kp, ti.data.tx_id);
-      if (!tools::has_unpruned_block(block_height, blockchain_height, pruning_seed) && !is_v1_tx(c_txs_pruned, &kp))
+      if (!tools::has_unpruned_block(block_height, blockchain_height, pruning_seed) && !is_v1_tx(c_txs_pruned, &kp, m_blob_compressors[blob_table_txs_pruned].get()))
       {
         result = mdb_cursor_get(c_txs_prunable, &kp, &v, MDB_SET);
         if (result && result != MDB_NOTFOUND)
@@ -2319,6 +3824,15 @@ bool BlockchainLMDB::prune_worker(int mode, uint32_t pruning_seed)
   mdb_cursor_close(c_txs_prunable);
   mdb_cursor_close(c_txs_pruned);
 
+  if (mode == prune_mode_prune)
+  {
+    // a full pass leaves nothing for online pruning to resume
+    MDB_val_str(pk, "pruning_progress");
+    result = mdb_del(txn, m_properties, &pk, NULL);
+    if (result && result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to delete pruning progress: ", result).c_str()));
+  }
+
   txn.commit();
 
   TIME_MEASURE_FINISH(t);
@@ -2345,15 +3859,432 @@ bool BlockchainLMDB::check_pruning()
   return prune_worker(prune_mode_check, 0);
 }
 
+bool BlockchainLMDB::prune_blockchain_incremental(uint32_t pruning_seed, uint64_t max_bytes)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  const uint32_t log_stripes = tools::get_pruning_log_stripes(pruning_seed);
+  if (log_stripes && log_stripes != CRYPTONOTE_PRUNING_LOG_STRIPES)
+    throw0(DB_ERROR("Pruning seed not in range"));
+  pruning_seed = tools::get_pruning_stripe(pruning_seed);
+  if (pruning_seed > (1ul << CRYPTONOTE_PRUNING_LOG_STRIPES))
+    throw0(DB_ERROR("Pruning seed not in range"));
+  check_open();
+
+  mdb_txn_safe txn;
+  int result = mdb_txn_begin(m_env, NULL, 0, txn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+
+  MDB_val_str(k_seed, "pruning_seed");
+  MDB_val_str(k_progress, "pruning_progress");
+  pruning_progress progress = {0, 0};
+  MDB_val v;
+  result = mdb_get(txn, m_properties, &k_seed, &v);
+  if (result == MDB_NOTFOUND)
+  {
+    // from now on, new blocks are pruned as for a pruned blockchain
+    if (pruning_seed == 0)
+      pruning_seed = tools::get_random_stripe();
+    pruning_seed = tools::make_pruning_seed(pruning_seed, CRYPTONOTE_PRUNING_LOG_STRIPES);
+    v.mv_data = &pruning_seed;
+    v.mv_size = sizeof(pruning_seed);
+    result = mdb_put(txn, m_properties, &k_seed, &v, 0);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to save pruning seed: ", result).c_str()));
+    MINFO("Pruning blockchain online with seed " << epee::string_tools::to_string_hex(pruning_seed));
+  }
+  else if (result == 0)
+  {
+    if (v.mv_size != sizeof(uint32_t))
+      throw0(DB_ERROR("Failed to retrieve or create pruning seed: unexpected value size"));
+    const uint32_t data = *(const uint32_t*)v.mv_data;
+    if (pruning_seed != 0 && tools::get_pruning_stripe(data) != pruning_seed)
+      throw0(DB_ERROR("Blockchain already pruned with different seed"));
+    if (tools::get_pruning_log_stripes(data) != CRYPTONOTE_PRUNING_LOG_STRIPES)
+      throw0(DB_ERROR("Blockchain already pruned with different base"));
+    pruning_seed = data;
+
+    result = mdb_get(txn, m_properties, &k_progress, &v);
+    if (result == MDB_NOTFOUND)
+    {
+      // pruned already, whether online or not
+      txn.abort();
+      return true;
+    }
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to retrieve pruning progress: ", result).c_str()));
+    if (v.mv_size != sizeof(progress))
+      throw0(DB_ERROR("Failed to retrieve pruning progress: unexpected value size"));
+    memcpy(&progress, v.mv_data, sizeof(progress));
+  }
+  else
+    throw0(DB_ERROR(lmdb_error("Failed to retrieve or create pruning seed: ", result).c_str()));
+
+  MDB_stat db_stats;
+  if ((result = mdb_stat(txn, m_block_info, &db_stats)))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_block_info: ", result).c_str()));
+  const uint64_t blockchain_height = db_stats.ms_entries;
+  const uint64_t tip_height = blockchain_height > CRYPTONOTE_PRUNING_TIP_BLOCKS ? blockchain_height - CRYPTONOTE_PRUNING_TIP_BLOCKS : 0;
+
+  MDB_cursor *c_blocks, *c_tx_indices, *c_txs_pruned, *c_txs_prunable, *c_txs_prunable_tip;
+  if ((result = mdb_cursor_open(txn, m_blocks, &c_blocks)))
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for blocks: ", result).c_str()));
+  if ((result = mdb_cursor_open(txn, m_tx_indices, &c_tx_indices)))
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for tx_indices: ", result).c_str()));
+  if ((result = mdb_cursor_open(txn, m_txs_pruned, &c_txs_pruned)))
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_pruned: ", result).c_str()));
+  if ((result = mdb_cursor_open(txn, m_txs_prunable, &c_txs_prunable)))
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_prunable: ", result).c_str()));
+  if ((result = mdb_cursor_open(txn, m_txs_prunable_tip, &c_txs_prunable_tip)))
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_prunable_tip: ", result).c_str()));
+
+  // tx IDs follow the blocks, starting with each block's miner tx
+  auto get_block = [&](uint64_t height, block &b, uint64_t &first_tx_id) {
+    blobdata bd;
+    if (is_cold(blob_table_blocks, height))
+    {
+      if (!get_cold_blob(blob_table_blocks, height, bd))
+        throw0(DB_ERROR(("Failed to find block " + std::to_string(height) + " in cold storage").c_str()));
+    }
+    else
+    {
+      MDB_val_set(key, height);
+      MDB_val value;
+      int ret = mdb_cursor_get(c_blocks, &key, &value, MDB_SET);
+      if (ret)
+        throw0(DB_ERROR(lmdb_error("Failed to find block " + std::to_string(height) + ": ", ret).c_str()));
+      decode_blob(blob_table_blocks, value, bd);
+    }
+    int ret;
+    if (!parse_and_validate_block_from_blob(bd, b))
+      throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+    const crypto::hash miner_tx_hash = get_transaction_hash(b.miner_tx);
+    MDB_val_set(index, miner_tx_hash);
+    ret = mdb_cursor_get(c_tx_indices, (MDB_val *)&zerokval, &index, MDB_GET_BOTH);
+    if (ret)
+      throw0(DB_ERROR(lmdb_error("Failed to find miner tx of block " + std::to_string(height) + ": ", ret).c_str()));
+    first_tx_id = ((const txindex *)index.mv_data)->data.tx_id;
+  };
+
+  uint64_t n_bytes = 0, n_pruned_records = 0;
+  block b;
+  bool done = false;
+  while (n_bytes < max_bytes)
+  {
+    if (progress.height >= tip_height)
+    {
+      // the txs of blocks added before pruning started are not in the tip
+      // table yet, add them so update_pruning prunes them in time
+      uint64_t tx_id;
+      progress.height = std::min(progress.height, tip_height);
+      if (progress.height < blockchain_height)
+        get_block(progress.height, b, tx_id);
+      for (uint64_t height = progress.height; height < blockchain_height; ++height)
+      {
+        if (height > progress.height)
+        {
+          uint64_t first_tx_id;
+          get_block(height, b, first_tx_id);
+          if (first_tx_id != tx_id)
+            throw0(DB_ERROR("Unexpected tx ID of a miner tx"));
+        }
+        for (size_t i = 0; i <= b.tx_hashes.size(); ++i, ++tx_id)
+        {
+          MDB_val_set(kp, tx_id);
+          MDB_val_set(vp, height);
+          result = mdb_cursor_put(c_txs_prunable_tip, &kp, &vp, 0);
+          if (result)
+            throw0(DB_ERROR(lmdb_error("Failed to add prunable tx id to db transaction: ", result).c_str()));
+        }
+      }
+      done = true;
+      break;
+    }
+
+    // skip to the next stripe this node does not keep
+    if (tools::has_unpruned_block(progress.height, blockchain_height, pruning_seed))
+    {
+      progress.height = tools::get_next_pruned_block_height(progress.height, blockchain_height, pruning_seed);
+      progress.tx_id = 0;
+      continue;
+    }
+
+    const uint64_t range_end = std::min(tip_height, tools::get_next_unpruned_block_height(progress.height, blockchain_height, pruning_seed));
+    uint64_t first_tx_id, end_tx_id;
+    get_block(progress.height, b, first_tx_id);
+    get_block(range_end, b, end_tx_id);
+    uint64_t next_tx_id = std::max(progress.tx_id, first_tx_id);
+
+    MDB_val_set(kp, next_tx_id);
+    result = mdb_cursor_get(c_txs_prunable, &kp, &v, MDB_SET_RANGE);
+    while (result == 0)
+    {
+      const uint64_t tx_id = *(const uint64_t*)kp.mv_data;
+      if (tx_id >= end_tx_id)
+      {
+        result = MDB_NOTFOUND;
+        break;
+      }
+      if (n_bytes >= max_bytes)
+        break;
+      n_bytes += kp.mv_size + v.mv_size;
+      if (!is_v1_tx(c_txs_pruned, &kp, m_blob_compressors[blob_table_txs_pruned].get()))
+      {
+        if ((result = mdb_cursor_del(c_txs_prunable, 0)))
+          throw0(DB_ERROR(lmdb_error("Failed to delete transaction prunable data: ", result).c_str()));
+        ++n_pruned_records;
+      }
+      next_tx_id = tx_id + 1;
+      result = mdb_cursor_get(c_txs_prunable, &kp, &v, MDB_NEXT);
+    }
+    if (result && result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to enumerate transaction prunable data: ", result).c_str()));
+
+    if (result == MDB_NOTFOUND)
+    {
+      progress.height = range_end;
+      progress.tx_id = 0;
+    }
+    else
+    {
+      progress.tx_id = next_tx_id;
+    }
+  }
+
+  mdb_cursor_close(c_txs_prunable_tip);
+  mdb_cursor_close(c_txs_prunable);
+  mdb_cursor_close(c_txs_pruned);
+  mdb_cursor_close(c_tx_indices);
+  mdb_cursor_close(c_blocks);
+
+  if (done)
+  {
+    result = mdb_del(txn, m_properties, &k_progress, NULL);
+    if (result && result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to delete pruning progress: ", result).c_str()));
+  }
+  else
+  {
+    MDB_val_set(vp, progress);
+    if ((result = mdb_put(txn, m_properties, &k_progress, &vp, 0)))
+      throw0(DB_ERROR(lmdb_error("Failed to save pruning progress: ", result).c_str()));
+  }
+  txn.commit();
+
+  MDEBUG("Pruned " << n_pruned_records << " records online, " << n_bytes << " bytes visited, next height " << progress.height);
+  if (done)
+    MINFO("Online blockchain pruning complete");
+  return done;
+}
+
+bool BlockchainLMDB::get_pruning_progress(uint64_t &height) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(properties)
+  MDB_val_str(k, "pruning_progress");
+  MDB_val v;
+  int result = mdb_cursor_get(m_cur_properties, &k, &v, MDB_SET);
+  if (result == MDB_NOTFOUND)
+    return false;
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to retrieve pruning progress: ", result).c_str()));
+  if (v.mv_size != sizeof(pruning_progress))
+    throw0(DB_ERROR("Failed to retrieve pruning progress: unexpected value size"));
+  pruning_progress progress;
+  memcpy(&progress, v.mv_data, sizeof(progress));
+  TXN_POSTFIX_RDONLY();
+  height = progress.height;
+  return true;
+}
+
+bool BlockchainLMDB::move_to_cold_storage(uint64_t max_bytes)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  if (!m_cold_env || !m_cold_storage_tables || is_read_only())
+    return true;
+
+  // pruned txs have no prunable data to move, and the rest is best left in
+  // the main database, where pruning expects it
+  const bool pruned = get_blockchain_pruning_seed() != 0;
+  const MDB_dbi dbis[num_blob_tables] = { m_blocks, m_txs_pruned, m_txs_prunable };
+  uint64_t boundaries[num_blob_tables], targets[num_blob_tables], new_boundaries[num_blob_tables];
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+    boundaries[table] = targets[table] = new_boundaries[table] = m_cold_boundaries[table].load(std::memory_order_acquire);
+
+  // read the values to move, up to max_bytes of them
+  std::vector<std::pair<uint64_t, cryptonote::blobdata>> values[num_blob_tables];
+  uint64_t n_bytes = 0;
+  {
+    mdb_txn_safe txn;
+    int result = mdb_txn_begin(m_env, NULL, MDB_RDONLY, txn);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+
+    MDB_stat db_stats;
+    if ((result = mdb_stat(txn, m_block_info, &db_stats)))
+      throw0(DB_ERROR(lmdb_error("Failed to query m_block_info: ", result).c_str()));
+    const uint64_t blockchain_height = db_stats.ms_entries;
+    if (blockchain_height <= m_cold_storage_depth)
+      return true;
+    const uint64_t cold_height = blockchain_height - m_cold_storage_depth;
+
+    if (m_cold_storage_tables & DB_COLD_BLOCKS)
+      targets[blob_table_blocks] = std::max(boundaries[blob_table_blocks], cold_height);
+    if ((m_cold_storage_tables & DB_COLD_TXS_PRUNABLE) && !pruned)
+    {
+      // the txs of a block follow its miner tx
+      blobdata bd;
+      if (is_cold(blob_table_blocks, cold_height))
+      {
+        if (!get_cold_blob(blob_table_blocks, cold_height, bd))
+          throw0(DB_ERROR(("Failed to find block " + std::to_string(cold_height) + " in cold storage").c_str()));
+      }
+      else
+      {
+        MDB_val_set(k, cold_height);
+        MDB_val v;
+        if ((result = mdb_get(txn, m_blocks, &k, &v)))
+          throw0(DB_ERROR(lmdb_error("Failed to find block " + std::to_string(cold_height) + ": ", result).c_str()));
+        decode_blob(blob_table_blocks, v, bd);
+      }
+      block b;
+      if (!parse_and_validate_block_from_blob(bd, b))
+        throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+      const crypto::hash miner_tx_hash = get_transaction_hash(b.miner_tx);
+      MDB_val_set(index, miner_tx_hash);
+      MDB_cursor *c_tx_indices;
+      if ((result = mdb_cursor_open(txn, m_tx_indices, &c_tx_indices)))
+        throw0(DB_ERROR(lmdb_error("Failed to open a cursor for tx_indices: ", result).c_str()));
+      result = mdb_cursor_get(c_tx_indices, (MDB_val *)&zerokval, &index, MDB_GET_BOTH);
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to find miner tx of block " + std::to_string(cold_height) + ": ", result).c_str()));
+      const uint64_t first_tx_id = ((const txindex *)index.mv_data)->data.tx_id;
+      mdb_cursor_close(c_tx_indices);
+      targets[blob_table_txs_prunable] = std::max(boundaries[blob_table_txs_prunable], first_tx_id);
+    }
+
+    for (unsigned table = 0; table < num_blob_tables; ++table)
+    {
+      if (boundaries[table] >= targets[table])
+        continue;
+      MDB_cursor *cursor;
+      if ((result = mdb_cursor_open(txn, dbis[table], &cursor)))
+        throw0(DB_ERROR(lmdb_error(std::string("Failed to open a cursor for ") + blob_table_names[table] + ": ", result).c_str()));
+      uint64_t key = boundaries[table];
+      MDB_val k = {sizeof(key), (void*)&key}, v;
+      result = mdb_cursor_get(cursor, &k, &v, MDB_SET_RANGE);
+      while (result == 0 && n_bytes < max_bytes)
+      {
+        key = *(const uint64_t*)k.mv_data;
+        if (key >= targets[table])
+          break;
+        cryptonote::blobdata blob;
+        decode_blob(table, v, blob);
+        n_bytes += blob.size();
+        values[table].emplace_back(key, std::move(blob));
+        result = mdb_cursor_get(cursor, &k, &v, MDB_NEXT);
+      }
+      if (result && result != MDB_NOTFOUND)
+        throw0(DB_ERROR(lmdb_error(std::string("Failed to enumerate ") + blob_table_names[table] + ": ", result).c_str()));
+      // stopping short of the target leaves the cursor on the next key to move
+      new_boundaries[table] = result == 0 ? std::min(*(const uint64_t*)k.mv_data, targets[table]) : targets[table];
+      mdb_cursor_close(cursor);
+    }
+    txn.abort();
+  }
+
+  bool changed = false, done = true;
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+  {
+    changed |= new_boundaries[table] != boundaries[table];
+    done &= new_boundaries[table] == targets[table];
+  }
+  if (!changed)
+    return done;
+
+  // copy to cold storage first, so the values are always in one or the other
+  resize_cold_storage(n_bytes);
+  {
+    mdb_txn_safe txn;
+    int result = lmdb_txn_begin(m_cold_env, NULL, 0, txn);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the cold storage: ", result).c_str()));
+    for (unsigned table = 0; table < num_blob_tables; ++table)
+    {
+      for (const auto &e: values[table])
+      {
+        MDB_val_set(k, e.first);
+        MDB_val v = {e.second.size(), (void*)e.second.data()};
+        if ((result = mdb_put(txn, m_cold_dbis[table], &k, &v, 0)))
+          throw0(DB_ERROR(lmdb_error(std::string("Failed to add ") + blob_table_names[table] + " data to cold storage: ", result).c_str()));
+      }
+    }
+    txn.commit();
+  }
+  for (unsigned table = 0; table < num_blob_tables; ++table)
+    m_cold_boundaries[table].store(new_boundaries[table], std::memory_order_release);
+
+  // then remove them from the main database
+  {
+    mdb_txn_safe txn;
+    int result = lmdb_txn_begin(m_env, NULL, 0, txn);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+    for (unsigned table = 0; table < num_blob_tables; ++table)
+    {
+      if (new_boundaries[table] == boundaries[table])
+        continue;
+      MDB_cursor *cursor;
+      if ((result = mdb_cursor_open(txn, dbis[table], &cursor)))
+        throw0(DB_ERROR(lmdb_error(std::string("Failed to open a cursor for ") + blob_table_names[table] + ": ", result).c_str()));
+      uint64_t key = boundaries[table];
+      MDB_val k = {sizeof(key), (void*)&key}, v;
+      result = mdb_cursor_get(cursor, &k, &v, MDB_SET_RANGE);
+      while (result == 0 && *(const uint64_t*)k.mv_data < new_boundaries[table])
+      {
+        if ((result = mdb_cursor_del(cursor, 0)))
+          throw0(DB_ERROR(lmdb_error(std::string("Failed to delete ") + blob_table_names[table] + " data moved to cold storage: ", result).c_str()));
+        result = mdb_cursor_get(cursor, &k, &v, MDB_NEXT);
+      }
+      if (result && result != MDB_NOTFOUND)
+        throw0(DB_ERROR(lmdb_error(std::string("Failed to enumerate ") + blob_table_names[table] + ": ", result).c_str()));
+      mdb_cursor_close(cursor);
+    }
+    cold_storage_state state;
+    memcpy(state.boundaries, new_boundaries, sizeof(state.boundaries));
+    MDB_val_str(k, "cold_storage");
+    MDB_val v = {sizeof(state), (void*)&state};
+    if ((result = mdb_put(txn, m_properties, &k, &v, 0)))
+      throw0(DB_ERROR(lmdb_error("Failed to save cold storage state: ", result).c_str()));
+    txn.commit();
+  }
+
+  MDEBUG("Moved " << n_bytes << " bytes to cold storage, up to block " << new_boundaries[blob_table_blocks]
+      << " and prunable tx " << new_boundaries[blob_table_txs_prunable]);
+  return done;
+}
+
 bool BlockchainLMDB::for_all_txpool_txes(std::function<bool(const crypto::hash&, const txpool_tx_meta_t&, const cryptonote::blobdata_ref*)> f, bool include_blob, relay_category category) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  // f may read the txpool too, so the cache is copied and the lock let go
+  // once the read txn has its snapshot
+  TXPOOL_CACHE_LOCK_RDONLY();
   TXN_PREFIX_RDONLY();
   RCURSOR(txpool_meta);
   RCURSOR(txpool_blob);
 
+  std::unordered_map<crypto::hash, txpool_cache::entry> cached;
+  m_txpool_cache->get_all(txpool_writer, cached, include_blob, txpool_snapshot);
+  if (txpool_cache_lock.owns_lock())
+    txpool_cache_lock.unlock();
+
   MDB_val k;
   MDB_val v;
   bool ret = true;
@@ -2368,11 +4299,14 @@ bool BlockchainLMDB::for_all_txpool_txes(std::function<bool(const crypto::hash&,
     if (result)
       throw0(DB_ERROR(lmdb_error("Failed to enumerate txpool tx metadata: ", result).c_str()));
     const crypto::hash txid = *(const crypto::hash*)k.mv_data;
-    const txpool_tx_meta_t &meta = *(const txpool_tx_meta_t*)v.mv_data;
+    const auto i = cached.find(txid);
+    const txpool_tx_meta_t &meta = i != cached.end() ? i->second.meta : *(const txpool_tx_meta_t*)v.mv_data;
     if (!meta.matches(category))
       continue;
     cryptonote::blobdata_ref bd;
-    if (include_blob)
+    if (include_blob && i != cached.end() && i->second.has_blob)
+      bd = {i->second.blob.data(), i->second.blob.size()};
+    else if (include_blob)
     {
       MDB_val b;
       result = mdb_cursor_get(m_cur_txpool_blob, &k, &b, MDB_SET);
@@ -2389,6 +4323,18 @@ bool BlockchainLMDB::for_all_txpool_txes(std::function<bool(const crypto::hash&,
     }
   }
 
+  // then the txes which are only in the cache
+  for (auto i = cached.begin(); ret && i != cached.end(); ++i)
+  {
+    if (i->second.in_db || !i->second.meta.matches(category))
+      continue;
+    cryptonote::blobdata_ref bd;
+    if (include_blob)
+      bd = {i->second.blob.data(), i->second.blob.size()};
+    if (!f(i->first, i->second.meta, &bd))
+      ret = false;
+  }
+
   TXN_POSTFIX_RDONLY();
 
   return ret;
@@ -2513,6 +4459,16 @@ cryptonote::blobdata BlockchainLMDB::get_block_blob_from_height(const uint64_t&
   TXN_PREFIX_RDONLY();
   RCURSOR(blocks);
 
+  // checked within the read txn, so a block being moved is found in one of
+  // the two databases
+  blobdata bd;
+  if (is_cold(blob_table_blocks, height))
+  {
+    if (!get_cold_blob(blob_table_blocks, height, bd))
+      throw0(BLOCK_DNE(std::string("Attempt to get block from height ").append(boost::lexical_cast<std::string>(height)).append(" failed -- block not in cold storage").c_str()));
+    return bd;
+  }
+
   MDB_val_copy<uint64_t> key(height);
   MDB_val result;
   auto get_result = mdb_cursor_get(m_cur_blocks, &key, &result, MDB_SET);
@@ -2523,8 +4479,7 @@ cryptonote::blobdata BlockchainLMDB::get_block_blob_from_height(const uint64_t&
   else if (get_result)
     throw0(DB_ERROR("Error attempting to retrieve a block from the db"));
 
-  blobdata bd;
-  bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
+  decode_blob(blob_table_blocks, result, bd);
 
   TXN_POSTFIX_RDONLY();
 
@@ -2536,6 +4491,10 @@ uint64_t BlockchainLMDB::get_block_timestamp(const uint64_t& height) const
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  mdb_block_info cached;
+  if (block_info_cache_usable() && m_block_info_cache->get(height, cached))
+    return cached.bi_timestamp;
+
   TXN_PREFIX_RDONLY();
   RCURSOR(block_info);
 
@@ -2569,8 +4528,8 @@ std::vector<uint64_t> BlockchainLMDB::get_block_cumulative_rct_outputs(const std
   RCURSOR(block_info);
 
   MDB_stat db_stats;
-  if ((result = mdb_stat(m_txn, m_blocks, &db_stats)))
-    throw0(DB_ERROR(lmdb_error("Failed to query m_blocks: ", result).c_str()));
+  if ((result = mdb_stat(m_txn, m_block_info, &db_stats)))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_block_info: ", result).c_str()));
   for (size_t i = 0; i < heights.size(); ++i)
     if (heights[i] >= db_stats.ms_entries)
       throw0(BLOCK_DNE(std::string("Attempt to get rct distribution from height " + std::to_string(heights[i]) + " failed -- block size not in db").c_str()));
@@ -2636,6 +4595,10 @@ size_t BlockchainLMDB::get_block_weight(const uint64_t& height) const
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  mdb_block_info cached;
+  if (block_info_cache_usable() && m_block_info_cache->get(height, cached))
+    return cached.bi_weight;
+
   TXN_PREFIX_RDONLY();
   RCURSOR(block_info);
 
@@ -2775,6 +4738,15 @@ difficulty_type BlockchainLMDB::get_block_cumulative_difficulty(const uint64_t&
   LOG_PRINT_L3("BlockchainLMDB::" << __func__ << "  height: " << height);
   check_open();
 
+  mdb_block_info cached;
+  if (block_info_cache_usable() && m_block_info_cache->get(height, cached))
+  {
+    difficulty_type ret = cached.bi_diff_hi;
+    ret <<= 64;
+    ret |= cached.bi_diff_lo;
+    return ret;
+  }
+
   TXN_PREFIX_RDONLY();
   RCURSOR(block_info);
 
@@ -2829,6 +4801,9 @@ void BlockchainLMDB::correct_block_cumulative_difficulties(const uint64_t& start
     throw0(DB_ERROR("Incorrect new_cumulative_difficulties size"));
   }
 
+  // the cached records may be stale until this txn is committed
+  m_block_info_cache->clear();
+
   for (uint64_t height = start_height; height < bc_height; ++height)
   {
     MDB_val_set(key, height);
@@ -2855,6 +4830,10 @@ uint64_t BlockchainLMDB::get_block_already_generated_coins(const uint64_t& heigh
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  mdb_block_info cached;
+  if (block_info_cache_usable() && m_block_info_cache->get(height, cached))
+    return cached.bi_coins;
+
   TXN_PREFIX_RDONLY();
   RCURSOR(block_info);
 
@@ -2878,6 +4857,10 @@ uint64_t BlockchainLMDB::get_block_long_term_weight(const uint64_t& height) cons
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  mdb_block_info cached;
+  if (block_info_cache_usable() && m_block_info_cache->get(height, cached))
+    return cached.bi_long_term_block_weight;
+
   TXN_PREFIX_RDONLY();
   RCURSOR(block_info);
 
@@ -2901,6 +4884,10 @@ crypto::hash BlockchainLMDB::get_block_hash_from_height(const uint64_t& height)
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  mdb_block_info cached;
+  if (block_info_cache_usable() && m_block_info_cache->get(height, cached))
+    return cached.bi_hash;
+
   TXN_PREFIX_RDONLY();
   RCURSOR(block_info);
 
@@ -2986,8 +4973,8 @@ uint64_t BlockchainLMDB::height() const
 
   // get current height
   MDB_stat db_stats;
-  if ((result = mdb_stat(m_txn, m_blocks, &db_stats)))
-    throw0(DB_ERROR(lmdb_error("Failed to query m_blocks: ", result).c_str()));
+  if ((result = mdb_stat(m_txn, m_block_info, &db_stats)))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_block_info: ", result).c_str()));
   return db_stats.ms_entries;
 }
 
@@ -3112,13 +5099,17 @@ bool BlockchainLMDB::get_tx_blob(const crypto::hash& h, cryptonote::blobdata &bd
 
   MDB_val_set(v, h);
   MDB_val result0, result1;
+  uint64_t tx_id = 0;
+  bool cold = false;
   auto get_result = mdb_cursor_get(m_cur_tx_indices, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
   if (get_result == 0)
   {
     txindex *tip = (txindex *)v.mv_data;
-    MDB_val_set(val_tx_id, tip->data.tx_id);
+    tx_id = tip->data.tx_id;
+    MDB_val_set(val_tx_id, tx_id);
     get_result = mdb_cursor_get(m_cur_txs_pruned, &val_tx_id, &result0, MDB_SET);
-    if (get_result == 0)
+    cold = is_cold(blob_table_txs_prunable, tx_id);
+    if (get_result == 0 && !cold)
     {
       get_result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &result1, MDB_SET);
     }
@@ -3128,8 +5119,11 @@ bool BlockchainLMDB::get_tx_blob(const crypto::hash& h, cryptonote::blobdata &bd
   else if (get_result)
     throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx from hash", get_result).c_str()));
 
-  bd.assign(reinterpret_cast<char*>(result0.mv_data), result0.mv_size);
-  bd.append(reinterpret_cast<char*>(result1.mv_data), result1.mv_size);
+  decode_blob(blob_table_txs_pruned, result0, bd);
+  if (!cold)
+    decode_blob(blob_table_txs_prunable, result1, bd, true);
+  else if (!get_cold_blob(blob_table_txs_prunable, tx_id, bd, true))
+    return false;
 
   TXN_POSTFIX_RDONLY();
 
@@ -3159,7 +5153,7 @@ bool BlockchainLMDB::get_pruned_tx_blob(const crypto::hash& h, cryptonote::blobd
   else if (get_result)
     throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx from hash", get_result).c_str()));
 
-  bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
+  decode_blob(blob_table_txs_pruned, result, bd);
 
   TXN_POSTFIX_RDONLY();
 
@@ -3200,7 +5194,8 @@ bool BlockchainLMDB::get_pruned_tx_blobs_from(const crypto::hash& h, size_t coun
       return false;
     if (res)
       throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx blob", res).c_str()));
-    bd.emplace_back(reinterpret_cast<char*>(result.mv_data), result.mv_size);
+    bd.emplace_back();
+    decode_blob(blob_table_txs_pruned, result, bd.back());
   }
 
   TXN_POSTFIX_RDONLY();
@@ -3226,23 +5221,55 @@ bool BlockchainLMDB::get_blocks_from(uint64_t start_height, size_t min_block_cou
   const uint64_t blockchain_height = height();
   uint64_t size = 0;
   size_t num_txes = 0;
-  MDB_val_copy<uint64_t> key(start_height);
   MDB_val v, val_tx_id;
   uint64_t tx_id = ~0;
+
+  // the blocks and prunable cursors step along while they read from the
+  // main database, and need setting again after reading from cold storage
+  bool blocks_positioned = false, prunable_positioned = false;
+  auto get_prunable = [&](MDB_cursor_op op, cryptonote::blobdata *tx_blob) {
+    const uint64_t id = *(const uint64_t*)val_tx_id.mv_data;
+    if (is_cold(blob_table_txs_prunable, id))
+    {
+      if (tx_blob && !get_cold_blob(blob_table_txs_prunable, id, *tx_blob, true))
+        throw0(DB_ERROR("Error attempting to retrieve transaction data from cold storage"));
+      prunable_positioned = false;
+      return;
+    }
+    int result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &v, prunable_positioned ? op : MDB_SET);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve transaction data from the db: ", result).c_str()));
+    if (tx_blob)
+      decode_blob(blob_table_txs_prunable, v, *tx_blob, true);
+    prunable_positioned = true;
+  };
+
   for (uint64_t h = start_height; h < blockchain_height && blocks.size() < max_block_count && (size < max_size || blocks.size() < min_block_count); ++h)
   {
     MDB_cursor_op op = h == start_height ? MDB_SET : MDB_NEXT;
-    int result = mdb_cursor_get(m_cur_blocks, &key, &v, op);
-    if (result == MDB_NOTFOUND)
-      throw0(BLOCK_DNE(std::string("Attempt to get block from height ").append(boost::lexical_cast<std::string>(h)).append(" failed -- block not in db").c_str()));
-    else if (result)
-      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve a block from the db", result).c_str()));
+    int result;
 
     blocks.resize(blocks.size() + 1);
     auto &current_block = blocks.back();
 
-    current_block.first.first.assign(reinterpret_cast<char*>(v.mv_data), v.mv_size);
-    size += v.mv_size;
+    if (is_cold(blob_table_blocks, h))
+    {
+      if (!get_cold_blob(blob_table_blocks, h, current_block.first.first))
+        throw0(BLOCK_DNE(std::string("Attempt to get block from height ").append(boost::lexical_cast<std::string>(h)).append(" failed -- block not in cold storage").c_str()));
+      blocks_positioned = false;
+    }
+    else
+    {
+      MDB_val_set(key, h);
+      result = mdb_cursor_get(m_cur_blocks, &key, &v, blocks_positioned ? op : MDB_SET);
+      if (result == MDB_NOTFOUND)
+        throw0(BLOCK_DNE(std::string("Attempt to get block from height ").append(boost::lexical_cast<std::string>(h)).append(" failed -- block not in db").c_str()));
+      else if (result)
+        throw0(DB_ERROR(lmdb_error("Error attempting to retrieve a block from the db", result).c_str()));
+      decode_blob(blob_table_blocks, v, current_block.first.first);
+      blocks_positioned = true;
+    }
+    size += current_block.first.first.size();
 
     cryptonote::block b;
     if (!parse_and_validate_block_from_blob(current_block.first.first, b))
@@ -3270,11 +5297,7 @@ bool BlockchainLMDB::get_blocks_from(uint64_t start_height, size_t min_block_cou
       if (result)
         throw0(DB_ERROR(lmdb_error("Error attempting to retrieve transaction data from the db: ", result).c_str()));
       if (!pruned)
-      {
-        result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &v, op);
-        if (result)
-          throw0(DB_ERROR(lmdb_error("Error attempting to retrieve transaction data from the db: ", result).c_str()));
-      }
+        get_prunable(op, NULL);
     }
 
     op = MDB_NEXT;
@@ -3288,15 +5311,10 @@ bool BlockchainLMDB::get_blocks_from(uint64_t start_height, size_t min_block_cou
       result = mdb_cursor_get(m_cur_txs_pruned, &val_tx_id, &v, op);
       if (result)
         throw0(DB_ERROR(lmdb_error("Error attempting to retrieve transaction data from the db: ", result).c_str()));
-      tx_blob.assign((const char*)v.mv_data, v.mv_size);
+      decode_blob(blob_table_txs_pruned, v, tx_blob);
 
       if (!pruned)
-      {
-        result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &v, op);
-        if (result)
-          throw0(DB_ERROR(lmdb_error("Error attempting to retrieve transaction data from the db: ", result).c_str()));
-        tx_blob.append(reinterpret_cast<const char*>(v.mv_data), v.mv_size);
-      }
+        get_prunable(op, &tx_blob);
       current_block.second.push_back(std::make_pair(tx_hash, std::move(tx_blob)));
       size += current_block.second.back().second.size();
     }
@@ -3325,6 +5343,8 @@ bool BlockchainLMDB::get_prunable_tx_blob(const crypto::hash& h, cryptonote::blo
   if (get_result == 0)
   {
     const txindex *tip = (const txindex *)v.mv_data;
+    if (is_cold(blob_table_txs_prunable, tip->data.tx_id))
+      return get_cold_blob(blob_table_txs_prunable, tip->data.tx_id, bd);
     MDB_val_set(val_tx_id, tip->data.tx_id);
     get_result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &result, MDB_SET);
   }
@@ -3333,7 +5353,7 @@ bool BlockchainLMDB::get_prunable_tx_blob(const crypto::hash& h, cryptonote::blo
   else if (get_result)
     throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx from hash", get_result).c_str()));
 
-  bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
+  decode_blob(blob_table_txs_prunable, result, bd);
 
   TXN_POSTFIX_RDONLY();
 
@@ -3568,6 +5588,10 @@ bool BlockchainLMDB::has_key_image(const crypto::key_image& img) const
 
   bool ret;
 
+  const std::shared_ptr<tools::bloom_filter<crypto::key_image>> filter = std::atomic_load(&m_spent_keys_filter);
+  if (filter && !filter->has(img))
+    return false;
+
   TXN_PREFIX_RDONLY();
   RCURSOR(spent_keys);
 
@@ -3623,16 +5647,43 @@ bool BlockchainLMDB::for_blocks_range(const uint64_t& h1, const uint64_t& h2, st
   MDB_val v;
   bool fret = true;
 
+  // returns whether to go on to the next block
+  auto visit = [&](uint64_t height, const blobdata_ref &bd) {
+    block b;
+    if (!parse_and_validate_block_from_blob(bd, b))
+      throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+    crypto::hash hash;
+    if (!get_block_hash(b, hash))
+        throw0(DB_ERROR("Failed to get block hash from blob retrieved from the db"));
+    if (!f(height, hash, b)) {
+      fret = false;
+      return false;
+    }
+    return height < h2;
+  };
+
+  // blocks moved to cold storage come first
+  uint64_t start = h1;
+  bool more = true;
+  while (more && is_cold(blob_table_blocks, start))
+  {
+    blobdata bd;
+    if (!get_cold_blob(blob_table_blocks, start, bd))
+      throw0(DB_ERROR("Failed to enumerate blocks in cold storage"));
+    more = visit(start, bd);
+    ++start;
+  }
+
   MDB_cursor_op op;
-  if (h1)
+  if (start)
   {
-    k = MDB_val{sizeof(h1), (void*)&h1};
+    k = MDB_val{sizeof(start), (void*)&start};
     op = MDB_SET;
   } else
   {
     op = MDB_FIRST;
   }
-  while (1)
+  while (more)
   {
     int ret = mdb_cursor_get(m_cur_blocks, &k, &v, op);
     op = MDB_NEXT;
@@ -3641,19 +5692,9 @@ bool BlockchainLMDB::for_blocks_range(const uint64_t& h1, const uint64_t& h2, st
     if (ret)
       throw0(DB_ERROR("Failed to enumerate blocks"));
     uint64_t height = *(const uint64_t*)k.mv_data;
-    blobdata_ref bd{reinterpret_cast<char*>(v.mv_data), v.mv_size};
-    block b;
-    if (!parse_and_validate_block_from_blob(bd, b))
-      throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
-    crypto::hash hash;
-    if (!get_block_hash(b, hash))
-        throw0(DB_ERROR("Failed to get block hash from blob retrieved from the db"));
-    if (!f(height, hash, b)) {
-      fret = false;
-      break;
-    }
-    if (height >= h2)
-      break;
+    blobdata buffer;
+    const blobdata_ref bd = decode_blob_ref(blob_table_blocks, v, buffer);
+    more = visit(height, bd);
   }
 
   TXN_POSTFIX_RDONLY();
@@ -3698,18 +5739,27 @@ bool BlockchainLMDB::for_all_transactions(std::function<bool(const crypto::hash&
     transaction tx;
     if (pruned)
     {
-      blobdata_ref bd{reinterpret_cast<char*>(v.mv_data), v.mv_size};
+      blobdata buffer;
+      const blobdata_ref bd = decode_blob_ref(blob_table_txs_pruned, v, buffer);
       if (!parse_and_validate_tx_base_from_blob(bd, tx))
         throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
     }
     else
     {
       blobdata bd;
-      bd.assign(reinterpret_cast<char*>(v.mv_data), v.mv_size);
-      ret = mdb_cursor_get(m_cur_txs_prunable, &k, &v, MDB_SET);
-      if (ret)
-        throw0(DB_ERROR(lmdb_error("Failed to get prunable tx data the db: ", ret).c_str()));
-      bd.append(reinterpret_cast<char*>(v.mv_data), v.mv_size);
+      decode_blob(blob_table_txs_pruned, v, bd);
+      if (is_cold(blob_table_txs_prunable, ti->data.tx_id))
+      {
+        if (!get_cold_blob(blob_table_txs_prunable, ti->data.tx_id, bd, true))
+          throw0(DB_ERROR("Failed to get prunable tx data from cold storage"));
+      }
+      else
+      {
+        ret = mdb_cursor_get(m_cur_txs_prunable, &k, &v, MDB_SET);
+        if (ret)
+          throw0(DB_ERROR(lmdb_error("Failed to get prunable tx data the db: ", ret).c_str()));
+        decode_blob(blob_table_txs_prunable, v, bd, true);
+      }
       if (!parse_and_validate_tx_from_blob(bd, tx))
         throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
     }
@@ -3833,11 +5883,7 @@ bool BlockchainLMDB::batch_start(uint64_t batch_num_blocks, uint64_t batch_bytes
   m_batch_active = true;
   memset(&m_wcursors, 0, sizeof(m_wcursors));
   if (m_tinfo.get())
-  {
-    if (m_tinfo->m_ti_rflags.m_rf_txn)
-      mdb_txn_reset(m_tinfo->m_ti_rtxn);
-    memset(&m_tinfo->m_ti_rflags, 0, sizeof(m_tinfo->m_ti_rflags));
-  }
+    m_tinfo->reset();
 
   LOG_PRINT_L3("batch transaction: begin");
   return true;
@@ -3858,10 +5904,20 @@ void BlockchainLMDB::batch_commit()
   check_open();
 
   LOG_PRINT_L3("batch transaction: committing...");
+  if (m_txpool_cache->due())
+    write_txpool_cache();
+  boost::unique_lock<boost::shared_mutex> txpool_cache_lock(m_txpool_cache->mutex, boost::defer_lock);
+  if (m_txpool_cache->dirty())
+    txpool_cache_lock.lock();
   TIME_MEASURE_START(time1);
+  const uint64_t txnid = mdb_txn_id(*m_write_txn);
   m_write_txn->commit();
   TIME_MEASURE_FINISH(time1);
   time_commit1 += time1;
+  m_block_info_cache->commit();
+  m_txpool_cache->commit(txnid, m_env);
+  if (txpool_cache_lock.owns_lock())
+    txpool_cache_lock.unlock();
   LOG_PRINT_L3("batch transaction: committed");
 
   m_write_txn = nullptr;
@@ -3896,13 +5952,23 @@ void BlockchainLMDB::batch_stop()
   TIME_MEASURE_START(time1);
   try
   {
+    if (m_txpool_cache->due())
+      write_txpool_cache();
+    boost::unique_lock<boost::shared_mutex> txpool_cache_lock(m_txpool_cache->mutex, boost::defer_lock);
+    if (m_txpool_cache->dirty())
+      txpool_cache_lock.lock();
+    const uint64_t txnid = mdb_txn_id(*m_write_txn);
     m_write_txn->commit();
     TIME_MEASURE_FINISH(time1);
     time_commit1 += time1;
+    m_block_info_cache->commit();
+    m_txpool_cache->commit(txnid, m_env);
     cleanup_batch();
   }
   catch (const std::exception &e)
   {
+    m_block_info_cache->abort();
+    m_txpool_cache->abort();
     cleanup_batch();
     throw;
   }
@@ -3929,6 +5995,8 @@ void BlockchainLMDB::batch_abort()
   m_write_batch_txn = nullptr;
   m_batch_active = false;
   memset(&m_wcursors, 0, sizeof(m_wcursors));
+  m_block_info_cache->abort();
+  m_txpool_cache->abort();
   LOG_PRINT_L3("batch transaction: aborted");
 }
 
@@ -3958,7 +6026,7 @@ bool BlockchainLMDB::block_rtxn_start(MDB_txn **mtxn, mdb_txn_cursors **mcur) co
    */
   if (!(tinfo = m_tinfo.get()) || mdb_txn_env(tinfo->m_ti_rtxn) != m_env)
   {
-    tinfo = new mdb_threadinfo;
+    tinfo = new mdb_threadinfo(m_tinfo_registry);
     m_tinfo.reset(tinfo);
     memset(&tinfo->m_ti_rcursors, 0, sizeof(tinfo->m_ti_rcursors));
     memset(&tinfo->m_ti_rflags, 0, sizeof(tinfo->m_ti_rflags));
@@ -3984,8 +6052,7 @@ bool BlockchainLMDB::block_rtxn_start(MDB_txn **mtxn, mdb_txn_cursors **mcur) co
 void BlockchainLMDB::block_rtxn_stop() const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
-  mdb_txn_reset(m_tinfo->m_ti_rtxn);
-  memset(&m_tinfo->m_ti_rflags, 0, sizeof(m_tinfo->m_ti_rflags));
+  m_tinfo->reset();
   /* cancel out the increment from rtxn_start */
   mdb_txn_safe::increment_txns(-1);
 }
@@ -4026,11 +6093,7 @@ void BlockchainLMDB::block_wtxn_start()
     }
     memset(&m_wcursors, 0, sizeof(m_wcursors));
     if (m_tinfo.get())
-    {
-      if (m_tinfo->m_ti_rflags.m_rf_txn)
-        mdb_txn_reset(m_tinfo->m_ti_rtxn);
-      memset(&m_tinfo->m_ti_rflags, 0, sizeof(m_tinfo->m_ti_rflags));
-    }
+      m_tinfo->reset();
   } else if (m_writer != boost::this_thread::get_id())
     throw0(DB_ERROR_TXN_START((std::string("Attempted to start new write txn when batch txn already exists in ")+__FUNCTION__).c_str()));
 }
@@ -4045,10 +6108,20 @@ void BlockchainLMDB::block_wtxn_stop()
   {
     if (! m_batch_active)
 	{
+      if (m_txpool_cache->due())
+        write_txpool_cache();
+      boost::unique_lock<boost::shared_mutex> txpool_cache_lock(m_txpool_cache->mutex, boost::defer_lock);
+      if (m_txpool_cache->dirty())
+        txpool_cache_lock.lock();
       TIME_MEASURE_START(time1);
+      const uint64_t txnid = mdb_txn_id(*m_write_txn);
       m_write_txn->commit();
       TIME_MEASURE_FINISH(time1);
       time_commit1 += time1;
+      m_block_info_cache->commit();
+      m_txpool_cache->commit(txnid, m_env);
+      if (txpool_cache_lock.owns_lock())
+        txpool_cache_lock.unlock();
 
       delete m_write_txn;
       m_write_txn = nullptr;
@@ -4070,14 +6143,15 @@ void BlockchainLMDB::block_wtxn_abort()
     delete m_write_txn;
     m_write_txn = nullptr;
     memset(&m_wcursors, 0, sizeof(m_wcursors));
+    m_block_info_cache->abort();
+    m_txpool_cache->abort();
   }
 }
 
 void BlockchainLMDB::block_rtxn_abort() const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
-  mdb_txn_reset(m_tinfo->m_ti_rtxn);
-  memset(&m_tinfo->m_ti_rflags, 0, sizeof(m_tinfo->m_ti_rflags));
+  m_tinfo->reset();
 }
 
 uint64_t BlockchainLMDB::add_block(const std::pair<block, blobdata>& blk, size_t block_weight, uint64_t long_term_block_weight, const difficulty_type& cumulative_difficulty, const uint64_t& coins_generated,
@@ -4211,6 +6285,91 @@ void BlockchainLMDB::get_output_key(const epee::span<const uint64_t> &amounts, c
   LOG_PRINT_L3("db3: " << db3);
 }
 
+void BlockchainLMDB::get_output_keys(const epee::span<const std::pair<uint64_t, uint64_t>> &amount_indices, std::vector<output_data_t> &outputs, std::vector<bool> &found) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  TIME_MEASURE_START(db3);
+  check_open();
+  outputs.clear();
+  outputs.resize(amount_indices.size());
+  found.clear();
+  found.resize(amount_indices.size(), false);
+
+  // visit the requests in key order, so duplicates are next to each other
+  // and the cursor only ever moves forward
+  std::vector<size_t> order(amount_indices.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&amount_indices](size_t a, size_t b) { return amount_indices[a] < amount_indices[b]; });
+
+  TXN_PREFIX_RDONLY();
+
+  RCURSOR(output_amounts);
+
+  bool positioned = false;
+  uint64_t cur_amount = 0, cur_index = 0;
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    const size_t idx = order[i];
+    const uint64_t amount = amount_indices[idx].first;
+    const uint64_t index = amount_indices[idx].second;
+    if (i > 0 && amount_indices[order[i - 1]] == amount_indices[idx])
+    {
+      outputs[idx] = outputs[order[i - 1]];
+      found[idx] = found[order[i - 1]];
+      continue;
+    }
+
+    MDB_val k, v;
+    int get_result = 0;
+    if (positioned && amount == cur_amount && index > cur_index && index - cur_index <= OUTPUT_KEYS_MAX_STEPS)
+    {
+      // amount indices are dense, so a nearby output is only a few steps
+      // along from the current one, which is cheaper than a fresh lookup
+      while (!get_result && cur_index < index)
+      {
+        get_result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_NEXT_DUP);
+        if (!get_result)
+          cur_index = *(const uint64_t*)v.mv_data;
+      }
+      if (!get_result && cur_index != index)
+        get_result = MDB_NOTFOUND;
+    }
+    else
+    {
+      k = {sizeof(amount), (void *)&amount};
+      v = {sizeof(index), (void *)&index};
+      get_result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_GET_BOTH);
+      cur_amount = amount;
+      cur_index = index;
+    }
+    positioned = !get_result;
+    if (get_result == MDB_NOTFOUND)
+      continue;
+    else if (get_result)
+      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an output pubkey from the db", get_result).c_str()));
+
+    output_data_t &data = outputs[idx];
+    if (amount == 0)
+    {
+      const outkey *okp = (const outkey *)v.mv_data;
+      data = okp->data;
+    }
+    else
+    {
+      const pre_rct_outkey *okp = (const pre_rct_outkey *)v.mv_data;
+      memcpy(&data, &okp->data, sizeof(pre_rct_output_data_t));
+      data.commitment = rct::zeroCommit(amount);
+    }
+    found[idx] = true;
+  }
+
+  TXN_POSTFIX_RDONLY();
+
+  TIME_MEASURE_FINISH(db3);
+  LOG_PRINT_L3("db3: " << db3);
+}
+
 void BlockchainLMDB::get_output_tx_and_index(const uint64_t& amount, const std::vector<uint64_t> &offsets, std::vector<tx_out_index> &indices) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -4346,40 +6505,64 @@ bool BlockchainLMDB::get_output_distribution(uint64_t amount, uint64_t from_heig
   check_open();
 
   TXN_PREFIX_RDONLY();
-  RCURSOR(output_amounts);
+  RCURSOR(output_distribution);
 
   distribution.clear();
   const uint64_t db_height = height();
   if (from_height >= db_height)
     return false;
-  distribution.resize(db_height - from_height, 0);
+  const uint64_t end_height = to_height > 0 ? std::min(to_height + 1, db_height) : db_height;
+  if (end_height <= from_height)
+    return false;
+  distribution.reserve(end_height - from_height);
 
+  // the record before the first one from from_height counts the outputs
+  // below it, and the records from there only need filling in between
   MDB_val_set(k, amount);
-  MDB_val v;
-  MDB_cursor_op op = MDB_SET;
-  base = 0;
-  while (1)
+  outdist from = {from_height, 0};
+  MDB_val v = {sizeof(from), (void *)&from};
+  uint64_t num_outputs = 0;
+  int result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_GET_BOTH_RANGE);
+  if (result == MDB_NOTFOUND)
   {
-    int ret = mdb_cursor_get(m_cur_output_amounts, &k, &v, op);
-    op = MDB_NEXT_DUP;
-    if (ret == MDB_NOTFOUND)
-      break;
-    if (ret)
-      throw0(DB_ERROR("Failed to enumerate outputs"));
-    const outkey *ok = (const outkey *)v.mv_data;
-    const uint64_t height = ok->data.height;
-    if (height >= from_height)
-      distribution[height - from_height]++;
-    else
-      base++;
-    if (to_height > 0 && height > to_height)
+    // no outputs of that amount from from_height
+    result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_SET);
+    if (!result)
+      result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_LAST_DUP);
+    if (!result)
+      num_outputs = ((const outdist *)v.mv_data)->num_outputs;
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to get output distribution: ", result).c_str()));
+    result = MDB_NOTFOUND;
+  }
+  else if (!result)
+  {
+    MDB_val pv;
+    result = mdb_cursor_get(m_cur_output_distribution, &k, &pv, MDB_PREV_DUP);
+    if (!result)
+    {
+      num_outputs = ((const outdist *)pv.mv_data)->num_outputs;
+      result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_NEXT_DUP);
+    }
+    else if (result == MDB_NOTFOUND)
+    {
+      v = {sizeof(from), (void *)&from};
+      result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_GET_BOTH_RANGE);
+    }
+  }
+  base = num_outputs;
+  while (!result)
+  {
+    const outdist *od = (const outdist *)v.mv_data;
+    if (od->height >= end_height)
       break;
+    distribution.resize(od->height - from_height, num_outputs);
+    num_outputs = od->num_outputs;
+    result = mdb_cursor_get(m_cur_output_distribution, &k, &v, MDB_NEXT_DUP);
   }
-
-  distribution[0] += base;
-  for (size_t n = 1; n < distribution.size(); ++n)
-    distribution[n] += distribution[n - 1];
-  base = 0;
+  if (result && result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to enumerate output distribution: ", result).c_str()));
+  distribution.resize(end_height - from_height, num_outputs);
 
   TXN_POSTFIX_RDONLY();
 
@@ -4467,108 +6650,665 @@ void BlockchainLMDB::add_alt_block(const crypto::hash &blkid, const cryptonote::
   }
 }
 
-bool BlockchainLMDB::get_alt_block(const crypto::hash &blkid, alt_block_data_t *data, cryptonote::blobdata *blob)
+bool BlockchainLMDB::get_alt_block(const crypto::hash &blkid, alt_block_data_t *data, cryptonote::blobdata *blob)
+{
+  LOG_PRINT_L3("BlockchainLMDB:: " << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(alt_blocks);
+
+  MDB_val_set(k, blkid);
+  MDB_val v;
+  int result = mdb_cursor_get(m_cur_alt_blocks, &k, &v, MDB_SET);
+  if (result == MDB_NOTFOUND)
+    return false;
+
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Error attempting to retrieve alternate block " + epee::string_tools::pod_to_hex(blkid) + " from the db: ", result).c_str()));
+  if (v.mv_size < sizeof(alt_block_data_t))
+    throw0(DB_ERROR("Record size is less than expected"));
+
+  const alt_block_data_t *ptr = (const alt_block_data_t*)v.mv_data;
+  if (data)
+    *data = *ptr;
+  if (blob)
+    blob->assign((const char*)(ptr + 1), v.mv_size - sizeof(alt_block_data_t));
+
+  TXN_POSTFIX_RDONLY();
+  return true;
+}
+
+void BlockchainLMDB::remove_alt_block(const crypto::hash &blkid)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  mdb_txn_cursors *m_cursors = &m_wcursors;
+
+  CURSOR(alt_blocks)
+
+  MDB_val k = {sizeof(blkid), (void *)&blkid};
+  MDB_val v;
+  int result = mdb_cursor_get(m_cur_alt_blocks, &k, &v, MDB_SET);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Error locating alternate block " + epee::string_tools::pod_to_hex(blkid) + " in the db: ", result).c_str()));
+  result = mdb_cursor_del(m_cur_alt_blocks, 0);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Error deleting alternate block " + epee::string_tools::pod_to_hex(blkid) + " from the db: ", result).c_str()));
+}
+
+uint64_t BlockchainLMDB::get_alt_block_count()
+{
+  LOG_PRINT_L3("BlockchainLMDB:: " << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(alt_blocks);
+
+  MDB_stat db_stats;
+  int result = mdb_stat(m_txn, m_alt_blocks, &db_stats);
+  uint64_t count = 0;
+  if (result != MDB_NOTFOUND)
+  {
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to query m_alt_blocks: ", result).c_str()));
+    count = db_stats.ms_entries;
+  }
+  TXN_POSTFIX_RDONLY();
+  return count;
+}
+
+void BlockchainLMDB::drop_alt_blocks()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX(0);
+
+  auto result = mdb_drop(*txn_ptr, m_alt_blocks, 0);
+  if (result)
+    throw1(DB_ERROR(lmdb_error("Error dropping alternative blocks: ", result).c_str()));
+
+  TXN_POSTFIX_SUCCESS();
+}
+
+void BlockchainLMDB::set_rct_ver_cache(const std::vector<crypto::hash> &entries)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX(0);
+
+  auto result = mdb_drop(*txn_ptr, m_rct_ver_cache, 0);
+  if (result)
+    throw1(DB_ERROR(lmdb_error("Error dropping RingCT verification cache: ", result).c_str()));
+
+  for (uint64_t i = 0; i < entries.size(); ++i)
+  {
+    MDB_val_set(k, i);
+    MDB_val v = {sizeof(entries[i]), (void *)&entries[i]};
+    result = mdb_put(*txn_ptr, m_rct_ver_cache, &k, &v, MDB_APPEND);
+    if (result)
+      throw1(DB_ERROR(lmdb_error("Error adding RingCT verification cache entry to db transaction: ", result).c_str()));
+  }
+
+  TXN_POSTFIX_SUCCESS();
+}
+
+std::vector<crypto::hash> BlockchainLMDB::get_rct_ver_cache() const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  std::vector<crypto::hash> entries;
+  if (is_read_only())
+    return entries;
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(rct_ver_cache);
+
+  MDB_val k, v;
+  MDB_cursor_op op = MDB_FIRST;
+  while (1)
+  {
+    int ret = mdb_cursor_get(m_cur_rct_ver_cache, &k, &v, op);
+    op = MDB_NEXT;
+    if (ret == MDB_NOTFOUND)
+      break;
+    if (ret)
+      throw0(DB_ERROR(lmdb_error("Failed to enumerate RingCT verification cache: ", ret).c_str()));
+    if (v.mv_size != sizeof(crypto::hash))
+      throw0(DB_ERROR("Unexpected RingCT verification cache entry size"));
+    entries.push_back(*(const crypto::hash*)v.mv_data);
+  }
+
+  TXN_POSTFIX_RDONLY();
+  return entries;
+}
+
+void BlockchainLMDB::add_block_pow(uint64_t height, const crypto::hash &blk_hash, const crypto::hash &pow)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  mdb_txn_cursors *m_cursors = &m_wcursors;
+
+  CURSOR(block_pow)
+
+  MDB_val_set(k, height);
+  blk_pow bp = {blk_hash, pow};
+  MDB_val_set(v, bp);
+  int result = mdb_cursor_put(m_cur_block_pow, &k, &v, MDB_NODUPDATA);
+  if (result && result != MDB_KEYEXIST)
+    throw1(DB_ERROR(lmdb_error("Error adding block PoW hash to db transaction: ", result).c_str()));
+}
+
+bool BlockchainLMDB::get_block_pow(uint64_t height, const crypto::hash &blk_hash, crypto::hash &pow) const
 {
-  LOG_PRINT_L3("BlockchainLMDB:: " << __func__);
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  if (is_read_only())
+    return false;
+
   TXN_PREFIX_RDONLY();
-  RCURSOR(alt_blocks);
+  RCURSOR(block_pow);
 
-  MDB_val_set(k, blkid);
-  MDB_val v;
-  int result = mdb_cursor_get(m_cur_alt_blocks, &k, &v, MDB_SET);
+  MDB_val_set(k, height);
+  blk_pow bp = {blk_hash, crypto::null_hash};
+  MDB_val_set(v, bp);
+  int result = mdb_cursor_get(m_cur_block_pow, &k, &v, MDB_GET_BOTH);
   if (result == MDB_NOTFOUND)
     return false;
-
   if (result)
-    throw0(DB_ERROR(lmdb_error("Error attempting to retrieve alternate block " + epee::string_tools::pod_to_hex(blkid) + " from the db: ", result).c_str()));
-  if (v.mv_size < sizeof(alt_block_data_t))
-    throw0(DB_ERROR("Record size is less than expected"));
-
-  const alt_block_data_t *ptr = (const alt_block_data_t*)v.mv_data;
-  if (data)
-    *data = *ptr;
-  if (blob)
-    blob->assign((const char*)(ptr + 1), v.mv_size - sizeof(alt_block_data_t));
+    throw0(DB_ERROR(lmdb_error("Error attempting to retrieve block PoW hash from the db: ", result).c_str()));
+  if (v.mv_size != sizeof(blk_pow))
+    throw0(DB_ERROR("Unexpected block PoW record size"));
+  pow = ((const blk_pow*)v.mv_data)->bp_pow;
 
   TXN_POSTFIX_RDONLY();
   return true;
 }
 
-void BlockchainLMDB::remove_alt_block(const crypto::hash &blkid)
+uint64_t BlockchainLMDB::trim_block_pow(uint64_t max_entries)
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
   mdb_txn_cursors *m_cursors = &m_wcursors;
 
-  CURSOR(alt_blocks)
+  CURSOR(block_pow)
 
-  MDB_val k = {sizeof(blkid), (void *)&blkid};
-  MDB_val v;
-  int result = mdb_cursor_get(m_cur_alt_blocks, &k, &v, MDB_SET);
+  MDB_stat db_stats;
+  int result = mdb_stat(*m_write_txn, m_block_pow, &db_stats);
   if (result)
-    throw0(DB_ERROR(lmdb_error("Error locating alternate block " + epee::string_tools::pod_to_hex(blkid) + " in the db: ", result).c_str()));
-  result = mdb_cursor_del(m_cur_alt_blocks, 0);
+    throw0(DB_ERROR(lmdb_error("Failed to query m_block_pow: ", result).c_str()));
+
+  uint64_t removed = 0;
+  MDB_val k, v;
+  while (db_stats.ms_entries - removed > max_entries)
+  {
+    result = mdb_cursor_get(m_cur_block_pow, &k, &v, MDB_FIRST);
+    if (result == MDB_NOTFOUND)
+      break;
+    if (result)
+      throw1(DB_ERROR(lmdb_error("Failed to enumerate block PoW hashes: ", result).c_str()));
+    result = mdb_cursor_del(m_cur_block_pow, 0);
+    if (result)
+      throw1(DB_ERROR(lmdb_error("Failed to remove block PoW hash: ", result).c_str()));
+    ++removed;
+  }
+  return removed;
+}
+
+bool BlockchainLMDB::is_read_only() const
+{
+  unsigned int flags;
+  auto result = mdb_env_get_flags(m_env, &flags);
   if (result)
-    throw0(DB_ERROR(lmdb_error("Error deleting alternate block " + epee::string_tools::pod_to_hex(blkid) + " from the db: ", result).c_str()));
+    throw0(DB_ERROR(lmdb_error("Error getting database environment info: ", result).c_str()));
+
+  if (flags & MDB_RDONLY)
+    return true;
+
+  return false;
 }
 
-uint64_t BlockchainLMDB::get_alt_block_count()
+uint64_t BlockchainLMDB::get_database_size() const
 {
-  LOG_PRINT_L3("BlockchainLMDB:: " << __func__);
+  boost::filesystem::path datafile(m_folder);
+  datafile /= CRYPTONOTE_BLOCKCHAINDATA_FILENAME;
+  boost::system::error_code ec{};
+  const boost::uintmax_t size = boost::filesystem::file_size(datafile, ec);
+  return (ec ? 0 : static_cast<uint64_t>(size));
+}
+
+void BlockchainLMDB::get_db_stats(db_stats &stats) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  // tables which are not opened when the database is read-only
+  static const struct { const char *name; MDB_dbi BlockchainLMDB::*dbi; bool writable_only; } tables[] = {
+    { LMDB_BLOCKS, &BlockchainLMDB::m_blocks, false },
+    { LMDB_BLOCK_INFO, &BlockchainLMDB::m_block_info, false },
+    { LMDB_BLOCK_HEIGHTS, &BlockchainLMDB::m_block_heights, false },
+    { LMDB_TXS, &BlockchainLMDB::m_txs, false },
+    { LMDB_TXS_PRUNED, &BlockchainLMDB::m_txs_pruned, false },
+    { LMDB_TXS_PRUNABLE, &BlockchainLMDB::m_txs_prunable, false },
+    { LMDB_TXS_PRUNABLE_HASH, &BlockchainLMDB::m_txs_prunable_hash, false },
+    { LMDB_TXS_PRUNABLE_TIP, &BlockchainLMDB::m_txs_prunable_tip, true },
+    { LMDB_TX_INDICES, &BlockchainLMDB::m_tx_indices, false },
+    { LMDB_TX_OUTPUTS, &BlockchainLMDB::m_tx_outputs, false },
+    { LMDB_OUTPUT_TXS, &BlockchainLMDB::m_output_txs, false },
+    { LMDB_OUTPUT_AMOUNTS, &BlockchainLMDB::m_output_amounts, false },
+    { LMDB_OUTPUT_DISTRIBUTION, &BlockchainLMDB::m_output_distribution, true },
+    { LMDB_SPENT_KEYS, &BlockchainLMDB::m_spent_keys, false },
+    { LMDB_TXPOOL_META, &BlockchainLMDB::m_txpool_meta, false },
+    { LMDB_TXPOOL_BLOB, &BlockchainLMDB::m_txpool_blob, false },
+    { LMDB_ALT_BLOCKS, &BlockchainLMDB::m_alt_blocks, false },
+    { LMDB_HF_VERSIONS, &BlockchainLMDB::m_hf_versions, false },
+    { LMDB_PROPERTIES, &BlockchainLMDB::m_properties, false },
+    { LMDB_RCT_VER_CACHE, &BlockchainLMDB::m_rct_ver_cache, true },
+    { LMDB_BLOCK_POW, &BlockchainLMDB::m_block_pow, true },
+  };
+
   TXN_PREFIX_RDONLY();
-  RCURSOR(alt_blocks);
 
-  MDB_stat db_stats;
-  int result = mdb_stat(m_txn, m_alt_blocks, &db_stats);
-  uint64_t count = 0;
+  MDB_envinfo mei;
+  MDB_stat mst;
+  mdb_env_info(m_env, &mei);
+  mdb_env_stat(m_env, &mst);
+  stats.page_size = mst.ms_psize;
+  stats.map_size = mei.me_mapsize;
+  stats.file_size = get_database_size();
+  stats.used_pages = mei.me_last_pgno + 1;
+  stats.readers = mei.me_numreaders;
+  stats.max_readers = mei.me_maxreaders;
+
+  // each record of the free list table holds a list of page numbers,
+  // preceded by their count
+  MDB_cursor *cur;
+  int result = mdb_cursor_open(m_txn, 0, &cur);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to open cursor: ", result).c_str()));
+  stats.free_pages = 0;
+  MDB_val k, v;
+  while (!(result = mdb_cursor_get(cur, &k, &v, MDB_NEXT)))
+    stats.free_pages += *(const mdb_size_t*)v.mv_data;
+  mdb_cursor_close(cur);
   if (result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to enumerate the free list: ", result).c_str()));
+
+  const bool read_only = m_env_flags & MDB_RDONLY;
+  stats.tables.clear();
+  for (const auto &table: tables)
   {
-    if (result)
-      throw0(DB_ERROR(lmdb_error("Failed to query m_alt_blocks: ", result).c_str()));
-    count = db_stats.ms_entries;
+    if (table.writable_only && read_only)
+      continue;
+    if ((result = mdb_stat(m_txn, this->*table.dbi, &mst)))
+      throw0(DB_ERROR(lmdb_error(std::string("Failed to query ") + table.name + ": ", result).c_str()));
+    stats.tables.push_back({table.name, mst.ms_entries, mst.ms_depth, mst.ms_branch_pages, mst.ms_leaf_pages, mst.ms_overflow_pages});
   }
+
   TXN_POSTFIX_RDONLY();
-  return count;
 }
 
-void BlockchainLMDB::drop_alt_blocks()
+bool BlockchainLMDB::start_compaction()
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
+  if ((m_env_flags & MDB_RDONLY) || m_batch_active)
+    return false;
 
-  TXN_PREFIX(0);
+  boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+  db_compaction_status &status = m_compaction->status;
+  if (status.state == db_compaction_status::copying || status.state == db_compaction_status::ready)
+    return false;
+  // the last one is over, its thread ends without the lock
+  if (m_compaction->thread.joinable())
+    m_compaction->thread.join();
 
-  auto result = mdb_drop(*txn_ptr, m_alt_blocks, 0);
-  if (result)
-    throw1(DB_ERROR(lmdb_error("Error dropping alternative blocks: ", result).c_str()));
+  status = db_compaction_status();
+  status.size_before = get_database_size();
 
-  TXN_POSTFIX_SUCCESS();
+  MDB_envinfo mei;
+  MDB_stat mst;
+  mdb_env_info(m_env, &mei);
+  mdb_env_stat(m_env, &mst);
+  const uint64_t size_used = (uint64_t)mst.ms_psize * mei.me_last_pgno;
+
+  boost::system::error_code ec;
+  const boost::filesystem::space_info si = boost::filesystem::space(m_folder, ec);
+  if (!ec && si.available < size_used)
+  {
+    status.state = db_compaction_status::failed;
+    status.error = "Not enough disk space for the compacted copy";
+    return false;
+  }
+
+  // resizes are put off until the compaction is over, so leave room for
+  // what gets written meanwhile, when pages freed after the copy started
+  // aren't reused
+  const uint64_t room = size_used + COMPACTION_MAP_ROOM;
+  const uint64_t mapsize_needed = (uint64_t)(room / RESIZE_PERCENT);
+  if (mapsize_needed > mei.me_mapsize)
+  {
+    if (m_write_txn)
+    {
+      status.state = db_compaction_status::failed;
+      status.error = "The database needs resizing first, which can't be done in a write transaction";
+      return false;
+    }
+    lock.unlock();
+    do_resize(mapsize_needed - mei.me_mapsize);
+    lock.lock();
+  }
+
+  // a resize cancels the compaction rather than waiting on its txns, so
+  // they don't count as active ones
+  status.state = db_compaction_status::copying;
+  m_compaction->release = false;
+  m_compaction->swapping = false;
+  m_compaction->thread = boost::thread([this](){ compaction_thread(); });
+  MGINFO("Compacting the database in the background");
+  return true;
 }
 
-bool BlockchainLMDB::is_read_only() const
+void BlockchainLMDB::compaction_thread()
 {
-  unsigned int flags;
-  auto result = mdb_env_get_flags(m_env, &flags);
+  const boost::filesystem::path dir = boost::filesystem::path(m_folder) / "compact";
+  boost::system::error_code ec;
+  bool again = true, swapped = false;
+  while (again)
+  {
+    // the snapshot finish_compaction compares the database with. While it's
+    // open, the pages of its tables can't be reused, so a table whose record
+    // is the same later on did not change.
+    MDB_txn *txn = NULL;
+    std::map<std::string, std::string> tables;
+    int result = mdb_txn_begin(m_env, NULL, MDB_RDONLY, &txn);
+    if (!result)
+      result = read_main_table(txn, tables);
+    if (!result)
+    {
+      boost::filesystem::remove_all(dir, ec);
+      boost::filesystem::create_directories(dir, ec);
+      // mdb_env_copy2 reads in a txn of its own, and a thread may only have
+      // one read txn at a time
+      boost::thread copier([&](){ result = mdb_env_copy2(m_env, dir.string().c_str(), MDB_CP_COMPACT); });
+      copier.join();
+    }
+
+    boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+    db_compaction_status &status = m_compaction->status;
+    ++status.attempts;
+    if (result)
+    {
+      status.state = db_compaction_status::failed;
+      status.error = lmdb_error("Failed to make the compacted copy: ", result);
+    }
+    else if (status.state == db_compaction_status::copying)
+    {
+      status.size_after = boost::filesystem::file_size(dir / CRYPTONOTE_BLOCKCHAINDATA_FILENAME, ec);
+      status.state = db_compaction_status::ready;
+      m_compaction->tables = std::move(tables);
+      MGINFO("Compacted copy of the database made, " << status.size_after / (1024 * 1024) << " MiB");
+
+      // if it's not swapped in for long, something may wait on the copy's
+      // txns, so give them up and copy again
+      const auto deadline = boost::chrono::steady_clock::now() + boost::chrono::seconds(COMPACTION_READY_TIMEOUT);
+      while (!m_compaction->release)
+      {
+        if (m_compaction->cond.wait_until(lock, deadline) == boost::cv_status::timeout && !m_compaction->swapping && !m_compaction->release)
+        {
+          status.state = db_compaction_status::copying;
+          if (status.attempts >= COMPACTION_MAX_ATTEMPTS)
+          {
+            status.state = db_compaction_status::failed;
+            status.error = "The compacted copy could not be swapped in";
+          }
+          break;
+        }
+      }
+      m_compaction->release = false;
+    }
+    again = status.state == db_compaction_status::copying;
+    swapped = status.state == db_compaction_status::done;
+    if (status.state == db_compaction_status::failed)
+      MERROR("Database compaction failed: " << status.error);
+    lock.unlock();
+
+    if (txn)
+      mdb_txn_abort(txn);
+  }
+  // finish_compaction moves the copy in place once this is gone
+  if (!swapped)
+    boost::filesystem::remove_all(dir, ec);
+}
+
+bool BlockchainLMDB::finish_compaction()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  {
+    boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+    if (m_compaction->status.state != db_compaction_status::ready)
+      return false;
+    m_compaction->swapping = true;
+  }
+
+  bool swapped = false;
+  if (!m_batch_active && !m_write_txn)
+  {
+    // readers may be stuck on a lock the caller holds, so don't wait long
+    mdb_txn_safe::prevent_new_txns();
+    const bool idle = mdb_txn_safe::wait_no_active_txns(COMPACTION_SWAP_TIMEOUT_MS);
+    if (idle)
+    {
+      try
+      {
+        swapped = swap_in_compacted_copy();
+      }
+      catch (const std::exception &e)
+      {
+        // either the copy was not swapped in, or the database could not be
+        // reopened and nothing will work until a restart
+        boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+        m_compaction->status.state = db_compaction_status::failed;
+        m_compaction->status.error = e.what();
+        m_compaction->release = true;
+        m_compaction->cond.notify_all();
+        lock.unlock();
+        mdb_txn_safe::allow_new_txns();
+        throw;
+      }
+    }
+    mdb_txn_safe::allow_new_txns();
+  }
+
+  boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+  m_compaction->swapping = false;
+  return swapped;
+}
+
+bool BlockchainLMDB::swap_in_compacted_copy()
+{
+  const boost::filesystem::path dir = boost::filesystem::path(m_folder) / "compact";
+
+  // tables which change without the blockchain changing. Their contents
+  // are carried over to the copy, rather than having the copy made again.
+  static const struct { const char *name; MDB_dbi BlockchainLMDB::*dbi; unsigned int flags; MDB_cmp_func *cmp; } carried_over[] = {
+    { LMDB_TXPOOL_META, &BlockchainLMDB::m_txpool_meta, 0, compare_hash32 },
+    { LMDB_TXPOOL_BLOB, &BlockchainLMDB::m_txpool_blob, 0, compare_hash32 },
+    { LMDB_ALT_BLOCKS, &BlockchainLMDB::m_alt_blocks, 0, compare_hash32 },
+    { LMDB_RCT_VER_CACHE, &BlockchainLMDB::m_rct_ver_cache, MDB_INTEGERKEY, compare_uint64 },
+  };
+
+  // no thread is in a read txn now, and they start new ones after the swap
+  m_tinfo_registry->end_all();
+
+  MDB_txn *rtxn;
+  int result = mdb_txn_begin(m_env, NULL, MDB_RDONLY, &rtxn);
   if (result)
-    throw0(DB_ERROR(lmdb_error("Error getting database environment info: ", result).c_str()));
+    throw0(DB_ERROR(lmdb_error("Failed to create a read transaction for the db: ", result).c_str()));
+  std::map<std::string, std::string> tables;
+  if ((result = read_main_table(rtxn, tables)))
+  {
+    mdb_txn_abort(rtxn);
+    throw0(DB_ERROR(lmdb_error("Failed to read the main table: ", result).c_str()));
+  }
 
-  if (flags & MDB_RDONLY)
-    return true;
+  {
+    boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+    std::map<std::string, std::string> &snapshot = m_compaction->tables;
+    for (const auto &table: carried_over)
+    {
+      tables.erase(table.name);
+      snapshot.erase(table.name);
+    }
+    if (tables != snapshot)
+    {
+      mdb_txn_abort(rtxn);
+      db_compaction_status &status = m_compaction->status;
+      if (status.attempts >= COMPACTION_MAX_ATTEMPTS)
+      {
+        status.state = db_compaction_status::failed;
+        status.error = "The blockchain kept changing while the compacted copy was made";
+      }
+      else
+      {
+        MGINFO("The blockchain changed while the compacted copy was made, making a new one");
+        status.state = db_compaction_status::copying;
+      }
+      m_compaction->release = true;
+      m_compaction->cond.notify_all();
+      return false;
+    }
+  }
 
-  return false;
+  MDB_envinfo mei;
+  mdb_env_info(m_env, &mei);
+
+  MDB_env *env = NULL;
+  MDB_txn *wtxn = NULL;
+  MDB_cursor *cur = NULL;
+  auto carry_over = [&]() -> int {
+    int result;
+    if ((result = mdb_env_create(&env)) || (result = mdb_env_set_maxdbs(env, 32)) || (result = mdb_env_set_mapsize(env, mei.me_mapsize)))
+      return result;
+    if ((result = mdb_env_open(env, dir.string().c_str(), m_env_flags, 0644)) || (result = mdb_txn_begin(env, NULL, 0, &wtxn)))
+      return result;
+    for (const auto &table: carried_over)
+    {
+      MDB_dbi dbi;
+      if ((result = mdb_dbi_open(wtxn, table.name, table.flags | MDB_CREATE, &dbi)) || (result = mdb_set_compare(wtxn, dbi, table.cmp)))
+        return result;
+      if ((result = mdb_drop(wtxn, dbi, 0)) || (result = mdb_cursor_open(rtxn, this->*table.dbi, &cur)))
+        return result;
+      MDB_val k, v;
+      while (!(result = mdb_cursor_get(cur, &k, &v, MDB_NEXT)))
+        if ((result = mdb_put(wtxn, dbi, &k, &v, MDB_APPEND)))
+          return result;
+      if (result != MDB_NOTFOUND)
+        return result;
+      mdb_cursor_close(cur);
+      cur = NULL;
+    }
+    result = mdb_txn_commit(wtxn);
+    wtxn = NULL;
+    return result ? result : mdb_env_sync(env, 1);
+  };
+  result = carry_over();
+  if (cur)
+    mdb_cursor_close(cur);
+  if (wtxn)
+    mdb_txn_abort(wtxn);
+  if (env)
+    mdb_env_close(env);
+  mdb_txn_abort(rtxn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to carry the txpool over to the compacted copy: ", result).c_str()));
+
+  {
+    boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+    m_compaction->status.state = db_compaction_status::done;
+    m_compaction->release = true;
+    m_compaction->cond.notify_all();
+  }
+  m_compaction->thread.join();
+
+  // the file is swapped while the environment is closed, so the lock file
+  // and reader table start afresh with it
+  mdb_env_close(m_env);
+  m_env = NULL;
+  boost::system::error_code ec;
+  boost::filesystem::rename(dir / CRYPTONOTE_BLOCKCHAINDATA_FILENAME, boost::filesystem::path(m_folder) / CRYPTONOTE_BLOCKCHAINDATA_FILENAME, ec);
+  const std::string rename_error = ec ? ec.message() : std::string();
+  boost::filesystem::remove_all(dir, ec);
+
+  if ((result = mdb_env_create(&m_env)) || (result = mdb_env_set_maxdbs(m_env, 32)))
+    throw0(DB_ERROR(lmdb_error("Failed to create lmdb environment: ", result).c_str()));
+  const int threads = tools::get_max_concurrency();
+  if (threads > 110 && (result = mdb_env_set_maxreaders(m_env, threads+16)))
+    throw0(DB_ERROR(lmdb_error("Failed to set max number of readers: ", result).c_str()));
+  if ((result = mdb_env_open(m_env, m_folder.c_str(), m_env_flags, 0644)))
+    throw0(DB_ERROR(lmdb_error("Failed to open lmdb environment: ", result).c_str()));
+  if ((result = mdb_env_set_mapsize(m_env, mei.me_mapsize)))
+    throw0(DB_ERROR(lmdb_error("Failed to set max memory map size: ", result).c_str()));
+
+  // handles are numbered in the order tables are opened, and the same
+  // tables are opened in the same order, but the comparison functions are
+  // set per environment
+  MDB_txn *txn;
+  if ((result = mdb_txn_begin(m_env, NULL, 0, &txn)))
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+  try
+  {
+    open_tables(txn, false);
+  }
+  catch (...)
+  {
+    mdb_txn_abort(txn);
+    throw;
+  }
+  if ((result = mdb_txn_commit(txn)))
+    throw0(DB_ERROR(lmdb_error("Failed to commit a transaction to the db: ", result).c_str()));
+
+  if (!rename_error.empty())
+  {
+    boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+    m_compaction->status.state = db_compaction_status::failed;
+    m_compaction->status.error = "Failed to move the compacted copy in place: " + rename_error;
+    MERROR("Database compaction failed: " << m_compaction->status.error);
+    return false;
+  }
+
+  const uint64_t size_before = get_compaction_status().size_before;
+  MGINFO("Database compacted from " << size_before / (1024 * 1024) << " MiB to " << get_database_size() / (1024 * 1024) << " MiB");
+  return true;
 }
 
-uint64_t BlockchainLMDB::get_database_size() const
+void BlockchainLMDB::cancel_compaction(const char *reason)
 {
-  boost::filesystem::path datafile(m_folder);
-  datafile /= CRYPTONOTE_BLOCKCHAINDATA_FILENAME;
-  boost::system::error_code ec{};
-  const boost::uintmax_t size = boost::filesystem::file_size(datafile, ec);
-  return (ec ? 0 : static_cast<uint64_t>(size));
+  {
+    boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+    db_compaction_status &status = m_compaction->status;
+    if (status.state == db_compaction_status::copying || status.state == db_compaction_status::ready)
+    {
+      status.state = db_compaction_status::failed;
+      status.error = reason;
+    }
+    m_compaction->release = true;
+    m_compaction->cond.notify_all();
+  }
+  if (m_compaction->thread.joinable())
+    m_compaction->thread.join();
+}
+
+db_compaction_status BlockchainLMDB::get_compaction_status() const
+{
+  boost::unique_lock<boost::mutex> lock(m_compaction->mutex);
+  return m_compaction->status;
 }
 
 void BlockchainLMDB::fixup()
@@ -5704,6 +8444,108 @@ void BlockchainLMDB::migrate_4_5()
   txn.commit();
 }
 
+void BlockchainLMDB::migrate_5_6()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  int result;
+  mdb_txn_safe txn(false);
+  MDB_val k, v;
+
+  MGINFO_YELLOW("Migrating blockchain from DB version 5 to 6 - this may take a while:");
+
+  do {
+    LOG_PRINT_L1("indexing output distribution:");
+
+    // start over if interrupted
+    result = mdb_txn_begin(m_env, NULL, 0, txn);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+    result = mdb_drop(txn, m_output_distribution, 0);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to empty output_distribution: ", result).c_str()));
+    txn.commit();
+
+    // amount 0 is left out, block_info has its distribution already
+    uint64_t amount = 1, n_records = 0;
+    while (1)
+    {
+      result = mdb_txn_begin(m_env, NULL, 0, txn);
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+      MDB_cursor *c_amounts, *c_distribution;
+      result = mdb_cursor_open(txn, m_output_amounts, &c_amounts);
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to open a cursor for output_amounts: ", result).c_str()));
+      result = mdb_cursor_open(txn, m_output_distribution, &c_distribution);
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to open a cursor for output_distribution: ", result).c_str()));
+
+      // whole amounts per txn, about 100000 records each
+      uint64_t n_txn_records = 0;
+      k = {sizeof(amount), (void *)&amount};
+      result = mdb_cursor_get(c_amounts, &k, &v, MDB_SET_RANGE);
+      while (!result && n_txn_records < 100000)
+      {
+        amount = *(const uint64_t *)k.mv_data;
+        outdist od = {0, 0};
+        bool have_record = false;
+        for (; !result; result = mdb_cursor_get(c_amounts, &k, &v, MDB_NEXT_DUP))
+        {
+          const pre_rct_outkey *ok = (const pre_rct_outkey *)v.mv_data;
+          if (have_record && ok->data.height != od.height)
+          {
+            MDB_val_set(vod, od);
+            MDB_val_set(kod, amount);
+            result = mdb_cursor_put(c_distribution, &kod, &vod, MDB_APPENDDUP);
+            if (result)
+              throw0(DB_ERROR(lmdb_error("Failed to add output distribution: ", result).c_str()));
+            ++n_txn_records;
+          }
+          od.height = ok->data.height;
+          od.num_outputs = ok->amount_index + 1;
+          have_record = true;
+        }
+        if (result != MDB_NOTFOUND)
+          throw0(DB_ERROR(lmdb_error("Failed to enumerate outputs: ", result).c_str()));
+        if (have_record)
+        {
+          MDB_val_set(vod, od);
+          MDB_val_set(kod, amount);
+          result = mdb_cursor_put(c_distribution, &kod, &vod, MDB_APPENDDUP);
+          if (result)
+            throw0(DB_ERROR(lmdb_error("Failed to add output distribution: ", result).c_str()));
+          ++n_txn_records;
+        }
+        result = mdb_cursor_get(c_amounts, &k, &v, MDB_NEXT_NODUP);
+      }
+      if (result && result != MDB_NOTFOUND)
+        throw0(DB_ERROR(lmdb_error("Failed to enumerate output amounts: ", result).c_str()));
+      const bool done = result == MDB_NOTFOUND;
+      if (!done)
+        amount = *(const uint64_t *)k.mv_data;
+      txn.commit();
+      n_records += n_txn_records;
+      if (done)
+        break;
+      LOGIF(el::Level::Info) {
+        std::cout << n_records << " records  \r" << std::flush;
+      }
+    }
+  } while(0);
+
+  uint32_t version = 6;
+  v.mv_data = (void *)&version;
+  v.mv_size = sizeof(version);
+  MDB_val_str(vk, "version");
+  result = mdb_txn_begin(m_env, NULL, 0, txn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+  result = mdb_put(txn, m_properties, &vk, &v, 0);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to update version for the db: ", result).c_str()));
+  txn.commit();
+}
+
 void BlockchainLMDB::migrate(const uint32_t oldversion)
 {
   if (oldversion < 1)
@@ -5716,6 +8558,8 @@ void BlockchainLMDB::migrate(const uint32_t oldversion)
     migrate_3_4();
   if (oldversion < 5)
     migrate_4_5();
+  if (oldversion < 6)
+    migrate_5_6();
 }
 
 }  // namespace cryptonote
@@ -27,10 +27,16 @@
 #pragma once
 
 #include <atomic>
+#include <map>
+#include <memory>
+#include <unordered_set>
 
 #include "blockchain_db/blockchain_db.h"
+#include "blockchain_db/blob_compression.h"
+#include "common/bloom_filter.h"
 #include "cryptonote_basic/blobdatatype.h" // for type blobdata
 #include "ringct/rctTypes.h"
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/tss.hpp>
 
 #include <lmdb.h>
@@ -53,6 +59,7 @@ typedef struct mdb_txn_cursors
 
   MDB_cursor *m_txc_output_txs;
   MDB_cursor *m_txc_output_amounts;
+  MDB_cursor *m_txc_output_distribution;
 
   MDB_cursor *m_txc_txs;
   MDB_cursor *m_txc_txs_pruned;
@@ -72,6 +79,10 @@ typedef struct mdb_txn_cursors
   MDB_cursor *m_txc_hf_versions;
 
   MDB_cursor *m_txc_properties;
+
+  MDB_cursor *m_txc_rct_ver_cache;
+
+  MDB_cursor *m_txc_block_pow;
 } mdb_txn_cursors;
 
 #define m_cur_blocks	m_cursors->m_txc_blocks
@@ -79,6 +90,7 @@ typedef struct mdb_txn_cursors
 #define m_cur_block_info	m_cursors->m_txc_block_info
 #define m_cur_output_txs	m_cursors->m_txc_output_txs
 #define m_cur_output_amounts	m_cursors->m_txc_output_amounts
+#define m_cur_output_distribution	m_cursors->m_txc_output_distribution
 #define m_cur_txs	m_cursors->m_txc_txs
 #define m_cur_txs_pruned	m_cursors->m_txc_txs_pruned
 #define m_cur_txs_prunable	m_cursors->m_txc_txs_prunable
@@ -92,15 +104,19 @@ typedef struct mdb_txn_cursors
 #define m_cur_alt_blocks	m_cursors->m_txc_alt_blocks
 #define m_cur_hf_versions	m_cursors->m_txc_hf_versions
 #define m_cur_properties	m_cursors->m_txc_properties
+#define m_cur_rct_ver_cache	m_cursors->m_txc_rct_ver_cache
+#define m_cur_block_pow	m_cursors->m_txc_block_pow
 
 typedef struct mdb_rflags
 {
   bool m_rf_txn;
+  bool m_rf_cold_txn;
   bool m_rf_blocks;
   bool m_rf_block_heights;
   bool m_rf_block_info;
   bool m_rf_output_txs;
   bool m_rf_output_amounts;
+  bool m_rf_output_distribution;
   bool m_rf_txs;
   bool m_rf_txs_pruned;
   bool m_rf_txs_prunable;
@@ -114,15 +130,40 @@ typedef struct mdb_rflags
   bool m_rf_alt_blocks;
   bool m_rf_hf_versions;
   bool m_rf_properties;
+  bool m_rf_rct_ver_cache;
+  bool m_rf_block_pow;
 } mdb_rflags;
 
+struct mdb_threadinfo;
+
+// the per-thread read txns of a BlockchainLMDB, so they can all be ended
+// before its environment is closed while the threads live on
+struct mdb_threadinfo_registry
+{
+  boost::mutex m_lock;
+  std::unordered_set<mdb_threadinfo*> m_infos;
+
+  void end_all();
+  // only the cold storage ones, before that environment is closed
+  void end_all_cold();
+};
+
 typedef struct mdb_threadinfo
 {
   MDB_txn *m_ti_rtxn;	// per-thread read txn
+  MDB_txn *m_ti_cold_rtxn;	// per-thread cold storage read txn, kept as long as m_ti_rtxn
   mdb_txn_cursors m_ti_rcursors;	// per-thread read cursors
   mdb_rflags m_ti_rflags;	// per-thread read state
+  std::shared_ptr<mdb_threadinfo_registry> m_ti_registry;
 
+  mdb_threadinfo(const std::shared_ptr<mdb_threadinfo_registry> &registry);
   ~mdb_threadinfo();
+
+  // resets the txns, keeping them for renewal
+  void reset();
+  // closes the cursors and aborts the txns
+  void end();
+  void end_cold();
 } mdb_threadinfo;
 
 struct mdb_txn_safe
@@ -153,6 +194,7 @@ struct mdb_txn_safe
 
   static void prevent_new_txns();
   static void wait_no_active_txns();
+  static bool wait_no_active_txns(unsigned int timeout_ms);
   static void allow_new_txns();
   static void increment_txns(int);
 
@@ -202,6 +244,8 @@ public:
 
   virtual std::string get_db_name() const;
 
+  virtual unsigned get_blob_compression() const;
+
   virtual bool lock();
 
   virtual void unlock();
@@ -272,6 +316,7 @@ public:
 
   virtual output_data_t get_output_key(const uint64_t& amount, const uint64_t& index, bool include_commitmemt) const;
   virtual void get_output_key(const epee::span<const uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs, bool allow_partial = false) const;
+  virtual void get_output_keys(const epee::span<const std::pair<uint64_t, uint64_t>> &amount_indices, std::vector<output_data_t> &outputs, std::vector<bool> &found) const;
 
   virtual tx_out_index get_output_tx_and_index_from_global(const uint64_t& index) const;
   virtual void get_output_tx_and_index_from_global(const std::vector<uint64_t> &global_indices,
@@ -292,10 +337,19 @@ public:
   virtual bool get_txpool_tx_meta(const crypto::hash& txid, txpool_tx_meta_t &meta) const;
   virtual bool get_txpool_tx_blob(const crypto::hash& txid, cryptonote::blobdata& bd, relay_category tx_category) const;
   virtual cryptonote::blobdata get_txpool_tx_blob(const crypto::hash& txid, relay_category tx_category) const;
+  virtual void flush_txpool_updates();
   virtual uint32_t get_blockchain_pruning_seed() const;
   virtual bool prune_blockchain(uint32_t pruning_seed = 0);
   virtual bool update_pruning();
   virtual bool check_pruning();
+  virtual bool prune_blockchain_incremental(uint32_t pruning_seed, uint64_t max_bytes);
+  virtual bool get_pruning_progress(uint64_t &height) const;
+  virtual bool move_to_cold_storage(uint64_t max_bytes);
+
+  virtual void get_db_stats(db_stats &stats) const;
+  virtual bool start_compaction();
+  virtual bool finish_compaction();
+  virtual db_compaction_status get_compaction_status() const;
 
   virtual void add_alt_block(const crypto::hash &blkid, const cryptonote::alt_block_data_t &data, const cryptonote::blobdata_ref &blob);
   virtual bool get_alt_block(const crypto::hash &blkid, alt_block_data_t *data, cryptonote::blobdata *blob);
@@ -303,6 +357,13 @@ public:
   virtual uint64_t get_alt_block_count();
   virtual void drop_alt_blocks();
 
+  virtual void set_rct_ver_cache(const std::vector<crypto::hash> &entries);
+  virtual std::vector<crypto::hash> get_rct_ver_cache() const;
+
+  virtual void add_block_pow(uint64_t height, const crypto::hash &blk_hash, const crypto::hash &pow);
+  virtual bool get_block_pow(uint64_t height, const crypto::hash &blk_hash, crypto::hash &pow) const;
+  virtual uint64_t trim_block_pow(uint64_t max_entries);
+
   virtual bool for_all_txpool_txes(std::function<bool(const crypto::hash&, const txpool_tx_meta_t&, const cryptonote::blobdata_ref*)> f, bool include_blob = false, relay_category category = relay_category::broadcasted) const;
 
   virtual bool for_all_key_images(std::function<bool(const crypto::key_image&)>) const;
@@ -376,6 +437,81 @@ private:
 
   virtual void remove_block();
 
+  // opens the handles of the tables, and sets their comparison functions
+  void open_tables(MDB_txn *txn, bool read_only);
+
+  // makes the compacted copy and holds the snapshot it was made from until
+  // finish_compaction is done with it
+  void compaction_thread();
+
+  // finish_compaction's part under the txn creation gate
+  bool swap_in_compacted_copy();
+
+  // fails a compaction under way and waits for its thread to end, which
+  // closes its snapshot. A copy being made can't be stopped, so that is
+  // waited for too.
+  void cancel_compaction(const char *reason);
+
+  // builds m_spent_keys_filter from the spent_keys table, unless the
+  // database is read only
+  void init_spent_keys_filter();
+
+  // a filter over the spent_keys table as txn sees it, with room for as
+  // many key images again
+  std::shared_ptr<tools::bloom_filter<crypto::key_image>> build_spent_keys_filter(MDB_txn *txn) const;
+
+  // fills m_block_info_cache with the top blocks of the block_info table
+  void init_block_info_cache();
+
+  // whether m_block_info_cache agrees with what this thread's txn would read
+  bool block_info_cache_usable() const;
+
+  // the id of the read txn this thread keeps open, whose snapshot may be
+  // older than the latest, 0 if it has none
+  uint64_t get_kept_snapshot() const;
+
+  // whether this thread is the one with the write txn
+  bool in_write_txn() const;
+
+  // puts everything in m_txpool_cache into the txpool tables in the write txn
+  void write_txpool_cache();
+
+  // the tables whose values may be compressed, in DB_COMPRESS_* bit order
+  enum blob_table { blob_table_blocks, blob_table_txs_pruned, blob_table_txs_prunable, num_blob_tables };
+
+  // converts any blob table whose compression differs from the one asked
+  // for with set_blob_compression, then loads the compressors. A table with
+  // too few values to train a dictionary on is left raw, and is recorded as
+  // pending so it is compressed on a later open
+  void init_blob_compression();
+
+  // compresses or decompresses every value of a blob table, resuming the
+  // conversion if it was interrupted
+  void convert_blob_table(unsigned table, bool compress);
+
+  // reads a value of a blob table into bd, appending to it if asked to
+  void decode_blob(unsigned table, const MDB_val &v, cryptonote::blobdata &bd, bool append = false) const;
+
+  // as decode_blob, but avoids the copy if the table is not compressed
+  cryptonote::blobdata_ref decode_blob_ref(unsigned table, const MDB_val &v, cryptonote::blobdata &buffer) const;
+
+  // turns a blob into a value for a blob table, which may point into buffer
+  MDB_val encode_blob(unsigned table, const void *data, size_t size, std::string &buffer) const;
+
+  // opens the cold storage environment, if set up or asked for
+  void init_cold_storage();
+  void close_cold_storage();
+
+  // whether a blob table's value for key was moved to cold storage
+  bool is_cold(unsigned table, uint64_t key) const { return key < m_cold_boundaries[table].load(std::memory_order_acquire); }
+
+  // reads a blob table's value from cold storage into bd, appending to it
+  // if asked to. Returns false if it is not there.
+  bool get_cold_blob(unsigned table, uint64_t key, cryptonote::blobdata &bd, bool append = false) const;
+
+  // grows the cold storage map so that it has room for size more bytes
+  void resize_cold_storage(uint64_t size);
+
   virtual uint64_t add_transaction_data(const crypto::hash& blk_hash, const std::pair<transaction, blobdata_ref>& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prunable_hash);
 
   virtual void remove_transaction_data(const crypto::hash& tx_hash, const transaction& tx);
@@ -395,6 +531,9 @@ private:
 
   void remove_output(const uint64_t amount, const uint64_t& out_index);
 
+  // uncounts the last output of an amount from the output_distribution table
+  void remove_output_distribution(uint64_t amount, uint64_t height, uint64_t amount_index);
+
   virtual void prune_outputs(uint64_t amount);
 
   virtual void add_spent_key(const crypto::key_image& k_image);
@@ -443,6 +582,9 @@ private:
   // migrate from DB version 4 to 5
   void migrate_4_5();
 
+  // fills the output_distribution table
+  void migrate_5_6();
+
   void cleanup_batch();
 
 private:
@@ -462,6 +604,7 @@ private:
 
   MDB_dbi m_output_txs;
   MDB_dbi m_output_amounts;
+  MDB_dbi m_output_distribution;
 
   MDB_dbi m_spent_keys;
 
@@ -475,6 +618,36 @@ private:
 
   MDB_dbi m_properties;
 
+  MDB_dbi m_rct_ver_cache;
+
+  MDB_dbi m_block_pow;
+
+  // has_key_image only reads spent_keys if this says the key image may be
+  // there. Removed key images stay in the filter until it is rebuilt. It is
+  // rebuilt twice as large when it fills up, so it is only accessed with
+  // std::atomic_load/std::atomic_store, and readers keep the one they got.
+  std::shared_ptr<tools::bloom_filter<crypto::key_image>> m_spent_keys_filter;
+
+  // the block_info records of the top blocks, which the block_info getters
+  // are served from. Only committed records are in it, so readers on other
+  // threads never see the ones of a write txn which may still be aborted.
+  struct block_info_cache;
+  std::unique_ptr<block_info_cache> m_block_info_cache;
+
+  // txpool additions and metadata updates not yet written to the txpool
+  // tables, which readers see on top of them. Removals are written at once.
+  struct txpool_cache;
+  std::unique_ptr<txpool_cache> m_txpool_cache;
+
+  // one per blob table, null when that table is stored raw
+  std::unique_ptr<blob_compressor> m_blob_compressors[num_blob_tables];
+
+  // old blob table values, stored raw in a second environment. Keys below
+  // a table's boundary were moved there and are no longer in the table.
+  MDB_env *m_cold_env;
+  MDB_dbi m_cold_dbis[num_blob_tables];
+  std::atomic<uint64_t> m_cold_boundaries[num_blob_tables];
+
   mutable uint64_t m_cum_size;	// used in batch size estimation
   mutable unsigned int m_cum_count;
   std::string m_folder;
@@ -487,6 +660,12 @@ private:
 
   mdb_txn_cursors m_wcursors;
   mutable boost::thread_specific_ptr<mdb_threadinfo> m_tinfo;
+  std::shared_ptr<mdb_threadinfo_registry> m_tinfo_registry;
+
+  unsigned int m_env_flags; // what the environment was opened with, to reopen it alike
+
+  struct compaction;
+  std::unique_ptr<compaction> m_compaction;
 
 #if defined(__arm__)
   // force a value so it can compile with 32-bit ARM
@@ -107,6 +107,7 @@ public:
   virtual cryptonote::tx_out_index get_output_tx_and_index(const uint64_t& amount, const uint64_t& index) const override { return cryptonote::tx_out_index(); }
   virtual void get_output_tx_and_index(const uint64_t& amount, const std::vector<uint64_t> &offsets, std::vector<cryptonote::tx_out_index> &indices) const override {}
   virtual void get_output_key(const epee::span<const uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<cryptonote::output_data_t> &outputs, bool allow_partial = false) const override {}
+  virtual void get_output_keys(const epee::span<const std::pair<uint64_t, uint64_t>> &amount_indices, std::vector<cryptonote::output_data_t> &outputs, std::vector<bool> &found) const override {}
   virtual bool can_thread_bulk_indices() const override { return false; }
   virtual std::vector<std::vector<uint64_t>> get_tx_amount_output_indices(const uint64_t tx_index, size_t n_txes) const override { return std::vector<std::vector<uint64_t>>(); }
   virtual bool has_key_image(const crypto::key_image& img) const override { return false; }
@@ -136,6 +137,7 @@ public:
   virtual bool get_txpool_tx_blob(const crypto::hash& txid, cryptonote::blobdata &bd, relay_category tx_category) const override { return false; }
   virtual uint64_t get_database_size() const override { return 0; }
   virtual cryptonote::blobdata get_txpool_tx_blob(const crypto::hash& txid, relay_category tx_category) const override { return ""; }
+  virtual void flush_txpool_updates() override {}
   virtual bool for_all_txpool_txes(std::function<bool(const crypto::hash&, const cryptonote::txpool_tx_meta_t&, const cryptonote::blobdata_ref*)>, bool include_blob = false, relay_category category = relay_category::broadcasted) const override { return false; }
 
   virtual void add_block( const cryptonote::block& blk
@@ -155,6 +157,13 @@ public:
   virtual bool prune_blockchain(uint32_t pruning_seed = 0) override { return true; }
   virtual bool update_pruning() override { return true; }
   virtual bool check_pruning() override { return true; }
+  virtual bool prune_blockchain_incremental(uint32_t pruning_seed, uint64_t max_bytes) override { return true; }
+  virtual bool get_pruning_progress(uint64_t &height) const override { return false; }
+  virtual bool move_to_cold_storage(uint64_t max_bytes) override { return true; }
+  virtual void get_db_stats(cryptonote::db_stats &stats) const override {}
+  virtual bool start_compaction() override { return false; }
+  virtual bool finish_compaction() override { return false; }
+  virtual cryptonote::db_compaction_status get_compaction_status() const override { return cryptonote::db_compaction_status(); }
   virtual void prune_outputs(uint64_t amount) override {}
 
   virtual uint64_t get_max_block_size() override { return 100000000; }
@@ -165,6 +174,11 @@ public:
   virtual void remove_alt_block(const crypto::hash &blkid) override {}
   virtual uint64_t get_alt_block_count() override { return 0; }
   virtual void drop_alt_blocks() override {}
+  virtual void set_rct_ver_cache(const std::vector<crypto::hash> &entries) override {}
+  virtual std::vector<crypto::hash> get_rct_ver_cache() const override { return {}; }
+  virtual void add_block_pow(uint64_t height, const crypto::hash &blk_hash, const crypto::hash &pow) override {}
+  virtual bool get_block_pow(uint64_t height, const crypto::hash &blk_hash, crypto::hash &pow) const override { return false; }
+  virtual uint64_t trim_block_pow(uint64_t max_entries) override { return 0; }
   virtual bool for_all_alt_blocks(std::function<bool(const crypto::hash &blkid, const alt_block_data_t &data, const cryptonote::blobdata_ref *blob)> f, bool include_blob = false) const override { return true; }
 };
 
@@ -0,0 +1,286 @@
+// Copyright (c) 2014-2022, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <chrono>
+#include <random>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include <boost/filesystem/path.hpp>
+#include "common/command_line.h"
+#include "cryptonote_core/tx_pool.h"
+#include "cryptonote_core/cryptonote_core.h"
+#include "cryptonote_core/blockchain.h"
+#include "blockchain_db/blockchain_db.h"
+#include "blockchain_db/blob_compression.h"
+#include "version.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "bcutil"
+
+namespace po = boost::program_options;
+using namespace epee;
+using namespace cryptonote;
+
+// Serves getblocks.bin sized requests from random heights straight out of
+// the database, the way the RPC server does, and reports the time taken and
+// the page faults incurred. Run it on a raw and on a compressed copy of the
+// same database, after dropping the page cache, to compare page faults saved
+// against decompression time. On a raw database it also estimates what
+// compression would cost and save, from the blobs it served.
+
+namespace
+{
+  struct fault_counts
+  {
+    uint64_t minor;
+    uint64_t major;
+  };
+
+  fault_counts get_fault_counts()
+  {
+#ifdef _WIN32
+    return {0, 0};
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+      return {0, 0};
+    return {(uint64_t)usage.ru_minflt, (uint64_t)usage.ru_majflt};
+#endif
+  }
+
+  typedef std::vector<std::pair<std::pair<cryptonote::blobdata, crypto::hash>, std::vector<std::pair<crypto::hash, cryptonote::blobdata>>>> block_batch;
+}
+
+int main(int argc, char* argv[])
+{
+  TRY_ENTRY();
+
+  epee::string_tools::set_module_name_and_folder(argv[0]);
+
+  uint32_t log_level = 0;
+
+  tools::on_startup();
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::string> arg_log_level  = {"log-level",  "0-4 or categories", ""};
+  const command_line::arg_descriptor<uint64_t> arg_requests  = {"requests", "Number of getblocks.bin requests to serve", 100};
+  const command_line::arg_descriptor<uint64_t> arg_blocks_per_request  = {"blocks-per-request", "Number of blocks per request", COMMAND_RPC_GET_BLOCKS_FAST_MAX_BLOCK_COUNT};
+  const command_line::arg_descriptor<uint64_t> arg_min_height  = {"min-height", "Lowest height requests start from", 0};
+  const command_line::arg_descriptor<bool> arg_pruned  = {"pruned", "Serve pruned blocks", false};
+  const command_line::arg_descriptor<uint32_t> arg_seed  = {"seed", "Seed for the request start heights", 0};
+
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_data_dir);
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_testnet_on);
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_stagenet_on);
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_regtest_on);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_requests);
+  command_line::add_arg(desc_cmd_sett, arg_blocks_per_request);
+  command_line::add_arg(desc_cmd_sett, arg_min_height);
+  command_line::add_arg(desc_cmd_sett, arg_pruned);
+  command_line::add_arg(desc_cmd_sett, arg_seed);
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    auto parser = po::command_line_parser(argc, argv).options(desc_options);
+    po::store(parser.run(), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  if (command_line::get_arg(vm, command_line::arg_help))
+  {
+    std::cout << "Wownero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  mlog_configure(mlog_get_default_log_path("wownero-blockchain-compression-bench.log"), true);
+  if (!command_line::is_arg_defaulted(vm, arg_log_level))
+    mlog_set_log(command_line::get_arg(vm, arg_log_level).c_str());
+  else
+    mlog_set_log(std::string(std::to_string(log_level) + ",bcutil:INFO").c_str());
+
+  LOG_PRINT_L0("Starting...");
+
+  std::string opt_data_dir = command_line::get_arg(vm, cryptonote::arg_data_dir);
+  const network_type net_type = core::get_network_type_from_args(vm);
+  const uint64_t opt_requests = command_line::get_arg(vm, arg_requests);
+  const uint64_t opt_blocks_per_request = command_line::get_arg(vm, arg_blocks_per_request);
+  const uint64_t opt_min_height = command_line::get_arg(vm, arg_min_height);
+  const bool opt_pruned = command_line::get_arg(vm, arg_pruned);
+
+  if (opt_requests == 0 || opt_blocks_per_request == 0)
+  {
+    std::cerr << "requests and blocks-per-request must be positive" << std::endl;
+    return 1;
+  }
+
+  LOG_PRINT_L0("Initializing source blockchain (BlockchainDB)");
+  std::unique_ptr<Blockchain> core_storage;
+  tx_memory_pool m_mempool(*core_storage);
+  core_storage.reset(new Blockchain(m_mempool));
+  BlockchainDB *db = new_db();
+  if (db == NULL)
+  {
+    LOG_ERROR("Failed to initialize a database");
+    throw std::runtime_error("Failed to initialize a database");
+  }
+  LOG_PRINT_L0("database: LMDB");
+
+  const std::string filename = (boost::filesystem::path(opt_data_dir) / db->get_db_name()).string();
+  LOG_PRINT_L0("Loading blockchain from folder " << filename << " ...");
+
+  try
+  {
+    db->open(filename, DBF_RDONLY);
+  }
+  catch (const std::exception& e)
+  {
+    LOG_PRINT_L0("Error opening database: " << e.what());
+    return 1;
+  }
+  r = core_storage->init(db, net_type);
+
+  CHECK_AND_ASSERT_MES(r, 1, "Failed to initialize source blockchain storage");
+  LOG_PRINT_L0("Source blockchain storage initialized OK");
+
+  const uint64_t db_height = db->height();
+  if (db_height <= opt_min_height + opt_blocks_per_request)
+  {
+    std::cerr << "Not enough blocks above min-height" << std::endl;
+    return 1;
+  }
+
+  std::mt19937 rng(command_line::get_arg(vm, arg_seed));
+  std::uniform_int_distribution<uint64_t> start_height(opt_min_height, db_height - opt_blocks_per_request);
+
+  // keep the blobs of the first requests for the compression estimate
+  static const size_t max_sample_bytes = 64 * 1024 * 1024;
+  std::vector<std::string> samples;
+  size_t sample_bytes = 0;
+
+  uint64_t n_blocks = 0, n_txes = 0, n_bytes = 0;
+  std::chrono::steady_clock::duration serve_time{0};
+  const fault_counts faults0 = get_fault_counts();
+  for (uint64_t i = 0; i < opt_requests; ++i)
+  {
+    block_batch blocks;
+    const uint64_t height = start_height(rng);
+    const auto t0 = std::chrono::steady_clock::now();
+    if (!db->get_blocks_from(height, 1, opt_blocks_per_request, COMMAND_RPC_GET_BLOCKS_FAST_MAX_TX_COUNT, 100*1024*1024, blocks, opt_pruned, false, false))
+    {
+      LOG_PRINT_L0("Failed to get blocks from height " << height);
+      return 1;
+    }
+    serve_time += std::chrono::steady_clock::now() - t0;
+
+    for (const auto &block: blocks)
+    {
+      ++n_blocks;
+      n_bytes += block.first.first.size();
+      if (sample_bytes < max_sample_bytes)
+      {
+        samples.push_back(block.first.first);
+        sample_bytes += block.first.first.size();
+      }
+      for (const auto &tx: block.second)
+      {
+        ++n_txes;
+        n_bytes += tx.second.size();
+        if (sample_bytes < max_sample_bytes)
+        {
+          samples.push_back(tx.second);
+          sample_bytes += tx.second.size();
+        }
+      }
+    }
+  }
+  const fault_counts faults1 = get_fault_counts();
+
+  const float serve_ms = std::chrono::duration_cast<std::chrono::microseconds>(serve_time).count() / 1000.0f;
+  const float mb = n_bytes / 1048576.0f;
+  std::cout << "Served " << opt_requests << " requests: " << n_blocks << " blocks, " << n_txes << " txes, " << mb << " MB" << std::endl;
+  std::cout << "  time: " << serve_ms << " ms, " << (serve_ms > 0 ? mb * 1000 / serve_ms : 0.0f) << " MB/s, " << serve_ms / opt_requests << " ms per request" << std::endl;
+  std::cout << "  page faults: " << faults1.major - faults0.major << " major, " << faults1.minor - faults0.minor << " minor, "
+    << (mb > 0 ? (faults1.major - faults0.major) / mb : 0.0f) << " major per MB" << std::endl;
+
+  if (!blob_compressor::is_supported())
+  {
+    std::cout << "This build has no zstd support, skipping the compression estimate" << std::endl;
+  }
+  else if (!samples.empty())
+  {
+    // what the served blobs would have cost and saved compressed
+    const std::string dictionary = blob_compressor::train_dictionary(samples);
+    blob_compressor compressor(dictionary);
+    std::vector<std::string> compressed(samples.size());
+    uint64_t compressed_bytes = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+      if (!compressor.compress(samples[i].data(), samples[i].size(), compressed[i]))
+      {
+        LOG_PRINT_L0("Failed to compress a sample");
+        return 1;
+      }
+      compressed_bytes += compressed[i].size();
+    }
+    std::string out;
+    const auto t0 = std::chrono::steady_clock::now();
+    for (const std::string &blob: compressed)
+    {
+      out.clear();
+      if (!compressor.decompress(blob.data(), blob.size(), out))
+      {
+        LOG_PRINT_L0("Failed to decompress a sample");
+        return 1;
+      }
+    }
+    const float decompress_ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count() / 1000.0f;
+    const float sample_mb = sample_bytes / 1048576.0f;
+    std::cout << "Compression estimate on " << samples.size() << " blobs, " << sample_mb << " MB, " << dictionary.size() << " byte dictionary:" << std::endl;
+    std::cout << "  size: " << 100.0f * compressed_bytes / sample_bytes << "% of raw, "
+      << (sample_bytes - compressed_bytes) / 4096 << " fewer 4 kB pages" << std::endl;
+    std::cout << "  decompression: " << decompress_ms << " ms, " << (decompress_ms > 0 ? sample_mb * 1000 / decompress_ms : 0.0f) << " MB/s, "
+      << decompress_ms * 1000 / samples.size() << " us per blob" << std::endl;
+  }
+
+  core_storage->deinit();
+  return 0;
+
+  CATCH_ENTRY("Compression benchmark error", 1);
+}
@@ -62,6 +62,8 @@ int main(int argc, char* argv[])
   const command_line::arg_descriptor<uint64_t> arg_block_start = {"block-start", "Start at block number", block_start};
   const command_line::arg_descriptor<uint64_t> arg_block_stop = {"block-stop", "Stop at block number", block_stop};
   const command_line::arg_descriptor<bool> arg_blocks_dat = {"blocksdat", "Output in blocks.dat format", blocks_dat};
+  const command_line::arg_descriptor<unsigned> arg_bootstrap_version = {"bootstrap-version", "Bootstrap file format: 1, or 2 for an indexed file", 1};
+  const command_line::arg_descriptor<bool> arg_compress = {"compress", "Compress the chunks of a v2 bootstrap file with zstd", false};
 
 
   command_line::add_arg(desc_cmd_sett, cryptonote::arg_data_dir);
@@ -73,6 +75,8 @@ int main(int argc, char* argv[])
   command_line::add_arg(desc_cmd_sett, arg_block_start);
   command_line::add_arg(desc_cmd_sett, arg_block_stop);
   command_line::add_arg(desc_cmd_sett, arg_blocks_dat);
+  command_line::add_arg(desc_cmd_sett, arg_bootstrap_version);
+  command_line::add_arg(desc_cmd_sett, arg_compress);
 
   command_line::add_arg(desc_cmd_only, command_line::arg_help);
 
@@ -107,6 +111,18 @@ int main(int argc, char* argv[])
   LOG_PRINT_L0("Starting...");
 
   bool opt_blocks_dat = command_line::get_arg(vm, arg_blocks_dat);
+  const unsigned bootstrap_version = command_line::get_arg(vm, arg_bootstrap_version);
+  const bool opt_compress = command_line::get_arg(vm, arg_compress);
+  if (bootstrap_version != 1 && bootstrap_version != 2)
+  {
+    std::cerr << "Error: bootstrap-version must be 1 or 2" << ENDL;
+    return 1;
+  }
+  if (opt_compress && bootstrap_version < 2)
+  {
+    std::cerr << "Error: compress needs bootstrap-version 2" << ENDL;
+    return 1;
+  }
 
   std::string m_config_folder;
 
@@ -177,6 +193,7 @@ int main(int argc, char* argv[])
   else
   {
     BootstrapFile bootstrap;
+    bootstrap.set_format(bootstrap_version, opt_compress);
     r = bootstrap.store_blockchain_raw(core_storage, NULL, output_file_path, block_start, block_stop);
   }
   CHECK_AND_ASSERT_MES(r, 1, "Failed to export blockchain raw data");
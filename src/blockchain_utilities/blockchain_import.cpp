@@ -29,10 +29,15 @@
 #include <atomic>
 #include <cstdio>
 #include <algorithm>
+#include <deque>
 #include <fstream>
+#include <memory>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <unistd.h>
 #include "misc_log_ex.h"
 #include "bootstrap_file.h"
@@ -43,6 +48,8 @@
 #include "serialization/json_utils.h" // dump_json()
 #include "include_base_utils.h"
 #include "cryptonote_core/cryptonote_core.h"
+#include "cryptonote_core/tx_verification_utils.h"
+#include "common/threadpool.h"
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
 #define MONERO_DEFAULT_LOG_CATEGORY "bcutil"
@@ -70,6 +77,340 @@ uint64_t db_batch_size = 100;
 uint64_t db_batch_size_verify = 5000;
 
 std::string refresh_string = "\r                                    \r";
+
+// number of blocks parsed in parallel while the previous ones are added
+const size_t parse_batch_size = 256;
+// blocks per parsing task, so small blocks don't drown in task overhead
+const size_t parse_task_size = 8;
+// number of raw chunks the reader may get ahead of the parsers
+const size_t max_queued_chunks = 1024;
+// number of v2 chunks checked and decompressed at once
+const size_t read_ahead_chunks = 16;
+
+// Reads raw chunks on its own thread, so the file keeps streaming in while
+// earlier blocks are parsed, verified and stored. From a v2 file, several
+// chunks get checked and decompressed at once on the thread pool.
+class chunk_reader
+{
+public:
+  chunk_reader(std::ifstream &import_file, uint64_t height, uint64_t block_stop):
+    m_import_file(&import_file), m_bootstrap(NULL), m_height(height), m_block_stop(block_stop), m_status(0),
+    m_done(false), m_stop(false), m_bytes_read(0), m_chunks_read(0)
+  {
+    m_thread = boost::thread([this]() { run(); });
+  }
+
+  chunk_reader(const BootstrapReader &bootstrap, uint64_t height, uint64_t block_stop):
+    m_import_file(NULL), m_bootstrap(&bootstrap), m_height(height), m_block_stop(block_stop), m_status(0),
+    m_done(false), m_stop(false), m_bytes_read(0), m_chunks_read(0)
+  {
+    m_thread = boost::thread([this]() { run(); });
+  }
+
+  ~chunk_reader()
+  {
+    {
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+  }
+
+  // returns false once there are no more chunks, status() tells why
+  bool get(std::string &chunk)
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (m_chunks.empty() && !m_done)
+      m_cond.wait(lock);
+    if (m_chunks.empty())
+      return false;
+    chunk = std::move(m_chunks.front());
+    m_chunks.pop_front();
+    m_cond.notify_all();
+    return true;
+  }
+
+  // 1 when the end of the file or block_stop was reached, 2 on error
+  int status()
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    return m_status;
+  }
+
+  uint64_t get_bytes_read()
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    return m_bytes_read;
+  }
+
+  uint64_t get_average_chunk_size()
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    return m_chunks_read ? m_bytes_read / m_chunks_read : 0;
+  }
+
+private:
+  void finish(int status)
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_status = status;
+    m_done = true;
+    m_cond.notify_all();
+  }
+
+  // waits for room in the queue, returns false if stopping
+  bool push(std::string &&chunk, uint64_t bytes)
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (m_chunks.size() >= max_queued_chunks && !m_stop)
+      m_cond.wait(lock);
+    if (m_stop)
+      return false;
+    m_chunks.push_back(std::move(chunk));
+    m_bytes_read += bytes;
+    ++m_chunks_read;
+    ++m_height;
+    m_cond.notify_all();
+    return true;
+  }
+
+  bool check_block_stop()
+  {
+    if (m_height <= m_block_stop)
+      return true;
+    MINFO("Specified block number reached - stopping.  block: " << m_height-1 << "  total blocks: " << m_height);
+    finish(1);
+    return false;
+  }
+
+  void run()
+  {
+    try
+    {
+      if (m_bootstrap)
+        run_v2();
+      else
+        run_v1();
+    }
+    catch (const std::exception &e)
+    {
+      MFATAL("exception while reading from file, height=" << m_height << ": " << e.what());
+      finish(2);
+    }
+  }
+
+  void run_v1()
+  {
+    char buffer1[1024];
+    std::string str1;
+    while (check_block_stop())
+    {
+      uint32_t chunk_size;
+      m_import_file->read(buffer1, sizeof(chunk_size));
+      // TODO: bootstrap.read_chunk();
+      if (! *m_import_file) {
+        MINFO("End of file reached");
+        finish(1);
+        return;
+      }
+
+      str1.assign(buffer1, sizeof(chunk_size));
+      if (! ::serialization::parse_binary(str1, chunk_size))
+      {
+        throw std::runtime_error("Error in deserialization of chunk size");
+      }
+      MDEBUG("chunk_size: " << chunk_size);
+
+      if (chunk_size > BUFFER_SIZE)
+      {
+        MWARNING("WARNING: chunk_size " << chunk_size << " > BUFFER_SIZE " << BUFFER_SIZE);
+        throw std::runtime_error("Aborting: chunk size exceeds buffer size");
+      }
+      if (chunk_size > CHUNK_SIZE_WARNING_THRESHOLD)
+      {
+        MINFO("NOTE: chunk_size " << chunk_size << " > " << CHUNK_SIZE_WARNING_THRESHOLD);
+      }
+      else if (chunk_size == 0) {
+        MFATAL("ERROR: chunk_size == 0");
+        finish(2);
+        return;
+      }
+      std::string chunk(chunk_size, '\0');
+      m_import_file->read(&chunk[0], chunk_size);
+      if (! *m_import_file) {
+        if (m_import_file->eof())
+        {
+          MINFO("End of file reached - file was truncated");
+          finish(1);
+        }
+        else
+        {
+          MFATAL("ERROR: unexpected end of file: bytes read before error: "
+              << m_import_file->gcount() << " of chunk_size " << chunk_size);
+          finish(2);
+        }
+        return;
+      }
+
+      if (!push(std::move(chunk), sizeof(chunk_size) + chunk_size))
+        return;
+    }
+  }
+
+  void run_v2()
+  {
+    tools::threadpool &tpool = tools::threadpool::getInstanceForCompute();
+    const size_t num_chunks = m_bootstrap->get_num_chunks();
+    size_t chunk = m_bootstrap->get_chunk(m_height);
+    while (chunk < num_chunks)
+    {
+      const size_t n = std::min(num_chunks - chunk, read_ahead_chunks);
+      std::vector<std::vector<cryptonote::blobdata>> blocks(n);
+      std::vector<char> ok(n, 0);
+      tools::threadpool::waiter waiter(tpool);
+      for (size_t i = 0; i < n; ++i)
+        tpool.submit(&waiter, [this, chunk, i, &blocks, &ok]() { ok[i] = m_bootstrap->read_chunk(chunk + i, blocks[i]); }, true);
+      waiter.wait();
+
+      for (size_t i = 0; i < n; ++i, ++chunk)
+      {
+        if (!ok[i])
+        {
+          MFATAL("Failed to read chunk " << chunk << " of the bootstrap file");
+          finish(2);
+          return;
+        }
+        // when resuming, the first chunk may start below the first height needed
+        uint64_t height = m_bootstrap->get_chunk_height(chunk);
+        for (cryptonote::blobdata &b: blocks[i])
+        {
+          if (height++ < m_height)
+            continue;
+          if (!check_block_stop())
+            return;
+          const uint64_t size = b.size();
+          if (!push(std::move(b), size))
+            return;
+        }
+      }
+    }
+    MINFO("End of file reached");
+    finish(1);
+  }
+
+  std::ifstream *m_import_file;
+  const BootstrapReader *m_bootstrap;
+  uint64_t m_height;
+  const uint64_t m_block_stop;
+  int m_status;
+  bool m_done;
+  bool m_stop;
+  uint64_t m_bytes_read;
+  uint64_t m_chunks_read;
+  std::deque<std::string> m_chunks;
+  boost::mutex m_mutex;
+  boost::condition_variable m_cond;
+  boost::thread m_thread;
+};
+
+// A block with its blobs and hashes, ready to be verified or stored
+struct parsed_block
+{
+  bool parsed = false;
+  cryptonote::block block;
+  cryptonote::blobdata block_blob;
+  crypto::hash block_hash;
+  std::vector<std::pair<cryptonote::transaction, cryptonote::blobdata>> txs;
+  std::vector<crypto::hash> tx_hashes;
+  size_t block_weight;
+  cryptonote::difficulty_type cumulative_difficulty;
+  uint64_t coins_generated;
+};
+
+struct parse_batch
+{
+  std::vector<std::string> chunks;
+  std::vector<parsed_block> blocks;
+  std::unique_ptr<tools::threadpool::waiter> waiter;
+};
+
+bool parse_block(const std::string &chunk, uint8_t major_version, parsed_block &pb)
+{
+  bootstrap::block_package bp;
+  bool res;
+  if (major_version == 0)
+  {
+    bootstrap::block_package_1 bp1;
+    res = ::serialization::parse_binary(chunk, bp1);
+    if (res)
+    {
+      bp.block = std::move(bp1.block);
+      bp.txs = std::move(bp1.txs);
+      bp.block_weight = bp1.block_weight;
+      bp.cumulative_difficulty = bp1.cumulative_difficulty;
+      bp.coins_generated = bp1.coins_generated;
+    }
+  }
+  else
+    res = ::serialization::parse_binary(chunk, bp);
+  if (!res)
+    return false;
+
+  // the hashes are cached in the block and txs, so they're not computed
+  // again when they get added
+  pb.block = std::move(bp.block);
+  pb.block_blob = cryptonote::block_to_blob(pb.block);
+  pb.block_hash = cryptonote::get_block_hash(pb.block);
+  pb.txs.reserve(bp.txs.size());
+  pb.tx_hashes.reserve(bp.txs.size());
+  for (const cryptonote::transaction &tx: bp.txs)
+  {
+    pb.txs.push_back(std::make_pair(tx, cryptonote::tx_to_blob(tx)));
+    pb.tx_hashes.push_back(cryptonote::get_transaction_hash(pb.txs.back().first));
+  }
+  pb.block_weight = bp.block_weight;
+  pb.cumulative_difficulty = bp.cumulative_difficulty;
+  pb.coins_generated = bp.coins_generated;
+  return true;
+}
+
+// takes the next chunks from the reader and parses them on the thread pool
+void start_parsing(chunk_reader &reader, uint8_t major_version, parse_batch &batch)
+{
+  batch.chunks.clear();
+  batch.blocks.clear();
+  std::string chunk;
+  while (batch.chunks.size() < parse_batch_size && reader.get(chunk))
+    batch.chunks.push_back(std::move(chunk));
+  batch.blocks.resize(batch.chunks.size());
+
+  tools::threadpool &tpool = tools::threadpool::getInstanceForCompute();
+  batch.waiter.reset(new tools::threadpool::waiter(tpool));
+  for (size_t i = 0; i < batch.chunks.size(); i += parse_task_size)
+  {
+    tpool.submit(batch.waiter.get(), [&batch, i, major_version]() {
+      const size_t end = std::min(i + parse_task_size, batch.chunks.size());
+      for (size_t n = i; n < end; ++n)
+      {
+        try { batch.blocks[n].parsed = parse_block(batch.chunks[n], major_version, batch.blocks[n]); }
+        catch (const std::exception &e) { MERROR("Failed to parse chunk: " << e.what()); }
+      }
+    }, true);
+  }
+}
+
+// blocks waiting to go through the same span verification as synced blocks
+struct pending_blocks
+{
+  std::vector<cryptonote::block_complete_entry> entries;
+  std::vector<crypto::hash> hashes;
+  std::vector<cryptonote::pool_supplement> txs;
+
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+  void clear() { entries.clear(); hashes.clear(); txs.clear(); }
+};
 }
 
 
@@ -127,7 +468,7 @@ int pop_blocks(cryptonote::core& core, int num_blocks)
   return num_blocks;
 }
 
-int check_flush(cryptonote::core &core, std::vector<block_complete_entry> &blocks, bool force)
+int check_flush(cryptonote::core &core, pending_blocks &blocks, bool force)
 {
   if (blocks.empty())
     return 0;
@@ -139,23 +480,10 @@ int check_flush(cryptonote::core &core, std::vector<block_complete_entry> &block
   if (!force && new_height % HASH_OF_HASHES_STEP)
     return 0;
 
-  std::vector<crypto::hash> hashes;
-  for (const auto &b: blocks)
-  {
-    cryptonote::block block;
-    if (!parse_and_validate_block_from_blob(b.block, block))
-    {
-      MERROR("Failed to parse block: "
-          << epee::string_tools::buff_to_hex_nodelimer(b.block));
-      core.cleanup_handle_incoming_blocks();
-      return 1;
-    }
-    hashes.push_back(cryptonote::get_block_hash(block));
-  }
-  core.prevalidate_block_hashes(core.get_blockchain_storage().get_db().height(), hashes, {});
+  core.prevalidate_block_hashes(core.get_blockchain_storage().get_db().height(), blocks.hashes, {});
 
   std::vector<block> pblocks;
-  if (!core.prepare_handle_incoming_blocks(blocks, pblocks))
+  if (!core.prepare_handle_incoming_blocks(blocks.entries, pblocks))
   {
     MERROR("Failed to prepare to add blocks");
     return 1;
@@ -167,42 +495,27 @@ int check_flush(cryptonote::core &core, std::vector<block_complete_entry> &block
     return 1;
   }
 
-  size_t blockidx = 0;
-  for(const block_complete_entry& block_entry: blocks)
+  // as when syncing, the txs of the whole span get their non-input
+  // consensus rules verified as one batch
+  const size_t num_unverified_blocks = cryptonote::ver_non_input_consensus(
+      epee::span<const pool_supplement>(blocks.txs.data(), blocks.txs.size()),
+      core.get_hard_fork_version(core.get_current_blockchain_height()));
+  if (num_unverified_blocks)
+    MDEBUG(num_unverified_blocks << " blocks failed batch tx verification, they will be verified on their own");
+
+  for (size_t blockidx = 0; blockidx < blocks.size(); ++blockidx)
   {
-    // process transactions
-    for(auto& tx_blob: block_entry.txs)
-    {
-      tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-      CHECK_AND_ASSERT_THROW_MES(tx_blob.prunable_hash == crypto::null_hash,
-        "block entry must not contain pruned txs");
-      core.handle_incoming_tx(tx_blob.blob, tvc, relay_method::block, true);
-      if(tvc.m_verifivation_failed)
-      {
-        cryptonote::transaction transaction;
-        if (cryptonote::parse_and_validate_tx_from_blob(tx_blob.blob, transaction))
-          MERROR("Transaction verification failed, tx_id = " << cryptonote::get_transaction_hash(transaction));
-        else
-          MERROR("Transaction verification failed, transaction is unparsable");
-        core.cleanup_handle_incoming_blocks();
-        return 1;
-      }
-    }
+    const block_complete_entry& block_entry = blocks.entries[blockidx];
 
     // process block
 
     block_verification_context bvc = {};
-    pool_supplement ps{};
 
-    core.handle_incoming_block(block_entry.block, pblocks.empty() ? NULL : &pblocks[blockidx++], bvc, ps, false); // <--- process block
+    core.handle_incoming_block(block_entry.block, pblocks.empty() ? NULL : &pblocks[blockidx], bvc, blocks.txs[blockidx], false); // <--- process block
 
     if(bvc.m_verifivation_failed)
     {
-      cryptonote::block block;
-      if (cryptonote::parse_and_validate_block_from_blob(block_entry.block, block))
-        MERROR("Block verification failed, id = " << cryptonote::get_block_hash(block));
-      else
-        MERROR("Block verification failed, block is unparsable");
+      MERROR("Block verification failed, id = " << blocks.hashes[blockidx]);
       core.cleanup_handle_incoming_blocks();
       return 1;
     }
@@ -273,11 +586,6 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
   uint64_t dummy;
   bootstrap.seek_to_first_chunk(import_file, major_version, minor_version, dummy, dummy);
 
-  std::string str1;
-  char buffer1[1024];
-  char buffer_block[BUFFER_SIZE];
-  block b;
-  transaction tx;
   int quit = 0;
   uint64_t bytes_read;
 
@@ -299,17 +607,31 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
   MINFO("Reading blockchain from bootstrap file...");
   std::cout << ENDL;
 
-  std::vector<block_complete_entry> blocks;
+  pending_blocks blocks;
 
-  // Skip to start_height before we start adding.
+  // v2 files are indexed, and read through a memory mapping
+  std::unique_ptr<BootstrapReader> indexed_file;
+  if (major_version >= 2)
+  {
+    indexed_file.reset(new BootstrapReader());
+    if (!indexed_file->open(import_file_path))
+    {
+      import_file.close();
+      return 2;
+    }
+    bytes_read = 0;
+    h = start_height;
+  }
+  else
   {
+    // Skip to start_height before we start adding.
     bool q2 = false;
     import_file.seekg(pos);
     bytes_read = bootstrap.count_bytes(import_file, start_height-seek_height, h, q2);
     if (q2)
     {
-      quit = 2;
-      goto quitting;
+      import_file.close();
+      return 2;
     }
     h = start_height;
   }
@@ -318,104 +640,57 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
   {
     uint64_t bytes, h2;
     bool q2;
-    pos = import_file.tellg();
-    bytes = bootstrap.count_bytes(import_file, db_batch_size, h2, q2);
-    if (import_file.eof())
-      import_file.clear();
-    import_file.seekg(pos);
-    core.get_blockchain_storage().get_db().batch_start(db_batch_size, bytes);
-  }
-  while (! quit)
-  {
-    uint32_t chunk_size;
-    import_file.read(buffer1, sizeof(chunk_size));
-    // TODO: bootstrap.read_chunk();
-    if (! import_file) {
-      std::cout << refresh_string;
-      MINFO("End of file reached");
-      quit = 1;
-      break;
-    }
-    bytes_read += sizeof(chunk_size);
-
-    str1.assign(buffer1, sizeof(chunk_size));
-    if (! ::serialization::parse_binary(str1, chunk_size))
+    if (indexed_file)
     {
-      throw std::runtime_error("Error in deserialization of chunk size");
+      bytes = 0;
+      for (size_t chunk = indexed_file->get_chunk(h); chunk < indexed_file->get_num_chunks() && indexed_file->get_chunk_height(chunk) < h + db_batch_size; ++chunk)
+        bytes += indexed_file->get_index().chunks[chunk].raw_size;
     }
-    MDEBUG("chunk_size: " << chunk_size);
-
-    if (chunk_size > BUFFER_SIZE)
+    else
     {
-      MWARNING("WARNING: chunk_size " << chunk_size << " > BUFFER_SIZE " << BUFFER_SIZE);
-      throw std::runtime_error("Aborting: chunk size exceeds buffer size");
+      pos = import_file.tellg();
+      bytes = bootstrap.count_bytes(import_file, db_batch_size, h2, q2);
+      if (import_file.eof())
+        import_file.clear();
+      import_file.seekg(pos);
     }
-    if (chunk_size > CHUNK_SIZE_WARNING_THRESHOLD)
+    core.get_blockchain_storage().get_db().batch_start(db_batch_size, bytes);
+  }
+
+  {
+    // one thread reads ahead, the thread pool parses the next batch of
+    // blocks while this one verifies or stores the current one
+    std::unique_ptr<chunk_reader> reader_ptr(indexed_file ?
+        new chunk_reader(*indexed_file, h, block_stop) :
+        new chunk_reader(import_file, h, block_stop));
+    chunk_reader &reader = *reader_ptr;
+    parse_batch batches[2];
+    size_t current = 0;
+    start_parsing(reader, major_version, batches[current]);
+    while (! quit)
     {
-      MINFO("NOTE: chunk_size " << chunk_size << " > " << CHUNK_SIZE_WARNING_THRESHOLD);
-    }
-    else if (chunk_size == 0) {
-      MFATAL("ERROR: chunk_size == 0");
-      return 2;
-    }
-    import_file.read(buffer_block, chunk_size);
-    if (! import_file) {
-      if (import_file.eof())
+      parse_batch &batch = batches[current];
+      batch.waiter->wait();
+      if (batch.blocks.empty())
       {
         std::cout << refresh_string;
-        MINFO("End of file reached - file was truncated");
-        quit = 1;
+        quit = reader.status();
         break;
       }
-      else
-      {
-        MFATAL("ERROR: unexpected end of file: bytes read before error: "
-            << import_file.gcount() << " of chunk_size " << chunk_size);
-        return 2;
-      }
-    }
-    bytes_read += chunk_size;
-    MDEBUG("Total bytes read: " << bytes_read);
+      start_parsing(reader, major_version, batches[current ^ 1]);
 
-    if (h > block_stop)
-    {
-      std::cout << refresh_string << "block " << h-1
-        << " / " << block_stop
-        << "\r" << std::flush;
-      std::cout << ENDL << ENDL;
-      MINFO("Specified block number reached - stopping.  block: " << h-1 << "  total blocks: " << h);
-      quit = 1;
-      break;
-    }
-
-    try
-    {
-      str1.assign(buffer_block, chunk_size);
-      bootstrap::block_package bp;
-      bool res;
-      if (major_version == 0)
+      int display_interval = 1000;
+      int progress_interval = 10;
+      for (parsed_block &pb: batch.blocks)
       {
-        bootstrap::block_package_1 bp1;
-        res = ::serialization::parse_binary(str1, bp1);
-        if (res)
+        if (!pb.parsed)
         {
-          bp.block = std::move(bp1.block);
-          bp.txs = std::move(bp1.txs);
-          bp.block_weight = bp1.block_weight;
-          bp.cumulative_difficulty = bp1.cumulative_difficulty;
-          bp.coins_generated = bp1.coins_generated;
+          std::cout << refresh_string;
+          MFATAL("exception while reading from file, height=" << h << ": Error in deserialization of chunk");
+          quit = 2;
+          break;
         }
-      }
-      else
-        res = ::serialization::parse_binary(str1, bp);
-      if (!res)
-        throw std::runtime_error("Error in deserialization of chunk");
 
-      int display_interval = 1000;
-      int progress_interval = 10;
-      // NOTE: use of NUM_BLOCKS_PER_CHUNK is a placeholder in case multi-block chunks are later supported.
-      for (int chunk_ind = 0; chunk_ind < NUM_BLOCKS_PER_CHUNK; ++chunk_ind)
-      {
         ++h;
         if ((h-1) % display_interval == 0)
         {
@@ -426,8 +701,7 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
         {
           MDEBUG("loading block number " << h-1);
         }
-        b = bp.block;
-        MDEBUG("block prev_id: " << b.prev_id << ENDL);
+        MDEBUG("block prev_id: " << pb.block.prev_id << ENDL);
 
         if ((h-1) % progress_interval == 0)
         {
@@ -438,19 +712,19 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
 
         if (opt_verify)
         {
-          cryptonote::blobdata block;
-          cryptonote::block_to_blob(bp.block, block);
-          std::vector<tx_blob_entry> txs;
-          for (const auto &tx: bp.txs)
-          {
-            txs.push_back({cryptonote::blobdata(), crypto::null_hash});
-            cryptonote::tx_to_blob(tx, txs.back().blob);
-          }
           block_complete_entry bce;
           bce.pruned = false;
-          bce.block = std::move(block);
-          bce.txs = std::move(txs);
-          blocks.push_back(bce);
+          bce.block = std::move(pb.block_blob);
+          bce.txs.reserve(pb.txs.size());
+          pool_supplement ps;
+          for (size_t i = 0; i < pb.txs.size(); ++i)
+          {
+            bce.txs.push_back({pb.txs[i].second, crypto::null_hash});
+            ps.txs_by_txid.emplace(pb.tx_hashes[i], std::move(pb.txs[i]));
+          }
+          blocks.entries.push_back(std::move(bce));
+          blocks.hashes.push_back(pb.block_hash);
+          blocks.txs.push_back(std::move(ps));
           int ret = check_flush(core, blocks, false);
           if (ret)
           {
@@ -460,38 +734,11 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
         }
         else
         {
-          std::vector<std::pair<transaction, blobdata>> txs;
-          std::vector<transaction> archived_txs;
-
-          archived_txs = bp.txs;
-
-          // tx number 1: coinbase tx
-          // tx number 2 onwards: archived_txs
-          for (const transaction &tx : archived_txs)
-          {
-            // add blocks with verification.
-            // for Blockchain and blockchain_storage add_new_block().
-            // for add_block() method, without (much) processing.
-            // don't add coinbase transaction to txs.
-            //
-            // because add_block() calls
-            // add_transaction(blk_hash, blk.miner_tx) first, and
-            // then a for loop for the transactions in txs.
-            txs.push_back(std::make_pair(tx, tx_to_blob(tx)));
-          }
-
-          size_t block_weight;
-          difficulty_type cumulative_difficulty;
-          uint64_t coins_generated;
-
-          block_weight = bp.block_weight;
-          cumulative_difficulty = bp.cumulative_difficulty;
-          coins_generated = bp.coins_generated;
-
+          // add_block() adds the miner tx first, so it's not among the txs
           try
           {
-            uint64_t long_term_block_weight = core.get_blockchain_storage().get_next_long_term_block_weight(block_weight);
-            core.get_blockchain_storage().get_db().add_block(std::make_pair(b, block_to_blob(b)), block_weight, long_term_block_weight, cumulative_difficulty, coins_generated, txs);
+            uint64_t long_term_block_weight = core.get_blockchain_storage().get_next_long_term_block_weight(pb.block_weight);
+            core.get_blockchain_storage().get_db().add_block(std::make_pair(pb.block, pb.block_blob), pb.block_weight, long_term_block_weight, pb.cumulative_difficulty, pb.coins_generated, pb.txs);
           }
           catch (const std::exception& e)
           {
@@ -505,16 +752,11 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
           {
             if ((h-1) % db_batch_size == 0)
             {
-              uint64_t bytes, h2;
-              bool q2;
               std::cout << refresh_string;
               // zero-based height
               std::cout << ENDL << "[- batch commit at height " << h-1 << " -]" << ENDL;
               core.get_blockchain_storage().get_db().batch_stop();
-              pos = import_file.tellg();
-              bytes = bootstrap.count_bytes(import_file, db_batch_size, h2, q2);
-              import_file.seekg(pos);
-              core.get_blockchain_storage().get_db().batch_start(db_batch_size, bytes);
+              core.get_blockchain_storage().get_db().batch_start(db_batch_size, db_batch_size * reader.get_average_chunk_size());
               std::cout << ENDL;
               core.get_blockchain_storage().get_db().show_stats();
             }
@@ -522,19 +764,19 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
         }
         ++num_imported;
       }
+      current ^= 1;
     }
-    catch (const std::exception& e)
-    {
-      std::cout << refresh_string;
-      MFATAL("exception while reading from file, height=" << h << ": " << e.what());
-      return 2;
-    }
-  } // while
 
-quitting:
+    // the batch being parsed ahead may still use the reader
+    for (parse_batch &b: batches)
+      if (b.waiter)
+        b.waiter->wait();
+    bytes_read += reader.get_bytes_read();
+  }
   import_file.close();
+  MDEBUG("Total bytes read: " << bytes_read);
 
-  if (opt_verify)
+  if (opt_verify && quit <= 1)
   {
     int ret = check_flush(core, blocks, true);
     if (ret)
@@ -246,6 +246,53 @@ static bool is_v1_tx(MDB_cursor *c_txs_pruned, MDB_val *tx_id)
   return cryptonote::is_v1_tx(cryptonote::blobdata_ref{(const char*)v.mv_data, v.mv_size});
 }
 
+// reads a value of the properties table, returns false if it is not set
+static bool get_property(MDB_env *env, const char *key, std::string &value)
+{
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  int dbr = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+  if (dbr) throw std::runtime_error("Failed to create LMDB transaction: " + std::string(mdb_strerror(dbr)));
+  epee::misc_utils::auto_scope_leave_caller txn_dtor = epee::misc_utils::create_scope_leave_handler([&](){
+    mdb_txn_abort(txn);
+  });
+  dbr = mdb_dbi_open(txn, "properties", 0, &dbi);
+  if (dbr) throw std::runtime_error("Failed to open LMDB dbi: " + std::string(mdb_strerror(dbr)));
+  MDB_val k, v;
+  k.mv_data = (void*)key;
+  k.mv_size = strlen(key) + 1;
+  dbr = mdb_get(txn, dbi, &k, &v);
+  if (dbr && dbr != MDB_NOTFOUND) throw std::runtime_error("Failed to read " + std::string(key) + " property: " + std::string(mdb_strerror(dbr)));
+  if (dbr)
+    return false;
+  value.assign((const char*)v.mv_data, v.mv_size);
+  return true;
+}
+
+// block and prunable tx data moved to cold storage is not in this database,
+// so neither the height nor the tx data could be read from its tables
+static bool has_cold_storage(MDB_env *env)
+{
+  std::string value;
+  return get_property(env, "cold_storage", value);
+}
+
+// compressed tx values are zstd frames, whose header is_v1_tx would take for
+// a tx version, and so drop the prunable data of v1 txes
+static bool has_compressed_blobs(MDB_env *env)
+{
+  std::string value;
+  if (get_property(env, "blob_compression_progress", value))
+    return true;
+  if (!get_property(env, "blob_compression", value))
+    return false;
+  uint32_t compressed = 0;
+  if (value.size() != sizeof(compressed))
+    throw std::runtime_error("Unexpected blob_compression value size");
+  memcpy(&compressed, value.data(), sizeof(compressed));
+  return compressed != 0;
+}
+
 static void prune(MDB_env *env0, MDB_env *env1)
 {
   MDB_dbi dbi0_blocks, dbi0_txs_pruned, dbi0_txs_prunable, dbi0_tx_indices, dbi1_txs_prunable, dbi1_txs_prunable_tip, dbi1_properties;
@@ -599,6 +646,18 @@ int main(int argc, char* argv[])
   MINFO("Pruning...");
   MDB_env *env0 = NULL, *env1 = NULL;
   open(env0, paths[0], db_flags, true);
+  if (has_cold_storage(env0))
+  {
+    close(env0);
+    MERROR("Part of the blockchain was moved to cold storage, which cannot be pruned");
+    return 1;
+  }
+  if (has_compressed_blobs(env0))
+  {
+    close(env0);
+    MERROR("The blockchain is compressed, which cannot be pruned. Run wownerod with --db-compression none first");
+    return 1;
+  }
   open(env1, paths[1], db_flags, false);
   copy_table(env0, env1, "blocks", MDB_INTEGERKEY, MDB_APPEND);
   copy_table(env0, env1, "block_info", MDB_INTEGERKEY | MDB_DUPSORT| MDB_DUPFIXED, MDB_APPENDDUP, BlockchainLMDB::compare_uint64);
@@ -611,6 +670,7 @@ int main(int argc, char* argv[])
   copy_table(env0, env1, "tx_outputs", MDB_INTEGERKEY, MDB_APPEND);
   copy_table(env0, env1, "output_txs", MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED, MDB_APPENDDUP, BlockchainLMDB::compare_uint64);
   copy_table(env0, env1, "output_amounts", MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED, MDB_APPENDDUP, BlockchainLMDB::compare_uint64);
+  copy_table(env0, env1, "output_distribution", MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED, MDB_APPENDDUP, BlockchainLMDB::compare_uint64);
   copy_table(env0, env1, "spent_keys", MDB_INTEGERKEY | MDB_DUPSORT | MDB_DUPFIXED, MDB_NODUPDATA, BlockchainLMDB::compare_hash32);
   copy_table(env0, env1, "txpool_meta", 0, MDB_NODUPDATA, BlockchainLMDB::compare_hash32);
   copy_table(env0, env1, "txpool_blob", 0, MDB_NODUPDATA, BlockchainLMDB::compare_hash32);
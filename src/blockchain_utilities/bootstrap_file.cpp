@@ -26,8 +26,11 @@
 // STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <boost/crc.hpp>
+
 #include "bootstrap_serialization.h"
 #include "serialization/binary_utils.h" // dump_binary(), parse_binary()
+#include "common/varint.h"
 #include "serialization/json_utils.h" // dump_json()
 
 #include "bootstrap_file.h"
@@ -47,7 +50,114 @@ namespace
   const uint32_t blockchain_raw_magic = 0x28721586;
   const uint32_t header_size = 1024;
 
+  // the last bytes of a v2 file: index offset, index size and this magic
+  const uint32_t bootstrap_index_magic = 0x6e4c91a3;
+  const size_t trailer_size = sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint32_t);
+
+  // v2 chunks start on a page boundary, and get closed past this size
+  const uint64_t page_size = 4096;
+  const uint64_t v2_chunk_size = 1024 * 1024;
+
+  uint32_t get_checksum(const void *data, size_t size)
+  {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+    return crc.checksum();
+  }
+
+  template<typename T>
+  bool read_pod(const char *data, size_t size, size_t &offset, T &value)
+  {
+    if (size < offset || size - offset < sizeof(T))
+      return false;
+    if (!::serialization::parse_binary(std::string(data + offset, sizeof(T)), value))
+      return false;
+    offset += sizeof(T);
+    return true;
+  }
+
   std::string refresh_string = "\r                                    \r";
+
+  // A v2 file always ends with an index. Writing to one leaves the index it
+  // had in place, and writes each new chunk followed by a provisional index
+  // and trailer, which the next chunk goes over. Until the final trailer is
+  // written, a journal next to the file holds the size the file had before,
+  // then the chunk_info of each chunk written since, so the index can be
+  // rebuilt and the export resumed if it is interrupted.
+  std::string get_append_journal_path(const std::string &file_path)
+  {
+    return file_path + ".append";
+  }
+
+  void write_append_journal_record(const std::string &file_path, const std::string &record, bool create)
+  {
+    std::string blob;
+    uint32_t record_size = record.size();
+    if (! ::serialization::dump_binary(record_size, blob))
+      throw std::runtime_error("Error in serialization of journal record size");
+    std::ofstream journal(get_append_journal_path(file_path), std::ios_base::binary | std::ios_base::out | (create ? std::ios_base::trunc : std::ios_base::app));
+    journal << blob << record;
+    journal.flush();
+    if (journal.fail())
+      throw std::runtime_error("Failed to write " + get_append_journal_path(file_path));
+  }
+
+  bool read_append_journal(const std::string &file_path, uint64_t &size, std::vector<bootstrap::chunk_info> &chunks)
+  {
+    std::ifstream journal(get_append_journal_path(file_path), std::ios_base::binary | std::ios_base::in);
+    if (journal.fail())
+      return false;
+    const std::string data((std::istreambuf_iterator<char>(journal)), std::istreambuf_iterator<char>());
+
+    // a record cut short by the interruption ends the journal
+    std::vector<std::string> records;
+    size_t offset = 0;
+    uint32_t record_size;
+    while (read_pod(data.data(), data.size(), offset, record_size) && record_size <= data.size() - offset)
+    {
+      records.push_back(data.substr(offset, record_size));
+      offset += record_size;
+    }
+    if (records.empty() || ! ::serialization::parse_binary(records[0], size))
+      throw std::runtime_error("Invalid append journal " + get_append_journal_path(file_path));
+    chunks.clear();
+    for (size_t i = 1; i < records.size(); ++i)
+    {
+      bootstrap::chunk_info ci;
+      if (! ::serialization::parse_binary(records[i], ci))
+        break;
+      chunks.push_back(ci);
+    }
+    return true;
+  }
+
+  void start_append_journal(const std::string &file_path, uint64_t size)
+  {
+    std::string blob;
+    if (! ::serialization::dump_binary(size, blob))
+      throw std::runtime_error("Error in serialization of file size");
+    write_append_journal_record(file_path, blob, true);
+  }
+
+  // writes the index at index_offset, followed by the trailer pointing to it
+  void write_index(std::ostream &file, uint64_t index_offset, const bootstrap::chunk_index &index)
+  {
+    const blobdata index_blob = t_serializable_object_to_blob(index);
+    std::string blob;
+    file.seekp(index_offset);
+    file << index_blob;
+    if (! ::serialization::dump_binary(index_offset, blob))
+      throw std::runtime_error("Error in serialization of index offset");
+    file << blob;
+    uint64_t index_size = index_blob.size();
+    if (! ::serialization::dump_binary(index_size, blob))
+      throw std::runtime_error("Error in serialization of index size");
+    file << blob;
+    uint32_t index_magic = bootstrap_index_magic;
+    if (! ::serialization::dump_binary(index_magic, blob))
+      throw std::runtime_error("Error in serialization of index magic");
+    file << blob;
+  }
 }
 
 
@@ -76,6 +186,22 @@ bool BootstrapFile::open_writer(const boost::filesystem::path& file_path, uint64
   }
 
   m_raw_data_file = new std::ofstream();
+  m_chunk_blocks = 0;
+  m_index = bootstrap::chunk_index();
+  if (m_compress)
+  {
+    if (m_version < 2)
+    {
+      MFATAL("Compression needs a v2 bootstrap file");
+      return false;
+    }
+    if (!blob_compressor::is_supported())
+    {
+      MFATAL("This build can't compress, it was made without zstd support");
+      return false;
+    }
+    m_compressor.reset(new blob_compressor(std::string()));
+  }
 
   bool do_initialize_file = false;
   uint64_t num_blocks = 0, block_first = 0;
@@ -86,8 +212,21 @@ bool BootstrapFile::open_writer(const boost::filesystem::path& file_path, uint64
     do_initialize_file = true;
     num_blocks = 0;
   }
+  else if (m_version >= 2)
+  {
+    return open_existing_v2(file_path);
+  }
   else
   {
+    std::ifstream existing_file(file_path.string(), std::ios_base::binary | std::ifstream::in);
+    uint8_t major_version, minor_version;
+    uint64_t dummy;
+    seek_to_first_chunk(existing_file, major_version, minor_version, dummy, dummy);
+    if (major_version >= 2)
+    {
+      MFATAL("Can't append v1 data to a v" << unsigned(major_version) << " bootstrap file: " << file_path);
+      return false;
+    }
     std::streampos dummy_pos;
     uint64_t dummy_height = 0;
     num_blocks = count_blocks(file_path.string(), dummy_pos, dummy_height, block_first);
@@ -108,11 +247,93 @@ bool BootstrapFile::open_writer(const boost::filesystem::path& file_path, uint64
     return false;
 
   if (do_initialize_file)
+  {
     initialize_file(start_block, stop_block);
+    if (m_version >= 2)
+    {
+      write_index(*m_raw_data_file, m_raw_data_file->tellp(), m_index);
+      m_raw_data_file->flush();
+      if (m_raw_data_file->fail())
+        return false;
+      m_data_end = m_raw_data_file->tellp();
+      m_append_journal = file_path.string();
+      start_append_journal(m_append_journal, m_data_end);
+    }
+  }
 
   return true;
 }
 
+bool BootstrapFile::open_existing_v2(const boost::filesystem::path& file_path)
+{
+  const std::string path = file_path.string();
+
+  // an interrupted export or append keeps the chunks it recorded, and gets
+  // its index written again after the last of them
+  uint64_t size;
+  std::vector<bootstrap::chunk_info> chunks;
+  if (read_append_journal(path, size, chunks))
+  {
+    BootstrapReader reader;
+    if (!reader.open(path, size))
+    {
+      MFATAL("Can't read the index " << file_path << " had before it was last written to");
+      return false;
+    }
+    bootstrap::chunk_index index = reader.get_index();
+    const uint64_t file_size = boost::filesystem::file_size(file_path);
+    uint64_t end = size;
+    for (const bootstrap::chunk_info &ci: chunks)
+    {
+      if (ci.offset < end || ci.offset > file_size || ci.size > file_size - ci.offset)
+        break;
+      index.chunks.push_back(ci);
+      end = ci.offset + ci.size;
+    }
+    MWARNING("Resuming the interrupted writing of " << file_path << ", keeping "
+        << index.chunks.size() - reader.get_num_chunks() << " chunks written since " << size << " bytes");
+    boost::filesystem::resize_file(file_path, end);
+    if (end != size)
+    {
+      std::fstream file(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+      write_index(file, end, index);
+      file.flush();
+      if (file.fail())
+      {
+        MFATAL("Failed to write the index of " << file_path);
+        return false;
+      }
+    }
+    boost::filesystem::remove(get_append_journal_path(path));
+  }
+
+  BootstrapReader reader;
+  if (!reader.open(path))
+  {
+    MFATAL("Can only append v2 data to a v2 bootstrap file: " << file_path);
+    return false;
+  }
+  if (!reader.get_index().compressed != !m_compress)
+  {
+    MFATAL("The existing file is " << (m_compress ? "not " : "") << "compressed");
+    return false;
+  }
+  m_index = reader.get_index();
+  m_height = reader.get_block_first() + reader.get_num_blocks();
+  MDEBUG("appending to existing v2 file with height: " << m_height-1 << "  total blocks: " << reader.get_num_blocks());
+
+  m_data_end = boost::filesystem::file_size(file_path);
+  m_append_journal = path;
+  start_append_journal(m_append_journal, m_data_end);
+
+  m_raw_data_file->open(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+  if (m_raw_data_file->fail())
+    return false;
+
+  m_output_stream = new boost::iostreams::stream<boost::iostreams::back_insert_device<buffer_type>>(m_buffer);
+  return true;
+}
+
 bool BootstrapFile::initialize_file(uint64_t first_block, uint64_t last_block)
 {
   const uint32_t file_magic = blockchain_raw_magic;
@@ -125,10 +346,13 @@ bool BootstrapFile::initialize_file(uint64_t first_block, uint64_t last_block)
   *m_raw_data_file << blob;
 
   bootstrap::file_info bfi;
-  bfi.major_version = 1;
+  bfi.major_version = m_version;
   bfi.minor_version = 0;
   bfi.header_size = header_size;
 
+  m_index.block_first = first_block;
+  m_index.compressed = m_compress;
+
   bootstrap::blocks_info bbi;
   bbi.block_first = first_block;
   bbi.block_last = last_block;
@@ -208,6 +432,70 @@ void BootstrapFile::flush_chunk()
   MDEBUG("flushed chunk:  chunk_size: " << chunk_size);
 }
 
+void BootstrapFile::flush_chunk_v2()
+{
+  m_output_stream->flush();
+
+  const std::string raw(m_buffer.begin(), m_buffer.end());
+  std::string compressed;
+  if (m_compressor && !m_compressor->compress(raw.data(), raw.size(), compressed))
+    throw std::runtime_error("Error compressing chunk");
+  const std::string &data = m_compressor ? compressed : raw;
+
+  const uint64_t offset = (m_data_end + page_size - 1) / page_size * page_size;
+  m_raw_data_file->seekp(m_data_end);
+  *m_raw_data_file << std::string(offset - m_data_end, 0);
+  m_raw_data_file->write(data.data(), data.size());
+  if (m_raw_data_file->fail())
+  {
+    MFATAL("Error writing chunk:  height: " << m_cur_height << "  chunk_size: " << data.size());
+    throw std::runtime_error("Error writing chunk");
+  }
+
+  bootstrap::chunk_info ci;
+  ci.offset = offset;
+  ci.size = data.size();
+  ci.raw_size = raw.size();
+  ci.num_blocks = m_chunk_blocks;
+  ci.checksum = get_checksum(data.data(), data.size());
+  m_index.chunks.push_back(ci);
+  if (m_max_chunk < data.size())
+    m_max_chunk = data.size();
+  m_data_end = offset + data.size();
+
+  // the file is complete with the provisional index, and the journal lets
+  // the next chunk go over that index
+  write_index(*m_raw_data_file, m_data_end, m_index);
+  m_raw_data_file->flush();
+  if (m_raw_data_file->fail())
+    throw std::runtime_error("Error writing index");
+  write_append_journal_record(m_append_journal, t_serializable_object_to_blob(ci), false);
+
+  m_chunk_blocks = 0;
+  m_buffer.clear();
+  delete m_output_stream;
+  m_output_stream = new boost::iostreams::stream<boost::iostreams::back_insert_device<buffer_type>>(m_buffer);
+  MDEBUG("flushed chunk:  chunk_size: " << data.size() << "  raw size: " << raw.size());
+}
+
+void BootstrapFile::write_block_package(const blobdata& bp_blob)
+{
+  if (m_version < 2)
+  {
+    m_output_stream->write((const char*)bp_blob.data(), bp_blob.size());
+    return;
+  }
+
+  std::string size;
+  tools::write_varint(std::back_inserter(size), bp_blob.size());
+  m_output_stream->write(size.data(), size.size());
+  m_output_stream->write((const char*)bp_blob.data(), bp_blob.size());
+  ++m_chunk_blocks;
+  m_output_stream->flush();
+  if (m_buffer.size() >= v2_chunk_size)
+    flush_chunk_v2();
+}
+
 void BootstrapFile::write_block(block& block)
 {
   bootstrap::block_package bp;
@@ -247,7 +535,7 @@ void BootstrapFile::write_block(block& block)
   }
 
   blobdata bd = t_serializable_object_to_blob(bp);
-  m_output_stream->write((const char*)bd.data(), bd.size());
+  write_block_package(bd);
 }
 
 bool BootstrapFile::close()
@@ -255,6 +543,18 @@ bool BootstrapFile::close()
   if (m_raw_data_file->fail())
     return false;
 
+  if (m_version >= 2)
+  {
+    // the file already ends with an index of all the chunks written
+    if (m_chunk_blocks)
+      flush_chunk_v2();
+    m_raw_data_file->flush();
+    if (m_raw_data_file->fail())
+      return false;
+    if (!m_append_journal.empty())
+      boost::filesystem::remove(get_append_journal_path(m_append_journal));
+  }
+
   m_raw_data_file->flush();
   delete m_output_stream;
   delete m_raw_data_file;
@@ -300,7 +600,10 @@ bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_mem
     crypto::hash hash = m_blockchain_storage->get_block_id_by_height(m_cur_height);
     m_blockchain_storage->get_block_by_hash(hash, b);
     write_block(b);
-    if (m_cur_height % NUM_BLOCKS_PER_CHUNK == 0) {
+    if (m_version >= 2) {
+      ++num_blocks_written;
+    }
+    else if (m_cur_height % NUM_BLOCKS_PER_CHUNK == 0) {
       flush_chunk();
       num_blocks_written += NUM_BLOCKS_PER_CHUNK;
     }
@@ -310,7 +613,7 @@ bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_mem
     }
   }
   // NOTE: use of NUM_BLOCKS_PER_CHUNK is a placeholder in case multi-block chunks are later supported.
-  if (m_cur_height % NUM_BLOCKS_PER_CHUNK != 0)
+  if (m_version < 2 && m_cur_height % NUM_BLOCKS_PER_CHUNK != 0)
   {
     flush_chunk();
   }
@@ -495,6 +798,23 @@ uint64_t BootstrapFile::count_blocks(const std::string& import_file_path, std::s
   uint64_t block_last;
   full_header_size = seek_to_first_chunk(import_file, major_version, minor_version, block_first, block_last);
 
+  if (major_version >= 2)
+  {
+    // no need to scan, the index knows
+    import_file.close();
+    BootstrapReader reader;
+    if (!reader.open(import_file_path))
+      throw std::runtime_error("Aborting");
+    block_first = reader.get_block_first();
+    h = reader.get_num_blocks();
+    if (seek_height < block_first)
+      seek_height = block_first;
+    start_pos = 0;
+    std::cout << "Number of chunks: " << reader.get_num_chunks() << ENDL;
+    std::cout << "Number of blocks: " << h << ENDL;
+    return h;
+  }
+
   MINFO("Scanning blockchain from bootstrap file...");
   bool quit = false;
   uint64_t bytes_read = 0, blocks;
@@ -533,3 +853,265 @@ uint64_t BootstrapFile::count_blocks(const std::string& import_file_path, std::s
   // one-based height.
   return h;
 }
+
+bool BootstrapFile::convert(const std::string& input_file, const boost::filesystem::path& output_file)
+{
+  if (m_version < 2)
+  {
+    MFATAL("Can only convert to a v2 bootstrap file");
+    return false;
+  }
+  if (boost::filesystem::exists(output_file))
+  {
+    MFATAL("Output file already exists: " << output_file);
+    return false;
+  }
+
+  std::ifstream import_file(input_file, std::ios_base::binary | std::ifstream::in);
+  if (import_file.fail())
+  {
+    MFATAL("import_file.open() fail");
+    return false;
+  }
+  uint8_t major_version, minor_version;
+  uint64_t block_first, block_last;
+  seek_to_first_chunk(import_file, major_version, minor_version, block_first, block_last);
+  if (major_version >= 2)
+  {
+    MFATAL("Input file is already v" << unsigned(major_version));
+    return false;
+  }
+
+  m_max_chunk = 0;
+  m_cur_height = block_first;
+  if (!open_writer(output_file, block_first, block_last))
+  {
+    MFATAL("failed to open raw file for write");
+    return false;
+  }
+
+  std::string str1;
+  std::vector<char> buffer(BUFFER_SIZE);
+  while (1)
+  {
+    uint32_t chunk_size;
+    import_file.read(buffer.data(), sizeof(chunk_size));
+    if (!import_file)
+      break;
+    str1.assign(buffer.data(), sizeof(chunk_size));
+    if (! ::serialization::parse_binary(str1, chunk_size))
+      throw std::runtime_error("Error in deserialization of chunk size");
+    if (chunk_size == 0 || chunk_size > BUFFER_SIZE)
+    {
+      MFATAL("Invalid chunk size " << chunk_size << " at height " << m_cur_height);
+      return false;
+    }
+    import_file.read(buffer.data(), chunk_size);
+    if (!import_file)
+    {
+      MWARNING("End of file reached - file was truncated");
+      break;
+    }
+    str1.assign(buffer.data(), chunk_size);
+
+    // v0 files used a 64 bit cumulative difficulty
+    if (major_version == 0)
+    {
+      bootstrap::block_package_1 bp1;
+      if (! ::serialization::parse_binary(str1, bp1))
+        throw std::runtime_error("Error in deserialization of chunk");
+      bootstrap::block_package bp;
+      bp.block = std::move(bp1.block);
+      bp.txs = std::move(bp1.txs);
+      bp.block_weight = bp1.block_weight;
+      bp.cumulative_difficulty = bp1.cumulative_difficulty;
+      bp.coins_generated = bp1.coins_generated;
+      str1 = t_serializable_object_to_blob(bp);
+    }
+    write_block_package(str1);
+
+    if (++m_cur_height % 1000 == 0)
+    {
+      std::cout << refresh_string;
+      std::cout << "block " << m_cur_height << "\r" << std::flush;
+    }
+  }
+  std::cout << refresh_string;
+
+  MINFO("Number of blocks converted: " << m_cur_height - block_first);
+  MINFO("Largest chunk: " << m_max_chunk << " bytes");
+  return BootstrapFile::close();
+}
+
+bool BootstrapReader::open(const std::string& file_path)
+{
+  // a file being written ends with a provisional index, except while a
+  // chunk goes over it, when the index it had before is used
+  uint64_t size;
+  std::vector<bootstrap::chunk_info> chunks;
+  bool writing;
+  try
+  {
+    writing = read_append_journal(file_path, size, chunks);
+  }
+  catch (const std::exception &e)
+  {
+    MERROR(e.what());
+    return false;
+  }
+  if (open(file_path, 0))
+    return true;
+  if (!writing)
+    return false;
+  MINFO(file_path << " is being written, or its writing was interrupted, reading its first " << size << " bytes");
+  return open(file_path, size);
+}
+
+bool BootstrapReader::open(const std::string& file_path, uint64_t file_size)
+{
+  try
+  {
+    m_file = boost::interprocess::file_mapping(file_path.c_str(), boost::interprocess::read_only);
+    m_region = boost::interprocess::mapped_region(m_file, boost::interprocess::read_only, 0, file_size);
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Failed to map " << file_path << ": " << e.what());
+    return false;
+  }
+  const char *data = (const char*)m_region.get_address();
+  const size_t size = m_region.get_size();
+
+  size_t offset = 0;
+  uint32_t file_magic, buflen_file_info;
+  if (!read_pod(data, size, offset, file_magic) || file_magic != blockchain_raw_magic)
+  {
+    MERROR("bootstrap file not recognized");
+    return false;
+  }
+  if (!read_pod(data, size, offset, buflen_file_info) || buflen_file_info > size - offset)
+  {
+    MERROR("Invalid bootstrap::file_info size");
+    return false;
+  }
+  bootstrap::file_info bfi;
+  if (! ::serialization::parse_binary(std::string(data + offset, buflen_file_info), bfi))
+  {
+    MERROR("Error in deserialization of bootstrap::file_info");
+    return false;
+  }
+  if (bfi.major_version < 2)
+  {
+    MERROR("Not a v2 bootstrap file: v" << unsigned(bfi.major_version) << "." << unsigned(bfi.minor_version));
+    return false;
+  }
+  const uint64_t data_start = sizeof(file_magic) + bfi.header_size;
+
+  uint64_t index_offset, index_size;
+  uint32_t index_magic;
+  offset = size < trailer_size ? 0 : size - trailer_size;
+  if (size < data_start + trailer_size ||
+      !read_pod(data, size, offset, index_offset) || !read_pod(data, size, offset, index_size) ||
+      !read_pod(data, size, offset, index_magic) || index_magic != bootstrap_index_magic)
+  {
+    MERROR("Bootstrap file has no index, it may be truncated or still being written");
+    return false;
+  }
+  if (index_offset < data_start || index_offset > size - trailer_size || index_size != size - trailer_size - index_offset)
+  {
+    MERROR("Invalid bootstrap file index location");
+    return false;
+  }
+  if (! ::serialization::parse_binary(std::string(data + index_offset, index_size), m_index))
+  {
+    MERROR("Error in deserialization of bootstrap file index");
+    return false;
+  }
+  m_index_offset = index_offset;
+
+  m_chunk_heights.clear();
+  m_chunk_heights.reserve(m_index.chunks.size() + 1);
+  uint64_t height = m_index.block_first, end = data_start;
+  for (const bootstrap::chunk_info &ci: m_index.chunks)
+  {
+    if (ci.offset < end || ci.offset % page_size || ci.offset > index_offset || ci.size > index_offset - ci.offset || ci.num_blocks == 0)
+    {
+      MERROR("Invalid chunk in bootstrap file index");
+      return false;
+    }
+    end = ci.offset + ci.size;
+    m_chunk_heights.push_back(height);
+    height += ci.num_blocks;
+  }
+  m_chunk_heights.push_back(height);
+
+  if (m_index.compressed)
+  {
+    if (!blob_compressor::is_supported())
+    {
+      MERROR("The bootstrap file is compressed, but this build was made without zstd support");
+      return false;
+    }
+    m_compressor.reset(new blob_compressor(std::string()));
+  }
+  return true;
+}
+
+size_t BootstrapReader::get_chunk(uint64_t height) const
+{
+  if (height < m_chunk_heights.front() || height >= m_chunk_heights.back())
+    return get_num_chunks();
+  return std::upper_bound(m_chunk_heights.begin(), m_chunk_heights.end(), height) - m_chunk_heights.begin() - 1;
+}
+
+bool BootstrapReader::read_chunk(size_t chunk, std::vector<blobdata>& blocks) const
+{
+  blocks.clear();
+  if (chunk >= m_index.chunks.size())
+    return false;
+  const bootstrap::chunk_info &ci = m_index.chunks[chunk];
+  const char *data = (const char*)m_region.get_address() + ci.offset;
+  if (get_checksum(data, ci.size) != ci.checksum)
+  {
+    MERROR("Checksum mismatch in bootstrap file chunk " << chunk << ", at height " << m_chunk_heights[chunk]);
+    return false;
+  }
+
+  std::string decompressed;
+  if (m_compressor)
+  {
+    if (!m_compressor->decompress(data, ci.size, decompressed))
+    {
+      MERROR("Failed to decompress bootstrap file chunk " << chunk);
+      return false;
+    }
+    data = decompressed.data();
+  }
+  const size_t size = m_compressor ? decompressed.size() : ci.size;
+  if (size != ci.raw_size)
+  {
+    MERROR("Unexpected size for bootstrap file chunk " << chunk);
+    return false;
+  }
+
+  blocks.reserve(ci.num_blocks);
+  const char *ptr = data, *end = data + size;
+  while (ptr < end)
+  {
+    uint64_t block_size;
+    const int read = tools::read_varint(ptr, end, block_size);
+    if (read <= 0 || block_size > (uint64_t)(end - ptr))
+    {
+      MERROR("Invalid block size in bootstrap file chunk " << chunk);
+      return false;
+    }
+    blocks.emplace_back(ptr, block_size);
+    ptr += block_size;
+  }
+  if (blocks.size() != ci.num_blocks)
+  {
+    MERROR("Unexpected number of blocks in bootstrap file chunk " << chunk);
+    return false;
+  }
+  return true;
+}
@@ -34,19 +34,24 @@
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #include "cryptonote_basic/cryptonote_basic.h"
 #include "cryptonote_core/blockchain.h"
+#include "blockchain_db/blob_compression.h"
 
 #include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <atomic>
+#include <memory>
 
 #include "common/command_line.h"
 #include "version.h"
 
 #include "blockchain_utilities.h"
+#include "bootstrap_serialization.h"
 
 
 using namespace cryptonote;
@@ -56,6 +61,11 @@ class BootstrapFile
 {
 public:
 
+  BootstrapFile(): m_version(1), m_compress(false), m_chunk_blocks(0), m_data_end(0) {}
+
+  // files are written as v1 unless asked otherwise, compression needs v2
+  void set_format(uint8_t version, bool compress) { m_version = version; m_compress = compress; }
+
   uint64_t count_bytes(std::ifstream& import_file, uint64_t blocks, uint64_t& h, bool& quit);
   uint64_t count_blocks(const std::string& dir_path, std::streampos& start_pos, uint64_t& seek_height, uint64_t& block_first);
   uint64_t count_blocks(const std::string& dir_path);
@@ -64,6 +74,9 @@ public:
   bool store_blockchain_raw(cryptonote::Blockchain* cs, cryptonote::tx_memory_pool* txp,
       boost::filesystem::path& output_file, uint64_t start_block=0, uint64_t stop_block=0);
 
+  // rewrites a v0 or v1 file in the format set by set_format
+  bool convert(const std::string& input_file, const boost::filesystem::path& output_file);
+
 protected:
 
   Blockchain* m_blockchain_storage;
@@ -79,11 +92,58 @@ protected:
   bool initialize_file(uint64_t start_block, uint64_t stop_block);
   bool close();
   void write_block(block& block);
+  void write_block_package(const blobdata& bp_blob);
   void flush_chunk();
+  void flush_chunk_v2();
+  bool open_existing_v2(const boost::filesystem::path& file_path);
 
 private:
 
   uint64_t m_height;
   uint64_t m_cur_height; // tracks current height during export
   uint32_t m_max_chunk;
+  uint8_t m_version;
+  bool m_compress;
+  uint64_t m_chunk_blocks; // blocks in the v2 chunk being built
+  bootstrap::chunk_index m_index;
+  uint64_t m_data_end; // where the next v2 chunk may start
+  std::string m_append_journal; // the v2 file whose journal goes once it is complete
+  std::unique_ptr<cryptonote::blob_compressor> m_compressor;
+};
+
+// Random access to a v2 file, which is mapped in memory. Chunks can be read
+// from several threads at once, so non-overlapping ranges of heights can be
+// handed to different workers.
+class BootstrapReader
+{
+public:
+
+  // a file being written, or whose writing was interrupted, is read as
+  // far as it has an index
+  bool open(const std::string& file_path);
+  // reads only the first file_size bytes, 0 for all of them
+  bool open(const std::string& file_path, uint64_t file_size);
+
+  const bootstrap::chunk_index& get_index() const { return m_index; }
+  uint64_t get_index_offset() const { return m_index_offset; }
+  uint64_t get_block_first() const { return m_index.block_first; }
+  uint64_t get_num_blocks() const { return m_chunk_heights.back() - m_index.block_first; }
+  size_t get_num_chunks() const { return m_index.chunks.size(); }
+
+  // the chunk holding the block at that height, get_num_chunks() if none does
+  size_t get_chunk(uint64_t height) const;
+  uint64_t get_chunk_height(size_t chunk) const { return m_chunk_heights[chunk]; }
+
+  // checks a chunk against its checksum and splits it into the serialized
+  // block packages it holds
+  bool read_chunk(size_t chunk, std::vector<blobdata>& blocks) const;
+
+private:
+
+  boost::interprocess::file_mapping m_file;
+  boost::interprocess::mapped_region m_region;
+  bootstrap::chunk_index m_index;
+  uint64_t m_index_offset;
+  std::vector<uint64_t> m_chunk_heights; // first height of each chunk, then the end
+  std::unique_ptr<cryptonote::blob_compressor> m_compressor;
 };
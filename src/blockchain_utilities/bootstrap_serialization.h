@@ -100,6 +100,42 @@ namespace cryptonote
       END_SERIALIZE()
     };
 
+    // A v2 file keeps consecutive blocks together in chunks, each starting
+    // on a page boundary. A chunk is a sequence of varint sizes each
+    // followed by a serialized block_package, possibly compressed as a
+    // whole with zstd.
+    struct chunk_info
+    {
+      uint64_t offset;
+      uint64_t size; // bytes in the file
+      uint64_t raw_size; // bytes once decompressed
+      uint64_t num_blocks;
+      uint32_t checksum; // crc32 of the bytes in the file
+
+      BEGIN_SERIALIZE_OBJECT()
+        VARINT_FIELD(offset)
+        VARINT_FIELD(size)
+        VARINT_FIELD(raw_size)
+        VARINT_FIELD(num_blocks)
+        FIELD(checksum)
+      END_SERIALIZE()
+    };
+
+    // The index of a v2 file follows its last chunk, and is located by
+    // the fixed size trailer at the very end of the file
+    struct chunk_index
+    {
+      uint64_t block_first;
+      uint8_t compressed;
+      std::vector<chunk_info> chunks;
+
+      BEGIN_SERIALIZE_OBJECT()
+        VARINT_FIELD(block_first)
+        FIELD(compressed)
+        FIELD(chunks)
+      END_SERIALIZE()
+    };
+
   }
 
 }
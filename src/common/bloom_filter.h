@@ -0,0 +1,130 @@
+// Copyright (c) 2014-2022, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <type_traits>
+
+namespace tools
+{
+  // A blocked Bloom filter over values which already look random, such as
+  // hashes or key images. Each value sets one bit in each of the eight 32 bit
+  // words of a single 256 bit block, so a lookup touches one cache line.
+  // Values can't be removed. Adding and testing may run concurrently, and a
+  // value is seen by has() on any thread once add() has returned.
+  template<typename T>
+  class bloom_filter
+  {
+    static_assert(std::is_trivially_copyable<T>::value && sizeof(T) >= 16, "bloom_filter needs 16 bytes or more of random data");
+
+  public:
+    bloom_filter(uint64_t max_values, unsigned bits_per_value):
+      m_num_blocks(std::max<uint64_t>(1, (max_values * bits_per_value + BLOCK_BITS - 1) / BLOCK_BITS)),
+      m_words(new std::atomic<uint32_t>[m_num_blocks * WORDS_PER_BLOCK]),
+      m_max_values(max_values),
+      m_num_values(0)
+    {
+      for (uint64_t i = 0; i < m_num_blocks * WORDS_PER_BLOCK; ++i)
+        m_words[i].store(0, std::memory_order_relaxed);
+      std::random_device rd;
+      m_salt = ((uint64_t)rd() << 32) | rd();
+    }
+
+    void add(const T &value)
+    {
+      uint64_t block, bits;
+      get_position(value, block, bits);
+      std::atomic<uint32_t> *words = &m_words[block * WORDS_PER_BLOCK];
+      for (size_t i = 0; i < WORDS_PER_BLOCK; ++i)
+        words[i].fetch_or(get_mask(bits, i), std::memory_order_release);
+      m_num_values.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // false means the value was never added, true means it may have been
+    bool has(const T &value) const
+    {
+      uint64_t block, bits;
+      get_position(value, block, bits);
+      const std::atomic<uint32_t> *words = &m_words[block * WORDS_PER_BLOCK];
+      for (size_t i = 0; i < WORDS_PER_BLOCK; ++i)
+      {
+        const uint32_t mask = get_mask(bits, i);
+        if ((words[i].load(std::memory_order_acquire) & mask) != mask)
+          return false;
+      }
+      return true;
+    }
+
+    uint64_t get_memory_usage() const { return m_num_blocks * BLOCK_BITS / 8; }
+    uint64_t get_max_values() const { return m_max_values; }
+    uint64_t get_num_values() const { return m_num_values.load(std::memory_order_relaxed); }
+
+  private:
+    static constexpr size_t WORDS_PER_BLOCK = 8;
+    static constexpr uint64_t BLOCK_BITS = WORDS_PER_BLOCK * 32;
+
+    static uint64_t mix(uint64_t x)
+    {
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccdull;
+      x ^= x >> 33;
+      x *= 0xc4ceb9fe1a85ec53ull;
+      x ^= x >> 33;
+      return x;
+    }
+
+    void get_position(const T &value, uint64_t &block, uint64_t &bits) const
+    {
+      uint64_t w[2];
+      memcpy(w, &value, sizeof(w));
+      block = mix(w[0] ^ m_salt) % m_num_blocks;
+      bits = mix(w[1] + m_salt);
+    }
+
+    static uint32_t get_mask(uint64_t bits, size_t word)
+    {
+      static const uint32_t salt[WORDS_PER_BLOCK] = {
+        0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+        0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+      };
+      return 1u << ((uint32_t(bits) * salt[word]) >> 27);
+    }
+
+    const uint64_t m_num_blocks;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_words;
+    const uint64_t m_max_values;
+    std::atomic<uint64_t> m_num_values;
+    uint64_t m_salt;
+  };
+}
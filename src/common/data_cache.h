@@ -30,36 +30,147 @@
 
 #pragma once 
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <unordered_set>
 #include <mutex>
+#include <vector>
 
 namespace tools
 {
-  template<typename T, size_t MAX_SIZE>
+  // A fixed capacity set which forgets its oldest entries first. Entries are
+  // spread over NUM_SHARDS independently locked shards, so threads looking up
+  // different values rarely contend on the same mutex.
+  template<typename T, size_t NUM_SHARDS = 16>
   class data_cache
   {
   public:
+    explicit data_cache(size_t max_size = 8192)
+    {
+      resize(max_size);
+    }
+
     void add(const T& value)
     {
-      std::lock_guard<std::mutex> lock(m);
-      if (data.insert(value).second)
+      shard &s = get_shard(value);
+      std::lock_guard<std::mutex> lock(s.m);
+      if (s.max_size == 0)
+        return;
+      if (s.data.insert(value).second)
       {
-        T& old_value = buf[counter++ % MAX_SIZE];
-        data.erase(old_value);
-        old_value = value;
+        if (s.buf.size() < s.max_size)
+        {
+          s.buf.push_back(value);
+        }
+        else
+        {
+          T& old_value = s.buf[s.counter++ % s.max_size];
+          s.data.erase(old_value);
+          old_value = value;
+        }
       }
     }
 
     bool has(const T& value) const
     {
-      std::lock_guard<std::mutex> lock(m);
-      return (data.find(value) != data.end());
+      const shard &s = get_shard(value);
+      std::lock_guard<std::mutex> lock(s.m);
+      const bool found = s.data.find(value) != s.data.end();
+      ++(found ? m_hits : m_misses);
+      return found;
+    }
+
+    // Change the capacity, dropping the oldest entries if shrinking
+    void resize(size_t max_size)
+    {
+      const size_t shard_max_size = (max_size + NUM_SHARDS - 1) / NUM_SHARDS;
+      for (shard &s: m_shards)
+      {
+        std::lock_guard<std::mutex> lock(s.m);
+        std::vector<T> entries = s.get_entries();
+        const size_t skip = entries.size() > shard_max_size ? entries.size() - shard_max_size : 0;
+        s.data.clear();
+        s.buf.clear();
+        s.buf.reserve(std::min(shard_max_size, entries.size()));
+        s.counter = 0;
+        s.max_size = shard_max_size;
+        for (size_t i = skip; i < entries.size(); ++i)
+        {
+          s.data.insert(entries[i]);
+          s.buf.push_back(std::move(entries[i]));
+        }
+      }
+      m_max_size = shard_max_size * NUM_SHARDS;
+    }
+
+    // All entries, oldest first within each shard, so that adding them back
+    // in this order to a new cache gives the same eviction order
+    std::vector<T> get_entries() const
+    {
+      std::vector<T> entries;
+      for (const shard &s: m_shards)
+      {
+        std::lock_guard<std::mutex> lock(s.m);
+        const std::vector<T> shard_entries = s.get_entries();
+        entries.insert(entries.end(), shard_entries.begin(), shard_entries.end());
+      }
+      return entries;
+    }
+
+    size_t size() const
+    {
+      size_t n = 0;
+      for (const shard &s: m_shards)
+      {
+        std::lock_guard<std::mutex> lock(s.m);
+        n += s.data.size();
+      }
+      return n;
     }
 
+    size_t capacity() const { return m_max_size; }
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+
   private:
-    mutable std::mutex m;
-    std::unordered_set<T> data;
-    T buf[MAX_SIZE] = {};
-    size_t counter = 0;
+    struct shard
+    {
+      mutable std::mutex m;
+      std::unordered_set<T> data;
+      std::vector<T> buf;
+      size_t counter = 0;
+      size_t max_size = 0;
+
+      std::vector<T> get_entries() const
+      {
+        if (buf.size() < max_size)
+          return buf;
+        std::vector<T> entries;
+        entries.reserve(buf.size());
+        for (size_t i = 0; i < buf.size(); ++i)
+          entries.push_back(buf[(counter + i) % buf.size()]);
+        return entries;
+      }
+    };
+
+    // The shard sets bucket on the low bits of the same hash, so picking the
+    // shard from those too would leave most buckets of each set empty. Scale
+    // the top bits of a multiplicative mix into range instead.
+    static size_t get_shard_index(const T& value)
+    {
+      const uint64_t h = (uint64_t)std::hash<T>()(value) * 0x9e3779b97f4a7c15ull;
+      return ((h >> 32) * NUM_SHARDS) >> 32;
+    }
+
+    shard &get_shard(const T& value) { return m_shards[get_shard_index(value)]; }
+    const shard &get_shard(const T& value) const { return m_shards[get_shard_index(value)]; }
+
+    std::array<shard, NUM_SHARDS> m_shards;
+    size_t m_max_size = 0;
+    mutable std::atomic<uint64_t> m_hits{0};
+    mutable std::atomic<uint64_t> m_misses{0};
   };
 }
@@ -25,6 +25,8 @@
 // INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
 // STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include <algorithm>
+#include <limits>
 #include "misc_log_ex.h"
 #include "common/threadpool.h"
 
@@ -33,11 +35,28 @@
 
 static __thread int depth = 0;
 static __thread bool is_leaf = false;
+static __thread const tools::threadpool *current_pool = NULL;
+static __thread int current_worker = -1;
+static __thread int current_priority = tools::threadpool::PRIORITY_NORMAL;
 
 namespace tools
 {
-threadpool::threadpool(unsigned int max_threads) : running(true), active(0) {
-  create(max_threads);
+constexpr size_t threadpool::NUM_LATENCY_BUCKETS;
+
+threadpool::threadpool(unsigned int max_threads) : next_queue(0), active(0), idle(0), running(true),
+    num_submitted(0), num_executed(0), num_inlined(0), num_steals(0) {
+  for (auto &p: pending)
+    p = 0;
+  for (auto &b: latency_histogram)
+    b = 0;
+  max = max_threads ? max_threads : tools::get_max_concurrency();
+  // the queues live as long as the pool, and are kept across a recycle,
+  // so workers and stealers can hold on to them without a lock
+  const size_t nqueues = std::max<size_t>(max ? max - 1 : 0, 1);
+  queues.reserve(nqueues);
+  while (queues.size() < nqueues)
+    queues.emplace_back(new worker_queue());
+  create();
 }
 
 threadpool::~threadpool() {
@@ -67,41 +86,56 @@ void threadpool::destroy() {
 
 void threadpool::recycle() {
   destroy();
-  create(max);
+  create();
 }
 
-void threadpool::create(unsigned int max_threads) {
+void threadpool::create() {
   const boost::unique_lock<boost::mutex> lock(mutex);
   boost::thread::attributes attrs;
   attrs.set_stack_size(THREAD_STACK_SIZE);
-  max = max_threads ? max_threads : tools::get_max_concurrency();
   size_t i = max ? max - 1 : 0;
   running = true;
-  while(i--) {
-    threads.push_back(boost::thread(attrs, boost::bind(&threadpool::run, this, false)));
+  for (size_t n = 0; n < i; ++n) {
+    threads.push_back(boost::thread(attrs, boost::bind(&threadpool::run_worker, this, (int)n)));
   }
 }
 
-void threadpool::submit(waiter *obj, std::function<void()> f, bool leaf) {
+void threadpool::submit(waiter *obj, std::function<void()> f, bool leaf, priority prio) {
   CHECK_AND_ASSERT_THROW_MES(!is_leaf, "A leaf routine is using a thread pool");
-  boost::unique_lock<boost::mutex> lock(mutex);
-  if (!leaf && ((active == max && !queue.empty()) || depth > 0)) {
+  if (current_priority < prio)
+    prio = (priority)current_priority;
+  ++num_submitted;
+  if (!leaf && ((active == max && pending[PRIORITY_HIGH] + pending[PRIORITY_NORMAL] > 0) || depth > 0)) {
     // if all available threads are already running
     // and there's work waiting, just run in current thread
-    lock.unlock();
+    ++num_inlined;
+    const int saved_priority = current_priority;
     ++depth;
     is_leaf = leaf;
+    current_priority = prio;
     f();
     --depth;
     is_leaf = false;
+    current_priority = saved_priority;
   } else {
     if (obj)
       obj->inc();
-    if (leaf)
-      queue.push_front({obj, f, leaf});
-    else
-      queue.push_back({obj, f, leaf});
-    has_work.notify_one();
+    const int self = current_pool == this ? current_worker : -1;
+    worker_queue &q = *queues[self >= 0 ? self : next_queue++ % queues.size()];
+    {
+      const boost::unique_lock<boost::mutex> lock(q.mutex);
+      if (leaf)
+        q.queue[prio].push_front({obj, std::move(f), leaf, prio, std::chrono::steady_clock::now()});
+      else
+        q.queue[prio].push_back({obj, std::move(f), leaf, prio, std::chrono::steady_clock::now()});
+      ++pending[prio];
+    }
+    // a thread going idle increments idle before checking pending, so
+    // either it sees this task or we see it and wake it up
+    if (idle > 0) {
+      const boost::unique_lock<boost::mutex> lock(mutex);
+      has_work.notify_one();
+    }
   }
 }
 
@@ -109,6 +143,26 @@ unsigned int threadpool::get_max_concurrency() const {
   return max;
 }
 
+uint64_t threadpool::get_latency_bucket_limit_us(size_t bucket) {
+  static const uint64_t limits[NUM_LATENCY_BUCKETS - 1] = { 10, 100, 1000, 10000, 100000 };
+  return bucket < NUM_LATENCY_BUCKETS - 1 ? limits[bucket] : std::numeric_limits<uint64_t>::max();
+}
+
+threadpool::stats threadpool::get_stats() const {
+  stats s;
+  s.threads = threads.size();
+  s.active = active;
+  for (size_t p = 0; p < NUM_PRIORITIES; ++p)
+    s.queue_depth[p] = pending[p];
+  s.submitted = num_submitted;
+  s.executed = num_executed;
+  s.inlined = num_inlined;
+  s.steals = num_steals;
+  for (size_t b = 0; b < NUM_LATENCY_BUCKETS; ++b)
+    s.latency_histogram[b] = latency_histogram[b];
+  return s;
+}
+
 threadpool::waiter::~waiter()
 {
   try
@@ -148,32 +202,82 @@ void threadpool::waiter::dec() {
     cv.notify_all();
 }
 
+bool threadpool::pop(int self, entry &e) {
+  const size_t nqueues = queues.size();
+  for (size_t p = 0; p < NUM_PRIORITIES; ++p) {
+    if (pending[p] == 0)
+      continue;
+    if (self >= 0) {
+      worker_queue &q = *queues[self];
+      const boost::unique_lock<boost::mutex> lock(q.mutex);
+      if (!q.queue[p].empty()) {
+        e = std::move(q.queue[p].front());
+        q.queue[p].pop_front();
+        --pending[p];
+        return true;
+      }
+    }
+    const size_t start = self >= 0 ? self : nqueues - 1;
+    for (size_t i = 1; i <= nqueues; ++i) {
+      const size_t idx = (start + i) % nqueues;
+      if ((int)idx == self)
+        continue;
+      worker_queue &q = *queues[idx];
+      const boost::unique_lock<boost::mutex> lock(q.mutex);
+      if (!q.queue[p].empty()) {
+        e = std::move(q.queue[p].back());
+        q.queue[p].pop_back();
+        --pending[p];
+        ++num_steals;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void threadpool::run_worker(int self) {
+  current_pool = this;
+  current_worker = self;
+  run(false);
+}
+
 void threadpool::run(bool flush) {
-  boost::unique_lock<boost::mutex> lock(mutex);
+  const int self = current_pool == this ? current_worker : -1;
   while (running) {
     entry e;
-    while(queue.empty() && running)
+    if (!pop(self, e))
     {
       if (flush)
         return;
-      has_work.wait(lock);
+      boost::unique_lock<boost::mutex> lock(mutex);
+      ++idle;
+      while (pending[PRIORITY_HIGH] + pending[PRIORITY_NORMAL] == 0 && running)
+        has_work.wait(lock);
+      --idle;
+      continue;
     }
-    if (!running) break;
 
     active++;
-    e = std::move(queue.front());
-    queue.pop_front();
-    lock.unlock();
+    ++num_executed;
+    const uint64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - e.submitted).count();
+    size_t bucket = 0;
+    while (latency_us >= get_latency_bucket_limit_us(bucket))
+      ++bucket;
+    ++latency_histogram[bucket];
+
+    const int saved_priority = current_priority;
     ++depth;
     is_leaf = e.leaf;
+    current_priority = e.prio;
     try { e.f(); }
-    catch (const std::exception &ex) { e.wo->set_error(); try { MERROR("Exception in threadpool job: " << ex.what()); } catch (...) {} }
+    catch (const std::exception &ex) { if (e.wo) e.wo->set_error(); try { MERROR("Exception in threadpool job: " << ex.what()); } catch (...) {} }
     --depth;
     is_leaf = false;
+    current_priority = saved_priority;
 
     if (e.wo)
       e.wo->dec();
-    lock.lock();
     active--;
   }
 }
@@ -30,9 +30,14 @@
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <utility>
 #include <vector>
 #include <stdexcept>
@@ -51,10 +56,43 @@ public:
     static threadpool instance(8);
     return instance;
   }
+  // For speculative work. Waiting on compute or IO tasks never runs
+  // these tasks inline, so they can't delay a thread which needs its
+  // own results. It only has two worker threads, so it does not compete
+  // for every core with the compute pool
+  static threadpool& getInstanceForBackground() {
+    static threadpool instance(3);
+    return instance;
+  }
   static threadpool *getNewForUnitTests(unsigned max_threads = 0) {
     return new threadpool(max_threads);
   }
 
+  // Queued high priority tasks are always picked before normal ones.
+  // Tasks submitted from within a running task get at least the priority
+  // of that task.
+  enum priority {
+    PRIORITY_HIGH = 0,
+    PRIORITY_NORMAL,
+    NUM_PRIORITIES
+  };
+
+  // Queue latency buckets, the last bucket catches everything above the
+  // last limit
+  static constexpr size_t NUM_LATENCY_BUCKETS = 6;
+  static uint64_t get_latency_bucket_limit_us(size_t bucket);
+
+  struct stats {
+    unsigned int threads;
+    unsigned int active;
+    uint64_t queue_depth[NUM_PRIORITIES];
+    uint64_t submitted;
+    uint64_t executed;
+    uint64_t inlined;
+    uint64_t steals;
+    uint64_t latency_histogram[NUM_LATENCY_BUCKETS];
+  };
+
   // The waiter lets the caller know when all of its
   // tasks are completed.
   class waiter {
@@ -76,31 +114,52 @@ public:
   // Submit a task to the pool. The waiter pointer may be
   // NULL if the caller doesn't care to wait for the
   // task to finish.
-  void submit(waiter *waiter, std::function<void()> f, bool leaf = false);
+  void submit(waiter *waiter, std::function<void()> f, bool leaf = false, priority prio = PRIORITY_NORMAL);
 
   // destroy and recreate threads
   void recycle();
 
   unsigned int get_max_concurrency() const;
 
+  stats get_stats() const;
+
   ~threadpool();
 
   private:
     threadpool(unsigned int max_threads = 0);
     void destroy();
-    void create(unsigned int max_threads);
+    void create();
     typedef struct entry {
       waiter *wo;
       std::function<void()> f;
       bool leaf;
+      priority prio;
+      std::chrono::steady_clock::time_point submitted;
     } entry;
-    std::deque<entry> queue;
+    // One per worker thread. The owner pushes and pops at the front,
+    // other threads steal from the back.
+    struct worker_queue {
+      boost::mutex mutex;
+      std::deque<entry> queue[NUM_PRIORITIES];
+    };
+    // Filled by the constructor, never resized or freed before the pool is
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::atomic<uint64_t> pending[NUM_PRIORITIES];
+    std::atomic<unsigned int> next_queue;
     boost::condition_variable has_work;
     boost::mutex mutex;
     std::vector<boost::thread> threads;
-    unsigned int active;
+    std::atomic<unsigned int> active;
+    std::atomic<unsigned int> idle;
     unsigned int max;
-    bool running;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> num_submitted;
+    std::atomic<uint64_t> num_executed;
+    std::atomic<uint64_t> num_inlined;
+    std::atomic<uint64_t> num_steals;
+    std::array<std::atomic<uint64_t>, NUM_LATENCY_BUCKETS> latency_histogram;
+    bool pop(int self, entry &e);
+    void run_worker(int self);
     void run(bool flush = false);
 };
 
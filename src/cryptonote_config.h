@@ -212,6 +212,13 @@
 
 #define DEFAULT_TXPOOL_MAX_WEIGHT               648000000ull // 3 days at 300000, in bytes
 
+#define DEFAULT_BLOCK_POW_CACHE_SIZE            262144 // block PoW hashes kept in the db, about 20 MB
+#define BLOCK_POW_CACHE_TRIM_INTERVAL           720 // blocks between trims of the stored PoW hashes
+#define DEFAULT_SPENT_KEY_FILTER_BITS           16 // bits per spent key image, about 0.1% false positives
+#define DEFAULT_PRUNING_ONLINE_RATE             4096 // kB of prunable data online pruning goes through per second
+#define DEFAULT_DB_COLD_DEPTH                   100000 // blocks whose data stays out of cold storage
+#define DB_COLD_STORAGE_RATE                    4096 // kB moved to cold storage per second
+
 #define BULLETPROOF_MAX_OUTPUTS                 16
 #define BULLETPROOF_PLUS_MAX_OUTPUTS            16
 
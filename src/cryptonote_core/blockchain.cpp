@@ -92,6 +92,7 @@ DISABLE_VS_WARNINGS(4267)
 //------------------------------------------------------------------
 Blockchain::Blockchain(tx_memory_pool& tx_pool) :
   m_db(), m_tx_pool(tx_pool), m_hardfork(NULL), m_timestamps_and_difficulties_height(0), m_reset_timestamps_and_difficulties_height(true), m_current_block_cumul_weight_limit(0), m_current_block_cumul_weight_median(0),
+  m_pow_lookahead_pending(0), m_prepared_span_height(0),
   m_enforce_dns_checkpoints(false), m_max_prepare_blocks_threads(4), m_db_sync_on_blocks(true), m_db_sync_threshold(1), m_db_sync_mode(db_async), m_db_default_sync(false), m_fast_sync(true), m_show_time_stats(false), m_sync_counter(0), m_bytes_to_sync(0), m_cancel(false),
   m_long_term_block_weights_window(CRYPTONOTE_LONG_TERM_BLOCK_WEIGHT_WINDOW_SIZE),
   m_long_term_effective_median_block_weight(0),
@@ -102,7 +103,9 @@ Blockchain::Blockchain(tx_memory_pool& tx_pool) :
   m_btc_valid(false),
   m_batch_success(true),
   m_prepare_height(0),
-  m_rct_ver_cache()
+  m_rct_ver_cache(RCT_VER_CACHE_SIZE),
+  m_rct_ver_cache_persist(false),
+  m_block_pow_cache_size(DEFAULT_BLOCK_POW_CACHE_SIZE)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
 }
@@ -137,7 +140,7 @@ bool Blockchain::have_tx_keyimg_as_spent(const crypto::key_image &key_im) const
 // and collects the public key for each from the transaction it was included in
 // via the visitor passed to it.
 template <class visitor_t>
-bool Blockchain::scan_outputkeys_for_indexes(size_t tx_version, const txin_to_key& tx_in_to_key, visitor_t &vis, const crypto::hash &tx_prefix_hash, uint64_t* pmax_related_block_height) const
+bool Blockchain::scan_outputkeys_for_indexes(size_t tx_version, const txin_to_key& tx_in_to_key, visitor_t &vis, const crypto::hash &tx_prefix_hash, uint64_t* pmax_related_block_height, const std::vector<output_data_t> *ring_members) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
 
@@ -166,6 +169,11 @@ bool Blockchain::scan_outputkeys_for_indexes(size_t tx_version, const txin_to_ke
       found = true;
     }
   }
+  if (!found && ring_members)
+  {
+    outputs = *ring_members;
+    found = true;
+  }
 
   if (!found)
   {
@@ -468,6 +476,21 @@ bool Blockchain::init(BlockchainDB* db, const network_type nettype, bool offline
       rx_set_main_seedhash(seedhash.data, tools::get_max_concurrency());
   }
 
+  if (m_rct_ver_cache_persist)
+  {
+    try
+    {
+      const std::vector<crypto::hash> entries = m_db->get_rct_ver_cache();
+      for (const crypto::hash &entry: entries)
+        m_rct_ver_cache.add(entry);
+      MINFO("Loaded " << entries.size() << " RingCT verification cache entries");
+    }
+    catch (const std::exception &e)
+    {
+      MWARNING("Failed to load RingCT verification cache: " << e.what());
+    }
+  }
+
   return true;
 }
 //------------------------------------------------------------------
@@ -522,6 +545,14 @@ bool Blockchain::deinit()
   m_async_pool.join_all();
   m_async_service.stop();
 
+  // PoW lookahead tasks reference this object
+  if (m_pow_lookahead)
+  {
+    m_pow_lookahead->waiter.wait();
+    m_pow_lookahead.reset();
+    m_pow_lookahead_pending = 0;
+  }
+
   // as this should be called if handling a SIGSEGV, need to check
   // if m_db is a NULL pointer (and thus may have caused the illegal
   // memory operation), otherwise we may cause a loop.
@@ -529,6 +560,17 @@ bool Blockchain::deinit()
   {
     if (m_db)
     {
+      if (m_rct_ver_cache_persist && !m_db->is_read_only())
+      {
+        try
+        {
+          m_db->set_rct_ver_cache(m_rct_ver_cache.get_entries());
+        }
+        catch (const std::exception &e)
+        {
+          MWARNING("Failed to store RingCT verification cache: " << e.what());
+        }
+      }
       m_db->close();
       MTRACE("Local blockchain read/write activity stopped successfully");
     }
@@ -2033,7 +2075,12 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
     CHECK_AND_ASSERT_MES(current_diff, false, "!!!!!!! DIFFICULTY OVERHEAD !!!!!!!");
     crypto::hash proof_of_work;
     memset(proof_of_work.data, 0xff, sizeof(proof_of_work.data));
-    if (b.major_version >= RX_BLOCK_VERSION)
+    const bool pow_cached = get_cached_block_pow(bei.height, id, proof_of_work);
+    if (pow_cached)
+    {
+      MDEBUG("Using stored PoW hash for alternative block " << id);
+    }
+    else if (b.major_version >= RX_BLOCK_VERSION)
     {
       crypto::hash seedhash = null_hash;
       uint64_t seedheight = rx_seedheight(bei.height);
@@ -2064,6 +2111,8 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
       bvc.m_bad_pow = true;
       return false;
     }
+    if (!pow_cached)
+      cache_block_pow(bei.height, id, proof_of_work);
 
     if(!prevalidate_miner_transaction(b, bei.height, hf_version))
     {
@@ -2469,6 +2518,9 @@ bool Blockchain::get_output_distribution(uint64_t amount, uint64_t from_height,
   }
   else
   {
+    // base counts the outputs below start_height here too; it used to be
+    // always 0, with those outputs only folded into distribution[0], which
+    // is what the RPC still returns unless asked for nonzero_amount_base
     return m_db->get_output_distribution(amount, start_height, to_height, distribution, base);
   }
 }
@@ -3359,14 +3411,72 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
 {
   PERF_TIMER(check_tx_inputs);
   LOG_PRINT_L3("Blockchain::" << __func__);
-  size_t sig_index = 0;
-  if(pmax_used_block_height)
-    *pmax_used_block_height = 0;
 
-  crypto::hash tx_prefix_hash = get_transaction_prefix_hash(tx);
+  tx_input_rings rings;
+  if (!check_tx_input_rings(tx, tvc, rings, pmax_used_block_height))
+    return false;
+  return check_tx_input_signatures(tx, rings, m_hardfork->get_current_version());
+}
+//------------------------------------------------------------------
+// Fetches the ring members of all inputs of a tx with a single batch query,
+// rather than one lookup per ring member. Each input's list stops at the
+// first output which was not found, like the scan table's partial results.
+// On error, ring_members is left empty and the caller falls back to looking
+// outputs up as it goes.
+void Blockchain::prefetch_ring_members(const transaction& tx, std::vector<std::vector<output_data_t>> &ring_members) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  ring_members.clear();
 
-  const uint8_t hf_version = m_hardfork->get_current_version();
+  std::vector<std::pair<uint64_t, uint64_t>> requests;
+  for (const auto& txin : tx.vin)
+  {
+    if (txin.type() != typeid(txin_to_key))
+      return;
+    const txin_to_key& in_to_key = boost::get<txin_to_key>(txin);
+    uint64_t offset = 0;
+    for (const uint64_t relative_offset : in_to_key.key_offsets)
+    {
+      offset += relative_offset;
+      requests.push_back({in_to_key.amount, offset});
+    }
+  }
 
+  std::vector<output_data_t> outputs;
+  std::vector<bool> found;
+  try
+  {
+    m_db->get_output_keys(epee::to_span(requests), outputs, found);
+  }
+  catch (const std::exception &e)
+  {
+    MERROR_VER("Failed to prefetch ring members: " << e.what());
+    return;
+  }
+  if (outputs.size() != requests.size() || found.size() != requests.size())
+    return;
+
+  ring_members.resize(tx.vin.size());
+  size_t pos = 0;
+  for (size_t i = 0; i < tx.vin.size(); ++i)
+  {
+    const size_t ring_size = boost::get<txin_to_key>(tx.vin[i]).key_offsets.size();
+    bool missing = false;
+    ring_members[i].reserve(ring_size);
+    for (size_t j = 0; j < ring_size; ++j, ++pos)
+    {
+      missing = missing || !found[pos];
+      if (!missing)
+        ring_members[i].push_back(outputs[pos]);
+    }
+  }
+}
+//------------------------------------------------------------------
+// The rules on a transaction's inputs which do not depend on its ring
+// members: output count, ring size, tx version and input order. Only the
+// per-amount output counts of pre-RingCT inputs come from the database.
+bool Blockchain::check_tx_input_rules(const transaction& tx, tx_verification_context &tvc, uint8_t hf_version) const
+{
   if (hf_version >= HF_VERSION_MIN_2_OUTPUTS)
   {
     if (tx.version >= 2)
@@ -3496,13 +3606,38 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
     }
   }
 
-  std::vector<std::vector<rct::ctkey>> pubkeys(tx.vin.size());
-  std::vector < uint64_t > results;
-  results.resize(tx.vin.size(), 0);
+  return true;
+}
+//------------------------------------------------------------------
+// This function does the part of check_tx_inputs which needs the database:
+// ring size and version rules, key image spent checks, and the lookup of
+// every ring member. The signatures themselves are left for
+// check_tx_input_signatures, which only works on the data collected here
+// and so may run on any thread.
+bool Blockchain::check_tx_input_rings(const transaction& tx, tx_verification_context &tvc, tx_input_rings &rings, uint64_t* pmax_used_block_height) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  size_t sig_index = 0;
+  if(pmax_used_block_height)
+    *pmax_used_block_height = 0;
 
-  tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
-  tools::threadpool::waiter waiter(tpool);
-  int threads = tpool.get_max_concurrency();
+  const crypto::hash tx_prefix_hash = get_transaction_prefix_hash(tx);
+  rings.tx_prefix_hash = tx_prefix_hash;
+
+  const uint8_t hf_version = m_hardfork->get_current_version();
+
+  if (!check_tx_input_rules(tx, tvc, hf_version))
+    return false;
+
+  std::vector<std::vector<rct::ctkey>> &pubkeys = rings.pubkeys;
+  pubkeys.clear();
+  pubkeys.resize(tx.vin.size());
+
+  // look all ring members up in one go, unless prepare_handle_incoming_blocks
+  // already did so for this tx
+  std::vector<std::vector<output_data_t>> ring_members;
+  if (m_scan_table.find(tx_prefix_hash) == m_scan_table.end())
+    prefetch_ring_members(tx, ring_members);
 
   uint64_t max_used_block_height = 0;
   if (!pmax_used_block_height)
@@ -3532,7 +3667,7 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
 
     // make sure that output being spent matches up correctly with the
     // signature spending it.
-    if (!check_tx_input(tx.version, in_to_key, tx_prefix_hash, tx.version == 1 ? tx.signatures[sig_index] : std::vector<crypto::signature>(), tx.rct_signatures, pubkeys[sig_index], pmax_used_block_height, hf_version))
+    if (!check_tx_input(tx.version, in_to_key, tx_prefix_hash, tx.version == 1 ? tx.signatures[sig_index] : std::vector<crypto::signature>(), tx.rct_signatures, pubkeys[sig_index], pmax_used_block_height, hf_version, ring_members.empty() ? NULL : &ring_members[sig_index]))
     {
       MERROR_VER("Failed to check ring signature for tx " << get_transaction_hash(tx) << "  vin key with k_image: " << in_to_key.k_image << "  sig_index: " << sig_index);
       if (pmax_used_block_height) // a default value of NULL is used when called from Blockchain::handle_block_to_main_chain()
@@ -3543,8 +3678,56 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
       return false;
     }
 
-    if (tx.version == 1)
+    sig_index++;
+  }
+
+  // enforce min output age
+  if (hf_version >= HF_VERSION_ENFORCE_MIN_AGE)
+  {
+    CHECK_AND_ASSERT_MES(*pmax_used_block_height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE <= m_db->height(),
+        false, "Transaction spends at least one output which is too young");
+  }
+
+  return true;
+}
+//------------------------------------------------------------------
+// The only RCT type whose verification results go in m_rct_ver_cache
+static std::uint8_t get_rct_ver_cache_type(uint8_t hf_version)
+{
+  return (hf_version >= HF_VERSION_BP_PLUS_FULL_COMMIT) ? static_cast<std::uint8_t>(rct::RCTTypeBulletproofPlus_FullCommit) : static_cast<std::uint8_t>(rct::RCTTypeBulletproofPlus);
+}
+//------------------------------------------------------------------
+// This function checks the signatures of a transaction against the ring
+// members collected by check_tx_input_rings. It does not touch the database
+// or any mutable blockchain state, so signatures of several transactions can
+// be checked concurrently.
+bool Blockchain::check_tx_input_signatures(transaction& tx, const tx_input_rings &rings, uint8_t hf_version) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+
+  const crypto::hash &tx_prefix_hash = rings.tx_prefix_hash;
+  const std::vector<std::vector<rct::ctkey>> &pubkeys = rings.pubkeys;
+  CHECK_AND_ASSERT_MES(pubkeys.size() == tx.vin.size(), false, "internal error: ring count mismatch with tx inputs");
+
+  // Warn that new RCT types are present, and thus the cache is not being used effectively
+  const std::uint8_t rct_cache_type = get_rct_ver_cache_type(hf_version);
+  if (static_cast<std::uint8_t>(tx.rct_signatures.type) > rct_cache_type)
+    MWARNING("RCT cache is not caching new verification results. Please update rct_cache_type.");
+
+  if (tx.version == 1)
+  {
+    CHECK_AND_ASSERT_MES(tx.signatures.size() == tx.vin.size(), false, "wrong transaction: signature count mismatch with tx inputs");
+
+    std::vector < uint64_t > results;
+    results.resize(tx.vin.size(), 0);
+
+    tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
+    tools::threadpool::waiter waiter(tpool);
+    int threads = tpool.get_max_concurrency();
+
+    for (size_t sig_index = 0; sig_index < tx.vin.size(); ++sig_index)
     {
+      const txin_to_key& in_to_key = boost::get<txin_to_key>(tx.vin[sig_index]);
       if (threads > 1)
       {
         // ND: Speedup
@@ -3557,39 +3740,15 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
         if (!results[sig_index])
         {
           MERROR_VER("Failed to check ring signature for tx " << get_transaction_hash(tx) << "  vin key with k_image: " << in_to_key.k_image << "  sig_index: " << sig_index);
-
-          if (pmax_used_block_height)  // a default value of NULL is used when called from Blockchain::handle_block_to_main_chain()
-          {
-            MERROR_VER("*pmax_used_block_height: " << *pmax_used_block_height);
-          }
-
           return false;
         }
       }
     }
-
-    sig_index++;
-  }
-  if (tx.version == 1 && threads > 1)
-    if (!waiter.wait())
-      return false;
-
-  // enforce min output age
-  if (hf_version >= HF_VERSION_ENFORCE_MIN_AGE)
-  {
-    CHECK_AND_ASSERT_MES(*pmax_used_block_height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE <= m_db->height(),
-        false, "Transaction spends at least one output which is too young");
-  }
-
-  // Warn that new RCT types are present, and thus the cache is not being used effectively
-  const std::uint8_t rct_cache_type = (hf_version >= HF_VERSION_BP_PLUS_FULL_COMMIT) ? static_cast<std::uint8_t>(rct::RCTTypeBulletproofPlus_FullCommit) : static_cast<std::uint8_t>(rct::RCTTypeBulletproofPlus);
-  if (static_cast<std::uint8_t>(tx.rct_signatures.type) > rct_cache_type)
-    MWARNING("RCT cache is not caching new verification results. Please update rct_cache_type.");
-
-  if (tx.version == 1)
-  {
     if (threads > 1)
     {
+      if (!waiter.wait())
+        return false;
+
       // save results to table, passed or otherwise
       bool failed = false;
       for (size_t i = 0; i < tx.vin.size(); i++)
@@ -3723,6 +3882,92 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
   return true;
 }
 
+//------------------------------------------------------------------
+// Checks the ringct signatures of a tx against its ring members as the
+// database holds them now, without taking the blockchain lock, so several
+// txes can be pre-verified at once while blocks are being added. Nothing is
+// decided here: a pass is only recorded in the RingCT verification cache,
+// where check_tx_inputs finds it if the rings are unchanged by then, and
+// anything else is left for check_tx_inputs to find and report.
+void Blockchain::preverify_tx_input_signatures(transaction& tx, uint8_t hf_version) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+
+  const std::uint8_t rct_cache_type = get_rct_ver_cache_type(hf_version);
+  if (tx.version < 2 || tx.vin.empty() || tx.rct_signatures.type != rct_cache_type)
+    return;
+
+  // the cheap checks go first, so a tx which check_tx_inputs would reject
+  // anyway costs no signature work
+  tx_verification_context tvc{};
+  if (!check_tx_input_rules(tx, tvc, hf_version))
+    return;
+  for (const txin_v &txin: tx.vin)
+  {
+    if (txin.type() != typeid(txin_to_key))
+      return;
+    const txin_to_key& in_to_key = boost::get<txin_to_key>(txin);
+    if (in_to_key.key_offsets.empty() || have_tx_keyimg_as_spent(in_to_key.k_image))
+      return;
+  }
+
+  std::vector<std::vector<output_data_t>> ring_members;
+  prefetch_ring_members(tx, ring_members);
+  if (ring_members.size() != tx.vin.size())
+    return;
+
+  std::vector<std::vector<rct::ctkey>> pubkeys(tx.vin.size());
+  for (size_t i = 0; i < tx.vin.size(); ++i)
+  {
+    const txin_to_key& in_to_key = boost::get<txin_to_key>(tx.vin[i]);
+    if (in_to_key.amount != 0 || ring_members[i].size() != in_to_key.key_offsets.size())
+      return;
+    pubkeys[i].reserve(ring_members[i].size());
+    for (const output_data_t &od: ring_members[i])
+      pubkeys[i].push_back(rct::ctkey({rct::pk2rct(od.pubkey), od.commitment}));
+  }
+
+  if (!ver_rct_non_semantics_simple_cached(tx, pubkeys, m_rct_ver_cache, rct_cache_type))
+    MDEBUG("Tx " << get_transaction_hash(tx) << " failed signature pre-verification");
+}
+//------------------------------------------------------------------
+size_t Blockchain::check_block_tx_signatures(std::vector<std::pair<transaction, blobdata>> &txs, const std::vector<tx_input_rings> &rings, uint8_t hf_version) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+
+  CHECK_AND_ASSERT_MES(txs.size() == rings.size(), 0, "internal error: rings count mismatch with block txes");
+
+  tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
+  const unsigned int threads = tpool.get_max_concurrency();
+  if (threads <= 1 || txs.size() <= 1)
+  {
+    for (size_t i = 0; i < txs.size(); ++i)
+      if (!check_tx_input_signatures(txs[i].first, rings[i], hf_version))
+        return i;
+    return txs.size();
+  }
+
+  // each transaction gets its own task, any nested work they submit (CLSAGs,
+  // v1 ring signatures) will run inline on the worker thread or be picked up
+  // by idle workers. Block verification holds up the chain tip, so it jumps
+  // ahead of other queued work
+  std::vector<uint8_t> results(txs.size(), 0);
+  tools::threadpool::waiter waiter(tpool);
+  for (size_t i = 0; i < txs.size(); ++i)
+  {
+    tpool.submit(&waiter, [this, &txs, &rings, &results, hf_version, i]() {
+      results[i] = check_tx_input_signatures(txs[i].first, rings[i], hf_version);
+    }, false, tools::threadpool::PRIORITY_HIGH);
+  }
+  // a task which threw leaves its result as failed, so we do not need the
+  // waiter's error flag to find out which one it was
+  waiter.wait();
+
+  for (size_t i = 0; i < txs.size(); ++i)
+    if (!results[i])
+      return i;
+  return txs.size();
+}
 //------------------------------------------------------------------
 void Blockchain::check_ring_signature(const crypto::hash &tx_prefix_hash, const crypto::key_image &key_image, const std::vector<rct::ctkey> &pubkeys, const std::vector<crypto::signature>& sig, uint64_t &result) const
 {
@@ -3989,7 +4234,7 @@ bool Blockchain::is_tx_spendtime_unlocked(uint64_t unlock_time, uint8_t hf_versi
 // This function locates all outputs associated with a given input (mixins)
 // and validates that they exist and are usable.  It also checks the ring
 // signature for each input.
-bool Blockchain::check_tx_input(size_t tx_version, const txin_to_key& txin, const crypto::hash& tx_prefix_hash, const std::vector<crypto::signature>& sig, const rct::rctSig &rct_signatures, std::vector<rct::ctkey> &output_keys, uint64_t* pmax_related_block_height, uint8_t hf_version) const
+bool Blockchain::check_tx_input(size_t tx_version, const txin_to_key& txin, const crypto::hash& tx_prefix_hash, const std::vector<crypto::signature>& sig, const rct::rctSig &rct_signatures, std::vector<rct::ctkey> &output_keys, uint64_t* pmax_related_block_height, uint8_t hf_version, const std::vector<output_data_t> *ring_members) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
 
@@ -4031,7 +4276,7 @@ bool Blockchain::check_tx_input(size_t tx_version, const txin_to_key& txin, cons
 
   // collect output keys
   outputs_visitor vi(output_keys, *this, hf_version);
-  if (!scan_outputkeys_for_indexes(tx_version, txin, vi, tx_prefix_hash, pmax_related_block_height))
+  if (!scan_outputkeys_for_indexes(tx_version, txin, vi, tx_prefix_hash, pmax_related_block_height, ring_members))
   {
     MERROR_VER("Failed to get output keys for tx with amount = " << print_money(txin.amount) << " and count indexes " << txin.key_offsets.size());
     return false;
@@ -4281,6 +4526,8 @@ leave:
       precomputed = true;
       proof_of_work = it->second;
     }
+    else if (get_cached_block_pow(blockchain_height, id, proof_of_work))
+      precomputed = true;
     else
       proof_of_work = get_block_longhash(this, bl, blockchain_height, 0);
 
@@ -4395,8 +4642,10 @@ leave:
   // Iterate over the block's transaction hashes, grabbing each
   // from the tx_pool (or from extra_block_txs) and validating them.  Each is then added
   // to txs.  Keys spent in each are added to <keys> by the double spend check.
+  std::vector<tx_input_rings> txs_rings;
   txs.reserve(bl.tx_hashes.size());
   txs_meta.reserve(bl.tx_hashes.size());
+  txs_rings.reserve(bl.tx_hashes.size());
   txpool_events.reserve(bl.tx_hashes.size());
   for (const crypto::hash& tx_id : bl.tx_hashes)
   {
@@ -4507,9 +4756,11 @@ leave:
     if (!fast_check)
 #endif
     {
-      // validate that transaction inputs and the keys spending them are correct.
+      // validate that transaction inputs are correct and collect the keys
+      // spending them, signatures are checked for the whole block below.
       tx_verification_context tvc;
-      if(!check_tx_inputs(tx, tvc))
+      txs_rings.emplace_back();
+      if(!check_tx_input_rings(tx, tvc, txs_rings.back()))
       {
         MERROR_VER("Block with id: " << id  << " has at least one transaction (id: " << tx_id << ") with wrong inputs.");
 
@@ -4528,6 +4779,29 @@ leave:
     cumulative_block_weight += tx_weight;
   }
 
+#if defined(PER_BLOCK_CHECKPOINT)
+  if (!fast_check)
+#endif
+  {
+    // all the rings are known now, so the signatures of every transaction
+    // in the block can be checked at once
+    TIME_MEASURE_START(cc);
+    const size_t bad_tx_index = check_block_tx_signatures(txs, txs_rings, hf_version);
+    TIME_MEASURE_FINISH(cc);
+    t_checktx += cc;
+    if (bad_tx_index < txs.size())
+    {
+      MERROR_VER("Block with id: " << id  << " has at least one transaction (id: " << std::get<0>(txs_meta[bad_tx_index]) << ") with wrong inputs.");
+
+      //TODO: why is this done?  make sure that keeping invalid blocks makes sense.
+      add_block_as_invalid(bl, id);
+      MERROR_VER("Block with id " << id << " added as invalid because of wrong inputs in transactions");
+      bvc.m_verifivation_failed = true;
+      return_txs_to_pool();
+      return false;
+    }
+  }
+
   // if we were syncing pruned blocks
   if (n_pruned > 0)
   {
@@ -4579,6 +4853,8 @@ leave:
       uint64_t long_term_block_weight = get_next_long_term_block_weight(block_weight);
       cryptonote::blobdata bd = cryptonote::block_to_blob(bl);
       new_height = m_db->add_block(std::make_pair(std::move(bl), std::move(bd)), block_weight, long_term_block_weight, cumulative_difficulty, already_generated_coins, txs);
+      if (!fast_check)
+        cache_block_pow(blockchain_height, id, proof_of_work);
     }
     catch (const KEY_IMAGE_EXISTS& e)
     {
@@ -4671,6 +4947,51 @@ bool Blockchain::prune_blockchain(uint32_t pruning_seed)
   return m_db->prune_blockchain(pruning_seed);
 }
 //------------------------------------------------------------------
+bool Blockchain::prune_blockchain_incremental(uint32_t pruning_seed, uint64_t max_bytes)
+{
+  m_tx_pool.lock();
+  epee::misc_utils::auto_scope_leave_caller unlocker = epee::misc_utils::create_scope_leave_handler([&](){m_tx_pool.unlock();});
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  return m_db->prune_blockchain_incremental(pruning_seed, max_bytes);
+}
+//------------------------------------------------------------------
+bool Blockchain::move_to_cold_storage(uint64_t max_bytes)
+{
+  m_tx_pool.lock();
+  epee::misc_utils::auto_scope_leave_caller unlocker = epee::misc_utils::create_scope_leave_handler([&](){m_tx_pool.unlock();});
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  return m_db->move_to_cold_storage(max_bytes);
+}
+//------------------------------------------------------------------
+bool Blockchain::start_db_compaction()
+{
+  m_tx_pool.lock();
+  epee::misc_utils::auto_scope_leave_caller unlocker = epee::misc_utils::create_scope_leave_handler([&](){m_tx_pool.unlock();});
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  return m_db->start_compaction();
+}
+//------------------------------------------------------------------
+bool Blockchain::finish_db_compaction()
+{
+  m_tx_pool.lock();
+  epee::misc_utils::auto_scope_leave_caller unlocker = epee::misc_utils::create_scope_leave_handler([&](){m_tx_pool.unlock();});
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  return m_db->finish_compaction();
+}
+//------------------------------------------------------------------
+void Blockchain::flush_txpool_updates()
+{
+  m_tx_pool.lock();
+  epee::misc_utils::auto_scope_leave_caller unlocker = epee::misc_utils::create_scope_leave_handler([&](){m_tx_pool.unlock();});
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  m_db->flush_txpool_updates();
+}
+//------------------------------------------------------------------
 bool Blockchain::update_blockchain_pruning()
 {
   m_tx_pool.lock();
@@ -4917,7 +5238,10 @@ void Blockchain::block_longhash_worker(uint64_t height, const epee::span<const b
     if (m_cancel)
        break;
     crypto::hash id = get_block_hash(block);
-    crypto::hash pow = get_block_longhash(this, block, height++, 0);
+    crypto::hash pow;
+    if (!get_cached_block_pow(height, id, pow))
+      pow = get_block_longhash(this, block, height, 0);
+    ++height;
     map.emplace(id, pow);
   }
 
@@ -4925,6 +5249,122 @@ void Blockchain::block_longhash_worker(uint64_t height, const epee::span<const b
   TIME_MEASURE_FINISH(t);
 }
 
+//------------------------------------------------------------------
+void Blockchain::queue_pow_lookahead(uint64_t height, const std::vector<blobdata> &block_blobs)
+{
+  MTRACE("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  if (block_blobs.empty() || m_cancel)
+    return;
+  if (m_pow_lookahead && m_pow_lookahead->height == height && m_pow_lookahead->blocks.size() == block_blobs.size())
+    return;
+
+  // only blocks directly on top of the span being added can be hashed
+  // ahead, as their seed hashes may be in that span
+  if (m_prepared_span_hashes.empty() || height != m_prepared_span_height + m_prepared_span_hashes.size())
+    return;
+
+  if (m_pow_lookahead)
+  {
+    m_pow_lookahead->waiter.wait();
+    m_pow_lookahead.reset();
+    m_pow_lookahead_pending = 0;
+  }
+
+  // not the compute pool: its waiters run queued tasks inline, which
+  // would have a thread validating a span hash the next one instead
+  tools::threadpool& tpool = tools::threadpool::getInstanceForBackground();
+  std::unique_ptr<pow_lookahead> lookahead(new pow_lookahead(tpool));
+  lookahead->height = height;
+  lookahead->blocks.resize(block_blobs.size());
+  lookahead->seeds.resize(block_blobs.size());
+  lookahead->pow.resize(block_blobs.size());
+  lookahead->done.resize(block_blobs.size(), 0);
+  crypto::hash prev_id = m_prepared_span_hashes.back();
+  for (size_t i = 0; i < block_blobs.size(); ++i)
+  {
+    block &b = lookahead->blocks[i];
+    crypto::hash block_hash;
+    if (!parse_and_validate_block_from_blob(block_blobs[i], b, block_hash) || b.prev_id != prev_id)
+      return;
+    prev_id = block_hash;
+
+    if (b.major_version >= RX_BLOCK_VERSION)
+    {
+      const uint64_t seed_height = crypto::rx_seedheight(height + i);
+      if (seed_height >= height)
+        lookahead->seeds[i] = get_block_hash(lookahead->blocks[seed_height - height]);
+      else if (seed_height >= m_prepared_span_height)
+        lookahead->seeds[i] = m_prepared_span_hashes[seed_height - m_prepared_span_height];
+      else
+        lookahead->seeds[i] = get_block_id_by_height(seed_height);
+    }
+    else
+    {
+      lookahead->seeds[i] = crypto::null_hash;
+    }
+  }
+
+  unsigned threads = tpool.get_max_concurrency();
+  if (threads > m_max_prepare_blocks_threads)
+    threads = m_max_prepare_blocks_threads;
+  threads = std::max(1u, std::min<unsigned>(threads, block_blobs.size()));
+
+  m_pow_lookahead_pending = block_blobs.size();
+  pow_lookahead *l = lookahead.get();
+  for (unsigned t = 0; t < threads; ++t)
+  {
+    const size_t start = block_blobs.size() * t / threads;
+    const size_t end = block_blobs.size() * (t + 1) / threads;
+    tpool.submit(&l->waiter, [this, l, start, end]() {
+      slow_hash_allocate_state();
+      for (size_t i = start; i < end && !m_cancel; ++i)
+      {
+        const block &b = l->blocks[i];
+        l->pow[i] = get_block_longhash(this, b, l->height + i, b.major_version >= RX_BLOCK_VERSION ? &l->seeds[i] : NULL);
+        l->done[i] = 1;
+        --m_pow_lookahead_pending;
+      }
+      slow_hash_free_state();
+    }, true);
+  }
+  m_pow_lookahead = std::move(lookahead);
+  MDEBUG("Hashing blocks " << height << " - " << (height + block_blobs.size() - 1) << " ahead");
+}
+//------------------------------------------------------------------
+bool Blockchain::take_pow_lookahead(uint64_t height, std::vector<block> &blocks)
+{
+  if (!m_pow_lookahead)
+    return false;
+
+  std::unique_ptr<pow_lookahead> lookahead = std::move(m_pow_lookahead);
+  lookahead->waiter.wait();
+  m_pow_lookahead_pending = 0;
+
+  if (lookahead->height != height || lookahead->blocks.size() != blocks.size())
+    return false;
+
+  // the seeds were picked before the previous span was added, so check
+  // they still are the ones this span needs
+  m_prepare_height = height;
+  m_prepare_nblocks = blocks.size();
+  m_prepare_blocks = &blocks;
+  bool ok = true;
+  for (size_t i = 0; i < blocks.size() && ok; ++i)
+  {
+    const crypto::hash expected_seed = blocks[i].major_version >= RX_BLOCK_VERSION ? get_pending_block_id_by_height(crypto::rx_seedheight(height + i)) : crypto::null_hash;
+    ok = lookahead->done[i] && get_block_hash(lookahead->blocks[i]) == get_block_hash(blocks[i]) && lookahead->seeds[i] == expected_seed;
+  }
+  m_prepare_height = 0;
+  if (!ok)
+    return false;
+
+  m_blocks_longhash_table.clear();
+  for (size_t i = 0; i < blocks.size(); ++i)
+    m_blocks_longhash_table.emplace(get_block_hash(blocks[i]), lookahead->pow[i]);
+  return true;
+}
 //------------------------------------------------------------------
 bool Blockchain::cleanup_handle_incoming_blocks(bool force_sync)
 {
@@ -5003,19 +5443,22 @@ bool Blockchain::cleanup_handle_incoming_blocks(bool force_sync)
 }
 
 //------------------------------------------------------------------
-void Blockchain::output_scan_worker(const uint64_t amount, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs) const
+void Blockchain::output_scan_worker(const epee::span<const std::pair<uint64_t, uint64_t>> amount_indices, std::vector<output_data_t> &outputs, std::vector<bool> &found) const
 {
   try
   {
-    m_db->get_output_key(epee::span<const uint64_t>(&amount, 1), offsets, outputs, true);
+    m_db->get_output_keys(amount_indices, outputs, found);
   }
   catch (const std::exception& e)
   {
     MERROR_VER("EXCEPTION: " << e.what());
+    outputs.clear();
+    found.clear();
   }
   catch (...)
   {
-
+    outputs.clear();
+    found.clear();
   }
 }
 
@@ -5271,6 +5714,19 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
     }
 
     if (!blocks_exist)
+    {
+      m_prepared_span_height = height;
+      m_prepared_span_hashes.clear();
+      m_prepared_span_hashes.reserve(blocks.size());
+      for (const block &b: blocks)
+        m_prepared_span_hashes.push_back(get_block_hash(b));
+    }
+
+    if (!blocks_exist && take_pow_lookahead(height, blocks))
+    {
+      MDEBUG("Using PoW hashed ahead for blocks " << height << " - " << (height + blocks.size() - 1));
+    }
+    else if (!blocks_exist)
     {
       m_blocks_longhash_table.clear();
       uint64_t thread_height = height;
@@ -5325,12 +5781,11 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
 
   TIME_MEASURE_START(scantable);
 
-  // [input] stores all unique amounts found
-  std::vector < uint64_t > amounts;
-  // [input] stores all absolute_offsets for each amount
-  std::map<uint64_t, std::vector<uint64_t>> offset_map;
-  // [output] stores all output_data_t for each absolute_offset
-  std::map<uint64_t, std::vector<output_data_t>> tx_map;
+  // [input] stores all (amount, absolute_offset) pairs referenced
+  std::vector<std::pair<uint64_t, uint64_t>> output_requests;
+  // [output] stores the output_data_t for each of them, if found
+  std::vector<output_data_t> output_data;
+  std::vector<bool> output_found;
   std::vector<std::pair<cryptonote::transaction, crypto::hash>> txes(total_txs);
 
 #define SCAN_TABLE_QUIT(m) \
@@ -5340,7 +5795,7 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
             return false; \
         } while(0); \
 
-  // generate sorted tables for all amounts and absolute offsets
+  // generate a sorted table of all amounts and absolute offsets
   size_t tx_index = 0, block_index = 0;
   for (const auto &entry : blocks_entry)
   {
@@ -5367,7 +5822,6 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
       its = m_scan_table.find(tx_prefix_hash);
       assert(its != m_scan_table.end());
 
-      // get all amounts from tx.vin(s)
       for (const auto &txin : tx.vin)
       {
         const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
@@ -5377,70 +5831,60 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
         if (it != its->second.end())
           SCAN_TABLE_QUIT("Duplicate key_image found from incoming blocks.");
 
-        amounts.push_back(in_to_key.amount);
-      }
-
-      // sort and remove duplicate amounts from amounts list
-      std::sort(amounts.begin(), amounts.end());
-      auto last = std::unique(amounts.begin(), amounts.end());
-      amounts.erase(last, amounts.end());
-
-      // add amount to the offset_map and tx_map
-      for (const uint64_t &amount : amounts)
-      {
-        if (offset_map.find(amount) == offset_map.end())
-          offset_map.emplace(amount, std::vector<uint64_t>());
-
-        if (tx_map.find(amount) == tx_map.end())
-          tx_map.emplace(amount, std::vector<output_data_t>());
-      }
-
-      // add new absolute_offsets to offset_map
-      for (const auto &txin : tx.vin)
-      {
-        const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
-        // no need to check for duplicate here.
-        auto absolute_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
-        for (const auto & offset : absolute_offsets)
-          offset_map[in_to_key.amount].push_back(offset);
-
+        uint64_t offset = 0;
+        for (const uint64_t relative_offset : in_to_key.key_offsets)
+        {
+          offset += relative_offset;
+          output_requests.push_back({in_to_key.amount, offset});
+        }
       }
     }
     ++block_index;
   }
 
-  // sort and remove duplicate absolute_offsets in offset_map
-  for (auto &offsets : offset_map)
-  {
-    std::sort(offsets.second.begin(), offsets.second.end());
-    auto last = std::unique(offsets.second.begin(), offsets.second.end());
-    offsets.second.erase(last, offsets.second.end());
-  }
+  // sort and remove duplicates, so each output is looked up once, in key order
+  std::sort(output_requests.begin(), output_requests.end());
+  output_requests.erase(std::unique(output_requests.begin(), output_requests.end()), output_requests.end());
 
-  // gather all the output keys
+  // gather all the output keys, in contiguous chunks if threaded
   threads = tpool.get_max_concurrency();
   if (!m_db->can_thread_bulk_indices())
     threads = 1;
 
-  if (threads > 1 && amounts.size() > 1)
+  if (threads > 1 && output_requests.size() > 1)
   {
+    const size_t nchunks = std::min<size_t>(threads, output_requests.size());
+    std::vector<std::vector<output_data_t>> chunk_data(nchunks);
+    std::vector<std::vector<bool>> chunk_found(nchunks);
     tools::threadpool::waiter waiter(tpool);
 
-    for (size_t i = 0; i < amounts.size(); i++)
+    for (size_t i = 0; i < nchunks; i++)
     {
-      uint64_t amount = amounts[i];
-      tpool.submit(&waiter, boost::bind(&Blockchain::output_scan_worker, this, amount, std::cref(offset_map[amount]), std::ref(tx_map[amount])), true);
+      const size_t start = output_requests.size() * i / nchunks;
+      const size_t end = output_requests.size() * (i + 1) / nchunks;
+      const epee::span<const std::pair<uint64_t, uint64_t>> chunk(output_requests.data() + start, end - start);
+      tpool.submit(&waiter, [this, chunk, &chunk_data, &chunk_found, i]() { output_scan_worker(chunk, chunk_data[i], chunk_found[i]); }, true);
     }
     if (!waiter.wait())
       return false;
+
+    output_data.reserve(output_requests.size());
+    output_found.reserve(output_requests.size());
+    for (size_t i = 0; i < nchunks; i++)
+    {
+      const size_t chunk_size = output_requests.size() * (i + 1) / nchunks - output_requests.size() * i / nchunks;
+      // a failed chunk is treated as not found
+      chunk_data[i].resize(chunk_size);
+      chunk_found[i].resize(chunk_size, false);
+      output_data.insert(output_data.end(), chunk_data[i].begin(), chunk_data[i].end());
+      output_found.insert(output_found.end(), chunk_found[i].begin(), chunk_found[i].end());
+    }
   }
   else
   {
-    for (size_t i = 0; i < amounts.size(); i++)
-    {
-      uint64_t amount = amounts[i];
-      output_scan_worker(amount, offset_map[amount], tx_map[amount]);
-    }
+    output_scan_worker(epee::to_span(output_requests), output_data, output_found);
+    output_data.resize(output_requests.size());
+    output_found.resize(output_requests.size(), false);
   }
 
   // now generate a table for each tx_prefix and k_image hashes
@@ -5465,32 +5909,23 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
       for (const auto &txin : tx.vin)
       {
         const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
-        auto needed_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
 
+        // outputs created in this batch are not in the db yet, so stop at the
+        // first one which is missing and let verification fetch the rest
         std::vector<output_data_t> outputs;
-        for (const uint64_t & offset_needed : needed_offsets)
+        outputs.reserve(in_to_key.key_offsets.size());
+        uint64_t offset = 0;
+        for (const uint64_t relative_offset : in_to_key.key_offsets)
         {
-          size_t pos = 0;
-          bool found = false;
-
-          for (const uint64_t &offset_found : offset_map[in_to_key.amount])
-          {
-            if (offset_needed == offset_found)
-            {
-              found = true;
-              break;
-            }
-
-            ++pos;
-          }
-
-          if (found && pos < tx_map[in_to_key.amount].size())
-            outputs.push_back(tx_map[in_to_key.amount].at(pos));
-          else
+          offset += relative_offset;
+          const auto it = std::lower_bound(output_requests.begin(), output_requests.end(), std::make_pair(in_to_key.amount, offset));
+          const size_t pos = it - output_requests.begin();
+          if (it == output_requests.end() || *it != std::make_pair(in_to_key.amount, offset) || !output_found[pos])
             break;
+          outputs.push_back(output_data[pos]);
         }
 
-        its->second.emplace(in_to_key.k_image, outputs);
+        its->second.emplace(in_to_key.k_image, std::move(outputs));
       }
     }
   }
@@ -5572,6 +6007,52 @@ bool Blockchain::txpool_tx_matches_category(const crypto::hash& tx_hash, relay_c
   return m_db->txpool_tx_matches_category(tx_hash, category);
 }
 
+void Blockchain::set_rct_ver_cache_options(size_t max_size, bool persist)
+{
+  m_rct_ver_cache.resize(max_size);
+  m_rct_ver_cache_persist = persist;
+}
+//------------------------------------------------------------------
+void Blockchain::get_rct_ver_cache_stats(uint64_t &hits, uint64_t &misses, uint64_t &size) const
+{
+  hits = m_rct_ver_cache.hits();
+  misses = m_rct_ver_cache.misses();
+  size = m_rct_ver_cache.size();
+}
+//------------------------------------------------------------------
+bool Blockchain::get_cached_block_pow(uint64_t height, const crypto::hash &id, crypto::hash &pow) const
+{
+  if (!m_block_pow_cache_size)
+    return false;
+  try
+  {
+    return m_db->get_block_pow(height, id, pow);
+  }
+  catch (const std::exception &e)
+  {
+    MWARNING("Failed to look up stored PoW hash for block " << id << ": " << e.what());
+    return false;
+  }
+}
+//------------------------------------------------------------------
+void Blockchain::cache_block_pow(uint64_t height, const crypto::hash &id, const crypto::hash &pow)
+{
+  if (!m_block_pow_cache_size || m_db->is_read_only())
+    return;
+  try
+  {
+    m_db->add_block_pow(height, id, pow);
+    // counting the stored hashes is not free, and a few more than asked
+    // for do no harm, so trim once in a while rather than on each block
+    if (height % BLOCK_POW_CACHE_TRIM_INTERVAL == 0)
+      m_db->trim_block_pow(m_block_pow_cache_size);
+  }
+  catch (const std::exception &e)
+  {
+    MWARNING("Failed to store PoW hash for block " << id << ": " << e.what());
+  }
+}
+//------------------------------------------------------------------
 void Blockchain::set_user_options(uint64_t maxthreads, bool sync_on_blocks, uint64_t sync_threshold, blockchain_db_sync_mode sync_mode, bool fast_sync)
 {
   if (sync_mode == db_defaultsync)
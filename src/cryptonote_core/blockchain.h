@@ -54,6 +54,7 @@
 #include "cryptonote_basic/cryptonote_basic.h"
 #include "common/powerof.h"
 #include "common/util.h"
+#include "common/threadpool.h"
 #include "cryptonote_protocol/cryptonote_protocol_defs.h"
 #include "rpc/core_rpc_server_commands_defs.h"
 #include "cryptonote_basic/difficulty.h"
@@ -256,6 +257,28 @@ namespace cryptonote
      */
     bool prepare_handle_incoming_blocks(const std::vector<block_complete_entry>  &blocks_entry, std::vector<block> &blocks);
 
+    /**
+     * @brief starts computing the PoW of the span following the one just prepared
+     *
+     * The hashing runs on the background threadpool while the prepared span is
+     * verified and committed, and its result is picked up by the next call
+     * to prepare_handle_incoming_blocks if it is for that span. That pool only
+     * has two threads, which leaves most cores to the verification. Only one span
+     * is hashed ahead at a time. Blocks which do not directly follow the
+     * prepared span are ignored.
+     *
+     * @param height the height of the first block
+     * @param block_blobs the blocks of the next span
+     */
+    void queue_pow_lookahead(uint64_t height, const std::vector<blobdata> &block_blobs);
+
+    /**
+     * @brief gets the number of blocks waiting to be hashed ahead
+     *
+     * @return the number of blocks queued by queue_pow_lookahead which are not hashed yet
+     */
+    uint64_t get_pow_lookahead_queue_depth() const { return m_pow_lookahead_pending; }
+
     /**
      * @brief prepare the blockchain for handling an incoming block, without performing preprocessing
      *
@@ -641,6 +664,22 @@ namespace cryptonote
      */
     bool check_tx_inputs(transaction& tx, uint64_t& pmax_used_block_height, crypto::hash& max_used_block_id, tx_verification_context &tvc, bool kept_by_block = false) const;
 
+    /**
+     * @brief checks a relayed transaction's ring signatures ahead of admission
+     *
+     * The ring members are read from the database as it is now, without
+     * the blockchain lock, so several transactions may be pre-verified
+     * concurrently. Only RingCT transactions whose results are cached are
+     * checked, and only once they pass the input rules and none of their
+     * key images is spent on chain: a pass is recorded in the RingCT verification cache, which
+     * check_tx_inputs consults later. No result is returned, since the
+     * rings may have changed by the time the transaction is admitted.
+     *
+     * @param tx the transaction to check; its rct signatures are expanded
+     * @param hf_version the consensus rules version to use
+     */
+    void preverify_tx_input_signatures(transaction& tx, uint8_t hf_version) const;
+
     /**
      * @brief get fee quantization mask
      *
@@ -887,6 +926,37 @@ namespace cryptonote
      */
     void set_show_time_stats(bool stats) { m_show_time_stats = stats; }
 
+    /**
+     * @brief configures the RingCT verification cache
+     *
+     * Must be called before init for persist to take effect.
+     *
+     * @param max_size the maximum number of cached verification results
+     * @param persist whether to load/store the cache from/to the database
+     */
+    void set_rct_ver_cache_options(size_t max_size, bool persist);
+
+    /**
+     * @brief gets RingCT verification cache statistics
+     *
+     * @param hits return-by-reference the number of cache hits
+     * @param misses return-by-reference the number of cache misses
+     * @param size return-by-reference the current number of entries
+     */
+    void get_rct_ver_cache_stats(uint64_t &hits, uint64_t &misses, uint64_t &size) const;
+
+    /**
+     * @brief sets the number of block PoW hashes kept in the database
+     *
+     * PoW hashes are looked up there before hashing a block again, which
+     * happens on reorgs, when switching to an alternative chain and when
+     * blocks are popped and added again. The oldest ones are removed every
+     * BLOCK_POW_CACHE_TRIM_INTERVAL blocks, so there can be that many more.
+     *
+     * @param max_entries the number of PoW hashes to keep, 0 to disable
+     */
+    void set_block_pow_cache_size(uint64_t max_entries) { m_block_pow_cache_size = max_entries; }
+
     /**
      * @brief gets the hardfork voting state object
      *
@@ -1060,14 +1130,27 @@ namespace cryptonote
     }
 
     /**
-     * @brief get a number of outputs of a specific amount
+     * @brief get a batch of outputs
      *
-     * @param amount the amount
-     * @param offsets the indices (indexed to the amount) of the outputs
+     * @param amount_indices the (amount, amount index) pairs of the outputs
      * @param outputs return-by-reference the outputs collected
+     * @param found return-by-reference whether each output was found
      */
-    void output_scan_worker(const uint64_t amount,const std::vector<uint64_t> &offsets,
-        std::vector<output_data_t> &outputs) const;
+    void output_scan_worker(const epee::span<const std::pair<uint64_t, uint64_t>> amount_indices,
+        std::vector<output_data_t> &outputs, std::vector<bool> &found) const;
+
+    /**
+     * @brief moves PoW hashed ahead for a span into the longhash table
+     *
+     * Waits for any hashing still in progress. The lookahead state is
+     * consumed whether or not it matches.
+     *
+     * @param height the height of the first block
+     * @param blocks the span's parsed blocks
+     *
+     * @return true if the PoW of every block was found, with the right seed
+     */
+    bool take_pow_lookahead(uint64_t height, std::vector<block> &blocks);
 
     /**
      * @brief computes the "short" and "long" hashes for a set of blocks
@@ -1094,12 +1177,17 @@ namespace cryptonote
     bool get_txpool_tx_blob(const crypto::hash& txid, cryptonote::blobdata &bd, relay_category tx_category) const;
     cryptonote::blobdata get_txpool_tx_blob(const crypto::hash& txid, relay_category tx_category) const;
     bool for_all_txpool_txes(std::function<bool(const crypto::hash&, const txpool_tx_meta_t&, const cryptonote::blobdata_ref*)>, bool include_blob = false, relay_category tx_category = relay_category::broadcasted) const;
+    void flush_txpool_updates();
     bool txpool_tx_matches_category(const crypto::hash& tx_hash, relay_category category);
 
     bool is_within_compiled_block_hash_area() const { return is_within_compiled_block_hash_area(m_db->height()); }
     uint64_t prevalidate_block_hashes(uint64_t height, const std::vector<crypto::hash> &hashes, const std::vector<uint64_t> &weights);
     uint32_t get_blockchain_pruning_seed() const { return m_db->get_blockchain_pruning_seed(); }
     bool prune_blockchain(uint32_t pruning_seed = 0);
+    bool prune_blockchain_incremental(uint32_t pruning_seed, uint64_t max_bytes);
+    bool move_to_cold_storage(uint64_t max_bytes);
+    bool start_db_compaction();
+    bool finish_db_compaction();
     bool update_blockchain_pruning();
     bool check_blockchain_pruning();
 
@@ -1181,6 +1269,23 @@ namespace cryptonote
     std::unordered_map<crypto::hash, std::unordered_map<crypto::key_image, std::vector<output_data_t>>> m_scan_table;
     std::unordered_map<crypto::hash, crypto::hash> m_blocks_longhash_table;
 
+    // PoW computed ahead for the next span, see queue_pow_lookahead
+    struct pow_lookahead
+    {
+      uint64_t height;
+      std::vector<block> blocks;
+      std::vector<crypto::hash> seeds;
+      std::vector<crypto::hash> pow;
+      std::vector<uint8_t> done;
+      tools::threadpool::waiter waiter;
+
+      pow_lookahead(tools::threadpool &tpool): height(0), waiter(tpool) {}
+    };
+    std::unique_ptr<pow_lookahead> m_pow_lookahead;
+    std::atomic<uint64_t> m_pow_lookahead_pending;
+    uint64_t m_prepared_span_height;
+    std::vector<crypto::hash> m_prepared_span_hashes;
+
     // Keccak hashes for each block and for fast pow checking
     std::vector<std::pair<crypto::hash, crypto::hash>> m_blocks_hash_of_hashes;
     std::vector<std::pair<crypto::hash, uint64_t>> m_blocks_hash_check;
@@ -1261,6 +1366,33 @@ namespace cryptonote
 
     // cache for verifying transaction RCT non semantics
     mutable rct_ver_cache_t m_rct_ver_cache;
+    bool m_rct_ver_cache_persist;
+
+    // block PoW hashes kept in the db, see set_block_pow_cache_size
+    uint64_t m_block_pow_cache_size;
+
+    /**
+     * @brief looks up a block's PoW hash in the database
+     *
+     * @param height the height of the block
+     * @param id the hash of the block
+     * @param pow return-by-reference the block's PoW hash
+     *
+     * @return true if the PoW hash was found, false otherwise
+     */
+    bool get_cached_block_pow(uint64_t height, const crypto::hash &id, crypto::hash &pow) const;
+
+    /**
+     * @brief stores a block's PoW hash in the database
+     *
+     * Needs a write transaction to be active. The oldest PoW hashes are
+     * removed if there are more than the configured maximum.
+     *
+     * @param height the height of the block
+     * @param id the hash of the block
+     * @param pow the block's PoW hash
+     */
+    void cache_block_pow(uint64_t height, const crypto::hash &id, const crypto::hash &pow);
 
     /**
      * @brief collects the keys for all outputs being "spent" as an input
@@ -1278,11 +1410,12 @@ namespace cryptonote
      * @param tx_prefix_hash the hash of the associated transaction_prefix
      * @param pmax_related_block_height return-by-pointer the height of the most recent block in the input set
      * @param tx_version version of the tx, if > 1 we also get commitments
+     * @param ring_members if not NULL, outputs already fetched for this input, used when there is no scan table entry
      *
      * @return false if any keys are not found or any inputs are not unlocked, otherwise true
      */
     template<class visitor_t>
-    inline bool scan_outputkeys_for_indexes(size_t tx_version, const txin_to_key& tx_in_to_key, visitor_t &vis, const crypto::hash &tx_prefix_hash, uint64_t* pmax_related_block_height = NULL) const;
+    inline bool scan_outputkeys_for_indexes(size_t tx_version, const txin_to_key& tx_in_to_key, visitor_t &vis, const crypto::hash &tx_prefix_hash, uint64_t* pmax_related_block_height = NULL, const std::vector<output_data_t> *ring_members = NULL) const;
 
     /**
      * @brief collect output public keys of a transaction input set
@@ -1302,10 +1435,11 @@ namespace cryptonote
      * @param rct_signatures the ringCT signatures, which are only valid if tx version > 1
      * @param pmax_related_block_height return-by-pointer the height of the most recent block in the input set
      * @param hf_version the consensus rules version to use
+     * @param ring_members if not NULL, outputs already fetched for this input
      *
      * @return false if any output is not yet unlocked, or is missing, otherwise true
      */
-    bool check_tx_input(size_t tx_version,const txin_to_key& txin, const crypto::hash& tx_prefix_hash, const std::vector<crypto::signature>& sig, const rct::rctSig &rct_signatures, std::vector<rct::ctkey> &output_keys, uint64_t* pmax_related_block_height, uint8_t hf_version) const;
+    bool check_tx_input(size_t tx_version,const txin_to_key& txin, const crypto::hash& tx_prefix_hash, const std::vector<crypto::signature>& sig, const rct::rctSig &rct_signatures, std::vector<rct::ctkey> &output_keys, uint64_t* pmax_related_block_height, uint8_t hf_version, const std::vector<output_data_t> *ring_members = NULL) const;
 
     /**
      * @brief validate a transaction's inputs and their keys
@@ -1329,6 +1463,88 @@ namespace cryptonote
      */
     bool check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height = NULL) const;
 
+    /**
+     * @brief ring members collected for a transaction's inputs
+     *
+     * Filled in by check_tx_input_rings, and consumed by
+     * check_tx_input_signatures once all database lookups are done.
+     */
+    struct tx_input_rings
+    {
+      crypto::hash tx_prefix_hash;
+      std::vector<std::vector<rct::ctkey>> pubkeys;
+    };
+
+    /**
+     * @brief checks the output count, ring size, version and input order rules
+     *
+     * These don't depend on the ring members, so they are cheap enough to
+     * run before any signature work.
+     *
+     * @param tx the transaction to validate
+     * @param tvc returned information about tx verification
+     * @param hf_version the consensus rules version to use
+     *
+     * @return false if any rule is broken, otherwise true
+     */
+    bool check_tx_input_rules(const transaction& tx, tx_verification_context &tvc, uint8_t hf_version) const;
+
+    /**
+     * @brief validates a transaction's inputs, except for their signatures
+     *
+     * This is the first half of check_tx_inputs: it checks the ring size and
+     * version rules, checks the key images are not spent, and looks up the
+     * ring members of each input.  It needs the database, so it must run on
+     * the thread which holds the blockchain lock.
+     *
+     * @param tx the transaction to validate
+     * @param tvc returned information about tx verification
+     * @param rings return-by-reference the ring members of each input
+     * @param pmax_related_block_height return-by-pointer the height of the most recent block in the input set
+     *
+     * @return false if any validation step fails, otherwise true
+     */
+    bool check_tx_input_rings(const transaction& tx, tx_verification_context &tvc, tx_input_rings &rings, uint64_t* pmax_used_block_height = NULL) const;
+
+    /**
+     * @brief looks up the ring members of all of a transaction's inputs at once
+     *
+     * @param tx the transaction
+     * @param ring_members return-by-reference the outputs found for each input, empty on error
+     */
+    void prefetch_ring_members(const transaction& tx, std::vector<std::vector<output_data_t>> &ring_members) const;
+
+    /**
+     * @brief validates a transaction's input signatures
+     *
+     * This is the second half of check_tx_inputs. It only uses the rings
+     * collected by check_tx_input_rings, so it is safe to call for several
+     * transactions concurrently.
+     * The transaction's rct signatures, if any, are expanded.
+     *
+     * @param tx the transaction to validate
+     * @param rings the ring members of each input
+     * @param hf_version the consensus rules version to use
+     *
+     * @return false if any signature fails to verify, otherwise true
+     */
+    bool check_tx_input_signatures(transaction& tx, const tx_input_rings &rings, uint8_t hf_version) const;
+
+    /**
+     * @brief validates the input signatures of all of a block's transactions
+     *
+     * The transactions are verified concurrently on the compute threadpool.
+     * Failures are reported deterministically: the result is always the first
+     * failing transaction in block order, regardless of thread scheduling.
+     *
+     * @param txs the block's transactions, in block order
+     * @param rings the ring members for each transaction, from check_tx_input_rings
+     * @param hf_version the consensus rules version to use
+     *
+     * @return the index of the first transaction which failed, or txs.size() if all passed
+     */
+    size_t check_block_tx_signatures(std::vector<std::pair<transaction, blobdata>> &txs, const std::vector<tx_input_rings> &rings, uint8_t hf_version) const;
+
     /**
      * @brief performs a blockchain reorganization according to the longest chain rule
      *
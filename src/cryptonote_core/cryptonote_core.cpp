@@ -35,6 +35,7 @@
 using namespace epee;
 
 #include <unordered_set>
+#include <chrono>
 #include "cryptonote_core.h"
 #include "common/util.h"
 #include "common/updates.h"
@@ -194,6 +195,16 @@ namespace cryptonote
   , "Prune blockchain"
   , false
   };
+  static const command_line::arg_descriptor<bool> arg_prune_blockchain_online  = {
+    "prune-blockchain-online"
+  , "With --prune-blockchain, prune in the background while the daemon runs instead of before it starts"
+  , false
+  };
+  static const command_line::arg_descriptor<uint64_t> arg_prune_blockchain_rate  = {
+    "prune-blockchain-rate"
+  , "kB of prunable data online pruning goes through per second"
+  , DEFAULT_PRUNING_ONLINE_RATE
+  };
   static const command_line::arg_descriptor<std::string> arg_reorg_notify = {
     "reorg-notify"
   , "Run a program for each reorg, '%s' will be replaced by the split height, "
@@ -219,6 +230,49 @@ namespace cryptonote
   , "Keep alternative blocks on restart"
   , false
   };
+  static const command_line::arg_descriptor<size_t> arg_rct_ver_cache_size  = {
+    "rct-ver-cache-size"
+  , "Number of RingCT verification results to cache"
+  , RCT_VER_CACHE_SIZE
+  };
+  static const command_line::arg_descriptor<bool> arg_rct_ver_cache_persist  = {
+    "rct-ver-cache-persist"
+  , "Save the RingCT verification cache to the database on exit, and reload it on start"
+  , false
+  };
+  static const command_line::arg_descriptor<unsigned> arg_spent_key_filter_bits  = {
+    "spent-key-filter-bits"
+  , "Bits of memory per spent key image for the filter saving database lookups of unspent ones, 0 to disable"
+  , DEFAULT_SPENT_KEY_FILTER_BITS
+  };
+  static const command_line::arg_descriptor<uint64_t> arg_block_pow_cache_size  = {
+    "block-pow-cache-size"
+  , "Number of block PoW hashes to keep in the database for reorgs and alternative chains, 0 to disable"
+  , DEFAULT_BLOCK_POW_CACHE_SIZE
+  };
+  static const command_line::arg_descriptor<std::string> arg_db_compression  = {
+    "db-compression"
+  , "Database tables to keep zstd compressed: none, all, or a comma separated list of blocks, txs_pruned and txs_prunable. "
+    "A change converts the database at start, which can take a long time. "
+    "A table with too few values to train a dictionary on, as in a new database, is compressed on a later start"
+  , ""
+  };
+  static const command_line::arg_descriptor<std::string> arg_db_cold_path  = {
+    "db-cold-path"
+  , "Move old prunable data to a second database at this path, which may be on slower storage. "
+    "Data already moved is found without this, but nothing more is moved"
+  , ""
+  };
+  static const command_line::arg_descriptor<uint64_t> arg_db_cold_depth  = {
+    "db-cold-depth"
+  , "Number of top blocks whose data stays out of cold storage"
+  , DEFAULT_DB_COLD_DEPTH
+  };
+  static const command_line::arg_descriptor<bool> arg_db_cold_blocks  = {
+    "db-cold-blocks"
+  , "Move old blocks to cold storage too"
+  , false
+  };
 
   //-----------------------------------------------------------------------------------------------
   core::core(i_cryptonote_protocol* pprotocol):
@@ -235,7 +289,10 @@ namespace cryptonote
               m_disable_dns_checkpoints(false),
               m_update_download(0),
               m_nettype(UNDEFINED),
-              m_update_available(false)
+              m_update_available(false),
+              m_online_pruning(false),
+              m_online_pruning_rate(DEFAULT_PRUNING_ONLINE_RATE * 1024),
+              m_cold_storage(false)
   {
     m_checkpoints_updating.clear();
     set_cryptonote_protocol(pprotocol);
@@ -338,9 +395,19 @@ namespace cryptonote
     command_line::add_arg(desc, arg_max_txpool_weight);
     command_line::add_arg(desc, arg_block_notify);
     command_line::add_arg(desc, arg_prune_blockchain);
+    command_line::add_arg(desc, arg_prune_blockchain_online);
+    command_line::add_arg(desc, arg_prune_blockchain_rate);
     command_line::add_arg(desc, arg_reorg_notify);
     command_line::add_arg(desc, arg_block_rate_notify);
     command_line::add_arg(desc, arg_keep_alt_blocks);
+    command_line::add_arg(desc, arg_rct_ver_cache_size);
+    command_line::add_arg(desc, arg_rct_ver_cache_persist);
+    command_line::add_arg(desc, arg_block_pow_cache_size);
+    command_line::add_arg(desc, arg_db_compression);
+    command_line::add_arg(desc, arg_db_cold_path);
+    command_line::add_arg(desc, arg_db_cold_depth);
+    command_line::add_arg(desc, arg_db_cold_blocks);
+    command_line::add_arg(desc, arg_spent_key_filter_bits);
 
     miner::init_options(desc);
     BlockchainDB::init_options(desc);
@@ -480,8 +547,13 @@ namespace cryptonote
     std::string check_updates_string = command_line::get_arg(vm, arg_check_updates);
     size_t max_txpool_weight = command_line::get_arg(vm, arg_max_txpool_weight);
     bool prune_blockchain = command_line::get_arg(vm, arg_prune_blockchain);
+    bool prune_online = command_line::get_arg(vm, arg_prune_blockchain_online);
+    m_online_pruning_rate = command_line::get_arg(vm, arg_prune_blockchain_rate) * 1024;
     bool keep_alt_blocks = command_line::get_arg(vm, arg_keep_alt_blocks);
     bool keep_fakechain = command_line::get_arg(vm, arg_keep_fakechain);
+    size_t rct_ver_cache_size = command_line::get_arg(vm, arg_rct_ver_cache_size);
+    bool rct_ver_cache_persist = command_line::get_arg(vm, arg_rct_ver_cache_persist);
+    uint64_t block_pow_cache_size = command_line::get_arg(vm, arg_block_pow_cache_size);
 
     boost::filesystem::path folder(m_config_folder);
     // --regtest already appends "fake" through arg_data_dir. Some tests set
@@ -613,6 +685,42 @@ namespace cryptonote
       if (db_salvage)
         db_flags |= DBF_SALVAGE;
 
+      db->set_spent_key_filter_bits(command_line::get_arg(vm, arg_spent_key_filter_bits));
+      if (!command_line::is_arg_defaulted(vm, arg_db_compression))
+      {
+        unsigned db_compression = 0;
+        std::vector<std::string> tables;
+        boost::split(tables, command_line::get_arg(vm, arg_db_compression), boost::is_any_of(","));
+        for (const std::string &table: tables)
+        {
+          if (table == "all")
+            db_compression |= DB_COMPRESS_ALL;
+          else if (table == "blocks")
+            db_compression |= DB_COMPRESS_BLOCKS;
+          else if (table == "txs_pruned")
+            db_compression |= DB_COMPRESS_TXS_PRUNED;
+          else if (table == "txs_prunable")
+            db_compression |= DB_COMPRESS_TXS_PRUNABLE;
+          else if (table != "none")
+          {
+            LOG_ERROR("Invalid db compression table: " << table);
+            return false;
+          }
+        }
+        db->set_blob_compression(db_compression);
+      }
+      const std::string db_cold_path = command_line::get_arg(vm, arg_db_cold_path);
+      if (!db_cold_path.empty())
+      {
+        const uint64_t db_cold_depth = command_line::get_arg(vm, arg_db_cold_depth);
+        if (db_cold_depth < CRYPTONOTE_PRUNING_TIP_BLOCKS)
+        {
+          LOG_ERROR("Cold storage depth must be at least " << CRYPTONOTE_PRUNING_TIP_BLOCKS << " blocks");
+          return false;
+        }
+        db->set_cold_storage(db_cold_path, db_cold_depth, DB_COLD_TXS_PRUNABLE | (command_line::get_arg(vm, arg_db_cold_blocks) ? DB_COLD_BLOCKS : 0));
+        m_cold_storage = true;
+      }
       db->open(filename, db_flags);
       if(!db->m_open)
         return false;
@@ -625,6 +733,8 @@ namespace cryptonote
 
     m_blockchain_storage.set_user_options(blocks_threads,
         sync_on_blocks, sync_threshold, sync_mode, fast_sync);
+    m_blockchain_storage.set_rct_ver_cache_options(rct_ver_cache_size, rct_ver_cache_persist);
+    m_blockchain_storage.set_block_pow_cache_size(block_pow_cache_size);
 
     try
     {
@@ -725,8 +835,16 @@ namespace cryptonote
       // display a message if the blockchain is not pruned yet
       if (!m_blockchain_storage.get_blockchain_pruning_seed())
       {
-        MGINFO("Pruning blockchain...");
-        CHECK_AND_ASSERT_MES(m_blockchain_storage.prune_blockchain(), false, "Failed to prune blockchain");
+        if (prune_online)
+        {
+          MGINFO("Pruning blockchain online...");
+          CHECK_AND_ASSERT_MES(prune_blockchain_online(), false, "Failed to start pruning blockchain");
+        }
+        else
+        {
+          MGINFO("Pruning blockchain...");
+          CHECK_AND_ASSERT_MES(m_blockchain_storage.prune_blockchain(), false, "Failed to prune blockchain");
+        }
       }
       else
       {
@@ -734,6 +852,14 @@ namespace cryptonote
       }
     }
 
+    // online pruning carries on where it was before a restart
+    uint64_t pruning_height;
+    if (!m_blockchain_storage.get_db().is_read_only() && get_blockchain_pruning_progress(pruning_height))
+    {
+      MGINFO("Resuming online blockchain pruning from height " << pruning_height);
+      m_online_pruning = true;
+    }
+
     return load_state_data();
   }
   //-----------------------------------------------------------------------------------------------
@@ -782,14 +908,8 @@ namespace cryptonote
     return false;
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, relay_method tx_relay, bool relayed)
+  bool core::parse_incoming_tx(const blobdata& tx_blob, transaction& tx, crypto::hash& txid, tx_verification_context& tvc) const
   {
-    tvc = {};
-
-    TRY_ENTRY();
-
-    CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
-
     if (tx_blob.size() > get_max_tx_size())
     {
       LOG_PRINT_L1("WRONG TRANSACTION BLOB, too big size " << tx_blob.size() << ", rejected");
@@ -798,17 +918,19 @@ namespace cryptonote
       return false;
     }
 
-    transaction tx;
-    crypto::hash txid;
     if (!parse_and_validate_tx_from_blob(tx_blob, tx, txid))
     {
       LOG_PRINT_L1("Incoming transactions failed to parse, rejected");
       tvc.m_verifivation_failed = true;
       return false;
     }
-
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::add_incoming_tx(transaction& tx, const crypto::hash& txid, const blobdata& tx_blob, tx_verification_context& tvc, relay_method tx_relay, bool relayed, uint8_t nic_verified_hf_version)
+  {
     const uint64_t tx_weight = get_transaction_weight(tx, tx_blob.size());
-    if (!add_new_tx(tx, txid, tx_blob, tx_weight, tvc, tx_relay, relayed))
+    if (!add_new_tx(tx, txid, tx_blob, tx_weight, tvc, tx_relay, relayed, nic_verified_hf_version))
       return false;
 
     if (tvc.m_verifivation_failed)
@@ -830,9 +952,140 @@ namespace cryptonote
     MDEBUG("tx added to pool: " << txid);
 
     return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, relay_method tx_relay, bool relayed)
+  {
+    tvc = {};
+
+    TRY_ENTRY();
+
+    CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
+
+    std::vector<incoming_tx> txs;
+    const uint8_t hf_version = m_blockchain_storage.get_current_hard_fork_version();
+    precheck_incoming_txs({&tx_blob, 1}, txs, {&tvc, 1}, hf_version);
+    incoming_tx &itx = txs[0];
+    if (!itx.parsed || (!itx.prechecked && tvc.m_verifivation_failed))
+      return false;
+
+    return add_incoming_tx(itx.tx, itx.txid, tx_blob, tvc, tx_relay, relayed, itx.prechecked ? hf_version : 0);
     CATCH_ENTRY_L0("core::handle_incoming_tx()", false);
   }
   //-----------------------------------------------------------------------------------------------
+  size_t core::precheck_incoming_txs(const epee::span<const blobdata> tx_blobs, std::vector<incoming_tx> &txs, epee::span<tx_verification_context> tvcs, uint8_t hf_version)
+  {
+    txs.resize(tx_blobs.size());
+    for (incoming_tx &itx: txs)
+      itx.parsed = itx.prechecked = false;
+
+    size_t n_txs = txs.size();
+    std::vector<size_t> checked;
+    for (size_t i = 0; i < txs.size(); ++i)
+    {
+      incoming_tx &itx = txs[i];
+      itx.parsed = parse_incoming_tx(tx_blobs[i], itx.tx, itx.txid, tvcs[i]);
+      if (!itx.parsed)
+      {
+        n_txs = i;
+        break;
+      }
+      // txes we already have are left for add_incoming_tx to skip
+      if (m_mempool.have_tx(itx.txid, relay_category::legacy) || m_blockchain_storage.have_tx(itx.txid))
+        continue;
+      checked.push_back(i);
+    }
+
+    // the non-input consensus rules, with the RingCT semantics of all the
+    // txes in one batch
+    std::vector<const transaction*> checked_txs(checked.size());
+    std::vector<tx_verification_context> checked_tvcs(checked.size());
+    for (size_t n = 0; n < checked.size(); ++n)
+      checked_txs[n] = &txs[checked[n]].tx;
+    ver_non_input_consensus(epee::to_span(checked_txs), epee::to_mut_span(checked_tvcs), hf_version);
+
+    for (size_t n = 0; n < checked.size(); ++n)
+    {
+      const size_t i = checked[n];
+      incoming_tx &itx = txs[i];
+      if (checked_tvcs[n].m_verifivation_failed)
+      {
+        LOG_PRINT_L1("transaction " << itx.txid << " failed non-input consensus rule checks");
+        tvcs[i] = checked_tvcs[n];
+        return i;
+      }
+      itx.prechecked = m_mempool.precheck_tx(itx.tx, itx.txid, get_transaction_weight(itx.tx, tx_blobs[i].size()), tvcs[i], hf_version, hf_version);
+      if (!itx.prechecked && !tvcs[i].m_no_drop_offense)
+        return i;
+    }
+
+    return n_txs;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_txs(const epee::span<const blobdata> tx_blobs, epee::span<tx_verification_context> tvcs, relay_method tx_relay, bool relayed)
+  {
+    TRY_ENTRY();
+
+    CHECK_AND_ASSERT_MES(tx_blobs.size() == tvcs.size(), false, "tx blobs and verification contexts mismatch");
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // the cheap checks go first and stop at the first tx which gets the
+    // peer dropped, so a batch of txes which are rejected anyway costs no
+    // signature work
+    std::vector<incoming_tx> txs;
+    for (size_t i = 0; i < tx_blobs.size(); ++i)
+      tvcs[i] = {};
+    const uint8_t hf_version = m_blockchain_storage.get_current_hard_fork_version();
+    const size_t n_txs = precheck_incoming_txs(tx_blobs, txs, tvcs, hf_version);
+
+    // signature checks don't need m_incoming_tx_lock, so the txes which
+    // passed go through them side by side, while the pool is free for other
+    // peers' txes and for blocks
+    tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
+    tools::threadpool::waiter waiter(tpool);
+    for (size_t i = 0; i < n_txs; ++i)
+    {
+      if (!txs[i].prechecked)
+        continue;
+      tpool.submit(&waiter, [this, &txs, hf_version, i](){
+        incoming_tx &itx = txs[i];
+        try { m_blockchain_storage.preverify_tx_input_signatures(itx.tx, hf_version); }
+        catch (const std::exception &e) { MDEBUG("Failed to pre-verify tx " << itx.txid << ": " << e.what()); }
+      });
+    }
+    waiter.wait();
+    const auto preverified = std::chrono::steady_clock::now();
+
+    // key image conflicts and the pool itself are only checked and changed
+    // one tx at a time; the signature checks in there now mostly hit the
+    // RingCT verification cache
+    size_t n_added = 0;
+    for (size_t i = 0; i < n_txs; ++i)
+    {
+      // a tx which failed the cheap checks without a drop offense has its tvc set already
+      if (!txs[i].parsed || (!txs[i].prechecked && tvcs[i].m_verifivation_failed))
+        continue;
+      CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
+      const bool ok = add_incoming_tx(txs[i].tx, txs[i].txid, tx_blobs[i], tvcs[i], tx_relay, relayed, txs[i].prechecked ? hf_version : 0);
+      if (tvcs[i].m_added_to_pool)
+        ++n_added;
+      if (!ok && !tvcs[i].m_no_drop_offense)
+        return false;
+    }
+    if (n_txs < txs.size())
+      return false;
+
+    const auto end = std::chrono::steady_clock::now();
+    const uint64_t preverify_us = std::chrono::duration_cast<std::chrono::microseconds>(preverified - start).count();
+    const uint64_t total_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    LOG_PRINT_L1("Admitted " << n_added << "/" << txs.size() << " incoming txes in " << total_us / 1000.0f << " ms ("
+        << preverify_us / 1000.0f << " ms pre-verifying), " << (total_us ? txs.size() * 1000000 / total_us : 0) << " tx/s");
+
+    return true;
+    CATCH_ENTRY_L0("core::handle_incoming_txs()", false);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::check_tx_semantic(const transaction& tx, tx_verification_context& tvc,
       uint8_t hf_version)
   {
@@ -1076,7 +1329,7 @@ namespace cryptonote
     return m_blockchain_storage.get_total_transactions();
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::add_new_tx(transaction& tx, const crypto::hash& tx_hash, const cryptonote::blobdata &blob, size_t tx_weight, tx_verification_context& tvc, relay_method tx_relay, bool relayed)
+  bool core::add_new_tx(transaction& tx, const crypto::hash& tx_hash, const cryptonote::blobdata &blob, size_t tx_weight, tx_verification_context& tvc, relay_method tx_relay, bool relayed, uint8_t nic_verified_hf_version)
   {
     if(m_mempool.have_tx(tx_hash, relay_category::legacy))
     {
@@ -1091,7 +1344,7 @@ namespace cryptonote
     }
 
     uint8_t version = m_blockchain_storage.get_current_hard_fork_version();
-    const bool res = m_mempool.add_tx(tx, tx_hash, blob, tx_weight, tvc, tx_relay, relayed, version);
+    const bool res = m_mempool.add_tx(tx, tx_hash, blob, tx_weight, tvc, tx_relay, relayed, version, nic_verified_hf_version);
 
     // If new incoming tx passed verification and entered the pool, notify ZMQ
     if (!tvc.m_verifivation_failed && res && matches_category(tvc.m_relay, relay_category::legacy))
@@ -1386,6 +1639,17 @@ namespace cryptonote
     return success;
   }
 
+  //-----------------------------------------------------------------------------------------------
+  void core::queue_pow_lookahead(uint64_t height, const std::vector<blobdata> &block_blobs)
+  {
+    m_blockchain_storage.queue_pow_lookahead(height, block_blobs);
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t core::get_pow_lookahead_queue_depth() const
+  {
+    return m_blockchain_storage.get_pow_lookahead_queue_depth();
+  }
+
   //-----------------------------------------------------------------------------------------------
   bool core::handle_incoming_block(const blobdata& block_blob, const block *b,
     block_verification_context& bvc, bool update_miner_blocktemplate)
@@ -1660,6 +1924,10 @@ namespace cryptonote
     m_check_disk_space_interval.do_call(boost::bind(&core::check_disk_space, this));
     m_block_rate_interval.do_call(boost::bind(&core::check_block_rate, this));
     m_blockchain_pruning_interval.do_call(boost::bind(&core::update_blockchain_pruning, this));
+    m_online_pruning_interval.do_call(boost::bind(&core::prune_blockchain_online_step, this));
+    m_cold_storage_interval.do_call(boost::bind(&core::move_to_cold_storage_step, this));
+    m_db_compaction_interval.do_call(boost::bind(&core::finish_database_compaction_step, this));
+    m_txpool_flush_interval.do_call(boost::bind(&core::flush_txpool_updates, this));
     m_diff_recalc_interval.do_call(boost::bind(&core::recalculate_difficulties, this));
     m_miner.on_idle();
     m_mempool.on_idle();
@@ -1925,6 +2193,16 @@ namespace cryptonote
     return m_blockchain_storage.check_blockchain_pruning();
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::compact_database()
+  {
+    return m_blockchain_storage.start_db_compaction();
+  }
+  //-----------------------------------------------------------------------------------------------
+  db_compaction_status core::get_database_compaction_status() const
+  {
+    return m_blockchain_storage.get_db().get_compaction_status();
+  }
+  //-----------------------------------------------------------------------------------------------
   void core::set_target_blockchain_height(uint64_t target_blockchain_height)
   {
     m_target_blockchain_height = target_blockchain_height;
@@ -1957,6 +2235,80 @@ namespace cryptonote
     return get_blockchain_storage().prune_blockchain(pruning_seed);
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::prune_blockchain_online(uint32_t pruning_seed)
+  {
+    // this only saves the seed and where to start, the steps do the rest
+    if (!get_blockchain_storage().prune_blockchain_incremental(pruning_seed, 0))
+      m_online_pruning = true;
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::get_blockchain_pruning_progress(uint64_t &height) const
+  {
+    return get_blockchain_storage().get_db().get_pruning_progress(height);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::prune_blockchain_online_step()
+  {
+    if (!m_online_pruning)
+      return true;
+    try
+    {
+      if (m_blockchain_storage.prune_blockchain_incremental(0, m_online_pruning_rate))
+        m_online_pruning = false;
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Online blockchain pruning failed, it will resume on the next start: " << e.what());
+      m_online_pruning = false;
+    }
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::move_to_cold_storage_step()
+  {
+    if (!m_cold_storage)
+      return true;
+    try
+    {
+      m_blockchain_storage.move_to_cold_storage(DB_COLD_STORAGE_RATE * 1024);
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Moving data to cold storage failed, it will resume on the next start: " << e.what());
+      m_cold_storage = false;
+    }
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::finish_database_compaction_step()
+  {
+    if (m_blockchain_storage.get_db().get_compaction_status().state != db_compaction_status::ready)
+      return true;
+    try
+    {
+      m_blockchain_storage.finish_db_compaction();
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Failed to swap in the compacted database: " << e.what());
+    }
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::flush_txpool_updates()
+  {
+    try
+    {
+      m_blockchain_storage.flush_txpool_updates();
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Failed to write txpool changes to the database: " << e.what());
+    }
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::is_within_compiled_block_hash_area(uint64_t height) const
   {
     return get_blockchain_storage().is_within_compiled_block_hash_area(height);
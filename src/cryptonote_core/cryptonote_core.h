@@ -128,6 +128,26 @@ namespace cryptonote
       */
      bool handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, relay_method tx_relay, bool relayed);
 
+     /**
+      * @brief handles a batch of incoming transactions
+      *
+      * The transactions are parsed and go through the cheap checks (non-input
+      * consensus rules, batched over all of them, then fee and pool key
+      * images), stopping at the first one which fails in a way which
+      * warrants dropping the peer. The
+      * ring signatures of those which passed are then checked concurrently,
+      * against the blockchain as it is at the time, and finally they are
+      * added to the transaction pool one at a time, in the given order.
+      *
+      * @param tx_blobs the txes to handle
+      * @param tvcs metadata about each transaction's validity, same size as tx_blobs
+      * @param tx_relay how the transactions were received
+      * @param relayed whether or not the transactions were relayed to us
+      *
+      * @return false if a transaction failed with a drop offense, otherwise true
+      */
+     bool handle_incoming_txs(const epee::span<const blobdata> tx_blobs, epee::span<tx_verification_context> tvcs, relay_method tx_relay, bool relayed);
+
     /**
       * @brief handles a single incoming block
       *
@@ -197,6 +217,20 @@ namespace cryptonote
       * @note see Blockchain::cleanup_handle_incoming_blocks
       */
      bool cleanup_handle_incoming_blocks(bool force_sync = false);
+
+     /**
+      * @copydoc Blockchain::queue_pow_lookahead
+      *
+      * @note see Blockchain::queue_pow_lookahead
+      */
+     void queue_pow_lookahead(uint64_t height, const std::vector<blobdata> &block_blobs);
+
+     /**
+      * @copydoc Blockchain::get_pow_lookahead_queue_depth
+      *
+      * @note see Blockchain::get_pow_lookahead_queue_depth
+      */
+     uint64_t get_pow_lookahead_queue_depth() const;
      	     	
      /**
       * @brief check the size of a block against the current maximum
@@ -869,6 +903,24 @@ namespace cryptonote
       */
      bool prune_blockchain(uint32_t pruning_seed = 0);
 
+     /**
+      * @brief starts pruning the blockchain a little at a time from on_idle
+      *
+      * @param pruning_seed the seed to use to prune the chain (0 for default, highly recommended)
+      *
+      * @return true iff success
+      */
+     bool prune_blockchain_online(uint32_t pruning_seed = 0);
+
+     /**
+      * @brief gets how far online pruning went
+      *
+      * @param height return-by-reference the height online pruning resumes from
+      *
+      * @return true if online pruning is under way, false otherwise
+      */
+     bool get_blockchain_pruning_progress(uint64_t &height) const;
+
      /**
       * @brief incrementally prunes blockchain
       *
@@ -883,6 +935,22 @@ namespace cryptonote
       */
      bool check_blockchain_pruning();
 
+     /**
+      * @brief starts compacting the database in the background
+      *
+      * The compacted copy is swapped in from on_idle once it is ready.
+      *
+      * @return false if a compaction is under way or could not be started
+      */
+     bool compact_database();
+
+     /**
+      * @brief gets the state of the last database compaction
+      *
+      * @return the compaction state
+      */
+     db_compaction_status get_database_compaction_status() const;
+
      /**
       * @brief checks whether a given block height is included in the precompiled block hash area
       *
@@ -960,6 +1028,57 @@ namespace cryptonote
 
    private:
 
+     /**
+      * @brief parses an incoming transaction, rejecting oversized blobs
+      *
+      * @param tx_blob the tx to parse
+      * @param tx return-by-reference the parsed transaction
+      * @param txid return-by-reference the transaction's hash
+      * @param tvc metadata about the transaction's validity
+      *
+      * @return true if the transaction parsed, false otherwise
+      */
+     bool parse_incoming_tx(const blobdata& tx_blob, transaction& tx, crypto::hash& txid, tx_verification_context& tvc) const;
+
+     //! an incoming transaction, and how far it got through the admission checks
+     struct incoming_tx
+     {
+       transaction tx;
+       crypto::hash txid;
+       bool parsed;
+       bool prechecked;
+     };
+
+     /**
+      * @brief the admission checks of incoming transactions, before any signature is checked
+      *
+      * The transactions are parsed, then go through the non-input consensus
+      * rules (size, version, duplicate key images, semantics), with the
+      * RingCT semantics of all of them verified as one batch, and then
+      * through tx_memory_pool::precheck_tx. This stops at the first
+      * transaction which fails in a way which warrants dropping the peer.
+      * Transactions we already have are parsed but not checked.
+      *
+      * @param tx_blobs the txes to check
+      * @param txs return-by-reference the txes, one per blob
+      * @param tvcs metadata about each transaction's validity, same size as tx_blobs
+      * @param hf_version the hard fork version to check against
+      *
+      * @return the number of transactions before the first one warranting a drop
+      */
+     size_t precheck_incoming_txs(const epee::span<const blobdata> tx_blobs, std::vector<incoming_tx> &txs, epee::span<tx_verification_context> tvcs, uint8_t hf_version);
+
+     /**
+      * @brief passes a parsed incoming transaction along to the transaction pool
+      *
+      * The caller must hold m_incoming_tx_lock.
+      *
+      * @param nic_verified_hf_version see tx_memory_pool::add_tx
+      *
+      * @return true if the transaction was accepted, false otherwise
+      */
+     bool add_incoming_tx(transaction& tx, const crypto::hash& txid, const blobdata& tx_blob, tx_verification_context& tvc, relay_method tx_relay, bool relayed, uint8_t nic_verified_hf_version = 0);
+
      /**
       * @copydoc add_new_tx(transaction&, tx_verification_context&, bool)
       *
@@ -968,9 +1087,10 @@ namespace cryptonote
       * @param tx_weight the weight of the transaction
       * @param tx_relay how the transaction was received
       * @param relayed whether or not the transaction was relayed to us
+      * @param nic_verified_hf_version see tx_memory_pool::add_tx
       *
       */
-     bool add_new_tx(transaction& tx, const crypto::hash& tx_hash, const cryptonote::blobdata &blob, size_t tx_weight, tx_verification_context& tvc, relay_method tx_relay, bool relayed);
+     bool add_new_tx(transaction& tx, const crypto::hash& tx_hash, const cryptonote::blobdata &blob, size_t tx_weight, tx_verification_context& tvc, relay_method tx_relay, bool relayed, uint8_t nic_verified_hf_version = 0);
 
      /**
       * @brief add a new transaction to the transaction pool
@@ -1058,6 +1178,34 @@ namespace cryptonote
       */
      bool check_block_rate();
 
+     /**
+      * @brief prunes the next part of the blockchain if online pruning is under way
+      *
+      * @return true
+      */
+     bool prune_blockchain_online_step();
+
+     /**
+      * @brief moves the next part of the old data to cold storage, if set up
+      *
+      * @return true
+      */
+     bool move_to_cold_storage_step();
+
+     /**
+      * @brief swaps in the compacted database once it is ready
+      *
+      * @return true
+      */
+     bool finish_database_compaction_step();
+
+     /**
+      * @brief writes out the txpool changes the database holds back
+      *
+      * @return true
+      */
+     bool flush_txpool_updates();
+
      /**
       * @brief recalculate difficulties after the last difficulty checklpoint to circumvent the annoying 'difficulty drift' bug
       *
@@ -1089,6 +1237,10 @@ namespace cryptonote
      epee::math_helper::once_a_time_seconds<60*10, true> m_check_disk_space_interval; //!< interval for checking for disk space
      epee::math_helper::once_a_time_seconds<90, false> m_block_rate_interval; //!< interval for checking block rate
      epee::math_helper::once_a_time_seconds<60*60*5, true> m_blockchain_pruning_interval; //!< interval for incremental blockchain pruning
+     epee::math_helper::once_a_time_seconds<1, true> m_online_pruning_interval; //!< interval for online blockchain pruning steps
+     epee::math_helper::once_a_time_seconds<1, true> m_cold_storage_interval; //!< interval for moving data to cold storage
+     epee::math_helper::once_a_time_seconds<5, true> m_db_compaction_interval; //!< interval for checking whether a compacted database can be swapped in
+     epee::math_helper::once_a_time_seconds<2, true> m_txpool_flush_interval; //!< interval for writing out held back txpool changes
      epee::math_helper::once_a_time_seconds<60*60*24*7, false> m_diff_recalc_interval; //!< interval for recalculating difficulties
 
      std::atomic<bool> m_starter_message_showed; //!< has the "daemon will sync now" message been shown?
@@ -1099,6 +1251,10 @@ namespace cryptonote
 
      std::atomic<bool> m_update_available;
 
+     std::atomic<bool> m_online_pruning; //!< whether online pruning steps are due
+     uint64_t m_online_pruning_rate; //!< bytes of prunable data each online pruning step goes through
+     std::atomic<bool> m_cold_storage; //!< whether old data is being moved to cold storage
+
      std::string m_checkpoints_path; //!< path to json checkpoints file
      time_t m_last_dns_checkpoints_update; //!< time when dns checkpoints were last updated
      time_t m_last_json_checkpoints_update; //!< time when json checkpoints were last updated
@@ -127,6 +127,8 @@ namespace cryptonote
     // class code expects unsigned values throughout
     if (m_next_check < time_t(0))
       throw std::runtime_error{"Unexpected time_t (system clock) value"};
+    m_block_template_cache.valid = false;
+    m_ready_txs_top_hash = crypto::null_hash;
 
     m_added_txs_start_time = (time_t)0;
     m_removed_txs_start_time = (time_t)0;
@@ -147,75 +149,9 @@ namespace cryptonote
 
     PERF_TIMER(add_tx);
 
-    // we do not accept transactions that timed out before, unless they're
-    // kept_by_block
-    if (!kept_by_block && m_timed_out_transactions.find(id) != m_timed_out_transactions.end())
-    {
-      // not clear if we should set that, since verifivation (sic) did not fail before, since
-      // the tx was accepted before timing out.
-      tvc.m_verifivation_failed = true;
-      return false;
-    }
-
-    if (version != nic_verified_hf_version && !cryptonote::ver_non_input_consensus(tx, tvc, version))
-    {
-      LOG_PRINT_L1("transaction " << id << " failed non-input consensus rule checks");
-      tvc.m_verifivation_failed = true; // should already be set, but just in case
-      return false;
-    }
-
     uint64_t fee;
-    bool fee_good = false;
-    try
-    {
-      // get_tx_fee() can throw. It shouldn't throw because we check preconditions in
-      // ver_non_input_consensus(), but let's put it in a try block just in case.
-      fee = get_tx_fee(tx);
-      fee_good = kept_by_block || m_blockchain.check_fee(tx_weight, fee);
-    }
-    catch(...) {}
-    if (!fee_good) // if fee calculation failed or fee in relayed tx is too low...
-    {
-      tvc.m_verifivation_failed = true;
-      tvc.m_fee_too_low = true;
-      tvc.m_no_drop_offense = true;
+    if (!check_tx_admission(tx, id, tx_weight, tvc, kept_by_block, version, nic_verified_hf_version, fee))
       return false;
-    }
-
-    size_t tx_extra_size = tx.extra.size();
-    if (!kept_by_block && tx_extra_size > MAX_TX_EXTRA_SIZE)
-    {
-      LOG_PRINT_L1("transaction tx-extra is too big: " << tx_extra_size << " bytes, the limit is: " << MAX_TX_EXTRA_SIZE);
-      tvc.m_verifivation_failed = true;
-      tvc.m_tx_extra_too_big = true;
-      tvc.m_no_drop_offense = true;
-      return false;
-    }
-
-    if (!kept_by_block && tx.unlock_time)
-    {
-      LOG_PRINT_L1("transaction unlock time is not zero: " << tx.unlock_time);
-      tvc.m_verifivation_failed = true;
-      tvc.m_nonzero_unlock_time = true;
-      tvc.m_no_drop_offense = true;
-      return false;
-    }
-
-    // if the transaction came from a block popped from the chain,
-    // don't check if we have its key images as spent.
-    // TODO: Investigate why not?
-    if(!kept_by_block)
-    {
-      if(have_tx_keyimges_as_spent(tx, id))
-      {
-        mark_double_spend(tx);
-        LOG_PRINT_L1("Transaction with id= "<< id << " used already spent key images");
-        tvc.m_verifivation_failed = true;
-        tvc.m_double_spend = true;
-        tvc.m_no_drop_offense = true;
-        return false;
-      }
-    }
 
     // assume failure during verification steps until success is certain
     tvc.m_verifivation_failed = true;
@@ -356,6 +292,87 @@ namespace cryptonote
     return true;
   }
   //---------------------------------------------------------------------------------
+  bool tx_memory_pool::precheck_tx(const transaction &tx, const crypto::hash &id, size_t tx_weight, tx_verification_context& tvc, uint8_t version, uint8_t nic_verified_hf_version)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    uint64_t fee;
+    return check_tx_admission(tx, id, tx_weight, tvc, false, version, nic_verified_hf_version, fee);
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_memory_pool::check_tx_admission(const transaction &tx, const crypto::hash &id, size_t tx_weight, tx_verification_context& tvc, bool kept_by_block, uint8_t version, uint8_t nic_verified_hf_version, uint64_t &fee)
+  {
+    // we do not accept transactions that timed out before, unless they're
+    // kept_by_block
+    if (!kept_by_block && m_timed_out_transactions.find(id) != m_timed_out_transactions.end())
+    {
+      // not clear if we should set that, since verifivation (sic) did not fail before, since
+      // the tx was accepted before timing out.
+      tvc.m_verifivation_failed = true;
+      return false;
+    }
+
+    if (version != nic_verified_hf_version && !cryptonote::ver_non_input_consensus(tx, tvc, version))
+    {
+      LOG_PRINT_L1("transaction " << id << " failed non-input consensus rule checks");
+      tvc.m_verifivation_failed = true; // should already be set, but just in case
+      return false;
+    }
+
+    bool fee_good = false;
+    try
+    {
+      // get_tx_fee() can throw. It shouldn't throw because we check preconditions in
+      // ver_non_input_consensus(), but let's put it in a try block just in case.
+      fee = get_tx_fee(tx);
+      fee_good = kept_by_block || m_blockchain.check_fee(tx_weight, fee);
+    }
+    catch(...) {}
+    if (!fee_good) // if fee calculation failed or fee in relayed tx is too low...
+    {
+      tvc.m_verifivation_failed = true;
+      tvc.m_fee_too_low = true;
+      tvc.m_no_drop_offense = true;
+      return false;
+    }
+
+    size_t tx_extra_size = tx.extra.size();
+    if (!kept_by_block && tx_extra_size > MAX_TX_EXTRA_SIZE)
+    {
+      LOG_PRINT_L1("transaction tx-extra is too big: " << tx_extra_size << " bytes, the limit is: " << MAX_TX_EXTRA_SIZE);
+      tvc.m_verifivation_failed = true;
+      tvc.m_tx_extra_too_big = true;
+      tvc.m_no_drop_offense = true;
+      return false;
+    }
+
+    if (!kept_by_block && tx.unlock_time)
+    {
+      LOG_PRINT_L1("transaction unlock time is not zero: " << tx.unlock_time);
+      tvc.m_verifivation_failed = true;
+      tvc.m_nonzero_unlock_time = true;
+      tvc.m_no_drop_offense = true;
+      return false;
+    }
+
+    // if the transaction came from a block popped from the chain,
+    // don't check if we have its key images as spent.
+    // TODO: Investigate why not?
+    if(!kept_by_block)
+    {
+      if(have_tx_keyimges_as_spent(tx, id))
+      {
+        mark_double_spend(tx);
+        LOG_PRINT_L1("Transaction with id= "<< id << " used already spent key images");
+        tvc.m_verifivation_failed = true;
+        tvc.m_double_spend = true;
+        tvc.m_no_drop_offense = true;
+        return false;
+      }
+    }
+
+    return true;
+  }
+  //---------------------------------------------------------------------------------
   bool tx_memory_pool::add_tx(transaction &tx, tx_verification_context& tvc, relay_method tx_relay,
     bool relayed, uint8_t version, uint8_t nic_verified_hf_version)
   {
@@ -877,6 +894,7 @@ namespace cryptonote
         {
           // txes can be received as "stem" or "fluff" in either order
           const bool already_broadcasted = meta.matches(relay_category::broadcasted);
+          const relay_method original_method = meta.get_relay_method();
           meta.upgrade_relay_method(method);
           meta.relayed = true;
 
@@ -889,6 +907,9 @@ namespace cryptonote
             meta.last_relayed_time = std::chrono::system_clock::to_time_t(now);
 
           m_blockchain.update_txpool_tx(hash, meta);
+          // the relay method decides whether the tx may be mined
+          if (meta.get_relay_method() != original_method)
+            ++m_cookie;
           // wait until db update succeeds to ensure tx is visible in the pool
           was_just_broadcasted = !already_broadcasted && meta.matches(relay_category::broadcasted);
 
@@ -1561,7 +1582,34 @@ namespace cryptonote
     uint64_t best_coinbase = 0, coinbase = 0;
     total_weight = 0;
     fee = 0;
-    
+
+    const size_t initial_num_txes = bl.tx_hashes.size();
+    const crypto::hash top_hash = m_blockchain.get_tail_id();
+    block_template_cache &cache = m_block_template_cache;
+    // a tx which was not ready may become so with time alone (time locked
+    // outputs), so those are checked again before reusing the template
+    if (cache.valid && cache.cookie == m_cookie && cache.top_hash == top_hash && cache.median_weight == median_weight
+        && cache.already_generated_coins == already_generated_coins && cache.version == version
+        && !any_transaction_became_ready(cache.not_ready_tx_hashes))
+    {
+      bl.tx_hashes.insert(bl.tx_hashes.end(), cache.tx_hashes.begin(), cache.tx_hashes.end());
+      total_weight = cache.total_weight;
+      fee = cache.fee;
+      expected_reward = cache.expected_reward;
+      LOG_PRINT_L2("Block template filled from cache with " << cache.tx_hashes.size() << " txes");
+      return true;
+    }
+    const uint64_t cookie = m_cookie;
+
+    // txes found ready on this chain before are still ready, as readiness
+    // only depends on the chain, and on time which only relaxes it
+    if (m_ready_txs_top_hash != top_hash)
+    {
+      m_ready_txs.clear();
+      m_ready_txs_top_hash = top_hash;
+    }
+    std::unordered_map<crypto::hash, std::vector<crypto::key_image>> ready_txs;
+
     //baseline empty block
     if (!get_block_reward(median_weight, total_weight, already_generated_coins, best_coinbase, version))
     {
@@ -1574,6 +1622,7 @@ namespace cryptonote
     size_t max_total_weight_v5 = 2 * median_weight - CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE;
     size_t max_total_weight = version >= 5 ? max_total_weight_v5 : max_total_weight_pre_v5;
     std::unordered_set<crypto::key_image> k_images;
+    std::vector<crypto::hash> not_ready_tx_hashes;
 
     LOG_PRINT_L2("Filling block template, median weight " << median_weight << ", " << m_txs_by_fee_and_receive_time.size() << " txes in the pool");
 
@@ -1640,6 +1689,25 @@ namespace cryptonote
         }
       }
 
+      auto ready_it = m_ready_txs.find(sorted_it->second);
+      if (ready_it != m_ready_txs.end())
+      {
+        const std::vector<crypto::key_image> &tx_key_images = ready_it->second;
+        if (std::any_of(tx_key_images.begin(), tx_key_images.end(), [&k_images](const crypto::key_image &ki) { return k_images.count(ki) != 0; }))
+        {
+          LOG_PRINT_L2("  key images already seen");
+          continue;
+        }
+        bl.tx_hashes.push_back(sorted_it->second);
+        total_weight += meta.weight;
+        fee += meta.fee;
+        best_coinbase = coinbase;
+        k_images.insert(tx_key_images.begin(), tx_key_images.end());
+        ready_txs.insert(*ready_it);
+        LOG_PRINT_L2("  added (known ready), new block weight " << total_weight << "/" << max_total_weight << ", coinbase " << print_money(best_coinbase));
+        continue;
+      }
+
       // "local" and "stem" txes are filtered above
       cryptonote::blobdata txblob = m_blockchain.get_txpool_tx_blob(sorted_it->second, relay_category::all);
 
@@ -1674,6 +1742,7 @@ namespace cryptonote
       if (!ready)
       {
         LOG_PRINT_L2("  not ready to go");
+        not_ready_tx_hashes.push_back(sorted_it->second);
         continue;
       }
       if (have_key_images(k_images, tx))
@@ -1687,17 +1756,81 @@ namespace cryptonote
       fee += meta.fee;
       best_coinbase = coinbase;
       append_key_images(k_images, tx);
+      std::vector<crypto::key_image> &tx_key_images = ready_txs[sorted_it->second];
+      for (const txin_v &in: tx.vin)
+        if (in.type() == typeid(txin_to_key))
+          tx_key_images.push_back(boost::get<txin_to_key>(in).k_image);
       LOG_PRINT_L2("  added, new block weight " << total_weight << "/" << max_total_weight << ", coinbase " << print_money(best_coinbase));
     }
     lock.commit();
 
     expected_reward = best_coinbase;
+
+    // only txes which made it into this template are kept, so the set
+    // does not grow with txes which left the pool
+    m_ready_txs = std::move(ready_txs);
+    cache.valid = true;
+    cache.cookie = cookie;
+    cache.top_hash = top_hash;
+    cache.median_weight = median_weight;
+    cache.already_generated_coins = already_generated_coins;
+    cache.version = version;
+    cache.not_ready_tx_hashes = std::move(not_ready_tx_hashes);
+    cache.tx_hashes.assign(bl.tx_hashes.end() - (bl.tx_hashes.size() - initial_num_txes), bl.tx_hashes.end());
+    cache.total_weight = total_weight;
+    cache.fee = fee;
+    cache.expected_reward = expected_reward;
     LOG_PRINT_L2("Block template filled with " << bl.tx_hashes.size() << " txes, weight "
         << total_weight << "/" << max_total_weight << ", coinbase " << print_money(best_coinbase)
         << " (including " << print_money(fee) << " in fees)");
     return true;
   }
   //---------------------------------------------------------------------------------
+  bool tx_memory_pool::any_transaction_became_ready(const std::vector<crypto::hash> &txids)
+  {
+    if (txids.empty())
+      return false;
+
+    LockedTXN lock(m_blockchain.get_db());
+    for (const crypto::hash &txid: txids)
+    {
+      txpool_tx_meta_t meta;
+      if (!m_blockchain.get_txpool_tx_meta(txid, meta))
+        continue;
+      cryptonote::blobdata txblob = m_blockchain.get_txpool_tx_blob(txid, relay_category::all);
+      cryptonote::transaction tx;
+      const cryptonote::txpool_tx_meta_t original_meta = meta;
+      bool ready = false;
+      try
+      {
+        ready = is_transaction_ready_to_go(meta, txid, txblob, tx);
+      }
+      catch (const std::exception &e)
+      {
+        MERROR("Failed to check transaction readiness: " << e.what());
+      }
+      if (memcmp(&original_meta, &meta, sizeof(meta)))
+      {
+        try
+        {
+          m_blockchain.update_txpool_tx(txid, meta);
+        }
+        catch (const std::exception &e)
+        {
+          MERROR("Failed to update tx meta: " << e.what());
+        }
+      }
+      if (ready)
+      {
+        LOG_PRINT_L2("Cached block template skipped " << txid << ", which is now ready to go");
+        lock.commit();
+        return true;
+      }
+    }
+    lock.commit();
+    return false;
+  }
+  //---------------------------------------------------------------------------------
   size_t tx_memory_pool::validate(uint8_t version)
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
@@ -1928,6 +2061,8 @@ namespace cryptonote
 
     m_mine_stem_txes = mine_stem_txes;
     m_cookie = 0;
+    m_block_template_cache.valid = false;
+    m_ready_txs.clear();
 
     // Ignore deserialization error
     return true;
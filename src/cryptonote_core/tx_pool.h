@@ -146,6 +146,26 @@ namespace cryptonote
     bool add_tx(transaction &tx, tx_verification_context& tvc, relay_method tx_relay, bool relayed,
       uint8_t version, uint8_t nic_verified_hf_version = 0);
 
+    /**
+     * @brief runs the cheap checks add_tx starts with on a relayed transaction
+     *
+     * These are the non-input consensus rules, the fee, tx extra size and
+     * unlock time, and the key images already spent in the pool. Incoming
+     * transactions go through them before any of their signatures are
+     * checked, and add_tx may then skip the non-input consensus rules by
+     * passing "version" as its "nic_verified_hf_version".
+     *
+     * @param tx the transaction to check
+     * @param id the transaction's hash
+     * @param tx_weight the transaction's weight
+     * @param tvc return-by-reference status about the transaction verification
+     * @param version the hard fork version to check against
+     * @param nic_verified_hf_version see add_tx
+     *
+     * @return true if the transaction passes these checks, false otherwise
+     */
+    bool precheck_tx(const transaction &tx, const crypto::hash &id, size_t tx_weight, tx_verification_context& tvc, uint8_t version, uint8_t nic_verified_hf_version = 0);
+
     /**
      * @brief takes a transaction with the given hash from the pool
      *
@@ -249,6 +269,11 @@ namespace cryptonote
      * @param expected_reward return-by-reference the total reward awarded to the miner finding this block, including transaction fees
      * @param version hard fork version to use for consensus rules
      *
+     * The result is kept until the pool or the chain changes, so repeated
+     * calls with the same parameters only copy the chosen transaction
+     * hashes. After a change, transactions already found ready to go on
+     * the same chain are not checked again.
+     *
      * @return true
      */
     bool fill_block_template(block &bl, size_t median_weight, uint64_t already_generated_coins, size_t &total_weight, uint64_t &fee, uint64_t &expected_reward, uint8_t version);
@@ -546,6 +571,17 @@ namespace cryptonote
      */
     bool have_tx_keyimges_as_spent(const transaction& tx, const crypto::hash& txid) const;
 
+    /**
+     * @brief the checks add_tx runs before the inputs, shared with precheck_tx
+     *
+     * The caller must hold m_transactions_lock.
+     *
+     * @param fee return-by-reference the transaction's fee
+     *
+     * @return true if the transaction passes these checks, false otherwise
+     */
+    bool check_tx_admission(const transaction &tx, const crypto::hash &id, size_t tx_weight, tx_verification_context& tvc, bool kept_by_block, uint8_t version, uint8_t nic_verified_hf_version, uint64_t &fee);
+
     /**
      * @brief forget a transaction's spent key images
      *
@@ -593,6 +629,16 @@ namespace cryptonote
     bool is_transaction_ready_to_go(txpool_tx_meta_t& txd, const crypto::hash &txid, const cryptonote::blobdata_ref &txblob, transaction&tx) const;
     bool is_transaction_ready_to_go(txpool_tx_meta_t& txd, const crypto::hash &txid, const cryptonote::blobdata &txblob, transaction&tx) const;
 
+    /**
+     * @brief checks whether any of the given pool txes, which were not ready
+     *        to go when last checked, now is
+     *
+     * @param txids the txes to check
+     *
+     * @return true if any of them is now ready to go, false otherwise
+     */
+    bool any_transaction_became_ready(const std::vector<crypto::hash> &txids);
+
     /**
      * @brief mark all transactions double spending the one passed
      */
@@ -689,6 +735,26 @@ private:
 
     std::unordered_map<crypto::hash, transaction> m_parsed_tx_cache;
 
+    //! the last result of fill_block_template, and what it was made from
+    struct block_template_cache
+    {
+      bool valid;
+      uint64_t cookie;
+      crypto::hash top_hash;
+      size_t median_weight;
+      uint64_t already_generated_coins;
+      uint8_t version;
+      std::vector<crypto::hash> not_ready_tx_hashes;
+      std::vector<crypto::hash> tx_hashes;
+      size_t total_weight;
+      uint64_t fee;
+      uint64_t expected_reward;
+    } m_block_template_cache;
+
+    //! key images of the txes found ready to go on top of m_ready_txs_top_hash
+    std::unordered_map<crypto::hash, std::vector<crypto::key_image>> m_ready_txs;
+    crypto::hash m_ready_txs_top_hash;
+
     //! Next timestamp that a DB check for relayable txes is allowed
     std::atomic<time_t> m_next_check;
   };
@@ -129,13 +129,17 @@ static bool is_canonical_bulletproof_plus_layout(const std::vector<rct::Bulletpr
     return true;
 }
 
-template <class TxForwardIt>
-static bool ver_non_input_consensus_templated(TxForwardIt tx_begin, TxForwardIt tx_end,
-        tx_verification_context& tvc, std::uint8_t hf_version)
+static const transaction& pool_supplement_tx(const decltype(pool_supplement::txs_by_txid)::value_type& in)
 {
-    std::vector<const rct::rctSig*> rvv;
-    rvv.reserve(static_cast<size_t>(std::distance(tx_begin, tx_end)));
+    return in.second.first;
+}
 
+// Check rules 1 through 6 of ver_non_input_consensus(), and collect the RingCT signatures which
+// need their semantics checked for rule 7 into rvv
+template <class TxForwardIt>
+static bool ver_non_input_consensus_no_rct_sem(TxForwardIt tx_begin, TxForwardIt tx_end,
+        tx_verification_context& tvc, std::uint8_t hf_version, std::vector<const rct::rctSig*>& rvv)
+{
     const size_t max_tx_version = hf_version < HF_VERSION_DYNAMIC_FEE ? 1 : 2;
 
     const size_t tx_weight_limit = get_transaction_weight_limit(hf_version);
@@ -182,6 +186,19 @@ static bool ver_non_input_consensus_templated(TxForwardIt tx_begin, TxForwardIt
             rvv.push_back(&tx.rct_signatures);
     }
 
+    return true;
+}
+
+template <class TxForwardIt>
+static bool ver_non_input_consensus_templated(TxForwardIt tx_begin, TxForwardIt tx_end,
+        tx_verification_context& tvc, std::uint8_t hf_version)
+{
+    std::vector<const rct::rctSig*> rvv;
+    rvv.reserve(static_cast<size_t>(std::distance(tx_begin, tx_end)));
+
+    if (!ver_non_input_consensus_no_rct_sem(tx_begin, tx_end, tvc, hf_version, rvv))
+        return false;
+
     // Rule 7
     if (!ver_mixed_rct_semantics(std::move(rvv)))
     {
@@ -193,6 +210,61 @@ static bool ver_non_input_consensus_templated(TxForwardIt tx_begin, TxForwardIt
     return true;
 }
 
+static auto pool_supplement_tx_begin(const pool_supplement& ps)
+    -> decltype(boost::make_transform_iterator(ps.txs_by_txid.cbegin(), &pool_supplement_tx))
+{
+    return boost::make_transform_iterator(ps.txs_by_txid.cbegin(), &pool_supplement_tx);
+}
+
+static auto pool_supplement_tx_end(const pool_supplement& ps)
+    -> decltype(boost::make_transform_iterator(ps.txs_by_txid.cend(), &pool_supplement_tx))
+{
+    return boost::make_transform_iterator(ps.txs_by_txid.cend(), &pool_supplement_tx);
+}
+
+// Find which of the signatures in rvv[begin, end) fail ver_mixed_rct_semantics(), knowing that
+// the whole range does. Each half is verified as its own batch and only failing halves are split
+// further, so a single bad signature in a batch of n costs about 2 log2(n) smaller batches.
+static void find_bad_rct_semantics(const std::vector<const rct::rctSig*>& rvv, const size_t begin,
+        const size_t end, std::vector<bool>& bad)
+{
+    if (end - begin == 1)
+    {
+        bad[begin] = true;
+        return;
+    }
+
+    const size_t mid = begin + (end - begin) / 2;
+    const bool lower_ok = ver_mixed_rct_semantics({rvv.begin() + begin, rvv.begin() + mid});
+    const bool upper_ok = ver_mixed_rct_semantics({rvv.begin() + mid, rvv.begin() + end});
+    if (!lower_ok)
+        find_bad_rct_semantics(rvv, begin, mid, bad);
+    if (!upper_ok)
+        find_bad_rct_semantics(rvv, mid, end, bad);
+
+    // Both halves passing on their own means we can't tell which signature made the whole range
+    // fail, so don't trust any of them
+    if (lower_ok && upper_ok)
+        for (size_t i = begin; i < end; ++i)
+            bad[i] = true;
+}
+
+// Rule 7 for signatures collected from several groups of transactions, rvv_owners[n] being the
+// group rvv[n] came from: marks the groups which have a signature failing the batch
+static void ver_rct_semantics_by_owner(const std::vector<const rct::rctSig*>& rvv,
+        const std::vector<size_t>& rvv_owners, std::vector<bool>& failed)
+{
+    if (rvv.empty() || ver_mixed_rct_semantics(rvv))
+        return;
+
+    MDEBUG("Batch RingCT semantics verification failed for " << rvv.size() << " signatures, bisecting");
+    std::vector<bool> bad(rvv.size(), false);
+    find_bad_rct_semantics(rvv, 0, rvv.size(), bad);
+    for (size_t n = 0; n < rvv.size(); ++n)
+        if (bad[n])
+            failed[rvv_owners[n]] = true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace cryptonote
@@ -347,13 +419,9 @@ bool ver_non_input_consensus(const pool_supplement& ps, tx_verification_context&
     if (ps.nic_verified_hf_version == hf_version)
         return true;
 
-    const auto it_transform = [] (const decltype(ps.txs_by_txid)::value_type& in)
-        -> const transaction& { return in.second.first; };
-    const auto tx_begin = boost::make_transform_iterator(ps.txs_by_txid.cbegin(), it_transform);
-    const auto tx_end = boost::make_transform_iterator(ps.txs_by_txid.cend(), it_transform);
-
     // Perform the checks...
-    const bool verified = ver_non_input_consensus_templated(tx_begin, tx_end, tvc, hf_version);
+    const bool verified = ver_non_input_consensus_templated(pool_supplement_tx_begin(ps),
+        pool_supplement_tx_end(ps), tvc, hf_version);
 
     // Cache the hard fork version on success
     if (verified)
@@ -362,4 +430,85 @@ bool ver_non_input_consensus(const pool_supplement& ps, tx_verification_context&
     return verified;
 }
 
+size_t ver_non_input_consensus(const epee::span<const pool_supplement> pss,
+    const std::uint8_t hf_version)
+{
+    std::vector<bool> failed(pss.size(), false);
+
+    // Rules 1 through 6 are checked per supplement, while the RingCT signatures of all of them are
+    // collected for a single batch, remembering which supplement each one came from
+    std::vector<const rct::rctSig*> rvv;
+    std::vector<size_t> rvv_owners;
+    for (size_t i = 0; i < pss.size(); ++i)
+    {
+        const pool_supplement& ps = pss[i];
+        if (ps.nic_verified_hf_version == hf_version)
+            continue;
+
+        const size_t n_prev_rvv = rvv.size();
+        tx_verification_context tvc{};
+        if (!ver_non_input_consensus_no_rct_sem(pool_supplement_tx_begin(ps),
+            pool_supplement_tx_end(ps), tvc, hf_version, rvv))
+        {
+            rvv.resize(n_prev_rvv);
+            failed[i] = true;
+            continue;
+        }
+        rvv_owners.resize(rvv.size(), i);
+    }
+
+    // Rule 7, with Bulletproof(+) proofs of every supplement sharing one multiexp
+    ver_rct_semantics_by_owner(rvv, rvv_owners, failed);
+
+    size_t n_failed = 0;
+    for (size_t i = 0; i < pss.size(); ++i)
+    {
+        if (failed[i])
+            ++n_failed;
+        else
+            pss[i].nic_verified_hf_version = hf_version;
+    }
+
+    return n_failed;
+}
+
+size_t ver_non_input_consensus(const epee::span<const transaction* const> txs,
+    epee::span<tx_verification_context> tvcs, const std::uint8_t hf_version)
+{
+    CHECK_AND_ASSERT_THROW_MES(txs.size() == tvcs.size(), "txs and verification contexts mismatch");
+
+    std::vector<bool> failed(txs.size(), false);
+
+    std::vector<const rct::rctSig*> rvv;
+    std::vector<size_t> rvv_owners;
+    for (size_t i = 0; i < txs.size(); ++i)
+    {
+        if (!ver_non_input_consensus_no_rct_sem(txs[i], txs[i] + 1, tvcs[i], hf_version, rvv))
+        {
+            failed[i] = true;
+            continue;
+        }
+        rvv_owners.resize(rvv.size(), i);
+    }
+
+    // Rule 7, with Bulletproof(+) proofs of every transaction sharing one multiexp
+    const std::vector<bool> failed_before_rct = failed;
+    ver_rct_semantics_by_owner(rvv, rvv_owners, failed);
+
+    size_t n_failed = 0;
+    for (size_t i = 0; i < txs.size(); ++i)
+    {
+        if (!failed[i])
+            continue;
+        ++n_failed;
+        if (!failed_before_rct[i])
+        {
+            tvcs[i].m_verifivation_failed = true;
+            tvcs[i].m_invalid_input = true;
+        }
+    }
+
+    return n_failed;
+}
+
 } // namespace cryptonote
@@ -31,6 +31,7 @@
 #include "common/data_cache.h"
 #include "cryptonote_basic/cryptonote_basic.h"
 #include "cryptonote_basic/verification_context.h"
+#include "span.h"
 
 namespace cryptonote
 {
@@ -43,10 +44,11 @@ namespace cryptonote
  */
 uint64_t get_transaction_weight_limit(uint8_t hf_version);
 
-// Modifying this value should not affect consensus. You can adjust it for performance needs
+// Modifying this value should not affect consensus. You can adjust it for performance needs, or
+// at runtime with --rct-ver-cache-size
 static constexpr const size_t RCT_VER_CACHE_SIZE = 8192;
 
-using rct_ver_cache_t = ::tools::data_cache<::crypto::hash, RCT_VER_CACHE_SIZE>;
+using rct_ver_cache_t = ::tools::data_cache<::crypto::hash>;
 
 /**
  * @brief Cached version of rct::verRctNonSemanticsSimple
@@ -137,4 +139,35 @@ bool ver_non_input_consensus(const transaction& tx, tx_verification_context& tvc
 bool ver_non_input_consensus(const pool_supplement& ps, tx_verification_context& tvc,
     std::uint8_t hf_version);
 
+/**
+ * @brief Verify every non-input consensus rule for the pool supplements of a span of blocks
+ *
+ * Same checks as above, but the RingCT semantics of all transactions in all supplements are
+ * verified as one batch, so every Bulletproof(+) proof in the span shares a single multiexp. If
+ * that batch fails, it is bisected to find the signatures which are actually bad.
+ *
+ * Supplements which pass get their .nic_verified_hf_version set to hf_version, so that block
+ * handling will not verify them again. Supplements which fail are left as they are: the block
+ * handling code will verify them again and report the failure against their own block.
+ *
+ * @param pss pool supplements to verify, usually one per block
+ * @param hf_version Hard fork version to run rules against
+ * @return the number of supplements which failed to verify
+ */
+size_t ver_non_input_consensus(epee::span<const pool_supplement> pss, std::uint8_t hf_version);
+
+/**
+ * @brief Verify every non-input consensus rule for a group of unrelated transactions
+ *
+ * Same checks as above for each transaction on its own, but the RingCT semantics of all of them
+ * are verified as one batch, bisected if it fails, like for the pool supplements of a span.
+ *
+ * @param txs transactions to verify
+ * @param tvcs one per transaction, relevant flags will be set for those which fail
+ * @param hf_version Hard fork version to run rules against
+ * @return the number of transactions which failed to verify
+ */
+size_t ver_non_input_consensus(epee::span<const transaction* const> txs,
+    epee::span<tx_verification_context> tvcs, std::uint8_t hf_version);
+
 } // namespace cryptonote
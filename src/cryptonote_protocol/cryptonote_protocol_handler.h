@@ -35,6 +35,7 @@
 #pragma once
 
 #include <boost/program_options/variables_map.hpp>
+#include <atomic>
 #include <string>
 
 #include "byte_slice.h"
@@ -111,6 +112,8 @@ namespace cryptonote
     void log_connections();
     std::list<connection_info> get_connections();
     const block_queue &get_block_queue() const { return m_block_queue; }
+    uint64_t get_sync_verify_queue_depth() const { return m_sync_verify_queue; }
+    uint64_t get_sync_commit_queue_depth() const { return m_sync_commit_queue; }
     void stop();
     void on_connection_close(cryptonote_connection_context &context);
     void set_max_out_peers(epee::net_utils::zone zone, unsigned int max) { CRITICAL_REGION_LOCAL(m_max_out_peers_lock); m_max_out_peers[zone] = max; }
@@ -189,6 +192,7 @@ namespace cryptonote
     uint64_t m_last_add_end_time;
     uint64_t m_sync_spans_downloaded, m_sync_old_spans_downloaded, m_sync_bad_spans_downloaded;
     uint64_t m_sync_download_chain_size, m_sync_download_objects_size;
+    std::atomic<uint64_t> m_sync_verify_queue, m_sync_commit_queue;
     size_t m_block_download_max_size;
     bool m_sync_pruned_blocks;
 
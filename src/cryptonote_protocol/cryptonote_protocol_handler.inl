@@ -185,7 +185,9 @@ namespace cryptonote
                                                                                                               m_synchronized(offline),
                                                                                                               m_ask_for_txpool_complement(true),
                                                                                                               m_stopping(false),
-                                                                                                              m_no_sync(false)
+                                                                                                              m_no_sync(false),
+                                                                                                              m_sync_verify_queue(0),
+                                                                                                              m_sync_commit_queue(0)
 
   {
     if(!m_p2p)
@@ -205,6 +207,8 @@ namespace cryptonote
     m_sync_bad_spans_downloaded = 0;
     m_sync_download_chain_size = 0;
     m_sync_download_objects_size = 0;
+    m_sync_verify_queue = 0;
+    m_sync_commit_queue = 0;
 
     m_block_download_max_size = command_line::get_arg(vm, cryptonote::arg_block_download_max_size);
     m_sync_pruned_blocks = command_line::get_arg(vm, cryptonote::arg_sync_pruned_blocks);
@@ -926,25 +930,25 @@ namespace cryptonote
     else
       stem_txs.reserve(arg.txs.size());
 
-    for (auto& tx : arg.txs)
+    std::vector<tx_verification_context> tvcs(arg.txs.size());
+    if (!m_core.handle_incoming_txs(epee::to_span(arg.txs), epee::to_mut_span(tvcs), tx_relay, true))
     {
-      tx_verification_context tvc{};
-      if (!m_core.handle_incoming_tx(tx, tvc, tx_relay, true) && !tvc.m_no_drop_offense)
-      {
-        LOG_PRINT_CCONTEXT_L1("Tx verification failed, dropping connection");
-        drop_connection(context, false, false);
-        return 1;
-      }
+      LOG_PRINT_CCONTEXT_L1("Tx verification failed, dropping connection");
+      drop_connection(context, false, false);
+      return 1;
+    }
 
-      switch (tvc.m_relay)
+    for (size_t i = 0; i < arg.txs.size(); ++i)
+    {
+      switch (tvcs[i].m_relay)
       {
         case relay_method::local:
         case relay_method::stem:
-          stem_txs.push_back(std::move(tx));
+          stem_txs.push_back(std::move(arg.txs[i]));
           break;
         case relay_method::block:
         case relay_method::fluff:
-          fluff_txs.push_back(std::move(tx));
+          fluff_txs.push_back(std::move(arg.txs[i]));
           break;
         default:
         case relay_method::forward: // not supposed to happen here
@@ -1475,9 +1479,22 @@ namespace cryptonote
             return 1;
           }
 
+          // start hashing the next span, if we have it already, while this one gets verified
+          if (!pblocks.empty())
+          {
+            std::vector<cryptonote::blobdata> next_blobs;
+            if (m_block_queue.get_span_block_blobs(start_height + blocks.size(), next_blobs))
+              m_core.queue_pow_lookahead(start_height + blocks.size(), next_blobs);
+          }
+          m_sync_verify_queue = blocks.size();
+          m_sync_commit_queue = 0;
+
           bool stopped = false;
           auto cleanup_on_exit = epee::misc_utils::create_scope_leave_handler([this, &stopped, &context, span_connection_id, start_height]() {
-            if (!m_core.cleanup_handle_incoming_blocks())
+            const bool cleaned_up = m_core.cleanup_handle_incoming_blocks();
+            m_sync_verify_queue = 0;
+            m_sync_commit_queue = 0;
+            if (!cleaned_up)
             {
               LOG_PRINT_CCONTEXT_L0("Failure in cleanup_handle_incoming_blocks");
               return;
@@ -1491,6 +1508,22 @@ namespace cryptonote
 
           uint64_t block_process_time_full = 0, transactions_process_time_full = 0;
           size_t num_txs = 0, blockidx = 0;
+
+          // parse the txs of the whole span up front, and verify their non-input consensus
+          // rules as one batch so that range proofs from all blocks share the same multiexp
+          TIME_MEASURE_START(transactions_process_time);
+          std::vector<pool_supplement> span_txs(blocks.size());
+          size_t num_parsed_blocks = 0;
+          while (num_parsed_blocks < blocks.size() && make_full_pool_supplement_from_block_entry(blocks[num_parsed_blocks], span_txs[num_parsed_blocks]))
+            ++num_parsed_blocks;
+          const size_t num_unverified_blocks = cryptonote::ver_non_input_consensus(
+              epee::span<const pool_supplement>(span_txs.data(), num_parsed_blocks),
+              m_core.get_hard_fork_version(m_core.get_current_blockchain_height()));
+          if (num_unverified_blocks)
+            MDEBUG(context << num_unverified_blocks << " blocks failed batch tx verification, they will be verified on their own");
+          TIME_MEASURE_FINISH(transactions_process_time);
+          transactions_process_time_full += transactions_process_time;
+
           for(const block_complete_entry& block_entry: blocks)
           {
             if (m_stopping)
@@ -1499,12 +1532,10 @@ namespace cryptonote
               return 1;
             }
 
-            // process transactions
-            TIME_MEASURE_START(transactions_process_time);
             num_txs += block_entry.txs.size();
 
-            pool_supplement block_txs;
-            if (!make_full_pool_supplement_from_block_entry(block_entry, block_txs))
+            pool_supplement &block_txs = span_txs[blockidx];
+            if (blockidx >= num_parsed_blocks)
             {
                 drop_connections(span_origin);
                 if (!m_p2p->for_connection(span_connection_id, [&](cryptonote_connection_context& context, nodetool::peerid_type peer_id, uint32_t f)->bool{
@@ -1517,8 +1548,6 @@ namespace cryptonote
 
                 return 1;
             }
-            TIME_MEASURE_FINISH(transactions_process_time);
-            transactions_process_time_full += transactions_process_time;
 
             // process block
 
@@ -1559,6 +1588,8 @@ namespace cryptonote
             TIME_MEASURE_FINISH(block_process_time);
             block_process_time_full += block_process_time;
             ++blockidx;
+            --m_sync_verify_queue;
+            ++m_sync_commit_queue;
 
           } // each download block
 
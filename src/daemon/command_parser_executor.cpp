@@ -971,13 +971,14 @@ bool t_command_parser_executor::version(const std::vector<std::string>& args)
 
 bool t_command_parser_executor::prune_blockchain(const std::vector<std::string>& args)
 {
-  if (args.size() > 1)
+  if (args.size() > 2)
   {
     std::cout << "Invalid syntax: Too many parameters. For more details, use the help command." << std::endl;
     return true;
   }
 
-  if (args.empty() || args[0] != "confirm")
+  const bool online = !args.empty() && args[0] == "online";
+  if (args.size() != (online ? 2 : 1) || args.back() != "confirm")
   {
     std::cout << "Warning: pruning from within wownerod will not shrink the database file size." << std::endl;
     std::cout << "Instead, parts of the file will be marked as free, so the file will not grow" << std::endl;
@@ -988,7 +989,7 @@ bool t_command_parser_executor::prune_blockchain(const std::vector<std::string>&
     return true;
   }
 
-  return m_executor.prune_blockchain();
+  return m_executor.prune_blockchain(online);
 }
 
 bool t_command_parser_executor::check_blockchain_pruning(const std::vector<std::string>& args)
@@ -996,6 +997,26 @@ bool t_command_parser_executor::check_blockchain_pruning(const std::vector<std::
   return m_executor.check_blockchain_pruning();
 }
 
+bool t_command_parser_executor::db_stats(const std::vector<std::string>& args)
+{
+  if (!args.empty())
+  {
+    std::cout << "Invalid syntax: No parameters expected. For more details, use the help command." << std::endl;
+    return true;
+  }
+  return m_executor.db_stats();
+}
+
+bool t_command_parser_executor::compact_db(const std::vector<std::string>& args)
+{
+  if (args.size() > 1 || (args.size() == 1 && args[0] != "status"))
+  {
+    std::cout << "Invalid syntax: Expected nothing or \"status\". For more details, use the help command." << std::endl;
+    return true;
+  }
+  return m_executor.compact_db(!args.empty());
+}
+
 bool t_command_parser_executor::set_bootstrap_daemon(const std::vector<std::string>& args)
 {
   struct parsed_t
@@ -150,6 +150,10 @@ public:
 
   bool check_blockchain_pruning(const std::vector<std::string>& args);
 
+  bool db_stats(const std::vector<std::string>& args);
+
+  bool compact_db(const std::vector<std::string>& args);
+
   bool print_net_stats(const std::vector<std::string>& args);
 
   bool set_bootstrap_daemon(const std::vector<std::string>& args);
@@ -315,14 +315,25 @@ t_command_server::t_command_server(
     m_command_lookup.set_handler(
       "prune_blockchain"
     , std::bind(&t_command_parser_executor::prune_blockchain, &m_parser, p::_1)
-    , "prune_blockchain [confirm]"
-    , "Prune the blockchain."
+    , "prune_blockchain [online] [confirm]"
+    , "Prune the blockchain, all at once or, with \"online\", a little at a time while the daemon runs."
     );
     m_command_lookup.set_handler(
       "check_blockchain_pruning"
     , std::bind(&t_command_parser_executor::check_blockchain_pruning, &m_parser, p::_1)
     , "Check the blockchain pruning."
     );
+    m_command_lookup.set_handler(
+      "db_stats"
+    , std::bind(&t_command_parser_executor::db_stats, &m_parser, p::_1)
+    , "Print how the database and its tables use their pages, and how many pages are free."
+    );
+    m_command_lookup.set_handler(
+      "compact_db"
+    , std::bind(&t_command_parser_executor::compact_db, &m_parser, p::_1)
+    , "compact_db [status]"
+    , "Write a copy of the database without its free pages in the background, and swap it in once done. This needs as much free disk space as the used part of the database. With \"status\", print how the last compaction went."
+    );
     m_command_lookup.set_handler(
       "set_bootstrap_daemon"
     , std::bind(&t_command_parser_executor::set_bootstrap_daemon, &m_parser, p::_1)
@@ -2338,7 +2338,7 @@ bool t_rpc_command_executor::pop_blocks(uint64_t num_blocks)
   return true;
 }
 
-bool t_rpc_command_executor::prune_blockchain()
+bool t_rpc_command_executor::prune_blockchain(bool online)
 {
     cryptonote::COMMAND_RPC_PRUNE_BLOCKCHAIN::request req;
     cryptonote::COMMAND_RPC_PRUNE_BLOCKCHAIN::response res;
@@ -2346,6 +2346,7 @@ bool t_rpc_command_executor::prune_blockchain()
     epee::json_rpc::error error_resp;
 
     req.check = false;
+    req.online = online;
 
     if (m_is_rpc)
     {
@@ -2363,7 +2364,10 @@ bool t_rpc_command_executor::prune_blockchain()
         }
     }
 
-    tools::success_msg_writer() << "Blockchain pruned";
+    if (res.online_pruning)
+      tools::success_msg_writer() << "Blockchain pruning in the background, at height " << res.pruning_height;
+    else
+      tools::success_msg_writer() << "Blockchain pruned";
     return true;
 }
 
@@ -2403,6 +2407,77 @@ bool t_rpc_command_executor::check_blockchain_pruning()
     return true;
 }
 
+bool t_rpc_command_executor::db_stats()
+{
+    cryptonote::COMMAND_RPC_GET_DB_STATS::request req;
+    cryptonote::COMMAND_RPC_GET_DB_STATS::response res;
+    std::string fail_message = "Unsuccessful";
+    epee::json_rpc::error error_resp;
+
+    if (m_is_rpc)
+    {
+        if (!m_rpc_client->json_rpc_request(req, res, "get_db_stats", fail_message.c_str()))
+        {
+            return true;
+        }
+    }
+    else
+    {
+        if (!m_rpc_server->on_get_db_stats(req, res, error_resp) || res.status != CORE_RPC_STATUS_OK)
+        {
+            tools::fail_msg_writer() << make_error(fail_message, res.status);
+            return true;
+        }
+    }
+
+    const uint64_t used = res.used_pages * res.page_size;
+    const uint64_t free = res.free_pages * res.page_size;
+    tools::success_msg_writer() << "File size: " << res.file_size / (1024 * 1024) << " MiB, map size: " << res.map_size / (1024 * 1024) << " MiB, page size: " << res.page_size;
+    tools::msg_writer() << "Used: " << used / (1024 * 1024) << " MiB, of which free: " << free / (1024 * 1024) << " MiB ("
+        << (boost::format("%.1f") % (used ? 100.0 * free / used : 0.0)).str() << "%)";
+    tools::msg_writer() << "Readers: " << res.readers << "/" << res.max_readers;
+    tools::msg_writer() << boost::format("%-22s %12s %5s %10s %12s %12s") % "table" % "entries" % "depth" % "branch" % "leaf" % "overflow";
+    for (const auto &t: res.tables)
+      tools::msg_writer() << boost::format("%-22s %12u %5u %10u %12u %12u") % t.name % t.entries % t.depth % t.branch_pages % t.leaf_pages % t.overflow_pages;
+    return true;
+}
+
+bool t_rpc_command_executor::compact_db(bool check)
+{
+    cryptonote::COMMAND_RPC_COMPACT_DB::request req;
+    cryptonote::COMMAND_RPC_COMPACT_DB::response res;
+    std::string fail_message = "Unsuccessful";
+    epee::json_rpc::error error_resp;
+
+    req.check = check;
+
+    if (m_is_rpc)
+    {
+        if (!m_rpc_client->json_rpc_request(req, res, "compact_db", fail_message.c_str()))
+        {
+            return true;
+        }
+    }
+    else
+    {
+        if (!m_rpc_server->on_compact_db(req, res, error_resp) || res.status != CORE_RPC_STATUS_OK)
+        {
+            tools::fail_msg_writer() << make_error(fail_message, error_resp.message.empty() ? res.status : error_resp.message);
+            return true;
+        }
+    }
+
+    if (res.state == "idle")
+      tools::msg_writer() << "The database was not compacted";
+    else if (res.state == "copying" || res.state == "ready")
+      tools::success_msg_writer() << "Compacting the database in the background, from " << res.size_before / (1024 * 1024) << " MiB";
+    else if (res.state == "done")
+      tools::success_msg_writer() << "Database compacted from " << res.size_before / (1024 * 1024) << " MiB to " << res.size_after / (1024 * 1024) << " MiB";
+    else
+      tools::fail_msg_writer() << "Database compaction failed: " << res.error;
+    return true;
+}
+
 bool t_rpc_command_executor::set_bootstrap_daemon(
   const std::string &address,
   const std::string &username,
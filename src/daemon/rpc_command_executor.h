@@ -156,10 +156,14 @@ public:
 
   bool pop_blocks(uint64_t num_blocks);
 
-  bool prune_blockchain();
+  bool prune_blockchain(bool online);
 
   bool check_blockchain_pruning();
 
+  bool db_stats();
+
+  bool compact_db(bool check);
+
   bool print_net_stats();
 
   bool version();
@@ -41,6 +41,7 @@ using namespace epee;
 #include "common/download.h"
 #include "common/util.h"
 #include "common/perf_timer.h"
+#include "common/threadpool.h"
 #include "int-util.h"
 #include "cryptonote_basic/cryptonote_format_utils.h"
 #include "cryptonote_basic/account.h"
@@ -570,6 +571,11 @@ namespace cryptonote
     res.synchronized = check_core_ready();
     res.busy_syncing = m_p2p.get_payload_object().is_busy_syncing();
     res.restricted = restricted;
+    if (restricted)
+      res.rct_ver_cache_hits = res.rct_ver_cache_misses = res.rct_ver_cache_size = 0;
+    else
+      m_core.get_blockchain_storage().get_rct_ver_cache_stats(res.rct_ver_cache_hits, res.rct_ver_cache_misses, res.rct_ver_cache_size);
+    res.online_pruning = m_core.get_blockchain_pruning_progress(res.pruning_height);
 
     res.status = CORE_RPC_STATUS_OK;
     return true;
@@ -3321,6 +3327,10 @@ namespace cryptonote
       return true;
     });
     res.overview = block_queue.get_overview(res.height);
+    res.pipeline_download_spans = block_queue.get_num_filled_spans();
+    res.pipeline_pow_blocks = m_core.get_pow_lookahead_queue_depth();
+    res.pipeline_verify_blocks = m_p2p.get_payload_object().get_sync_verify_queue_depth();
+    res.pipeline_commit_blocks = m_p2p.get_payload_object().get_sync_commit_queue_depth();
 
     res.status = CORE_RPC_STATUS_OK;
     return true;
@@ -3372,7 +3382,7 @@ namespace cryptonote
       const uint64_t req_to_height = req.to_height ? req.to_height : (m_core.get_current_blockchain_height() - 1);
       for (uint64_t amount: req.amounts)
       {
-        auto data = rpc::RpcHandler::get_output_distribution([this](uint64_t amount, uint64_t from, uint64_t to, uint64_t &start_height, std::vector<uint64_t> &distribution, uint64_t &base) { return m_core.get_output_distribution(amount, from, to, start_height, distribution, base); }, amount, req.from_height, req_to_height, [this](uint64_t height) { return m_core.get_blockchain_storage().get_db().get_block_hash_from_height(height); }, req.cumulative, m_core.get_current_blockchain_height());
+        auto data = rpc::RpcHandler::get_output_distribution([this](uint64_t amount, uint64_t from, uint64_t to, uint64_t &start_height, std::vector<uint64_t> &distribution, uint64_t &base) { return m_core.get_output_distribution(amount, from, to, start_height, distribution, base); }, amount, req.from_height, req_to_height, [this](uint64_t height) { return m_core.get_blockchain_storage().get_db().get_block_hash_from_height(height); }, req.cumulative, m_core.get_current_blockchain_height(), req.nonzero_amount_base);
         if (!data)
         {
           error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
@@ -3427,7 +3437,7 @@ namespace cryptonote
       const uint64_t req_to_height = req.to_height ? req.to_height : (m_core.get_current_blockchain_height() - 1);
       for (uint64_t amount: req.amounts)
       {
-        auto data = rpc::RpcHandler::get_output_distribution([this](uint64_t amount, uint64_t from, uint64_t to, uint64_t &start_height, std::vector<uint64_t> &distribution, uint64_t &base) { return m_core.get_output_distribution(amount, from, to, start_height, distribution, base); }, amount, req.from_height, req_to_height, [this](uint64_t height) { return m_core.get_blockchain_storage().get_db().get_block_hash_from_height(height); }, req.cumulative, m_core.get_current_blockchain_height());
+        auto data = rpc::RpcHandler::get_output_distribution([this](uint64_t amount, uint64_t from, uint64_t to, uint64_t &start_height, std::vector<uint64_t> &distribution, uint64_t &base) { return m_core.get_output_distribution(amount, from, to, start_height, distribution, base); }, amount, req.from_height, req_to_height, [this](uint64_t height) { return m_core.get_blockchain_storage().get_db().get_block_hash_from_height(height); }, req.cumulative, m_core.get_current_blockchain_height(), req.nonzero_amount_base);
         if (!data)
         {
           res.status = "Failed to get output distribution";
@@ -3453,7 +3463,14 @@ namespace cryptonote
 
     try
     {
-      if (!(req.check ? m_core.check_blockchain_pruning() : m_core.prune_blockchain()))
+      bool r;
+      if (req.check)
+        r = m_core.check_blockchain_pruning();
+      else if (req.online)
+        r = m_core.prune_blockchain_online();
+      else
+        r = m_core.prune_blockchain();
+      if (!r)
       {
         error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
         error_resp.message = req.check ? "Failed to check blockchain pruning" : "Failed to prune blockchain";
@@ -3461,6 +3478,7 @@ namespace cryptonote
       }
       res.pruning_seed = m_core.get_blockchain_pruning_seed();
       res.pruned = res.pruning_seed != 0;
+      res.online_pruning = m_core.get_blockchain_pruning_progress(res.pruning_height);
     }
     catch (const std::exception &e)
     {
@@ -3545,6 +3563,104 @@ namespace cryptonote
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_threadpool_stats(const COMMAND_RPC_GET_THREADPOOL_STATS::request& req, COMMAND_RPC_GET_THREADPOOL_STATS::response& res, epee::json_rpc::error& error_resp, const connection_context *ctx)
+  {
+    RPC_TRACKER(get_threadpool_stats);
+    for (size_t b = 0; b < tools::threadpool::NUM_LATENCY_BUCKETS; ++b)
+      res.latency_bucket_limits_us.push_back(tools::threadpool::get_latency_bucket_limit_us(b));
+
+    const auto add_pool = [&res](const char *name, const tools::threadpool &tpool) {
+      const tools::threadpool::stats stats = tpool.get_stats();
+      COMMAND_RPC_GET_THREADPOOL_STATS::pool pool;
+      pool.name = name;
+      pool.threads = stats.threads;
+      pool.active = stats.active;
+      pool.queue_depth_high = stats.queue_depth[tools::threadpool::PRIORITY_HIGH];
+      pool.queue_depth_normal = stats.queue_depth[tools::threadpool::PRIORITY_NORMAL];
+      pool.submitted = stats.submitted;
+      pool.executed = stats.executed;
+      pool.inlined = stats.inlined;
+      pool.steals = stats.steals;
+      pool.latency_histogram.assign(stats.latency_histogram, stats.latency_histogram + tools::threadpool::NUM_LATENCY_BUCKETS);
+      res.pools.push_back(std::move(pool));
+    };
+    add_pool("compute", tools::threadpool::getInstanceForCompute());
+    add_pool("io", tools::threadpool::getInstanceForIO());
+
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_db_stats(const COMMAND_RPC_GET_DB_STATS::request& req, COMMAND_RPC_GET_DB_STATS::response& res, epee::json_rpc::error& error_resp, const connection_context *ctx)
+  {
+    RPC_TRACKER(get_db_stats);
+    db_stats stats;
+    try
+    {
+      m_core.get_blockchain_storage().get_db().get_db_stats(stats);
+    }
+    catch (const std::exception &e)
+    {
+      error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+      error_resp.message = std::string("Failed to get database stats: ") + e.what();
+      return false;
+    }
+    res.page_size = stats.page_size;
+    res.map_size = stats.map_size;
+    res.file_size = stats.file_size;
+    res.used_pages = stats.used_pages;
+    res.free_pages = stats.free_pages;
+    res.readers = stats.readers;
+    res.max_readers = stats.max_readers;
+    for (const db_table_stats &t: stats.tables)
+    {
+      COMMAND_RPC_GET_DB_STATS::table table;
+      table.name = t.name;
+      table.entries = t.entries;
+      table.depth = t.depth;
+      table.branch_pages = t.branch_pages;
+      table.leaf_pages = t.leaf_pages;
+      table.overflow_pages = t.overflow_pages;
+      res.tables.push_back(std::move(table));
+    }
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_compact_db(const COMMAND_RPC_COMPACT_DB::request& req, COMMAND_RPC_COMPACT_DB::response& res, epee::json_rpc::error& error_resp, const connection_context *ctx)
+  {
+    RPC_TRACKER(compact_db);
+    static const char *const states[] = { "idle", "copying", "ready", "done", "failed" };
+
+    try
+    {
+      if (!req.check && !m_core.compact_database())
+      {
+        const db_compaction_status status = m_core.get_database_compaction_status();
+        if (status.state != db_compaction_status::copying && status.state != db_compaction_status::ready)
+        {
+          error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+          error_resp.message = status.error.empty() ? "Failed to start compacting the database" : status.error;
+          return false;
+        }
+      }
+    }
+    catch (const std::exception &e)
+    {
+      error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+      error_resp.message = std::string("Failed to start compacting the database: ") + e.what();
+      return false;
+    }
+    const db_compaction_status status = m_core.get_database_compaction_status();
+    res.state = states[status.state];
+    res.size_before = status.size_before;
+    res.size_after = status.size_after;
+    res.attempts = status.attempts;
+    res.error = status.error;
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
   bool core_rpc_server::on_rpc_access_submit_nonce(const COMMAND_RPC_ACCESS_SUBMIT_NONCE::request& req, COMMAND_RPC_ACCESS_SUBMIT_NONCE::response& res, epee::json_rpc::error& error_resp, const connection_context *ctx)
   {
     RPC_TRACKER(rpc_access_submit_nonce);
@@ -88,7 +88,7 @@ namespace cryptonote
 // advance which version they will stop working with
 // Don't go over 32767 for any of these
 #define CORE_RPC_VERSION_MAJOR 3
-#define CORE_RPC_VERSION_MINOR 15
+#define CORE_RPC_VERSION_MINOR 21
 #define MAKE_CORE_RPC_VERSION(major,minor) (((major)<<16)|(minor))
 #define CORE_RPC_VERSION MAKE_CORE_RPC_VERSION(CORE_RPC_VERSION_MAJOR, CORE_RPC_VERSION_MINOR)
 
@@ -744,6 +744,11 @@ namespace cryptonote
       std::string version;
       bool synchronized;
       bool restricted;
+      uint64_t rct_ver_cache_hits;
+      uint64_t rct_ver_cache_misses;
+      uint64_t rct_ver_cache_size;
+      bool online_pruning;
+      uint64_t pruning_height;
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE_PARENT(rpc_access_response_base)
@@ -786,6 +791,11 @@ namespace cryptonote
         KV_SERIALIZE(version)
         KV_SERIALIZE(synchronized)
         KV_SERIALIZE(restricted)
+        KV_SERIALIZE_OPT(rct_ver_cache_hits, (uint64_t)0)
+        KV_SERIALIZE_OPT(rct_ver_cache_misses, (uint64_t)0)
+        KV_SERIALIZE_OPT(rct_ver_cache_size, (uint64_t)0)
+        KV_SERIALIZE_OPT(online_pruning, false)
+        KV_SERIALIZE_OPT(pruning_height, (uint64_t)0)
       END_KV_SERIALIZE_MAP()
     };
     typedef epee::misc_utils::struct_init<response_t> response;
@@ -2435,6 +2445,10 @@ namespace cryptonote
       std::list<peer> peers;
       std::list<span> spans;
       std::string overview;
+      uint64_t pipeline_download_spans;
+      uint64_t pipeline_pow_blocks;
+      uint64_t pipeline_verify_blocks;
+      uint64_t pipeline_commit_blocks;
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE_PARENT(rpc_access_response_base)
@@ -2444,6 +2458,10 @@ namespace cryptonote
         KV_SERIALIZE(peers)
         KV_SERIALIZE(spans)
         KV_SERIALIZE(overview)
+        KV_SERIALIZE_OPT(pipeline_download_spans, (uint64_t)0)
+        KV_SERIALIZE_OPT(pipeline_pow_blocks, (uint64_t)0)
+        KV_SERIALIZE_OPT(pipeline_verify_blocks, (uint64_t)0)
+        KV_SERIALIZE_OPT(pipeline_commit_blocks, (uint64_t)0)
       END_KV_SERIALIZE_MAP()
     };
     typedef epee::misc_utils::struct_init<response_t> response;
@@ -2459,6 +2477,11 @@ namespace cryptonote
       bool cumulative;
       bool binary;
       bool compress;
+      // since 3.21: for non zero amounts, return the number of outputs below
+      // from_height in base, as for amount 0, instead of 0. A non cumulative
+      // distribution then starts with the first block's own outputs, rather
+      // than with all outputs up to it.
+      bool nonzero_amount_base;
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE_PARENT(rpc_access_request_base)
@@ -2468,6 +2491,7 @@ namespace cryptonote
         KV_SERIALIZE_OPT(cumulative, false)
         KV_SERIALIZE_OPT(binary, true)
         KV_SERIALIZE_OPT(compress, false)
+        KV_SERIALIZE_OPT(nonzero_amount_base, false)
       END_KV_SERIALIZE_MAP()
     };
     typedef epee::misc_utils::struct_init<request_t> request;
@@ -2756,10 +2780,12 @@ namespace cryptonote
     struct request_t: public rpc_request_base
     {
       bool check;
+      bool online;
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE_PARENT(rpc_request_base)
         KV_SERIALIZE_OPT(check, false)
+        KV_SERIALIZE_OPT(online, false)
       END_KV_SERIALIZE_MAP()
     };
     typedef epee::misc_utils::struct_init<request_t> request;
@@ -2768,11 +2794,15 @@ namespace cryptonote
     {
       bool pruned;
       uint32_t pruning_seed;
+      bool online_pruning;
+      uint64_t pruning_height;
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE_PARENT(rpc_response_base)
         KV_SERIALIZE(pruned)
         KV_SERIALIZE(pruning_seed)
+        KV_SERIALIZE_OPT(online_pruning, false)
+        KV_SERIALIZE_OPT(pruning_height, (uint64_t)0)
       END_KV_SERIALIZE_MAP()
     };
     typedef epee::misc_utils::struct_init<response_t> response;
@@ -2800,4 +2830,143 @@ namespace cryptonote
     typedef epee::misc_utils::struct_init<response_t> response;
   };
 
+  struct COMMAND_RPC_GET_THREADPOOL_STATS
+  {
+    struct request_t: public rpc_request_base
+    {
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_PARENT(rpc_request_base)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<request_t> request;
+
+    struct pool
+    {
+      std::string name;
+      uint32_t threads;
+      uint32_t active;
+      uint64_t queue_depth_high;
+      uint64_t queue_depth_normal;
+      uint64_t submitted;
+      uint64_t executed;
+      uint64_t inlined;
+      uint64_t steals;
+      std::vector<uint64_t> latency_histogram;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(name)
+        KV_SERIALIZE(threads)
+        KV_SERIALIZE(active)
+        KV_SERIALIZE(queue_depth_high)
+        KV_SERIALIZE(queue_depth_normal)
+        KV_SERIALIZE(submitted)
+        KV_SERIALIZE(executed)
+        KV_SERIALIZE(inlined)
+        KV_SERIALIZE(steals)
+        KV_SERIALIZE(latency_histogram)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response_t: public rpc_response_base
+    {
+      std::vector<uint64_t> latency_bucket_limits_us;
+      std::vector<pool> pools;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_PARENT(rpc_response_base)
+        KV_SERIALIZE(latency_bucket_limits_us)
+        KV_SERIALIZE(pools)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<response_t> response;
+  };
+
+
+  struct COMMAND_RPC_GET_DB_STATS
+  {
+    struct request_t: public rpc_request_base
+    {
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_PARENT(rpc_request_base)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<request_t> request;
+
+    struct table
+    {
+      std::string name;
+      uint64_t entries;
+      uint32_t depth;
+      uint64_t branch_pages;
+      uint64_t leaf_pages;
+      uint64_t overflow_pages;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(name)
+        KV_SERIALIZE(entries)
+        KV_SERIALIZE(depth)
+        KV_SERIALIZE(branch_pages)
+        KV_SERIALIZE(leaf_pages)
+        KV_SERIALIZE(overflow_pages)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response_t: public rpc_response_base
+    {
+      uint64_t page_size;
+      uint64_t map_size;
+      uint64_t file_size;
+      uint64_t used_pages;
+      uint64_t free_pages;
+      uint32_t readers;
+      uint32_t max_readers;
+      std::vector<table> tables;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_PARENT(rpc_response_base)
+        KV_SERIALIZE(page_size)
+        KV_SERIALIZE(map_size)
+        KV_SERIALIZE(file_size)
+        KV_SERIALIZE(used_pages)
+        KV_SERIALIZE(free_pages)
+        KV_SERIALIZE(readers)
+        KV_SERIALIZE(max_readers)
+        KV_SERIALIZE(tables)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<response_t> response;
+  };
+
+  struct COMMAND_RPC_COMPACT_DB
+  {
+    struct request_t: public rpc_request_base
+    {
+      bool check;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_PARENT(rpc_request_base)
+        KV_SERIALIZE_OPT(check, false)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<request_t> request;
+
+    struct response_t: public rpc_response_base
+    {
+      std::string state;
+      uint64_t size_before;
+      uint64_t size_after;
+      uint32_t attempts;
+      std::string error;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_PARENT(rpc_response_base)
+        KV_SERIALIZE(state)
+        KV_SERIALIZE(size_before)
+        KV_SERIALIZE(size_after)
+        KV_SERIALIZE(attempts)
+        KV_SERIALIZE(error)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<response_t> response;
+  };
 }
@@ -1,5 +1,6 @@
 
 #include <algorithm>
+#include <list>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 
@@ -12,8 +13,10 @@ namespace rpc
   namespace
   {
     output_distribution_data
-      process_distribution(bool cumulative, std::uint64_t start_height, std::vector<std::uint64_t> distribution, std::uint64_t base)
+      process_distribution(bool cumulative, std::uint64_t start_height, std::vector<std::uint64_t> distribution, std::uint64_t base, bool report_base)
     {
+      if (!report_base)
+        base = 0;
       if (!cumulative && !distribution.empty())
       {
         for (std::size_t n = distribution.size() - 1; 0 < n; --n)
@@ -23,49 +26,81 @@ namespace rpc
 
       return {std::move(distribution), start_height, base};
     }
+
+    // one entry per (amount, from height), so wallets asking for several
+    // amounts or start heights don't keep evicting each other
+    constexpr const std::size_t MAX_CACHED_DISTRIBUTIONS = 16;
+
+    struct cached_distribution
+    {
+      std::uint64_t amount = 0;
+      std::uint64_t from = 0;
+      std::uint64_t to = 0;
+      std::uint64_t start_height = 0;
+      std::uint64_t base = 0;
+      std::vector<std::uint64_t> distribution;
+      crypto::hash m10_hash = crypto::null_hash;
+      crypto::hash top_hash = crypto::null_hash;
+      bool cached = false;
+    };
   }
 
   boost::optional<output_distribution_data>
-    RpcHandler::get_output_distribution(const std::function<bool(uint64_t, uint64_t, uint64_t, uint64_t&, std::vector<uint64_t>&, uint64_t&)> &f, uint64_t amount, uint64_t from_height, uint64_t to_height, const std::function<crypto::hash(uint64_t)> &get_hash, bool cumulative, uint64_t blockchain_height)
+    RpcHandler::get_output_distribution(const std::function<bool(uint64_t, uint64_t, uint64_t, uint64_t&, std::vector<uint64_t>&, uint64_t&)> &f, uint64_t amount, uint64_t from_height, uint64_t to_height, const std::function<crypto::hash(uint64_t)> &get_hash, bool cumulative, uint64_t blockchain_height, bool nonzero_amount_base)
   {
+      const bool report_base = amount == 0 || nonzero_amount_base;
+
       static struct D
       {
         boost::mutex mutex;
-        std::vector<std::uint64_t> cached_distribution;
-        std::uint64_t cached_from, cached_to, cached_start_height, cached_base;
-        crypto::hash cached_m10_hash;
-        crypto::hash cached_top_hash;
-        bool cached;
-        D(): cached_from(0), cached_to(0), cached_start_height(0), cached_base(0), cached_m10_hash(crypto::null_hash), cached_top_hash(crypto::null_hash), cached(false) {}
+        std::list<cached_distribution> entries; // most recently used first
       } d;
       const boost::unique_lock<boost::mutex> lock(d.mutex);
 
+      auto it = std::find_if(d.entries.begin(), d.entries.end(), [amount, from_height](const cached_distribution &e) {
+        return e.amount == amount && e.from == from_height;
+      });
+      if (it == d.entries.end())
+      {
+        if (d.entries.size() >= MAX_CACHED_DISTRIBUTIONS)
+          d.entries.pop_back();
+        d.entries.emplace_front();
+        it = d.entries.begin();
+        it->amount = amount;
+        it->from = from_height;
+      }
+      else if (it != d.entries.begin())
+      {
+        d.entries.splice(d.entries.begin(), d.entries, it);
+      }
+      cached_distribution &c = *it;
+
       crypto::hash top_hash = crypto::null_hash;
-      if (d.cached_to < blockchain_height)
-        top_hash = get_hash(d.cached_to);
-      if (d.cached && amount == 0 && d.cached_from == from_height && d.cached_to == to_height && d.cached_top_hash == top_hash)
-        return process_distribution(cumulative, d.cached_start_height, d.cached_distribution, d.cached_base);
+      if (c.to < blockchain_height)
+        top_hash = get_hash(c.to);
+      if (c.cached && c.to == to_height && c.top_hash == top_hash)
+        return process_distribution(cumulative, c.start_height, c.distribution, c.base, report_base);
 
       std::vector<std::uint64_t> distribution;
       std::uint64_t start_height, base;
 
       // see if we can extend the cache - a common case
-      bool can_extend = d.cached && amount == 0 && d.cached_from == from_height && to_height > d.cached_to && top_hash == d.cached_top_hash;
+      bool can_extend = c.cached && to_height > c.to && top_hash == c.top_hash;
       if (!can_extend)
       {
         // we kept track of the hash 10 blocks below, if it exists, so if it matches,
         // we can still pop the last 10 cached slots and try again
-        if (d.cached && amount == 0 && d.cached_from == from_height && d.cached_to - d.cached_from >= 10 && to_height > d.cached_to - 10)
+        if (c.cached && c.to - c.from >= 10 && to_height > c.to - 10)
         {
-          crypto::hash hash10 = get_hash(d.cached_to - 10);
-          if (hash10 == d.cached_m10_hash)
+          crypto::hash hash10 = get_hash(c.to - 10);
+          if (hash10 == c.m10_hash)
           {
-            d.cached_to -= 10;
-            d.cached_top_hash = hash10;
-            d.cached_m10_hash = crypto::null_hash;
-            CHECK_AND_ASSERT_MES(d.cached_distribution.size() >= 10, boost::none, "Cached distribution size does not match cached bounds");
+            c.to -= 10;
+            c.top_hash = hash10;
+            c.m10_hash = crypto::null_hash;
+            CHECK_AND_ASSERT_MES(c.distribution.size() >= 10, boost::none, "Cached distribution size does not match cached bounds");
             for (int p = 0; p < 10; ++p)
-              d.cached_distribution.pop_back();
+              c.distribution.pop_back();
             can_extend = true;
           }
         }
@@ -73,14 +108,14 @@ namespace rpc
       if (can_extend)
       {
         std::vector<std::uint64_t> new_distribution;
-        if (!f(amount, d.cached_to + 1, to_height, start_height, new_distribution, base))
+        if (!f(amount, c.to + 1, to_height, start_height, new_distribution, base))
           return boost::none;
-        distribution = d.cached_distribution;
+        distribution = c.distribution;
         distribution.reserve(distribution.size() + new_distribution.size());
         for (const auto &e: new_distribution)
           distribution.push_back(e);
-        start_height = d.cached_start_height;
-        base = d.cached_base;
+        start_height = c.start_height;
+        base = c.base;
       }
       else
       {
@@ -95,19 +130,15 @@ namespace rpc
           distribution.resize(to_height - offset + 1);
       }
 
-      if (amount == 0)
-      {
-        d.cached_from = from_height;
-        d.cached_to = to_height;
-        d.cached_top_hash = get_hash(d.cached_to);
-        d.cached_m10_hash = d.cached_to >= 10 ? get_hash(d.cached_to - 10) : crypto::null_hash;
-        d.cached_distribution = distribution;
-        d.cached_start_height = start_height;
-        d.cached_base = base;
-        d.cached = true;
-      }
+      c.to = to_height;
+      c.top_hash = get_hash(c.to);
+      c.m10_hash = c.to >= 10 ? get_hash(c.to - 10) : crypto::null_hash;
+      c.distribution = distribution;
+      c.start_height = start_height;
+      c.base = base;
+      c.cached = true;
 
-      return process_distribution(cumulative, start_height, std::move(distribution), base);
+      return process_distribution(cumulative, start_height, std::move(distribution), base, report_base);
   }
 } // rpc
 } // cryptonote
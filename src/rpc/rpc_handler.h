@@ -57,8 +57,11 @@ class RpcHandler
 
     virtual epee::byte_slice handle(std::string&& request) = 0;
 
+    // base is only reported for non zero amounts if nonzero_amount_base is
+    // set; otherwise it is 0 and the outputs below from_height are in the
+    // first entry, as before it was known for those
     static boost::optional<output_distribution_data>
-      get_output_distribution(const std::function<bool(uint64_t, uint64_t, uint64_t, uint64_t&, std::vector<uint64_t>&, uint64_t&)> &f, uint64_t amount, uint64_t from_height, uint64_t to_height, const std::function<crypto::hash(uint64_t)> &get_hash, bool cumulative, uint64_t blockchain_height);
+      get_output_distribution(const std::function<bool(uint64_t, uint64_t, uint64_t, uint64_t&, std::vector<uint64_t>&, uint64_t&)> &f, uint64_t amount, uint64_t from_height, uint64_t to_height, const std::function<crypto::hash(uint64_t)> &get_hash, bool cumulative, uint64_t blockchain_height, bool nonzero_amount_base = false);
 };
 
 
@@ -1394,6 +1394,40 @@ struct WalletManager
 
     //! sets proxy address, empty string to disable
     virtual bool setProxy(const std::string &address) = 0;
+
+    /*!
+     * \brief addSharedScanWallet - lets scanSharedWallets refresh this wallet together with
+     *                              the other registered ones. The wallet's own refresh should
+     *                              be paused while it is registered.
+     * \param wallet - wallet opened with this manager
+     * \return - true if the wallet was registered
+     */
+    virtual bool addSharedScanWallet(Wallet *wallet) = 0;
+
+    //! stops refreshing the wallet from scanSharedWallets, returns false if it was not registered.
+    //! If a scan is running, waits until the batch of blocks it is scanning is done with the wallet
+    virtual bool removeSharedScanWallet(Wallet *wallet) = 0;
+
+    /*!
+     * \brief scanSharedWallets - fetches and parses new blocks from the daemon set with
+     *                            setDaemonAddress once, and scans them for all registered wallets,
+     *                            until they are all caught up with the daemon. Each wallet resumes
+     *                            from its own height, a new or restored wallet first skips to its
+     *                            restore height with block hashes only. Wallets which fail (eg, on
+     *                            a reorg) are refreshed on their own. Wallets can be added, removed
+     *                            and queried while this runs.
+     * \return - number of blocks fetched from the daemon
+     */
+    virtual uint64_t scanSharedWallets() = 0;
+
+    /*!
+     * \brief sharedScanStatus - progress of a wallet registered for shared scanning
+     * \param height - the wallet's blockchain height, where its next scan resumes
+     * \param blocksScanned - blocks added to the wallet by shared scans
+     * \param error - last error scanning the wallet, empty if none
+     * \return - false if the wallet is not registered
+     */
+    virtual bool sharedScanStatus(Wallet *wallet, uint64_t &height, uint64_t &blocksScanned, std::string &error) const = 0;
 };
 
 
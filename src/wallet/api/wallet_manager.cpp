@@ -35,7 +35,9 @@
 #include "common/dns_utils.h"
 #include "common/util.h"
 #include "common/updates.h"
+#include "common/threadpool.h"
 #include "version.h"
+#include "misc_language.h"
 #include "net/http_client.h"
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
@@ -161,6 +163,7 @@ bool WalletManagerImpl::closeWallet(Wallet *wallet, bool store)
     WalletImpl * wallet_ = dynamic_cast<WalletImpl*>(wallet);
     if (!wallet_)
         return false;
+    removeSharedScanWallet(wallet);
     bool result = wallet_->close(store);
     if (!result) {
         m_errorString = wallet_->errorString();
@@ -385,6 +388,219 @@ bool WalletManagerImpl::setProxy(const std::string &address)
     return m_http_client.set_proxy(address);
 }
 
+bool WalletManagerImpl::addSharedScanWallet(Wallet *wallet)
+{
+    WalletImpl * wallet_ = dynamic_cast<WalletImpl*>(wallet);
+    if (!wallet_)
+        return false;
+    boost::lock_guard<boost::mutex> lock(m_sharedScanMutex);
+    for (const auto &w: m_sharedScanWallets)
+        if (w.wallet == wallet_)
+            return true;
+    m_sharedScanWallets.push_back({wallet_, wallet_->blockChainHeight(), 0, {}});
+    return true;
+}
+
+bool WalletManagerImpl::removeSharedScanWallet(Wallet *wallet)
+{
+    boost::unique_lock<boost::mutex> lock(m_sharedScanMutex);
+    auto it = std::find_if(m_sharedScanWallets.begin(), m_sharedScanWallets.end(), [wallet](const SharedScanWallet &w) { return w.wallet == wallet; });
+    if (it == m_sharedScanWallets.end())
+        return false;
+    m_sharedScanWallets.erase(it);
+    // the wallet may be closed once we return, so let the batch in progress finish with it
+    while (std::find(m_sharedScanBusy.begin(), m_sharedScanBusy.end(), wallet) != m_sharedScanBusy.end())
+        m_sharedScanIdle.wait(lock);
+    return true;
+}
+
+bool WalletManagerImpl::sharedScanStatus(Wallet *wallet, uint64_t &height, uint64_t &blocksScanned, std::string &error) const
+{
+    boost::lock_guard<boost::mutex> lock(m_sharedScanMutex);
+    for (const auto &w: m_sharedScanWallets)
+    {
+        if (w.wallet == wallet)
+        {
+            height = w.height;
+            blocksScanned = w.blocksScanned;
+            error = w.error;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t WalletManagerImpl::scanSharedWallets()
+{
+    boost::lock_guard<boost::mutex> run_lock(m_sharedScanRunMutex);
+    uint64_t blocks_fetched = 0;
+    tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
+
+    while (true)
+    {
+        // work on a snapshot of the registered wallets, so the daemon calls and scanning
+        // below don't hold m_sharedScanMutex, and publish the results when done
+        std::vector<SharedScanWallet> wallets;
+        {
+            boost::lock_guard<boost::mutex> lock(m_sharedScanMutex);
+            wallets = m_sharedScanWallets;
+            for (const SharedScanWallet &w: wallets)
+                m_sharedScanBusy.push_back(w.wallet);
+        }
+        epee::misc_utils::auto_scope_leave_caller publish = epee::misc_utils::create_scope_leave_handler([&]() {
+            boost::lock_guard<boost::mutex> lock(m_sharedScanMutex);
+            for (const SharedScanWallet &w: wallets)
+            {
+                auto it = std::find_if(m_sharedScanWallets.begin(), m_sharedScanWallets.end(), [&w](const SharedScanWallet &e) { return e.wallet == w.wallet; });
+                if (it != m_sharedScanWallets.end())
+                    *it = w;
+            }
+            m_sharedScanBusy.clear();
+            m_sharedScanIdle.notify_all();
+        });
+        const size_t num_wallets = wallets.size();
+        if (num_wallets == 0)
+            break;
+
+        // each wallet resumes from its own height, fetch from the one furthest behind. A new
+        // or restored wallet first skips to its restore height with hashes only, and if it
+        // can't, it refreshes on its own rather than have everyone scan from below it
+        std::vector<tools::wallet2::RefreshType> refresh_types(num_wallets);
+        std::vector<char> joined(num_wallets, 0);
+        size_t lowest = num_wallets;
+        bool no_miner_tx = true;
+        for (size_t i = 0; i < num_wallets; ++i)
+        {
+            SharedScanWallet &w = wallets[i];
+            boost::lock_guard<boost::mutex> guard(w.wallet->m_refreshMutex2);
+            try
+            {
+                joined[i] = w.wallet->m_wallet->fast_refresh_to_scan_height(w.wallet->trustedDaemon());
+            }
+            catch (const std::exception &e)
+            {
+                w.error = e.what();
+            }
+            w.height = w.wallet->m_wallet->get_blockchain_current_height();
+            if (!joined[i])
+                continue;
+            refresh_types[i] = w.wallet->m_wallet->get_refresh_type();
+            no_miner_tx = no_miner_tx && refresh_types[i] == tools::wallet2::RefreshNoCoinbase;
+            if (lowest == num_wallets || w.height < wallets[lowest].height)
+                lowest = i;
+        }
+
+        std::vector<uint64_t> blocks_added(num_wallets, 0);
+        std::vector<char> failed(num_wallets, 0);
+        bool done = true;
+        if (lowest < num_wallets)
+        {
+            cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::request req = AUTO_VAL_INIT(req);
+            cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::response res = AUTO_VAL_INIT(res);
+            {
+                boost::lock_guard<boost::mutex> guard(wallets[lowest].wallet->m_refreshMutex2);
+                wallets[lowest].wallet->m_wallet->get_scan_chain_history(req.block_ids);
+            }
+            req.start_height = 0;
+            req.prune = true;
+            req.no_miner_tx = no_miner_tx;
+            req.requested_info = cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::BLOCKS_ONLY;
+            if (!epee::net_utils::invoke_http_bin("/getblocks.bin", req, res, m_http_client) || res.status != CORE_RPC_STATUS_OK)
+            {
+                m_errorString = "Failed to get blocks from daemon";
+                break;
+            }
+            if (res.blocks.empty())
+                break;
+
+            // parse blocks and tx extra once for all wallets
+            std::vector<tools::wallet2::parsed_block> parsed_blocks;
+            std::map<tools::wallet2::RefreshType, std::vector<tools::wallet2::tx_cache_data>> tx_cache_data;
+            try
+            {
+                bool error = false;
+                tools::wallet2::parse_blocks(res.blocks, res.output_indices, parsed_blocks, error);
+                if (error)
+                {
+                    m_errorString = "Failed to parse blocks from daemon";
+                    break;
+                }
+                for (size_t i = 0; i < num_wallets; ++i)
+                    if (joined[i] && tx_cache_data.find(refresh_types[i]) == tx_cache_data.end())
+                        tools::wallet2::cache_blocks_tx_data(parsed_blocks, refresh_types[i], tx_cache_data[refresh_types[i]]);
+            }
+            catch (const std::exception &e)
+            {
+                m_errorString = e.what();
+                break;
+            }
+            blocks_fetched += res.blocks.size();
+
+            // key derivations and output checks are per wallet, run them all on the compute pool
+            tools::threadpool::waiter waiter(tpool);
+            for (size_t i = 0; i < num_wallets; ++i)
+            {
+                if (!joined[i])
+                    continue;
+                tpool.submit(&waiter, [&, i]() {
+                    SharedScanWallet &w = wallets[i];
+                    boost::lock_guard<boost::mutex> guard(w.wallet->m_refreshMutex2);
+                    try
+                    {
+                        w.wallet->m_wallet->process_shared_blocks(res.start_height, res.blocks, parsed_blocks, tx_cache_data.find(refresh_types[i])->second, blocks_added[i]);
+                        w.blocksScanned += blocks_added[i];
+                        w.error.clear();
+                    }
+                    catch (const std::exception &e)
+                    {
+                        w.error = e.what();
+                        failed[i] = 1;
+                    }
+                });
+            }
+            waiter.wait();
+            done = res.start_height + res.blocks.size() >= res.current_height;
+        }
+
+        // wallets which could not use the shared blocks (reorg, corrupt cache, still below
+        // their restore height...) refresh on their own
+        bool progress = false;
+        for (size_t i = 0; i < num_wallets; ++i)
+        {
+            progress = progress || blocks_added[i] > 0;
+            if (joined[i] && !failed[i])
+                continue;
+            SharedScanWallet &w = wallets[i];
+            if (joined[i])
+                LOG_PRINT_L1("Shared scan failed for " << w.wallet->path() << " (" << w.error << "), refreshing it on its own");
+            else
+                LOG_PRINT_L1(w.wallet->path() << " did not reach its restore height with hashes only, refreshing it on its own");
+            boost::lock_guard<boost::mutex> guard(w.wallet->m_refreshMutex2);
+            try
+            {
+                w.wallet->m_wallet->refresh(w.wallet->trustedDaemon());
+                w.error.clear();
+                progress = true;
+            }
+            catch (const std::exception &e)
+            {
+                w.error = e.what();
+            }
+        }
+
+        for (SharedScanWallet &w: wallets)
+        {
+            boost::lock_guard<boost::mutex> guard(w.wallet->m_refreshMutex2);
+            w.height = w.wallet->m_wallet->get_blockchain_current_height();
+        }
+
+        if (!progress || done)
+            break;
+    }
+
+    return blocks_fetched;
+}
+
 ///////////////////// WalletManagerFactory implementation //////////////////////
 WalletManager *WalletManagerFactory::getWalletManager()
 {
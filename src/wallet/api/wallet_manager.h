@@ -31,10 +31,15 @@
 
 #include "wallet/api/wallet2_api.h"
 #include "net/http.h"
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <string>
+#include <vector>
 
 namespace Monero {
 
+class WalletImpl;
+
 class WalletManagerImpl : public WalletManager
 {
 public:
@@ -93,12 +98,31 @@ public:
     bool stopMining() override;
     std::string resolveOpenAlias(const std::string &address, bool &dnssec_valid) const override;
     bool setProxy(const std::string &address) override;
+    bool addSharedScanWallet(Wallet *wallet) override;
+    bool removeSharedScanWallet(Wallet *wallet) override;
+    uint64_t scanSharedWallets() override;
+    bool sharedScanStatus(Wallet *wallet, uint64_t &height, uint64_t &blocksScanned, std::string &error) const override;
 
 private:
     WalletManagerImpl();
     friend struct WalletManagerFactory;
     net::http::client m_http_client;
     std::string m_errorString;
+
+    struct SharedScanWallet
+    {
+        WalletImpl *wallet;
+        uint64_t height;
+        uint64_t blocksScanned;
+        std::string error;
+    };
+    std::vector<SharedScanWallet> m_sharedScanWallets;
+    // wallets the running scan batch works on, removing one waits for it
+    std::vector<WalletImpl*> m_sharedScanBusy;
+    mutable boost::mutex m_sharedScanMutex;
+    boost::condition_variable m_sharedScanIdle;
+    // one scan at a time, held while scanning without blocking the above
+    boost::mutex m_sharedScanRunMutex;
 };
 
 } // namespace
@@ -0,0 +1,447 @@
+// Copyright (c) 2014-2022, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "common/util.h"
+#include "crypto/crypto.h"
+#include "file_io_utils.h"
+#include "memwipe.h"
+#include "misc_log_ex.h"
+#include "cache_journal.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "wallet.cache_journal"
+
+namespace
+{
+  // same layout as wallet2::cache_file_data, so a snapshot written here is
+  // an ordinary wallet cache file
+  struct encrypted_data
+  {
+    crypto::chacha_iv iv;
+    std::string data;
+
+    BEGIN_SERIALIZE_OBJECT()
+      FIELD(iv)
+      FIELD(data)
+    END_SERIALIZE()
+  };
+
+  bool same_iv(const crypto::chacha_iv &a, const crypto::chacha_iv &b)
+  {
+    return !memcmp(&a, &b, sizeof(a));
+  }
+
+  bool remove_file(const std::string &filename)
+  {
+    boost::system::error_code ec;
+    boost::filesystem::remove(filename, ec);
+    if (ec)
+      MERROR("Failed to remove " << filename << ": " << ec.message());
+    return !ec;
+  }
+}
+
+namespace tools
+{
+namespace cache_journal
+{
+  uint64_t fingerprint(const std::string &blob)
+  {
+    crypto::hash h;
+    crypto::cn_fast_hash(blob.data(), blob.size(), h);
+    uint64_t fp;
+    memcpy(&fp, &h, sizeof(fp));
+    return fp;
+  }
+
+  journal::journal():
+    m_snapshot_size(0),
+    m_size(0),
+    m_valid_size(0),
+    m_compacting(false),
+    m_compaction_done(false),
+    m_compaction_succeeded(false),
+    m_compaction_snapshot_size(0)
+  {
+  }
+
+  journal::~journal()
+  {
+    close();
+  }
+
+  void journal::open(const std::string &wallet_file, const crypto::chacha_iv &snapshot, uint64_t snapshot_size)
+  {
+    close();
+    m_wallet_file = wallet_file;
+    m_filename = wallet_file + ".journal";
+    m_base = snapshot;
+    m_snapshot = snapshot;
+    m_snapshot_size = snapshot_size;
+    m_size = 0;
+    m_valid_size = 0;
+    boost::system::error_code ec;
+    if (boost::filesystem::exists(m_filename, ec))
+      m_size = boost::filesystem::file_size(m_filename, ec);
+  }
+
+  void journal::close()
+  {
+    // a snapshot left half way is harmless, the journal still has everything
+    if (m_compaction_thread.joinable())
+      m_compaction_thread.join();
+    m_compacting = false;
+    m_wallet_file.clear();
+    m_filename.clear();
+  }
+
+  bool journal::encrypt(frame &f, const crypto::chacha_key &key, std::string &data)
+  {
+    std::string plain;
+    if (!::serialization::dump_binary(f, plain))
+      return false;
+    crypto::hash check;
+    crypto::cn_fast_hash(plain.data(), plain.size(), check);
+    plain.append((const char*)&check, sizeof(check));
+
+    encrypted_data e;
+    e.iv = crypto::rand<crypto::chacha_iv>();
+    e.data.resize(plain.size());
+    crypto::chacha20(plain.data(), plain.size(), key, e.iv, &e.data[0]);
+    memwipe(&plain[0], plain.size());
+    return ::serialization::dump_binary(e, data);
+  }
+
+  bool journal::parse(const std::string &data, const crypto::chacha_key &key, std::vector<frame> &frames, uint64_t &valid_size) const
+  {
+    frames.clear();
+    valid_size = 0;
+    binary_archive<false> ar{epee::strspan<std::uint8_t>(data)};
+    std::string plain;
+    while (ar.remaining_bytes() > 0)
+    {
+      encrypted_data e;
+      if (!::serialization::serialize_noeof(ar, e) || e.data.size() < sizeof(crypto::hash))
+        break;
+      plain.resize(e.data.size());
+      crypto::chacha20(e.data.data(), e.data.size(), key, e.iv, &plain[0]);
+      const size_t body = plain.size() - sizeof(crypto::hash);
+      crypto::hash check;
+      crypto::cn_fast_hash(plain.data(), body, check);
+      if (memcmp(&check, plain.data() + body, sizeof(check)))
+        break;
+      plain.resize(body);
+      frame f;
+      if (!::serialization::parse_binary(plain, f))
+        break;
+      frames.push_back(std::move(f));
+      valid_size = data.size() - ar.remaining_bytes();
+    }
+    if (!plain.empty())
+      memwipe(&plain[0], plain.size());
+    if (valid_size < data.size())
+      MWARNING("Ignoring " << (data.size() - valid_size) << " bytes of damaged or incomplete data at the end of " << m_filename);
+    return true;
+  }
+
+  bool journal::read(const crypto::chacha_key &key, std::vector<frame> &frames)
+  {
+    frames.clear();
+    if (m_size == 0)
+      return true;
+
+    std::string data;
+    if (!epee::file_io_utils::load_file_to_string(m_filename, data, std::numeric_limits<size_t>::max()))
+    {
+      MERROR("Failed to read " << m_filename);
+      return false;
+    }
+    m_size = data.size();
+
+    std::vector<frame> all;
+    parse(data, key, all, m_valid_size);
+    if (all.empty())
+      return true;
+
+    if (same_iv(all.front().base, m_snapshot))
+    {
+      // a compaction which did not complete can be ignored
+      for (frame &f: all)
+        if (f.type == frame::type_changes)
+          frames.push_back(std::move(f));
+      return true;
+    }
+
+    // the snapshot was written by a compaction, but the journal was not
+    // shortened yet: the frames from the compaction on apply to it
+    auto i = all.end();
+    while (i != all.begin() && !((i - 1)->type == frame::type_compaction && same_iv((i - 1)->snapshot, m_snapshot)))
+      --i;
+    if (i == all.begin())
+    {
+      MWARNING(m_filename << " does not match the wallet cache, ignoring it");
+      m_valid_size = 0;
+      return true;
+    }
+    for (; i != all.end(); ++i)
+      if (i->type == frame::type_changes)
+        frames.push_back(*i);
+    return rewrite(frames, key);
+  }
+
+  bool journal::rewrite(std::vector<frame> &frames, const crypto::chacha_key &key)
+  {
+    m_base = m_snapshot;
+    std::string data, frame_data;
+    for (frame &f: frames)
+    {
+      f.base = m_base;
+      if (!encrypt(f, key, frame_data))
+        return false;
+      data += frame_data;
+    }
+
+    if (data.empty())
+    {
+      if (!remove_file(m_filename))
+        return false;
+    }
+    else
+    {
+      const std::string new_filename = m_filename + ".new";
+      if (!epee::file_io_utils::save_string_to_file(new_filename, data))
+      {
+        MERROR("Failed to write " << new_filename);
+        return false;
+      }
+      const std::error_code e = tools::replace_file(new_filename, m_filename);
+      if (e)
+      {
+        MERROR("Failed to replace " << m_filename << ": " << e.message());
+        return false;
+      }
+    }
+    m_size = m_valid_size = data.size();
+    return true;
+  }
+
+  bool journal::append(frame &f, const crypto::chacha_key &key)
+  {
+    f.base = m_base;
+    std::string data;
+    if (!encrypt(f, key, data))
+      return false;
+
+    boost::system::error_code ec;
+    if (m_size != m_valid_size)
+    {
+      // drop whatever a previous crash, or an older snapshot, left there
+      if (boost::filesystem::exists(m_filename, ec))
+        boost::filesystem::resize_file(m_filename, m_valid_size, ec);
+      if (ec)
+      {
+        MERROR("Failed to truncate " << m_filename << ": " << ec.message());
+        return false;
+      }
+      m_size = m_valid_size;
+    }
+
+    boost::filesystem::ofstream ostr(boost::filesystem::path(m_filename), std::ios_base::binary | std::ios_base::out | std::ios_base::app);
+    ostr.write(data.data(), data.size());
+    ostr.close();
+    if (!ostr.good())
+    {
+      MERROR("Failed to append to " << m_filename);
+      // whatever made it to the file is ignored when reading it
+      m_size += data.size();
+      return false;
+    }
+    m_size = m_valid_size = m_valid_size + data.size();
+    return true;
+  }
+
+  bool journal::reset(const crypto::chacha_iv &snapshot, uint64_t snapshot_size)
+  {
+    m_base = m_snapshot = snapshot;
+    m_snapshot_size = snapshot_size;
+    boost::system::error_code ec;
+    if (boost::filesystem::exists(m_filename, ec) && !remove_file(m_filename))
+    {
+      // the stale frames do not apply to the new snapshot, and get overwritten
+      m_valid_size = 0;
+      return false;
+    }
+    m_size = m_valid_size = 0;
+    return true;
+  }
+
+  bool journal::wants_compaction(unsigned ratio) const
+  {
+    return !m_compacting && m_valid_size * ratio > m_snapshot_size;
+  }
+
+  bool journal::write_snapshot(const std::string &filename, const std::string &cache_data, const crypto::chacha_key &key, const crypto::chacha_iv &iv)
+  {
+    encrypted_data e;
+    e.iv = iv;
+    e.data.resize(cache_data.size());
+    crypto::chacha20(cache_data.data(), cache_data.size(), key, iv, &e.data[0]);
+    std::string data;
+    if (!::serialization::dump_binary(e, data))
+      return false;
+    e.data.clear();
+    e.data.shrink_to_fit();
+
+    const std::string new_filename = filename + ".new";
+    if (!epee::file_io_utils::save_string_to_file(new_filename, data))
+    {
+      MERROR("Failed to write " << new_filename);
+      return false;
+    }
+    const std::error_code ec = tools::replace_file(new_filename, filename);
+    if (ec)
+    {
+      MERROR("Failed to replace " << filename << ": " << ec.message());
+      return false;
+    }
+    return true;
+  }
+
+  bool journal::fold_snapshot(uint64_t journal_size, const crypto::chacha_key &key, const fold_t &fold, const crypto::chacha_iv &iv, uint64_t &snapshot_size) const
+  {
+    std::string data;
+    encrypted_data e;
+    if (!epee::file_io_utils::load_file_to_string(m_wallet_file, data, std::numeric_limits<size_t>::max()) || !::serialization::parse_binary(data, e))
+    {
+      MERROR("Failed to read " << m_wallet_file);
+      return false;
+    }
+    if (!same_iv(e.iv, m_snapshot))
+    {
+      MERROR(m_wallet_file << " was changed behind the journal's back");
+      return false;
+    }
+    std::string snapshot(e.data.size(), '\0');
+    crypto::chacha20(e.data.data(), e.data.size(), key, e.iv, &snapshot[0]);
+
+    if (!epee::file_io_utils::load_file_to_string(m_filename, data, std::numeric_limits<size_t>::max()) || data.size() < journal_size)
+    {
+      MERROR("Failed to read " << m_filename);
+      return false;
+    }
+    // frames appended since are not part of the new snapshot
+    data.resize(journal_size);
+    std::vector<frame> all, frames;
+    uint64_t valid_size;
+    parse(data, key, all, valid_size);
+    for (frame &f: all)
+      if (f.type == frame::type_changes)
+        frames.push_back(std::move(f));
+
+    std::string cache_data;
+    const bool r = fold(snapshot, frames, cache_data) && write_snapshot(m_wallet_file, cache_data, key, iv);
+    snapshot_size = cache_data.size();
+    memwipe(&snapshot[0], snapshot.size());
+    if (!cache_data.empty())
+      memwipe(&cache_data[0], cache_data.size());
+    return r;
+  }
+
+  bool journal::start_compaction(const crypto::chacha_key &key, fold_t fold)
+  {
+    if (m_compacting)
+      return false;
+
+    frame marker;
+    marker.type = frame::type_compaction;
+    marker.snapshot = crypto::rand<crypto::chacha_iv>();
+    if (!append(marker, key))
+      return false;
+
+    MDEBUG("Compacting " << m_filename << " (" << m_valid_size << " bytes) into a new snapshot");
+    m_compacting = true;
+    m_compaction_done = false;
+    m_compaction_succeeded = false;
+    m_compaction_snapshot = marker.snapshot;
+    m_compaction_snapshot_size = 0;
+    m_compaction_thread = boost::thread([this, key, fold = std::move(fold), journal_size = m_valid_size, iv = marker.snapshot]() {
+      bool r = false;
+      uint64_t snapshot_size = 0;
+      try { r = fold_snapshot(journal_size, key, fold, iv, snapshot_size); }
+      catch (const std::exception &e) { MERROR("Failed to write wallet cache snapshot: " << e.what()); }
+      boost::unique_lock<boost::mutex> lock(m_compaction_mutex);
+      m_compaction_done = true;
+      m_compaction_succeeded = r;
+      m_compaction_snapshot_size = snapshot_size;
+    });
+    return true;
+  }
+
+  bool journal::compact(const crypto::chacha_key &key, fold_t fold)
+  {
+    finish_compaction(key, true);
+    if (m_valid_size == 0)
+      return true;
+
+    MDEBUG("Folding " << m_filename << " (" << m_valid_size << " bytes) into a new snapshot");
+    const crypto::chacha_iv iv = crypto::rand<crypto::chacha_iv>();
+    uint64_t snapshot_size = 0;
+    if (!fold_snapshot(m_valid_size, key, fold, iv, snapshot_size))
+      return false;
+    // should this fail, the journal does not match the new snapshot, and is ignored
+    return reset(iv, snapshot_size);
+  }
+
+  void journal::finish_compaction(const crypto::chacha_key &key, bool wait)
+  {
+    if (!m_compacting)
+      return;
+    {
+      boost::unique_lock<boost::mutex> lock(m_compaction_mutex);
+      if (!m_compaction_done && !wait)
+        return;
+    }
+    m_compaction_thread.join();
+    m_compacting = false;
+    if (!m_compaction_succeeded)
+    {
+      // the journal still applies on top of the old snapshot
+      MERROR("Failed to compact " << m_filename);
+      return;
+    }
+
+    m_snapshot = m_compaction_snapshot;
+    m_snapshot_size = m_compaction_snapshot_size;
+    std::vector<frame> frames;
+    if (!read(key, frames))
+      MERROR("Failed to shorten " << m_filename << " after compaction");
+  }
+}
+}
@@ -0,0 +1,474 @@
+// Copyright (c) 2014-2022, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "crypto/chacha.h"
+#include "crypto/hash.h"
+#include "serialization/binary_archive.h"
+#include "serialization/containers.h"
+#include "serialization/crypto.h"
+#include "serialization/pair.h"
+#include "serialization/string.h"
+#include "serialization/binary_utils.h"
+
+namespace tools
+{
+  // The wallet cache file is a full snapshot, rewritten from scratch. Between
+  // snapshots, stores append the changes since the previous store to a journal
+  // next to it, as encrypted frames. The wallet records which elements of its
+  // large containers it changes as it changes them, so a store only serializes
+  // those. The journal is folded back into a new snapshot, in the background,
+  // once it has grown large compared to the snapshot.
+  namespace cache_journal
+  {
+    // elements of a vector, by index
+    struct sequence_changes
+    {
+      uint64_t size;
+      std::vector<std::pair<uint64_t, std::string>> elements;
+
+      BEGIN_SERIALIZE_OBJECT()
+        VARINT_FIELD(size)
+        FIELD(elements)
+      END_SERIALIZE()
+    };
+
+    // entries of a map or multimap: the container is emptied if all is set,
+    // then the entries with the given keys, and single entries by fingerprint,
+    // are erased, then the added entries are added
+    struct set_changes
+    {
+      bool all;
+      std::vector<std::string> keys;
+      std::vector<uint64_t> erased;
+      std::vector<std::string> added;
+
+      set_changes(): all(false) {}
+
+      BEGIN_SERIALIZE_OBJECT()
+        FIELD(all)
+        FIELD(keys)
+        FIELD(erased)
+        FIELD(added)
+      END_SERIALIZE()
+    };
+
+    // the wallet's hashchain, which only changes at its ends
+    struct hashchain_changes
+    {
+      std::string full;
+      uint64_t offset;
+      uint64_t keep;
+      std::vector<crypto::hash> tail;
+
+      BEGIN_SERIALIZE_OBJECT()
+        FIELD(full)
+        VARINT_FIELD(offset)
+        VARINT_FIELD(keep)
+        FIELD(tail)
+      END_SERIALIZE()
+    };
+
+    struct frame
+    {
+      enum type_t: uint8_t { type_changes = 0, type_compaction = 1 };
+
+      uint8_t type;
+      crypto::chacha_iv base;     // iv of the snapshot the journal file starts from
+      crypto::chacha_iv snapshot; // compaction: iv of the snapshot being written
+      std::string rest;           // everything not journaled per element, if changed
+      bool has_blockchain;
+      hashchain_changes blockchain;
+      std::vector<sequence_changes> sequences;
+      std::vector<set_changes> sets;
+
+      frame(): type(type_changes), has_blockchain(false) {}
+
+      BEGIN_SERIALIZE_OBJECT()
+        VERSION_FIELD(0)
+        FIELD(type)
+        FIELD(base)
+        FIELD(snapshot)
+        FIELD(rest)
+        FIELD(has_blockchain)
+        if (has_blockchain)
+          FIELD(blockchain)
+        FIELD(sequences)
+        FIELD(sets)
+      END_SERIALIZE()
+    };
+
+    uint64_t fingerprint(const std::string &blob);
+
+    template<typename T>
+    bool dump_element(T &e, std::string &blob)
+    {
+      std::ostringstream oss;
+      binary_archive<true> ar(oss);
+      if (!::serialization::detail::serialize_container_element(ar, e) || !oss.good())
+        return false;
+      blob = oss.str();
+      return true;
+    }
+
+    template<typename T>
+    bool parse_element(const std::string &blob, T &e)
+    {
+      binary_archive<false> ar{epee::strspan<std::uint8_t>(blob)};
+      return ::serialization::detail::serialize_container_element(ar, e) && ::serialization::check_stream_state(ar);
+    }
+
+    // Changed elements are given by index. Elements past the size as of the
+    // previous store are always new, and so are all elements from the first
+    // one which was removed or replaced wholesale.
+    class sequence_section
+    {
+    public:
+      sequence_section(): m_size(0), m_from(0) {}
+
+      void reset(size_t size) { m_size = m_from = size; m_changed.clear(); }
+      void touch(size_t i) { if (i < m_from) m_changed.insert(i); }
+      void touch_from(size_t i) { m_from = std::min(m_from, i); }
+
+      template<typename C> bool diff(C &c, sequence_changes &changes) const
+      {
+        std::string blob;
+        const size_t from = std::min<size_t>(m_from, c.size());
+        changes.size = c.size();
+        changes.elements.clear();
+        for (auto i = m_changed.begin(); i != m_changed.end() && *i < from; ++i)
+        {
+          if (!dump_element(c[*i], blob))
+            return false;
+          changes.elements.push_back(std::make_pair(*i, std::move(blob)));
+        }
+        for (size_t i = from; i < c.size(); ++i)
+        {
+          if (!dump_element(c[i], blob))
+            return false;
+          changes.elements.push_back(std::make_pair(i, std::move(blob)));
+        }
+        return true;
+      }
+
+      template<typename C> static bool apply(C &c, const sequence_changes &changes)
+      {
+        c.resize(changes.size);
+        for (const auto &e: changes.elements)
+          if (e.first >= c.size() || !parse_element(e.second, c[e.first]))
+            return false;
+        return true;
+      }
+
+      bool empty(const sequence_changes &changes) const { return changes.elements.empty() && changes.size == m_size; }
+
+    private:
+      size_t m_size;
+      size_t m_from;
+      std::set<size_t> m_changed;
+    };
+
+    // Changed entries of a map are given by key, and taken as they are at
+    // the next store. Entries of a multimap, where a key may not single one
+    // out, are given as they are added and erased instead. A container may
+    // also be changed wholesale. Should an element fail to serialize, which
+    // it does not, the whole container is journaled.
+    class set_section
+    {
+    public:
+      set_section(): m_all(false) {}
+
+      void reset() { m_all = false; m_keys.clear(); m_added.clear(); m_erased.clear(); }
+      void touch_all() { reset(); m_all = true; }
+
+      template<typename K> void touch(const K &k)
+      {
+        if (m_all)
+          return;
+        K key = k;
+        std::string blob;
+        if (!dump_element(key, blob))
+          return touch_all();
+        m_keys.insert(std::move(blob));
+      }
+
+      template<typename E> void add(E &e)
+      {
+        std::string blob;
+        if (m_all)
+          return;
+        if (!dump_element(e, blob))
+          return touch_all();
+        const uint64_t fp = fingerprint(blob);
+        m_added.emplace(fp, std::move(blob));
+      }
+
+      template<typename E> void erase(E &e)
+      {
+        std::string blob;
+        if (m_all)
+          return;
+        if (!dump_element(e, blob))
+          return touch_all();
+        const uint64_t fp = fingerprint(blob);
+        const auto i = m_added.find(fp);
+        if (i != m_added.end())
+          m_added.erase(i);
+        else
+          m_erased.push_back(fp);
+      }
+
+      template<typename C> bool diff(C &c, set_changes &changes) const
+      {
+        std::string blob;
+        changes.all = m_all;
+        changes.keys.assign(m_keys.begin(), m_keys.end());
+        changes.erased = m_erased;
+        changes.added.clear();
+        if (m_all)
+        {
+          for (auto &e: c)
+          {
+            if (!dump_element((typename C::value_type&)e, blob))
+              return false;
+            changes.added.push_back(std::move(blob));
+          }
+          return true;
+        }
+        for (const std::string &k: m_keys)
+        {
+          typename C::key_type key;
+          if (!parse_element(k, key))
+            return false;
+          const auto range = c.equal_range(key);
+          for (auto i = range.first; i != range.second; ++i)
+          {
+            if (!dump_element((typename C::value_type&)*i, blob))
+              return false;
+            changes.added.push_back(std::move(blob));
+          }
+        }
+        for (const auto &e: m_added)
+          changes.added.push_back(e.second);
+        return true;
+      }
+
+      template<typename C> static bool apply(C &c, const set_changes &changes)
+      {
+        if (changes.all)
+          c.clear();
+        for (const std::string &k: changes.keys)
+        {
+          typename C::key_type key;
+          if (!parse_element(k, key))
+            return false;
+          c.erase(key);
+        }
+        if (!changes.erased.empty())
+        {
+          std::unordered_map<uint64_t, std::vector<typename C::iterator>> index;
+          std::string blob;
+          for (auto i = c.begin(); i != c.end(); ++i)
+          {
+            if (!dump_element((typename C::value_type&)*i, blob))
+              return false;
+            index[fingerprint(blob)].push_back(i);
+          }
+          for (uint64_t fp: changes.erased)
+          {
+            auto i = index.find(fp);
+            if (i == index.end() || i->second.empty())
+              return false;
+            c.erase(i->second.back());
+            i->second.pop_back();
+          }
+        }
+        for (const std::string &blob: changes.added)
+        {
+          typename C::value_type e;
+          if (!parse_element(blob, e))
+            return false;
+          ::serialization::detail::do_add(c, std::move(e));
+        }
+        return true;
+      }
+
+      bool empty() const { return !m_all && m_keys.empty() && m_added.empty() && m_erased.empty(); }
+
+    private:
+      bool m_all;
+      std::set<std::string> m_keys;
+      std::unordered_multimap<uint64_t, std::string> m_added;
+      std::vector<uint64_t> m_erased;
+    };
+
+    // Blocks are added and popped at the top, and the bottom is trimmed. Only
+    // the top of the chain is remembered, so a reorg deeper than that, or a
+    // refill of the bottom, journals the whole chain.
+    class hashchain_section
+    {
+    public:
+      static constexpr size_t TAIL_SIZE = 1024;
+
+      template<typename H> void reset(const H &h)
+      {
+        m_offset = h.offset();
+        m_size = h.size();
+        m_tail.clear();
+        for (size_t i = std::max(h.offset(), h.size() - std::min(h.size(), TAIL_SIZE)); i < h.size(); ++i)
+          m_tail.push_back(h[i]);
+      }
+
+      template<typename H> bool diff(H &h, hashchain_changes &changes)
+      {
+        changes.full.clear();
+        changes.tail.clear();
+        changes.offset = h.offset();
+        const size_t start = m_size - m_tail.size();
+        size_t keep = std::min(h.size(), m_size);
+        bool found = false;
+        while (keep > start && !found)
+        {
+          if (h.is_in_bounds(keep - 1) && h[keep - 1] == m_tail[keep - 1 - start])
+            found = true;
+          else
+            --keep;
+        }
+        if (h.offset() < m_offset || (!found && start > m_offset) || keep < h.offset())
+        {
+          if (!::serialization::dump_binary(h, changes.full))
+            return false;
+          changes.keep = 0;
+        }
+        else
+        {
+          changes.keep = keep;
+          for (size_t i = keep; i < h.size(); ++i)
+            changes.tail.push_back(h[i]);
+        }
+        return true;
+      }
+
+      template<typename H> static bool apply(H &h, const hashchain_changes &changes)
+      {
+        if (!changes.full.empty())
+          return ::serialization::parse_binary(changes.full, h);
+        if (changes.keep < h.offset() || changes.keep > h.size())
+          return false;
+        h.crop(changes.keep);
+        for (const crypto::hash &hash: changes.tail)
+          h.push_back(hash);
+        if (changes.offset > h.offset())
+          h.trim(changes.offset);
+        return h.offset() == changes.offset;
+      }
+
+      bool empty(const hashchain_changes &changes) const
+      {
+        return changes.full.empty() && changes.tail.empty() && changes.keep == m_size && changes.offset == m_offset;
+      }
+
+    private:
+      size_t m_offset;
+      size_t m_size;
+      std::deque<crypto::hash> m_tail;
+    };
+
+    class journal
+    {
+    public:
+      journal();
+      ~journal();
+
+      // points the journal at the file next to the given wallet cache,
+      // whose snapshot was written with the given iv
+      void open(const std::string &wallet_file, const crypto::chacha_iv &snapshot, uint64_t snapshot_size);
+      void close();
+      bool is_open() const { return !m_filename.empty(); }
+
+      // reads the frames which apply on top of the snapshot; a damaged or
+      // partly written tail, as left by a crash during a store, is ignored
+      bool read(const crypto::chacha_key &key, std::vector<frame> &frames);
+      bool append(frame &f, const crypto::chacha_key &key);
+      // replaces the journal with the given frames, on top of the snapshot
+      bool rewrite(std::vector<frame> &frames, const crypto::chacha_key &key);
+      // after a snapshot was written in the foreground, the journal is empty
+      bool reset(const crypto::chacha_iv &snapshot, uint64_t snapshot_size);
+
+      // makes the contents of a new snapshot from those of the current one
+      // and the frames which apply on top of it
+      typedef std::function<bool(const std::string &snapshot, std::vector<frame> &frames, std::string &cache_data)> fold_t;
+
+      bool wants_compaction(unsigned ratio) const;
+      // folds the journal into a new snapshot in the background; frames
+      // appended meanwhile apply on top of both the old and the new snapshot
+      bool start_compaction(const crypto::chacha_key &key, fold_t fold);
+      // once the background snapshot is written, drops the frames it contains
+      void finish_compaction(const crypto::chacha_key &key, bool wait);
+      // folds the whole journal into a new snapshot, and removes it
+      bool compact(const crypto::chacha_key &key, fold_t fold);
+
+      uint64_t size() const { return m_size; }
+      const crypto::chacha_iv &snapshot() const { return m_snapshot; }
+
+    private:
+      bool parse(const std::string &data, const crypto::chacha_key &key, std::vector<frame> &frames, uint64_t &valid_size) const;
+      static bool encrypt(frame &f, const crypto::chacha_key &key, std::string &data);
+      bool fold_snapshot(uint64_t journal_size, const crypto::chacha_key &key, const fold_t &fold, const crypto::chacha_iv &iv, uint64_t &snapshot_size) const;
+      static bool write_snapshot(const std::string &filename, const std::string &cache_data, const crypto::chacha_key &key, const crypto::chacha_iv &iv);
+
+      std::string m_wallet_file;
+      std::string m_filename;
+      crypto::chacha_iv m_base;
+      crypto::chacha_iv m_snapshot;
+      uint64_t m_snapshot_size;
+      uint64_t m_size;
+      uint64_t m_valid_size;
+
+      boost::thread m_compaction_thread;
+      boost::mutex m_compaction_mutex;
+      bool m_compacting;
+      bool m_compaction_done;
+      bool m_compaction_succeeded;
+      crypto::chacha_iv m_compaction_snapshot;
+      uint64_t m_compaction_snapshot_size;
+    };
+  }
+}
@@ -42,6 +42,8 @@
 #include <boost/asio/ip/address.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/preprocessor/stringize.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
 #include <openssl/evp.h>
 #include "include_base_utils.h"
 using namespace epee;
@@ -140,6 +142,11 @@ using namespace cryptonote;
 
 #define FIRST_REFRESH_GRANULARITY     1024
 
+#define REFRESH_PREFETCH_MIN_DEPTH 2 // the batch being processed and the next one
+#define REFRESH_PREFETCH_MAX_DEPTH 8
+#define REFRESH_PREFETCH_INITIAL_BLOCK_COUNT 100
+#define REFRESH_PREFETCH_STALL_THRESHOLD_US 10000 // shorter stalls are noise
+
 #define GAMMA_SHAPE 19.28
 #define GAMMA_SCALE (1/1.61)
 
@@ -153,6 +160,9 @@ using namespace cryptonote;
 #define DEFAULT_UNLOCK_TIME (CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE * DIFFICULTY_TARGET_V2)
 #define RECENT_SPEND_WINDOW (15 * DIFFICULTY_TARGET_V2)
 
+#define CACHE_JOURNAL_MIN_SNAPSHOT_SIZE (1024 * 1024) // smaller caches are rewritten on every store
+#define CACHE_JOURNAL_COMPACTION_RATIO 4 // compact once the journal is a quarter of the snapshot
+
 static const std::string MULTISIG_SIGNATURE_MAGIC = "SigMultisigPkV1";
 
 static const std::string ASCII_OUTPUT_MAGIC = "WowneroAsciiDataV1";
@@ -279,6 +289,7 @@ struct options {
   const command_line::arg_descriptor<bool> offline = {"offline", tools::wallet2::tr("Do not connect to a daemon, nor use DNS"), false};
   const command_line::arg_descriptor<std::string> extra_entropy = {"extra-entropy", tools::wallet2::tr("File containing extra entropy to initialize the PRNG (any data, aim for 256 bits of entropy to be useful, which typically means more than 256 bits of data)")};
   const command_line::arg_descriptor<bool> allow_mismatched_daemon_version = {"allow-mismatched-daemon-version", tools::wallet2::tr("Allow communicating with a daemon that uses a different version"), false};
+  const command_line::arg_descriptor<bool> check_balance_cache = {"check-balance-cache", tools::wallet2::tr("Check the running balances against a full scan of the wallet's outputs on every query (debug)"), false};
 };
 
 void do_prepare_file_names(const std::string& file_path, std::string& keys_file, std::string& wallet_file, std::string &mms_file)
@@ -491,6 +502,9 @@ std::unique_ptr<tools::wallet2> make_basic(const boost::program_options::variabl
   if (command_line::has_arg(vm, opts.allow_mismatched_daemon_version))
     wallet->allow_mismatched_daemon_version(true);
 
+  if (command_line::has_arg(vm, opts.check_balance_cache))
+    wallet->check_balance_cache(true);
+
   try
   {
     if (!command_line::is_arg_defaulted(vm, opts.tx_notify))
@@ -1275,7 +1289,11 @@ wallet2::wallet2(network_type nettype, uint64_t kdf_rounds, bool unattended, std
   m_enable_multisig(false),
   m_pool_info_query_time(0),
   m_has_ever_refreshed_from_node(false),
-  m_allow_mismatched_daemon_version(false)
+  m_allow_mismatched_daemon_version(false),
+  m_cache_journal_ready(false),
+  m_cache_journal_min_snapshot_size(CACHE_JOURNAL_MIN_SNAPSHOT_SIZE),
+  m_cache_journal_rest(0),
+  m_check_balance_cache(false)
 {
   set_rpc_client_secret_key(rct::rct2sk(rct::skGen()));
 }
@@ -1341,6 +1359,7 @@ void wallet2::init_options(boost::program_options::options_description& desc_par
   command_line::add_arg(desc_params, opts.offline);
   command_line::add_arg(desc_params, opts.extra_entropy);
   command_line::add_arg(desc_params, opts.allow_mismatched_daemon_version);
+  command_line::add_arg(desc_params, opts.check_balance_cache);
 }
 
 std::pair<std::unique_ptr<wallet2>, tools::password_container> wallet2::make_from_json(const boost::program_options::variables_map& vm, bool unattended, const std::string& json_file, const std::function<boost::optional<tools::password_container>(const char *, bool)> &password_prompter)
@@ -1673,6 +1692,7 @@ void wallet2::expand_subaddresses(const cryptonote::subaddress_index& index)
     {
       const crypto::public_key &D = pkeys.at(minor - minor_begin);
       m_subaddresses[D] = {major, minor};
+      journal_key(m_subaddresses, D);
     }
   }
 }
@@ -1681,6 +1701,7 @@ void wallet2::create_one_off_subaddress(const cryptonote::subaddress_index& inde
 {
   const crypto::public_key pkey = get_subaddress_spend_public_key(index);
   m_subaddresses[pkey] = index;
+  journal_key(m_subaddresses, pkey);
 }
 //----------------------------------------------------------------------------------------------------
 std::string wallet2::get_subaddress_label(const cryptonote::subaddress_index& index) const
@@ -1865,6 +1886,7 @@ void wallet2::process_scan_txs(const tx_entry_data &txs_to_scan, const tx_entry_
         dbd.detached_confirmed_txs_dests.find(tx_info.tx_hash) != dbd.detached_confirmed_txs_dests.end())
     {
       m_confirmed_txs[tx_info.tx_hash].m_dests = std::move(dbd.detached_confirmed_txs_dests[tx_info.tx_hash]);
+      journal_key(m_confirmed_txs, tx_info.tx_hash);
     }
   }
 
@@ -2023,6 +2045,8 @@ void wallet2::set_spent(size_t idx, uint64_t height)
   LOG_PRINT_L2("Setting SPENT at " << height << ": ki " << td.m_key_image << ", amount " << print_money(td.m_amount));
   td.m_spent = true;
   td.m_spent_height = height;
+  journal_transfer(idx);
+  update_balance(idx);
 }
 //----------------------------------------------------------------------------------------------------
 void wallet2::set_unspent(size_t idx)
@@ -2032,6 +2056,8 @@ void wallet2::set_unspent(size_t idx)
   LOG_PRINT_L2("Setting UNSPENT: ki " << td.m_key_image << ", amount " << print_money(td.m_amount));
   td.m_spent = false;
   td.m_spent_height = 0;
+  journal_transfer(idx);
+  update_balance(idx);
 }
 //----------------------------------------------------------------------------------------------------
 bool wallet2::is_spent(const transfer_details &td, bool strict) const
@@ -2058,6 +2084,8 @@ void wallet2::freeze(size_t idx)
   CHECK_AND_ASSERT_THROW_MES(idx < m_transfers.size(), "Invalid transfer_details index");
   transfer_details &td = m_transfers[idx];
   td.m_frozen = true;
+  journal_transfer(idx);
+  update_balance(idx);
 }
 //----------------------------------------------------------------------------------------------------
 void wallet2::thaw(size_t idx)
@@ -2065,6 +2093,8 @@ void wallet2::thaw(size_t idx)
   CHECK_AND_ASSERT_THROW_MES(idx < m_transfers.size(), "Invalid transfer_details index");
   transfer_details &td = m_transfers[idx];
   td.m_frozen = false;
+  journal_transfer(idx);
+  update_balance(idx);
 }
 //----------------------------------------------------------------------------------------------------
 bool wallet2::frozen(size_t idx) const
@@ -2277,6 +2307,11 @@ void wallet2::scan_output(const cryptonote::transaction &tx, bool miner_tx, cons
 }
 //----------------------------------------------------------------------------------------------------
 void wallet2::cache_tx_data(const cryptonote::transaction& tx, const crypto::hash &txid, tx_cache_data &tx_cache_data) const
+{
+  cache_tx_data(tx, txid, tx_cache_data, m_refresh_type);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::cache_tx_data(const cryptonote::transaction& tx, const crypto::hash &txid, tx_cache_data &tx_cache_data, RefreshType refresh_type)
 {
   if(!parse_tx_extra(tx.extra, tx_cache_data.tx_extra_fields))
   {
@@ -2288,9 +2323,9 @@ void wallet2::cache_tx_data(const cryptonote::transaction& tx, const crypto::has
 
   // Don't try to extract tx public key if tx has no ouputs
   const bool is_miner = tx.vin.size() == 1 && tx.vin[0].type() == typeid(cryptonote::txin_gen);
-  if (!is_miner || m_refresh_type != RefreshType::RefreshNoCoinbase)
+  if (!is_miner || refresh_type != RefreshType::RefreshNoCoinbase)
   {
-    const size_t rec_size = (is_miner && m_refresh_type == RefreshType::RefreshOptimizeCoinbase && tx.version < 2) ? 1 : tx.vout.size();
+    const size_t rec_size = (is_miner && refresh_type == RefreshType::RefreshOptimizeCoinbase && tx.version < 2) ? 1 : tx.vout.size();
     if (!tx.vout.empty())
     {
       // if tx.vout is not empty, we loop through all tx pubkeys
@@ -2585,8 +2620,12 @@ void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote
             td.m_frozen = false;
 	    set_unspent(m_transfers.size()-1);
             if (td.m_key_image_known)
+            {
 	      m_key_images[td.m_key_image] = m_transfers.size()-1;
+	      journal_key(m_key_images, td.m_key_image);
+            }
 	    m_pub_keys[tx_scan_info[o].in_ephemeral.pub] = m_transfers.size()-1;
+	    journal_key(m_pub_keys, tx_scan_info[o].in_ephemeral.pub);
             if (output_tracker_cache)
               (*output_tracker_cache)[std::make_pair(tx.vout[o].amount, td.m_global_output_index)] = m_transfers.size() - 1;
             if (m_multisig)
@@ -2673,6 +2712,8 @@ void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote
             }
             THROW_WALLET_EXCEPTION_IF(td.get_public_key() != tx_scan_info[o].in_ephemeral.pub, error::wallet_internal_error, "Inconsistent public keys");
 	    THROW_WALLET_EXCEPTION_IF(td.m_spent, error::wallet_internal_error, "Inconsistent spent status");
+            journal_transfer(kit->second);
+            update_balance(kit->second);
 
 	    LOG_PRINT_L0("Received money: " << print_money(td.amount()) << ", with tx: " << txid);
 	    if (!ignore_callbacks && 0 != m_callback)
@@ -2714,6 +2755,8 @@ void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote
           //   2) the wallet set the highest amount among them to transfer_details::m_amount, and
           //   3) the wallet somehow spent that output with an amount smaller than the above amount, causing inconsistency
           td.m_amount = amount;
+          journal_transfer(it->second);
+          update_balance(it->second);
         }
       }
       else
@@ -2765,7 +2808,10 @@ void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote
             THROW_WALLET_EXCEPTION_IF(idx >= m_transfers.size(), error::wallet_internal_error, "Output tracker cache index out of range");
 
             if (m_track_uses)
+            {
               m_transfers[idx].m_uses.push_back(std::make_pair(height, txid));
+              journal_transfer(idx);
+            }
 
             // We'll re-process all txs which *might* be spends when we disable
             // background sync and retrieve the spend key. We don't know if an
@@ -2795,7 +2841,10 @@ void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote
           if (offset == td.m_global_output_index)
           {
             if (m_track_uses)
+            {
               td.m_uses.push_back(std::make_pair(height, txid));
+              journal_transfer(&td - m_transfers.data());
+            }
             if (m_background_syncing && !td.m_key_image_known && m_background_sync_data.txs.find(txid) == m_background_sync_data.txs.end())
             {
               size_t bgs_idx = m_background_sync_data.txs.size();
@@ -2834,6 +2883,7 @@ void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote
         THROW_WALLET_EXCEPTION_IF(i == m_confirmed_txs.end(), error::wallet_internal_error,
           "confirmed tx wasn't found: " + string_tools::pod_to_hex(txid));
         i->second.m_change = self_received;
+        journal_key(m_confirmed_txs, txid);
       }
     }
     else if (!m_unconfirmed_txs.count(txid))
@@ -2945,7 +2995,7 @@ void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote
           m_callback->on_unconfirmed_money_received(height, txid, tx, payment.m_amount, payment.m_subaddr_index);
       }
       else
-        m_payments.emplace(payment_id, payment);
+        journal_added(m_payments, *m_payments.emplace(payment_id, payment));
       LOG_PRINT_L2("Payment found in " << (pool ? "pool" : "block") << ": " << payment_id << " / " << payment.m_tx_hash << " / " << payment.m_amount);
     }
 
@@ -2972,6 +3022,7 @@ void wallet2::process_unconfirmed(const crypto::hash &txid, const cryptonote::tr
     if (store_tx_info()) {
       try {
         m_confirmed_txs.insert(std::make_pair(txid, confirmed_transfer_details(unconf_it->second, height)));
+        journal_key(m_confirmed_txs, txid);
       }
       catch (...) {
         // can fail if the tx has unexpected input types
@@ -3018,6 +3069,7 @@ void wallet2::process_outgoing(const crypto::hash &txid, const cryptonote::trans
   entry.first->second.m_block_height = height;
   entry.first->second.m_timestamp = ts;
   entry.first->second.m_unlock_time = tx.unlock_time;
+  journal_key(m_confirmed_txs, txid);
 
   add_rings(tx);
 }
@@ -3101,9 +3153,47 @@ void wallet2::get_short_chain_history(std::list<crypto::hash>& ids, uint64_t gra
     ids.push_back(m_blockchain.genesis());
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::parse_block_round(const cryptonote::blobdata &blob, cryptonote::block &bl, crypto::hash &bl_id, bool &error) const
+void wallet2::parse_blocks(const std::vector<cryptonote::block_complete_entry> &blocks, std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> &o_indices, std::vector<parsed_block> &parsed_blocks, bool &error)
 {
-  error = !cryptonote::parse_and_validate_block_from_blob(blob, bl, bl_id);
+  THROW_WALLET_EXCEPTION_IF(blocks.size() != o_indices.size(), error::wallet_internal_error, "Mismatched sizes of blocks and o_indices");
+
+  tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
+  tools::threadpool::waiter waiter(tpool);
+  error = false;
+  parsed_blocks.resize(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i)
+  {
+    tpool.submit(&waiter, [&, i](){
+      parsed_blocks[i].error = !cryptonote::parse_and_validate_block_from_blob(blocks[i].block, parsed_blocks[i].block, parsed_blocks[i].hash);
+    }, true);
+  }
+  THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+  for (size_t i = 0; i < blocks.size(); ++i)
+  {
+    if (parsed_blocks[i].error)
+    {
+      error = true;
+      break;
+    }
+    parsed_blocks[i].o_indices = std::move(o_indices[i]);
+  }
+
+  boost::mutex error_lock;
+  for (size_t i = 0; i < blocks.size(); ++i)
+  {
+    parsed_blocks[i].txes.resize(blocks[i].txs.size());
+    for (size_t j = 0; j < blocks[i].txs.size(); ++j)
+    {
+      tpool.submit(&waiter, [&, i, j](){
+        if (!parse_and_validate_tx_base_from_blob(blocks[i].txs[j].blob, parsed_blocks[i].txes[j]))
+        {
+          boost::unique_lock<boost::mutex> lock(error_lock);
+          error = true;
+        }
+      }, true);
+    }
+  }
+  THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
 }
 //----------------------------------------------------------------------------------------------------
 void read_pool_txs(const cryptonote::COMMAND_RPC_GET_TRANSACTIONS::request &req, const cryptonote::COMMAND_RPC_GET_TRANSACTIONS::response &res, bool r, const std::vector<crypto::hash> &txids, std::vector<std::tuple<cryptonote::transaction, crypto::hash, bool>> &txs)
@@ -3182,7 +3272,7 @@ void wallet2::process_pool_info_extent(const cryptonote::COMMAND_RPC_GET_BLOCKS_
   update_pool_state_from_pool_data(res.pool_info_extent == COMMAND_RPC_GET_BLOCKS_FAST::INCREMENTAL, res.removed_pool_txids, added_pool_txs, process_txs, refreshed);
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::pull_blocks(bool first, bool try_incremental, uint64_t start_height, uint64_t &blocks_start_height, const std::list<crypto::hash> &short_chain_history, std::vector<cryptonote::block_complete_entry> &blocks, std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> &o_indices, uint64_t &current_height)
+void wallet2::pull_blocks(bool first, bool try_incremental, uint64_t start_height, uint64_t &blocks_start_height, const std::list<crypto::hash> &short_chain_history, std::vector<cryptonote::block_complete_entry> &blocks, std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> &o_indices, uint64_t &current_height, uint64_t max_block_count)
 {
   cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::request req = AUTO_VAL_INIT(req);
   cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::response res = AUTO_VAL_INIT(res);
@@ -3193,6 +3283,7 @@ void wallet2::pull_blocks(bool first, bool try_incremental, uint64_t start_heigh
   req.prune = true;
   req.start_height = start_height;
   req.no_miner_tx = m_refresh_type == RefreshNoCoinbase;
+  req.max_block_count = max_block_count;
 
   req.requested_info = (first && !m_background_syncing) ? COMMAND_RPC_GET_BLOCKS_FAST::BLOCKS_AND_POOL : COMMAND_RPC_GET_BLOCKS_FAST::BLOCKS_ONLY;
   if (try_incremental && !m_background_syncing)
@@ -3262,11 +3353,10 @@ void wallet2::pull_hashes(uint64_t start_height, uint64_t &blocks_start_height,
 //----------------------------------------------------------------------------------------------------
 void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cryptonote::block_complete_entry> &blocks, const std::vector<parsed_block> &parsed_blocks, uint64_t& blocks_added, std::map<std::pair<uint64_t, uint64_t>, size_t> *output_tracker_cache)
 {
-  size_t current_index = start_height;
   blocks_added = 0;
 
   THROW_WALLET_EXCEPTION_IF(blocks.size() != parsed_blocks.size(), error::wallet_internal_error, "size mismatch");
-  THROW_WALLET_EXCEPTION_IF(!m_blockchain.is_in_bounds(current_index), error::out_of_hashchain_bounds_error);
+  THROW_WALLET_EXCEPTION_IF(!m_blockchain.is_in_bounds(start_height), error::out_of_hashchain_bounds_error);
 
   tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
   tools::threadpool::waiter waiter(tpool);
@@ -3298,6 +3388,21 @@ void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cry
   THROW_WALLET_EXCEPTION_IF(txidx != num_txes, error::wallet_internal_error, "txidx does not match tx_cache_data size");
   THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
 
+  process_cached_blocks(start_height, blocks, parsed_blocks, 0, tx_cache_data, blocks_added, output_tracker_cache);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::process_cached_blocks(uint64_t start_height, const std::vector<cryptonote::block_complete_entry> &blocks, const std::vector<parsed_block> &parsed_blocks, size_t first, std::vector<tx_cache_data> &tx_cache_data, uint64_t& blocks_added, std::map<std::pair<uint64_t, uint64_t>, size_t> *output_tracker_cache)
+{
+  // tx_cache_data starts with the miner tx of blocks[first]
+  size_t current_index = start_height + first;
+  blocks_added = 0;
+
+  THROW_WALLET_EXCEPTION_IF(blocks.size() != parsed_blocks.size(), error::wallet_internal_error, "size mismatch");
+  THROW_WALLET_EXCEPTION_IF(!m_blockchain.is_in_bounds(current_index), error::out_of_hashchain_bounds_error);
+
+  tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
+  tools::threadpool::waiter waiter(tpool);
+
   hw::device &hwdev =  m_account.get_device();
   hw::reset_mode rst(hwdev);
   hwdev.set_mode(hw::device::TRANSACTION_PARSE);
@@ -3354,11 +3459,11 @@ void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cry
     size_t txidx;
   };
   std::vector<geniod_params> geniods;
-  geniods.reserve(num_txes);
+  geniods.reserve(tx_cache_data.size());
 
-  txidx = 0;
+  size_t txidx = 0;
   uint8_t hf_version_view_tags = get_view_tag_fork();
-  for (size_t i = 0; i < blocks.size(); ++i)
+  for (size_t i = first; i < blocks.size(); ++i)
   {
     if (should_skip_block(parsed_blocks[i].block, start_height + i))
     {
@@ -3419,7 +3524,7 @@ void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cry
   hwdev.set_mode(hw::device::NONE);
 
   size_t tx_cache_data_offset = 0;
-  for (size_t i = 0; i < blocks.size(); ++i)
+  for (size_t i = first; i < blocks.size(); ++i)
   {
     const crypto::hash &bl_id = parsed_blocks[i].hash;
     const cryptonote::block &bl = parsed_blocks[i].block;
@@ -3432,9 +3537,9 @@ void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cry
     else if(bl_id != m_blockchain[current_index])
     {
       //split detected here !!!
-      THROW_WALLET_EXCEPTION_IF(current_index == start_height, error::wallet_internal_error,
+      THROW_WALLET_EXCEPTION_IF(current_index == start_height + first, error::wallet_internal_error,
         "wrong daemon response: split starts from the first block in response " + string_tools::pod_to_hex(bl_id) +
-        " (height " + std::to_string(start_height) + "), local block id at this height: " +
+        " (height " + std::to_string(start_height + first) + "), local block id at this height: " +
         string_tools::pod_to_hex(m_blockchain[current_index]));
 
       const uint64_t reorg_depth = m_blockchain.size() - current_index;
@@ -3454,6 +3559,82 @@ void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cry
   }
 }
 //----------------------------------------------------------------------------------------------------
+void wallet2::cache_blocks_tx_data(const std::vector<parsed_block> &parsed_blocks, RefreshType refresh_type, std::vector<tx_cache_data> &tx_cache_data)
+{
+  tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
+  tools::threadpool::waiter waiter(tpool);
+
+  size_t num_txes = 0;
+  for (const parsed_block &pb: parsed_blocks)
+    num_txes += 1 + pb.txes.size();
+  tx_cache_data.clear();
+  tx_cache_data.resize(num_txes);
+  size_t txidx = 0;
+  for (size_t i = 0; i < parsed_blocks.size(); ++i)
+  {
+    THROW_WALLET_EXCEPTION_IF(parsed_blocks[i].txes.size() != parsed_blocks[i].block.tx_hashes.size(),
+        error::wallet_internal_error, "Mismatched parsed_blocks[i].txes.size() and parsed_blocks[i].block.tx_hashes.size()");
+    if (refresh_type != RefreshNoCoinbase)
+      tpool.submit(&waiter, [&, i, txidx](){ cache_tx_data(parsed_blocks[i].block.miner_tx, get_transaction_hash(parsed_blocks[i].block.miner_tx), tx_cache_data[txidx], refresh_type); });
+    ++txidx;
+    for (size_t idx = 0; idx < parsed_blocks[i].txes.size(); ++idx)
+    {
+      tpool.submit(&waiter, [&, i, idx, txidx](){ cache_tx_data(parsed_blocks[i].txes[idx], parsed_blocks[i].block.tx_hashes[idx], tx_cache_data[txidx], refresh_type); });
+      ++txidx;
+    }
+  }
+  THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::process_shared_blocks(uint64_t start_height, const std::vector<cryptonote::block_complete_entry> &blocks, const std::vector<parsed_block> &parsed_blocks, const std::vector<tx_cache_data> &tx_cache_data, uint64_t &blocks_added)
+{
+  blocks_added = 0;
+  THROW_WALLET_EXCEPTION_IF(blocks.size() != parsed_blocks.size(), error::wallet_internal_error, "size mismatch");
+
+  // start from our top block, so a reorg below it is caught as a split on
+  // the first block, and leave it to a normal refresh
+  const uint64_t height = m_blockchain.size();
+  if (height == 0 || height - 1 < start_height || height >= start_height + blocks.size())
+    return false;
+  const size_t first = height - 1 - start_height;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < first; ++i)
+    offset += 1 + parsed_blocks[i].txes.size();
+  THROW_WALLET_EXCEPTION_IF(offset > tx_cache_data.size(), error::wallet_internal_error, "tx_cache_data too small");
+
+  // derivations are per wallet, so work on a copy
+  std::vector<wallet2::tx_cache_data> own_tx_cache_data(tx_cache_data.begin() + offset, tx_cache_data.end());
+  size_t txidx = 0;
+  for (size_t i = first; i < blocks.size(); ++i)
+  {
+    const size_t n = 1 + parsed_blocks[i].txes.size();
+    THROW_WALLET_EXCEPTION_IF(txidx + n > own_tx_cache_data.size(), error::wallet_internal_error, "tx_cache_data too small");
+    if (should_skip_block(parsed_blocks[i].block, start_height + i))
+      for (size_t j = 0; j < n; ++j)
+        own_tx_cache_data[txidx + j] = wallet2::tx_cache_data();
+    txidx += n;
+  }
+  THROW_WALLET_EXCEPTION_IF(txidx != own_tx_cache_data.size(), error::wallet_internal_error, "txidx does not match tx_cache_data size");
+
+  process_cached_blocks(start_height, blocks, parsed_blocks, first, own_tx_cache_data, blocks_added);
+  return true;
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::fast_refresh_to_scan_height(bool trusted_daemon)
+{
+  const uint64_t scan_height = std::max(m_refresh_from_block_height, m_skip_to_height);
+  if (m_offline || m_light_wallet || scan_height <= m_blockchain.size())
+    return true;
+
+  std::list<crypto::hash> short_chain_history;
+  uint64_t blocks_start_height;
+  get_short_chain_history(short_chain_history, (m_first_refresh_done || trusted_daemon) ? 1 : FIRST_REFRESH_GRANULARITY);
+  m_run.store(true, std::memory_order_relaxed);
+  fast_refresh(scan_height, blocks_start_height, short_chain_history);
+  return scan_height <= m_blockchain.size();
+}
+//----------------------------------------------------------------------------------------------------
 void wallet2::refresh(bool trusted_daemon)
 {
   uint64_t blocks_fetched = 0;
@@ -3494,90 +3675,250 @@ void check_block_hard_fork_version(cryptonote::network_type nettype, uint8_t hf_
   daemon_is_outdated = height < start_height || height >= end_height;
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::pull_and_parse_next_blocks(bool first, bool try_incremental, uint64_t start_height, uint64_t &blocks_start_height, std::list<crypto::hash> &short_chain_history, const std::vector<cryptonote::block_complete_entry> &prev_blocks, const std::vector<parsed_block> &prev_parsed_blocks, std::vector<cryptonote::block_complete_entry> &blocks, std::vector<parsed_block> &parsed_blocks, bool &last, bool &error, std::exception_ptr &exception)
+void wallet2::check_block_versions(uint64_t start_height, const std::vector<parsed_block> &parsed_blocks) const
 {
-  error = false;
-  last = false;
-  exception = NULL;
+  if (m_allow_mismatched_daemon_version)
+    return;
 
-  try
+  for (size_t i = 0; i < parsed_blocks.size(); ++i)
   {
-    drop_from_short_history(short_chain_history, 3);
-
-    THROW_WALLET_EXCEPTION_IF(prev_blocks.size() != prev_parsed_blocks.size(), error::wallet_internal_error, "size mismatch");
+    if (parsed_blocks[i].error)
+      break;
 
-    // prepend the last 3 blocks, should be enough to guard against a block or two's reorg
-    auto s = std::next(prev_parsed_blocks.rbegin(), std::min((size_t)3, prev_parsed_blocks.size())).base();
-    for (; s != prev_parsed_blocks.end(); ++s)
+    // make sure block's hard fork version is expected at the block's height
+    uint8_t hf_version = parsed_blocks[i].block.major_version;
+    uint64_t height = start_height + i;
+    bool wallet_is_outdated = false;
+    bool daemon_is_outdated = false;
+    check_block_hard_fork_version(m_nettype, hf_version, height, wallet_is_outdated, daemon_is_outdated);
+    THROW_WALLET_EXCEPTION_IF(wallet_is_outdated || daemon_is_outdated, error::incorrect_fork_version,
+      "Unexpected hard fork version v" + std::to_string(hf_version) + " at height " + std::to_string(height) + ". " +
+      (wallet_is_outdated
+        ? "Make sure your wallet is up to date"
+        : "Make sure the node you are connected to is running the latest version")
+    );
+  }
+}
+//----------------------------------------------------------------------------------------------------
+// A range of blocks pulled ahead of processing. A batch with a start height
+// of 0 follows the short chain history instead, which is how the daemon
+// tells us where its chain and ours part ways.
+struct wallet2::blocks_batch
+{
+  blocks_batch(uint64_t start_height, uint64_t max_block_count):
+    start_height(start_height),
+    max_block_count(max_block_count),
+    blocks_start_height(0),
+    current_height(0),
+    network_us(0),
+    parse_us(0),
+    network_stall_us(0),
+    parse_stall_us(0),
+    error(false),
+    fetched(false),
+    parse_waiter(tools::threadpool::getInstanceForCompute())
+  {}
+
+  const uint64_t start_height;
+  const uint64_t max_block_count;
+  uint64_t blocks_start_height;
+  std::vector<cryptonote::block_complete_entry> blocks;
+  std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> o_indices;
+  std::vector<parsed_block> parsed_blocks;
+  uint64_t current_height;
+  uint64_t network_us;
+  uint64_t parse_us;
+  uint64_t network_stall_us;
+  uint64_t parse_stall_us;
+  bool error;
+  std::exception_ptr exception;
+  bool fetched; // guarded by the window's mutex
+  tools::threadpool::waiter parse_waiter;
+};
+//----------------------------------------------------------------------------------------------------
+// Keeps up to m_refresh_stats.depth batches in flight, counting the one being
+// processed. A single thread talks to the daemon, since requests share one
+// connection, and hands each batch to the compute pool to parse as soon as
+// it arrives. Batches are handed out in the order they were asked for.
+struct wallet2::refresh_window
+{
+  refresh_window(wallet2 &wallet, bool first, bool try_incremental, const std::list<crypto::hash> &short_chain_history, uint64_t end_height);
+  ~refresh_window();
+
+  // waits for the next batch to be fetched and parsed, NULL if there are no more
+  std::shared_ptr<blocks_batch> front();
+  // drops the front batch once processed, and adapts to where the time went
+  void pop_front(uint64_t process_us);
+
+private:
+  void run();
+  void parse(const std::shared_ptr<blocks_batch> &batch);
+
+  wallet2 &m_wallet;
+  const bool m_first;
+  const bool m_try_incremental;
+  const std::list<crypto::hash> m_short_chain_history;
+  const uint64_t m_end_height;
+  boost::mutex m_mutex;
+  boost::condition_variable m_cond;
+  std::deque<std::shared_ptr<blocks_batch>> m_batches;
+  bool m_stop;
+  bool m_done;
+  uint64_t m_idle_us; // time run() waited on a full window since the last pop
+  boost::thread m_thread;
+};
+//----------------------------------------------------------------------------------------------------
+wallet2::refresh_window::refresh_window(wallet2 &wallet, bool first, bool try_incremental, const std::list<crypto::hash> &short_chain_history, uint64_t end_height):
+  m_wallet(wallet),
+  m_first(first),
+  m_try_incremental(try_incremental),
+  m_short_chain_history(short_chain_history),
+  m_end_height(end_height),
+  m_stop(false),
+  m_done(false),
+  m_idle_us(0)
+{
+  m_thread = boost::thread([this]() { run(); });
+}
+//----------------------------------------------------------------------------------------------------
+wallet2::refresh_window::~refresh_window()
+{
+  {
+    const boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_all();
+  if (m_thread.joinable())
+    m_thread.join();
+  for (const auto &batch: m_batches)
+    batch->parse_waiter.wait();
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::refresh_window::run()
+{
+  uint64_t start_height = 0;
+  while (true)
+  {
+    std::shared_ptr<blocks_batch> batch;
     {
-      short_chain_history.push_front(s->hash);
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      if (!m_stop && m_batches.size() >= m_wallet.m_refresh_stats.depth)
+      {
+        const auto idle_start = std::chrono::steady_clock::now();
+        while (!m_stop && m_batches.size() >= m_wallet.m_refresh_stats.depth)
+          m_cond.wait(lock);
+        const uint64_t idle_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - idle_start).count();
+        m_idle_us += idle_us;
+        m_wallet.m_refresh_stats.process_stall_us += idle_us;
+      }
+      if (m_stop)
+        break;
+      // the daemon picks how many blocks follow the short chain history
+      batch = std::make_shared<blocks_batch>(start_height, start_height ? m_wallet.m_refresh_stats.block_count : 0);
+      m_batches.push_back(batch);
     }
 
-    // pull the new blocks
-    std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> o_indices;
-    uint64_t current_height;
-    pull_blocks(first, try_incremental, start_height, blocks_start_height, short_chain_history, blocks, o_indices, current_height);
-    THROW_WALLET_EXCEPTION_IF(blocks.size() != o_indices.size(), error::wallet_internal_error, "Mismatched sizes of blocks and o_indices");
-
-    tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
-    tools::threadpool::waiter waiter(tpool);
-    parsed_blocks.resize(blocks.size());
-    for (size_t i = 0; i < blocks.size(); ++i)
+    try
     {
-      tpool.submit(&waiter, boost::bind(&wallet2::parse_block_round, this, std::cref(blocks[i].block),
-        std::ref(parsed_blocks[i].block), std::ref(parsed_blocks[i].hash), std::ref(parsed_blocks[i].error)), true);
+      const auto fetch_start = std::chrono::steady_clock::now();
+      const std::list<crypto::hash> no_history;
+      m_wallet.pull_blocks(m_first && !start_height, m_try_incremental, start_height, batch->blocks_start_height, start_height ? no_history : m_short_chain_history, batch->blocks, batch->o_indices, batch->current_height, batch->max_block_count);
+      batch->network_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - fetch_start).count();
+      if (!batch->blocks.empty())
+        tools::threadpool::getInstanceForCompute().submit(&batch->parse_waiter, [this, batch]() { parse(batch); }, false, tools::threadpool::PRIORITY_HIGH);
     }
-    THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
-    for (size_t i = 0; i < blocks.size(); ++i)
+    catch (...)
     {
-      if (parsed_blocks[i].error)
-      {
-        error = true;
-        break;
-      }
-
-      if (!m_allow_mismatched_daemon_version)
-      {
-        // make sure block's hard fork version is expected at the block's height
-        uint8_t hf_version = parsed_blocks[i].block.major_version;
-        uint64_t height = blocks_start_height + i;
-        bool wallet_is_outdated = false;
-        bool daemon_is_outdated = false;
-        check_block_hard_fork_version(m_nettype, hf_version, height, wallet_is_outdated, daemon_is_outdated);
-        THROW_WALLET_EXCEPTION_IF(wallet_is_outdated || daemon_is_outdated, error::incorrect_fork_version,
-          "Unexpected hard fork version v" + std::to_string(hf_version) + " at height " + std::to_string(height) + ". " +
-          (wallet_is_outdated
-            ? "Make sure your wallet is up to date"
-            : "Make sure the node you are connected to is running the latest version")
-        );
-      }
-
-      parsed_blocks[i].o_indices = std::move(o_indices[i]);
+      batch->error = true;
+      batch->exception = std::current_exception();
     }
 
-    boost::mutex error_lock;
-    for (size_t i = 0; i < blocks.size(); ++i)
+    start_height = batch->blocks_start_height + batch->blocks.size();
+    const bool done = batch->error || batch->blocks.empty() || start_height >= batch->current_height || start_height >= m_end_height || !m_wallet.m_run.load(std::memory_order_relaxed);
     {
-      parsed_blocks[i].txes.resize(blocks[i].txs.size());
-      for (size_t j = 0; j < blocks[i].txs.size(); ++j)
-      {
-        tpool.submit(&waiter, [&, i, j](){
-          if (!parse_and_validate_tx_base_from_blob(blocks[i].txs[j].blob, parsed_blocks[i].txes[j]))
-          {
-            boost::unique_lock<boost::mutex> lock(error_lock);
-            error = true;
-          }
-        }, true);
-      }
+      const boost::unique_lock<boost::mutex> lock(m_mutex);
+      batch->fetched = true;
+      m_done = done;
     }
-    THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
-    last = !blocks.empty() && cryptonote::get_block_height(parsed_blocks.back().block) + 1 == current_height;
+    m_cond.notify_all();
+    if (done)
+      return;
   }
-  catch(...)
+
   {
-    error = true;
-    exception = std::current_exception();
+    const boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_done = true;
   }
+  m_cond.notify_all();
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::refresh_window::parse(const std::shared_ptr<blocks_batch> &batch)
+{
+  const auto parse_start = std::chrono::steady_clock::now();
+  try
+  {
+    bool error = false;
+    parse_blocks(batch->blocks, batch->o_indices, batch->parsed_blocks, error);
+    m_wallet.check_block_versions(batch->blocks_start_height, batch->parsed_blocks);
+    batch->error = error;
+  }
+  catch (...)
+  {
+    batch->error = true;
+    batch->exception = std::current_exception();
+  }
+  batch->parse_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - parse_start).count();
+}
+//----------------------------------------------------------------------------------------------------
+std::shared_ptr<wallet2::blocks_batch> wallet2::refresh_window::front()
+{
+  std::shared_ptr<blocks_batch> batch;
+  const auto fetch_wait_start = std::chrono::steady_clock::now();
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (m_batches.empty() ? !m_done : !m_batches.front()->fetched)
+      m_cond.wait(lock);
+    if (m_batches.empty())
+      return NULL;
+    batch = m_batches.front();
+  }
+  const auto parse_wait_start = std::chrono::steady_clock::now();
+  batch->parse_waiter.wait();
+  const auto parse_wait_end = std::chrono::steady_clock::now();
+  batch->network_stall_us = std::chrono::duration_cast<std::chrono::microseconds>(parse_wait_start - fetch_wait_start).count();
+  batch->parse_stall_us = std::chrono::duration_cast<std::chrono::microseconds>(parse_wait_end - parse_wait_start).count();
+  return batch;
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::refresh_window::pop_front(uint64_t process_us)
+{
+  {
+    const boost::unique_lock<boost::mutex> lock(m_mutex);
+    const std::shared_ptr<blocks_batch> batch = m_batches.front();
+    m_batches.pop_front();
+
+    refresh_stats &stats = m_wallet.m_refresh_stats;
+    ++stats.batches;
+    stats.network_stall_us += batch->network_stall_us;
+    stats.parse_stall_us += batch->parse_stall_us;
+    stats.process_us += process_us;
+
+    MDEBUG("Blocks " << batch->blocks_start_height << " to " << batch->blocks_start_height + batch->blocks.size()
+        << ": network " << batch->network_us / 1000 << " ms, parse " << batch->parse_us / 1000 << " ms, process " << process_us / 1000
+        << " ms, waited " << batch->network_stall_us / 1000 << " ms on network and " << batch->parse_stall_us / 1000 << " ms on parsing");
+
+    // waiting on a full batch means requests are too small to hide their
+    // latency, waiting on parsing means more batches should parse at once,
+    // and the prefetcher waiting on us means the window can shrink
+    if (batch->network_stall_us >= REFRESH_PREFETCH_STALL_THRESHOLD_US && batch->max_block_count && batch->blocks.size() >= batch->max_block_count)
+      stats.block_count = std::min<uint64_t>(stats.block_count * 2, COMMAND_RPC_GET_BLOCKS_FAST_MAX_BLOCK_COUNT);
+    else if (batch->parse_stall_us >= REFRESH_PREFETCH_STALL_THRESHOLD_US)
+      stats.depth = std::min<size_t>(stats.depth + 1, REFRESH_PREFETCH_MAX_DEPTH);
+    else if (m_idle_us >= REFRESH_PREFETCH_STALL_THRESHOLD_US)
+      stats.depth = std::max<size_t>(stats.depth - 1, REFRESH_PREFETCH_MIN_DEPTH);
+    m_idle_us = 0;
+  }
+  m_cond.notify_all();
 }
 
 void wallet2::remove_obsolete_pool_txs(const std::vector<crypto::hash> &tx_hashes, bool remove_if_found)
@@ -4146,11 +4487,8 @@ void wallet2::refresh(bool trusted_daemon, uint64_t start_height, uint64_t & blo
   size_t try_count = 0;
   crypto::hash last_tx_hash_id = m_transfers.size() ? m_transfers.back().m_txid : null_hash;
   std::list<crypto::hash> short_chain_history;
-  tools::threadpool& tpool = tools::threadpool::getInstanceForCompute();
-  tools::threadpool::waiter waiter(tpool);
   uint64_t blocks_start_height;
-  std::vector<cryptonote::block_complete_entry> blocks;
-  std::vector<parsed_block> parsed_blocks;
+  std::unique_ptr<refresh_window> window;
   bool refreshed = false;
   std::shared_ptr<std::map<std::pair<uint64_t, uint64_t>, size_t>> output_tracker_cache;
   hw::device &hwdev = m_account.get_device();
@@ -4193,39 +4531,74 @@ void wallet2::refresh(bool trusted_daemon, uint64_t start_height, uint64_t & blo
   // leak allowing a passive adversary with traffic analysis capability to
   // infer when we get an incoming output
 
-  bool first = true, last = false;
+  m_refresh_stats = refresh_stats();
+  m_refresh_stats.depth = REFRESH_PREFETCH_MIN_DEPTH;
+  m_refresh_stats.block_count = REFRESH_PREFETCH_INITIAL_BLOCK_COUNT;
+
+  bool first = true, window_added_blocks = false;
   while(m_run.load(std::memory_order_relaxed) && blocks_fetched < max_blocks)
   {
-    uint64_t next_blocks_start_height;
-    std::vector<cryptonote::block_complete_entry> next_blocks;
-    std::vector<parsed_block> next_parsed_blocks;
-    bool error;
-    std::exception_ptr exception;
     try
     {
-      // pull the next set of blocks while we're processing the current one
-      error = false;
-      exception = NULL;
-      next_blocks.clear();
-      next_parsed_blocks.clear();
       added_blocks = 0;
-      if (!first && blocks.empty())
+      if (!window)
+      {
+        const uint64_t max_end_height = std::numeric_limits<uint64_t>::max() - m_blockchain.size();
+        const uint64_t end_height = m_blockchain.size() + std::min(max_blocks - blocks_fetched, max_end_height);
+        window.reset(new refresh_window(*this, first, try_incremental, short_chain_history, end_height));
+        window_added_blocks = false;
+      }
+
+      const std::shared_ptr<blocks_batch> batch = window->front();
+      if (!batch)
       {
         m_node_rpc_proxy.set_height(m_blockchain.size());
         break;
       }
-      if (!last)
-        tpool.submit(&waiter, [&]{pull_and_parse_next_blocks(first, try_incremental, start_height, next_blocks_start_height, short_chain_history, blocks, parsed_blocks, next_blocks, next_parsed_blocks, last, error, exception);});
 
-      if (!first)
+      // handle error from async fetching thread
+      if (batch->error)
       {
+        if (batch->exception)
+          std::rethrow_exception(batch->exception);
+        else
+          throw std::runtime_error("proxy exception in refresh thread");
+      }
+
+      m_has_ever_refreshed_from_node = true;
+      first = false;
+
+      // blocks pulled by height must carry on from our top block, else the
+      // daemon's chain changed since we last asked: go back to the short
+      // chain history, which finds where the chains part ways
+      if (batch->start_height && (batch->blocks.empty() || batch->blocks_start_height != m_blockchain.size()
+          || !m_blockchain.is_in_bounds(m_blockchain.size() - 1) || batch->parsed_blocks.front().block.prev_id != m_blockchain[m_blockchain.size() - 1]))
+      {
+        MDEBUG("Blocks prefetched from height " << batch->blocks_start_height << " do not follow ours, pulling from the short chain history");
+        THROW_WALLET_EXCEPTION_IF(!window_added_blocks, error::wallet_internal_error, "Daemon keeps sending blocks which do not follow ours");
+        window.reset();
+        short_chain_history.clear();
+        get_short_chain_history(short_chain_history, 1);
+        continue;
+      }
+
+      uint64_t process_us = 0;
+      if (!batch->blocks.empty())
+      {
+        // if we've got at least 10 blocks to refresh, assume we're starting
+        // a long refresh, and setup a tracking output cache if we need to
+        if (m_track_uses && (!output_tracker_cache || output_tracker_cache->empty()) && batch->blocks.size() >= 10)
+          output_tracker_cache = create_output_tracker_cache();
+
+        const auto process_start = std::chrono::steady_clock::now();
         try
         {
-          process_parsed_blocks(blocks_start_height, blocks, parsed_blocks, added_blocks, output_tracker_cache.get());
+          process_parsed_blocks(batch->blocks_start_height, batch->blocks, batch->parsed_blocks, added_blocks, output_tracker_cache.get());
         }
         catch (const tools::error::out_of_hashchain_bounds_error&)
         {
           MINFO("Daemon claims next refresh block is out of hash chain bounds, resetting hash chain");
+          window.reset();
           uint64_t stop_height = m_blockchain.offset();
           std::vector<crypto::hash> tip(m_blockchain.size() - m_blockchain.offset());
           for (size_t i = m_blockchain.offset(); i < m_blockchain.size(); ++i)
@@ -4249,76 +4622,46 @@ void wallet2::refresh(bool trusted_daemon, uint64_t start_height, uint64_t & blo
         catch (const std::exception &e)
         {
           MERROR("Error parsing blocks: " << e.what());
-          exception = std::current_exception();
-          error = true;
+          throw;
         }
+        process_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - process_start).count();
         blocks_fetched += added_blocks;
+        window_added_blocks |= added_blocks > 0;
+        added_blocks = 0;
       }
-      THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
-
-      // handle error from async fetching thread
-      if (error)
-      {
-        if (exception)
-          std::rethrow_exception(exception);
-        else
-          throw std::runtime_error("proxy exception in refresh thread");
-      }
-
-      m_has_ever_refreshed_from_node = true;
-
-      if(!first && blocks_start_height == next_blocks_start_height)
-      {
-        m_node_rpc_proxy.set_height(m_blockchain.size());
-        break;
-      }
-
-      first = false;
-
-      // if we've got at least 10 blocks to refresh, assume we're starting
-      // a long refresh, and setup a tracking output cache if we need to
-      if (m_track_uses && (!output_tracker_cache || output_tracker_cache->empty()) && next_blocks.size() >= 10)
-        output_tracker_cache = create_output_tracker_cache();
-
-      // switch to the new blocks from the daemon
-      blocks_start_height = next_blocks_start_height;
-      blocks = std::move(next_blocks);
-      parsed_blocks = std::move(next_parsed_blocks);
+      window->pop_front(process_us);
     }
     catch (const tools::error::password_needed&)
     {
       blocks_fetched += added_blocks;
-      THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+      window.reset();
       throw;
     }
     catch (const error::payment_required&)
     {
       // no point in trying again, it'd just eat up credits
-      THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+      window.reset();
       throw;
     }
     catch (const error::reorg_depth_error&)
     {
-      THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+      window.reset();
       throw;
     }
     catch (const error::incorrect_fork_version&)
     {
-      THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+      window.reset();
       throw;
     }
     catch (const std::exception&)
     {
       blocks_fetched += added_blocks;
-      THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+      window.reset();
       if(try_count < 3)
       {
         LOG_PRINT_L1("Another try pull_blocks (try_count=" << try_count << ")...");
         first = true;
-        last = false;
         start_height = 0;
-        blocks.clear();
-        parsed_blocks.clear();
         short_chain_history.clear();
         get_short_chain_history(short_chain_history, 1);
         ++try_count;
@@ -4330,6 +4673,12 @@ void wallet2::refresh(bool trusted_daemon, uint64_t start_height, uint64_t & blo
       }
     }
   }
+  window.reset();
+  MINFO("Refresh took " << m_refresh_stats.batches << " batches, stalled " << m_refresh_stats.network_stall_us / 1000 << " ms on the network, "
+      << m_refresh_stats.parse_stall_us / 1000 << " ms on parsing and " << m_refresh_stats.process_stall_us / 1000 << " ms on processing ("
+      << m_refresh_stats.process_us / 1000 << " ms total), ending with " << m_refresh_stats.depth << " batches of "
+      << m_refresh_stats.block_count << " blocks in flight");
+
   if(last_tx_hash_id != (m_transfers.size() ? m_transfers.back().m_txid : null_hash))
     received_money = true;
 
@@ -4434,8 +4783,11 @@ wallet2::detached_blockchain_data wallet2::detach_blockchain(uint64_t height, st
 
   for (transfer_details &td: m_transfers)
   {
+    if (td.m_uses.empty() || td.m_uses.back().first < height)
+      continue;
     while (!td.m_uses.empty() && td.m_uses.back().first >= height)
       td.m_uses.pop_back();
+    journal_transfer(&td - m_transfers.data());
   }
 
   for (auto it = m_background_sync_data.txs.begin(); it != m_background_sync_data.txs.end(); )
@@ -4458,6 +4810,7 @@ wallet2::detached_blockchain_data wallet2::detach_blockchain(uint64_t height, st
       continue;
     auto it_ki = m_key_images.find(m_transfers[i].m_key_image);
     THROW_WALLET_EXCEPTION_IF(it_ki == m_key_images.end(), error::wallet_internal_error, "key image not found: index " + std::to_string(i) + ", ki " + epee::string_tools::pod_to_hex(m_transfers[i].m_key_image) + ", " + std::to_string(m_key_images.size()) + " key images known");
+    journal_key(m_key_images, it_ki->first);
     m_key_images.erase(it_ki);
   }
 
@@ -4465,6 +4818,7 @@ wallet2::detached_blockchain_data wallet2::detach_blockchain(uint64_t height, st
   {
     auto it_pk = m_pub_keys.find(m_transfers[i].get_public_key());
     THROW_WALLET_EXCEPTION_IF(it_pk == m_pub_keys.end(), error::wallet_internal_error, "public key not found");
+    journal_key(m_pub_keys, it_pk->first);
     m_pub_keys.erase(it_pk);
   }
 
@@ -4474,6 +4828,8 @@ wallet2::detached_blockchain_data wallet2::detach_blockchain(uint64_t height, st
     dbd.detached_tx_hashes.insert(std::move(m_transfers[i].m_txid));
   MDEBUG(transfers_detached << " transfers detached / expected " << dbd.detached_tx_hashes.size());
   m_transfers.erase(it, m_transfers.end());
+  journal_transfers_from(i_start);
+  truncate_balances(m_transfers.size());
 
   size_t blocks_detached = 0;
   dbd.original_chain_size = m_blockchain.size();
@@ -4491,6 +4847,7 @@ wallet2::detached_blockchain_data wallet2::detach_blockchain(uint64_t height, st
     if(height <= it->second.m_block_height)
     {
       dbd.detached_tx_hashes.insert(it->second.m_tx_hash);
+      journal_erased(m_payments, *it);
       it = m_payments.erase(it);
     }
     else
@@ -4502,6 +4859,7 @@ wallet2::detached_blockchain_data wallet2::detach_blockchain(uint64_t height, st
     if(height <= it->second.m_block_height)
     {
       dbd.detached_tx_hashes.insert(it->first);
+      journal_key(m_confirmed_txs, it->first);
       dbd.detached_confirmed_txs_dests[it->first] = std::move(it->second.m_dests);
       it = m_confirmed_txs.erase(it);
     }
@@ -4538,6 +4896,21 @@ bool wallet2::deinit()
     unlock_background_keys_file();
     m_account.deinit();
   }
+  // fold the journal back into the cache file, so the wallet files on their
+  // own hold the whole wallet again, as copies and backups expect
+  if (m_cache_journal.is_open() && !m_background_syncing && !m_is_background_wallet)
+  {
+    try
+    {
+      if (!m_cache_journal.compact(get_cache_key(), fold_cache_journal))
+        MERROR("Failed to fold " << m_wallet_file << ".journal into the wallet cache");
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Failed to fold " << m_wallet_file << ".journal into the wallet cache: " << e.what());
+    }
+  }
+  m_cache_journal.close();
   return true;
 }
 //----------------------------------------------------------------------------------------------------
@@ -4563,6 +4936,9 @@ bool wallet2::clear()
   m_pool_info_query_time = 0;
   m_skip_to_height = 0;
   m_background_sync_data = background_sync_data_t{};
+  m_cache_journal.close();
+  m_cache_journal_ready = false;
+  rebuild_balances();
   return true;
 }
 //----------------------------------------------------------------------------------------------------
@@ -4582,6 +4958,9 @@ void wallet2::clear_soft(bool keep_key_images)
   m_pool_info_query_time = 0;
   m_skip_to_height = 0;
   m_background_sync_data = background_sync_data_t{};
+  // next to nothing is left, so the next store rewrites the cache in full
+  m_cache_journal_ready = false;
+  rebuild_balances();
 
   cryptonote::block b;
   generate_genesis(b);
@@ -4597,12 +4976,15 @@ void wallet2::clear_user_data()
     i->second.m_dests.clear();
   for (auto i = m_transfers.begin(); i != m_transfers.end(); ++i)
     i->m_frozen = false;
+  rebuild_balances();
   m_tx_keys.clear();
   m_tx_notes.clear();
   m_address_book.clear();
   m_subaddress_labels.clear();
   m_attributes.clear();
   m_account_tags = std::pair<serializable_map<std::string, std::string>, std::vector<std::string>>();
+  // the next store rewrites the cache in full, so no user data is left in the journal
+  m_cache_journal_ready = false;
 }
 //----------------------------------------------------------------------------------------------------
 /*!
@@ -6165,6 +6547,7 @@ std::string wallet2::exchange_multisig_keys(const epee::wipeable_string &passwor
     }
 
     m_subaddresses.clear();
+    journal_all(m_subaddresses);
     m_subaddress_labels.clear();
     add_subaddress_account(tr("Primary account"));
 
@@ -6550,6 +6933,7 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
   // Here we erase these multisig keys if they're zero'd out to free up space.
   for (auto &td : m_transfers)
   {
+    const size_t n_multisig_k = td.m_multisig_k.size();
     auto mk_it = td.m_multisig_k.begin();
     while (mk_it != td.m_multisig_k.end())
     {
@@ -6558,6 +6942,8 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
       else
         ++mk_it;
     }
+    if (td.m_multisig_k.size() != n_multisig_k)
+      journal_transfer(&td - m_transfers.data());
   }
 
   cryptonote::block genesis;
@@ -6614,6 +7000,7 @@ void wallet2::load_wallet_cache(const bool use_fs, const std::string& cache_buf)
     wallet2::cache_file_data cache_file_data;
     std::string cache_file_buf;
     bool r = true;
+    bool current_format = false;
     if (use_fs)
     {
       r = load_from_file(m_wallet_file, cache_file_buf, std::numeric_limits<size_t>::max());
@@ -6639,7 +7026,7 @@ void wallet2::load_wallet_cache(const bool use_fs, const std::string& cache_buf)
           binary_archive<false> ar{epee::strspan<std::uint8_t>(cache_data)};
           if (::serialization::serialize(ar, *this))
             if (::serialization::check_stream_state(ar))
-              loaded = true;
+              loaded = current_format = true;
           if (!loaded)
           {
             binary_archive<false> ar{epee::strspan<std::uint8_t>(cache_data)};
@@ -6718,6 +7105,177 @@ void wallet2::load_wallet_cache(const bool use_fs, const std::string& cache_buf)
       m_account_public_address.m_spend_public_key != m_account.get_keys().m_account_address.m_spend_public_key ||
       m_account_public_address.m_view_public_key  != m_account.get_keys().m_account_address.m_view_public_key,
       error::wallet_files_doesnt_correspond, m_keys_file, m_wallet_file);
+
+    // the journal only goes on top of a cache in the current format; any
+    // other is rewritten in full on the next store, which drops the journal
+    if (use_fs && current_format)
+      load_cache_journal(cache_file_data.iv, cache_file_buf.size());
+  }
+  rebuild_balances();
+}
+//----------------------------------------------------------------------------------------------------
+template<typename Tuple, typename F>
+static bool for_each_journaled_container(Tuple &&containers, F f)
+{
+  return std::apply([&f](auto&... c) { size_t n = 0; return (f(n++, c) && ...); }, containers);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::load_cache_journal(const crypto::chacha_iv &snapshot, uint64_t snapshot_size)
+{
+  m_cache_journal.open(m_wallet_file, snapshot, snapshot_size);
+  const crypto::chacha_key key = get_cache_key();
+  std::vector<cache_journal::frame> frames;
+  THROW_WALLET_EXCEPTION_IF(!m_cache_journal.read(key, frames), error::file_read_error, m_wallet_file + ".journal");
+
+  size_t applied = 0;
+  while (applied < frames.size() && apply_cache_journal_frame(frames[applied]))
+    ++applied;
+  if (applied < frames.size())
+  {
+    // the bad frame may have been applied in part, so start over from the
+    // snapshot, with only the frames before it
+    MERROR("Failed to apply " << m_wallet_file << ".journal from change " << applied << " of " << frames.size() << " on, dropping those changes");
+    frames.resize(applied);
+    std::string cache_file_buf, cache_data;
+    cache_file_data cache_file_data;
+    bool r = load_from_file(m_wallet_file, cache_file_buf, std::numeric_limits<size_t>::max());
+    r = r && ::serialization::parse_binary(cache_file_buf, cache_file_data);
+    if (r)
+    {
+      cache_data.resize(cache_file_data.cache_data.size());
+      crypto::chacha20(cache_file_data.cache_data.data(), cache_file_data.cache_data.size(), key, cache_file_data.iv, &cache_data[0]);
+      r = ::serialization::parse_binary(cache_data, *this);
+      memwipe(&cache_data[0], cache_data.size());
+    }
+    THROW_WALLET_EXCEPTION_IF(!r, error::file_read_error, m_wallet_file);
+    for (cache_journal::frame &f: frames)
+      THROW_WALLET_EXCEPTION_IF(!apply_cache_journal_frame(f), error::wallet_internal_error, "Failed to apply " + m_wallet_file + ".journal");
+    if (!m_cache_journal.rewrite(frames, key))
+      MERROR("Failed to shorten " << m_wallet_file << ".journal");
+  }
+  if (!frames.empty())
+    LOG_PRINT_L1("Applied " << frames.size() << " journaled changes to the wallet cache");
+
+  reset_cache_journal_state(snapshot_size);
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::apply_cache_journal_frame(cache_journal::frame &f)
+{
+  try
+  {
+    constexpr size_t num_sets = std::tuple_size<decltype(journaled_containers())>::value;
+    bool r = f.sequences.size() == 1 && f.sets.size() == num_sets;
+    r = r && (f.rest.empty() || serialize_cache_rest(f.rest, true));
+    r = r && (!f.has_blockchain || cache_journal::hashchain_section::apply(m_blockchain, f.blockchain));
+    r = r && cache_journal::sequence_section::apply(m_transfers, f.sequences[0]);
+    r = r && for_each_journaled_container(journaled_containers(), [&f](size_t i, auto &c) { return cache_journal::set_section::apply(c, f.sets[i]); });
+    return r;
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Error applying journaled wallet cache changes: " << e.what());
+    return false;
+  }
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::fold_cache_journal(const std::string &snapshot, std::vector<cache_journal::frame> &frames, std::string &cache_data)
+{
+  // runs away from the wallet, on a scratch one which only holds the cache
+  wallet2 w;
+  if (!::serialization::parse_binary(snapshot, w))
+    return false;
+  for (cache_journal::frame &f: frames)
+    if (!w.apply_cache_journal_frame(f))
+      return false;
+  return ::serialization::dump_binary(w, cache_data);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::reset_cache_journal(const crypto::chacha_iv &snapshot, uint64_t snapshot_size)
+{
+  m_cache_journal.open(m_wallet_file, snapshot, snapshot_size);
+  if (!m_cache_journal.reset(snapshot, snapshot_size))
+    MERROR("Failed to remove " << m_wallet_file << ".journal");
+  reset_cache_journal_state(snapshot_size);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::reset_cache_journal_state(uint64_t snapshot_size)
+{
+  // a journal is only worth its upkeep when rewriting the cache is expensive
+  m_cache_journal_ready = false;
+  if (snapshot_size < m_cache_journal_min_snapshot_size || m_is_background_wallet)
+    return;
+
+  try
+  {
+    std::string rest;
+    if (!serialize_cache_rest(rest, false))
+      return;
+    m_cache_journal_rest = cache_journal::fingerprint(rest);
+    m_cache_journal_blockchain.reset(m_blockchain);
+    m_cache_journal_transfers.reset(m_transfers.size());
+    m_cache_journal_sets.clear();
+    m_cache_journal_sets.resize(std::tuple_size<decltype(journaled_containers())>::value);
+    m_cache_journal_ready = true;
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Failed to set up the wallet cache journal: " << e.what());
+  }
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::serialize_cache_rest(std::string &blob, bool loading)
+{
+  cache_rest rest{*this};
+  if (!loading)
+    return ::serialization::dump_binary(rest, blob);
+  return ::serialization::parse_binary(blob, rest);
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::store_cache_journal()
+{
+  if (!m_cache_journal_ready || !m_cache_journal.is_open() || m_is_background_wallet || m_background_syncing)
+    return false;
+
+  try
+  {
+    const crypto::chacha_key key = get_cache_key();
+    m_cache_journal.finish_compaction(key, false);
+
+    cache_journal::frame f;
+    std::string rest;
+    THROW_WALLET_EXCEPTION_IF(!serialize_cache_rest(rest, false), error::wallet_internal_error, "Failed to serialize wallet cache");
+    const uint64_t rest_fingerprint = cache_journal::fingerprint(rest);
+    if (rest_fingerprint != m_cache_journal_rest)
+      f.rest = std::move(rest);
+    f.sequences.resize(1);
+    f.sets.resize(m_cache_journal_sets.size());
+    bool r = m_cache_journal_blockchain.diff(m_blockchain, f.blockchain);
+    r = r && m_cache_journal_transfers.diff(m_transfers, f.sequences[0]);
+    r = r && for_each_journaled_container(journaled_containers(), [this, &f](size_t i, auto &c) { return m_cache_journal_sets[i].diff(c, f.sets[i]); });
+    THROW_WALLET_EXCEPTION_IF(!r, error::wallet_internal_error, "Failed to serialize wallet cache");
+
+    f.has_blockchain = !m_cache_journal_blockchain.empty(f.blockchain);
+    bool changed = !f.rest.empty() || f.has_blockchain || !m_cache_journal_transfers.empty(f.sequences[0]);
+    for (const cache_journal::set_section &s: m_cache_journal_sets)
+      changed = changed || !s.empty();
+    if (changed && !m_cache_journal.append(f, key))
+      return false;
+
+    m_cache_journal_rest = rest_fingerprint;
+    m_cache_journal_blockchain.reset(m_blockchain);
+    m_cache_journal_transfers.reset(m_transfers.size());
+    for (cache_journal::set_section &s: m_cache_journal_sets)
+      s.reset();
+    MDEBUG("Stored wallet cache changes, journal is now " << m_cache_journal.size() << " bytes");
+
+    if (m_cache_journal.wants_compaction(CACHE_JOURNAL_COMPACTION_RATIO))
+      m_cache_journal.start_compaction(key, fold_cache_journal);
+    return true;
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Failed to journal wallet cache changes, rewriting it instead: " << e.what());
+    return false;
   }
 }
 //----------------------------------------------------------------------------------------------------
@@ -6904,9 +7462,18 @@ void wallet2::store_to(const std::string &path, const epee::wipeable_string &pas
     return;
   }
 
+  // if the cache stays where it is, only append what changed to its journal
+  const bool journaled = same_file && !force_rewrite_keys && store_cache_journal();
+
   // get wallet cache data
-  boost::optional<wallet2::cache_file_data> cache_file_data = get_cache_file_data();
-  THROW_WALLET_EXCEPTION_IF(cache_file_data == boost::none, error::wallet_internal_error, "failed to generate wallet cache data");
+  boost::optional<wallet2::cache_file_data> cache_file_data;
+  if (!journaled)
+  {
+    // a background compaction would write the same file
+    m_cache_journal.close();
+    cache_file_data = get_cache_file_data();
+    THROW_WALLET_EXCEPTION_IF(cache_file_data == boost::none, error::wallet_internal_error, "failed to generate wallet cache data");
+  }
 
   const std::string new_file = same_file ? m_wallet_file + ".new" : path;
   const std::string old_file = m_wallet_file;
@@ -6956,6 +7523,8 @@ void wallet2::store_to(const std::string &path, const epee::wipeable_string &pas
   }
 
   // Save cache to new file. If storing to the same file, the temp path has the ".new" extension
+  if (!journaled)
+  {
 #ifdef WIN32
     // On Windows avoid using std::ofstream which does not work with UTF-8 filenames
     // The price to pay is temporary higher memory consumption for string stream + binary archive
@@ -6974,8 +7543,9 @@ void wallet2::store_to(const std::string &path, const epee::wipeable_string &pas
     ostr.close();
     THROW_WALLET_EXCEPTION_IF(!success || !ostr.good(), error::file_save_error, new_file);
 #endif
+  }
 
-  if (same_file)
+  if (same_file && !journaled)
   {
     // here we have "*.new" file, we need to rename it to be without ".new"
     std::error_code e = tools::replace_file(new_file, m_wallet_file);
@@ -6983,12 +7553,16 @@ void wallet2::store_to(const std::string &path, const epee::wipeable_string &pas
   }
   else if (!same_file && had_old_wallet_files)
   {
-    // remove old wallet file
+    // remove old wallet file, and the journal of changes to it
     bool r = boost::filesystem::remove(old_file);
     if (!r) {
       LOG_ERROR("error removing file: " << old_file);
     }
+    boost::system::error_code ec;
+    boost::filesystem::remove(old_file + ".journal", ec);
   }
+  if (!journaled)
+    reset_cache_journal(cache_file_data->iv, cache_file_data->cache_data.size());
   
   if (m_message_store.get_active())
   {
@@ -7070,6 +7644,81 @@ uint64_t wallet2::unlocked_balance(uint32_t index_major, bool strict, uint64_t *
 }
 //----------------------------------------------------------------------------------------------------
 std::map<uint32_t, uint64_t> wallet2::balance_per_subaddress(uint32_t index_major, bool strict) const
+{
+  // const callers can't catch up with transfers added behind our back, scan instead
+  if (m_balance_entries.size() != m_transfers.size())
+    return balance_per_subaddress_scan(index_major, strict);
+
+  std::map<uint32_t, uint64_t> amount_per_subaddr;
+  const auto totals = m_balance_totals[strict].find(index_major);
+  if (totals != m_balance_totals[strict].end())
+    for (const auto &e: totals->second)
+      amount_per_subaddr[e.first] = e.second.amount;
+  if (!strict)
+    add_unconfirmed_balance_per_subaddress(amount_per_subaddr, index_major);
+
+  if (m_check_balance_cache)
+  {
+    std::map<uint32_t, uint64_t> scanned = balance_per_subaddress_scan(index_major, strict);
+    if (scanned != amount_per_subaddr)
+    {
+      MERROR("Running balance of account " << index_major << " does not match the scanned balance");
+      return scanned;
+    }
+  }
+  return amount_per_subaddr;
+}
+//----------------------------------------------------------------------------------------------------
+std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> wallet2::unlocked_balance_per_subaddress(uint32_t index_major, bool strict)
+{
+  sync_balances();
+
+  std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> amount_per_subaddr;
+  const uint64_t blockchain_height = get_blockchain_current_height();
+  const uint64_t now = time(NULL);
+  const auto totals = m_balance_totals[strict].find(index_major);
+  if (totals != m_balance_totals[strict].end())
+  {
+    for (const auto &e: totals->second)
+    {
+      const balance_totals &bt = e.second;
+      uint64_t amount = bt.amount, blocks_to_unlock = 0, time_to_unlock = 0;
+      for (auto i = bt.schedule.upper_bound(std::make_pair(blockchain_height, std::numeric_limits<uint64_t>::max())); i != bt.schedule.end(); ++i)
+      {
+        amount -= i->second.first;
+        if (i->first.second > blockchain_height)
+          blocks_to_unlock = std::max(blocks_to_unlock, i->first.second - blockchain_height);
+      }
+      for (size_t idx: bt.time_locked)
+      {
+        const transfer_details &td = m_transfers[idx];
+        if (is_transfer_unlocked(td))
+          continue;
+        const balance_entry &be = m_balance_entries[idx];
+        amount -= be.amount;
+        if (be.unlock_height > blockchain_height)
+          blocks_to_unlock = std::max(blocks_to_unlock, be.unlock_height - blockchain_height);
+        if (td.m_tx.unlock_time > now)
+          time_to_unlock = std::max(time_to_unlock, td.m_tx.unlock_time - now);
+      }
+      amount_per_subaddr[e.first] = std::make_pair(amount, std::make_pair(blocks_to_unlock, time_to_unlock));
+    }
+  }
+
+  if (m_check_balance_cache)
+  {
+    auto scanned = unlocked_balance_per_subaddress_scan(index_major, strict);
+    if (scanned != amount_per_subaddr)
+    {
+      MERROR("Running unlocked balance of account " << index_major << " does not match the scanned balance, rebuilding");
+      rebuild_balances();
+      return scanned;
+    }
+  }
+  return amount_per_subaddr;
+}
+//----------------------------------------------------------------------------------------------------
+std::map<uint32_t, uint64_t> wallet2::balance_per_subaddress_scan(uint32_t index_major, bool strict) const
 {
   std::map<uint32_t, uint64_t> amount_per_subaddr;
   for (const auto& td: m_transfers)
@@ -7084,9 +7733,14 @@ std::map<uint32_t, uint64_t> wallet2::balance_per_subaddress(uint32_t index_majo
     }
   }
   if (!strict)
+    add_unconfirmed_balance_per_subaddress(amount_per_subaddr, index_major);
+  return amount_per_subaddr;
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::add_unconfirmed_balance_per_subaddress(std::map<uint32_t, uint64_t> &amount_per_subaddr, uint32_t index_major) const
+{
+  for (const auto& utx: m_unconfirmed_txs)
   {
-   for (const auto& utx: m_unconfirmed_txs)
-   {
     if (utx.second.m_subaddr_account == index_major && utx.second.m_state != wallet2::unconfirmed_transfer_details::failed)
     {
       // all changes go to 0-th subaddress (in the current subaddress account)
@@ -7109,20 +7763,18 @@ std::map<uint32_t, uint64_t> wallet2::balance_per_subaddress(uint32_t index_majo
         }
       }
     }
-   }
+  }
 
-   for (const auto& utx: m_unconfirmed_payments)
-   {
+  for (const auto& utx: m_unconfirmed_payments)
+  {
     if (utx.second.m_pd.m_subaddr_index.major == index_major)
     {
       amount_per_subaddr[utx.second.m_pd.m_subaddr_index.minor] += utx.second.m_pd.m_amount;
     }
-   }
   }
-  return amount_per_subaddr;
 }
 //----------------------------------------------------------------------------------------------------
-std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> wallet2::unlocked_balance_per_subaddress(uint32_t index_major, bool strict)
+std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> wallet2::unlocked_balance_per_subaddress_scan(uint32_t index_major, bool strict)
 {
   std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> amount_per_subaddr;
   const uint64_t blockchain_height = get_blockchain_current_height();
@@ -7162,6 +7814,204 @@ std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> wallet2::
   return amount_per_subaddr;
 }
 //----------------------------------------------------------------------------------------------------
+void wallet2::account_balance_entry(size_t idx, bool add)
+{
+  const balance_entry &be = m_balance_entries[idx];
+  for (int strict = 0; strict < 2; ++strict)
+  {
+    if (!be.counted[strict])
+      continue;
+    auto &per_major = m_balance_totals[strict][be.index.major];
+    balance_totals &bt = per_major[be.index.minor];
+    if (add)
+    {
+      ++bt.count;
+      bt.amount += be.amount;
+      if (be.time_locked)
+        bt.time_locked.insert(idx);
+      else
+      {
+        auto &scheduled = bt.schedule[std::make_pair(be.unlocked_at, be.unlock_height)];
+        scheduled.first += be.amount;
+        ++scheduled.second;
+      }
+      if (!strict)
+      {
+        bt.by_amount.insert(std::make_pair(be.amount, idx));
+        if (!be.time_locked)
+          bt.by_unlock.insert(std::make_pair(be.unlocked_at, idx));
+      }
+    }
+    else
+    {
+      --bt.count;
+      bt.amount -= be.amount;
+      if (be.time_locked)
+        bt.time_locked.erase(idx);
+      else
+      {
+        auto scheduled = bt.schedule.find(std::make_pair(be.unlocked_at, be.unlock_height));
+        THROW_WALLET_EXCEPTION_IF(scheduled == bt.schedule.end(), error::wallet_internal_error, "Transfer missing from the unlock schedule");
+        scheduled->second.first -= be.amount;
+        if (--scheduled->second.second == 0)
+          bt.schedule.erase(scheduled);
+      }
+      if (!strict)
+      {
+        bt.by_amount.erase(std::make_pair(be.amount, idx));
+        if (!be.time_locked)
+          bt.by_unlock.erase(std::make_pair(be.unlocked_at, idx));
+      }
+      if (bt.count == 0)
+      {
+        per_major.erase(be.index.minor);
+        if (per_major.empty())
+          m_balance_totals[strict].erase(be.index.major);
+      }
+    }
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::update_balance(size_t idx)
+{
+  if (idx >= m_transfers.size())
+    return;
+  // transfers appended since the last update are accounted first, in order
+  size_t first = idx;
+  if (idx >= m_balance_entries.size())
+  {
+    first = m_balance_entries.size();
+    m_balance_entries.resize(idx + 1, balance_entry{});
+  }
+  for (size_t i = first; i <= idx; ++i)
+  {
+    account_balance_entry(i, false);
+
+    const transfer_details &td = m_transfers[i];
+    balance_entry &be = m_balance_entries[i];
+    be.counted[0] = !td.m_frozen && !is_spent(td, false);
+    be.counted[1] = !td.m_frozen && !is_spent(td, true);
+    be.index = td.m_subaddr_index;
+    be.amount = td.amount();
+    be.time_locked = td.m_tx.unlock_time >= CRYPTONOTE_MAX_BLOCK_NUMBER;
+    // same rules as is_tx_spendtime_unlocked and is_transfer_unlocked
+    be.unlocked_at = td.m_block_height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE;
+    if (!be.time_locked && td.m_tx.unlock_time + 1 > CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS)
+      be.unlocked_at = std::max<uint64_t>(be.unlocked_at, td.m_tx.unlock_time + 1 - CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS);
+    be.unlock_height = td.m_block_height + std::max<uint64_t>(CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE, CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS);
+    if (!be.time_locked && td.m_tx.unlock_time > be.unlock_height)
+      be.unlock_height = td.m_tx.unlock_time;
+
+    account_balance_entry(i, true);
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::truncate_balances(size_t size)
+{
+  while (m_balance_entries.size() > size)
+  {
+    account_balance_entry(m_balance_entries.size() - 1, false);
+    m_balance_entries.pop_back();
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::rebuild_balances()
+{
+  m_balance_entries.clear();
+  m_balance_totals[0].clear();
+  m_balance_totals[1].clear();
+  sync_balances();
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::sync_balances()
+{
+  if (m_balance_entries.size() > m_transfers.size())
+    rebuild_balances();
+  else if (m_balance_entries.size() < m_transfers.size())
+    update_balance(m_transfers.size() - 1);
+}
+//----------------------------------------------------------------------------------------------------
+std::vector<size_t> wallet2::get_unspent_transfers(const boost::optional<uint32_t> &subaddr_account, const std::set<uint32_t> &subaddr_indices, bool unlocked, uint64_t min_amount)
+{
+  // outputs which are neither spent (even in the pool) nor frozen, of the given
+  // account (or any) and subaddresses (or all), sorted by transfer index. Only
+  // the matching range of the unlock or amount index is visited, not all transfers
+  sync_balances();
+
+  std::vector<size_t> outputs;
+  const uint64_t blockchain_height = get_blockchain_current_height();
+  auto add_outputs = [&](const balance_totals &bt) {
+    if (unlocked && min_amount == 0)
+    {
+      // height locked outputs which unlocked at or below the current height, then the time locked ones
+      const auto end = bt.by_unlock.upper_bound(std::make_pair(blockchain_height, std::numeric_limits<size_t>::max()));
+      for (auto i = bt.by_unlock.begin(); i != end; ++i)
+        outputs.push_back(i->second);
+      for (size_t idx: bt.time_locked)
+        if (is_transfer_unlocked(m_transfers[idx]))
+          outputs.push_back(idx);
+      return;
+    }
+    for (auto i = bt.by_amount.lower_bound(std::make_pair(min_amount, size_t(0))); i != bt.by_amount.end(); ++i)
+    {
+      if (unlocked)
+      {
+        const balance_entry &be = m_balance_entries[i->second];
+        if (be.time_locked ? !is_transfer_unlocked(m_transfers[i->second]) : be.unlocked_at > blockchain_height)
+          continue;
+      }
+      outputs.push_back(i->second);
+    }
+  };
+  auto add_account = [&](const std::map<uint32_t, balance_totals> &per_minor) {
+    if (subaddr_indices.empty())
+    {
+      for (const auto &e: per_minor)
+        add_outputs(e.second);
+    }
+    else
+    {
+      for (uint32_t index_minor: subaddr_indices)
+      {
+        const auto i = per_minor.find(index_minor);
+        if (i != per_minor.end())
+          add_outputs(i->second);
+      }
+    }
+  };
+  if (subaddr_account)
+  {
+    const auto i = m_balance_totals[0].find(*subaddr_account);
+    if (i != m_balance_totals[0].end())
+      add_account(i->second);
+  }
+  else
+  {
+    for (const auto &e: m_balance_totals[0])
+      add_account(e.second);
+  }
+  std::sort(outputs.begin(), outputs.end());
+
+  if (m_check_balance_cache)
+  {
+    std::vector<size_t> scanned;
+    for (size_t i = 0; i < m_transfers.size(); ++i)
+    {
+      const transfer_details &td = m_transfers[i];
+      if (!is_spent(td, false) && !td.m_frozen && td.amount() >= min_amount && (!unlocked || is_transfer_unlocked(td)) &&
+          (!subaddr_account || td.m_subaddr_index.major == *subaddr_account) && (subaddr_indices.empty() || subaddr_indices.count(td.m_subaddr_index.minor) == 1))
+        scanned.push_back(i);
+    }
+    if (scanned != outputs)
+    {
+      MERROR("Unspent output index does not match the scanned outputs, rebuilding");
+      rebuild_balances();
+      return scanned;
+    }
+  }
+  return outputs;
+}
+//----------------------------------------------------------------------------------------------------
 uint64_t wallet2::balance_all(bool strict) const
 {
   uint64_t r = 0;
@@ -7654,6 +8504,8 @@ void wallet2::commit_tx(pending_tx& ptx)
   {
     m_tx_keys[txid] = ptx.tx_key;
     m_additional_tx_keys[txid] = ptx.additional_tx_keys;
+    journal_key(m_tx_keys, txid);
+    journal_key(m_additional_tx_keys, txid);
   }
 
   LOG_PRINT_L2("transaction " << txid << " generated ok and sent to daemon, key_images: [" << ptx.key_images << "]");
@@ -7668,6 +8520,7 @@ void wallet2::commit_tx(pending_tx& ptx)
   {
     memwipe(m_transfers[idx].m_multisig_k.data(), m_transfers[idx].m_multisig_k.size() * sizeof(m_transfers[idx].m_multisig_k[0]));
     m_transfers[idx].m_multisig_k.clear();
+    journal_transfer(idx);
   }
 
   //fee includes dust if dust policy specified it.
@@ -7880,6 +8733,8 @@ bool wallet2::sign_tx(unsigned_tx_set &exported_txs, std::vector<wallet2::pendin
       const crypto::hash txid = get_transaction_hash(ptx.tx);
       m_tx_keys[txid] = tx_key;
       m_additional_tx_keys[txid] = additional_tx_keys;
+      journal_key(m_tx_keys, txid);
+      journal_key(m_additional_tx_keys, txid);
     }
 
     std::string key_images;
@@ -8159,7 +9014,10 @@ bool wallet2::parse_tx_from_str(const std::string &signed_tx_st, std::vector<too
 
   // remember key images for this tx, for when we get those txes from the blockchain
   for (const auto &e: signed_txs.tx_key_images)
+  {
     m_cold_key_images.insert(e);
+    journal_key(m_cold_key_images, e.first);
+  }
 
   ptx = signed_txs.ptx;
 
@@ -8176,6 +9034,7 @@ std::string wallet2::save_multisig_tx(multisig_tx_set txs)
     {
       memwipe(m_transfers[idx].m_multisig_k.data(), m_transfers[idx].m_multisig_k.size() * sizeof(m_transfers[idx].m_multisig_k[0]));
       m_transfers[idx].m_multisig_k.clear();
+      journal_transfer(idx);
     }
 
   // zero out some data we don't want to share
@@ -8332,6 +9191,8 @@ bool wallet2::load_multisig_tx(cryptonote::blobdata s, multisig_tx_set &exported
       {
         m_tx_keys[txid] = ptx.tx_key;
         m_additional_tx_keys[txid] = ptx.additional_tx_keys;
+        journal_key(m_tx_keys, txid);
+        journal_key(m_additional_tx_keys, txid);
       }
     }
   }
@@ -8492,6 +9353,8 @@ bool wallet2::sign_multisig_tx(multisig_tx_set &exported_txs, std::vector<crypto
       {
         m_tx_keys[txid] = ptx.tx_key;
         m_additional_tx_keys[txid] = ptx.additional_tx_keys;
+        journal_key(m_tx_keys, txid);
+        journal_key(m_additional_tx_keys, txid);
       }
       txids.push_back(txid);
     }
@@ -8504,6 +9367,7 @@ bool wallet2::sign_multisig_tx(multisig_tx_set &exported_txs, std::vector<crypto
     {
       memwipe(m_transfers[idx].m_multisig_k.data(), m_transfers[idx].m_multisig_k.size() * sizeof(m_transfers[idx].m_multisig_k[0]));
       m_transfers[idx].m_multisig_k.clear();
+      journal_transfer(idx);
     }
 
   exported_txs.m_signers.insert(get_multisig_signer_public_key());
@@ -10441,8 +11305,11 @@ std::vector<size_t> wallet2::pick_preferred_rct_inputs(uint64_t needed_money, ui
 
   LOG_PRINT_L2("pick_preferred_rct_inputs: needed_money " << print_money(needed_money));
 
+  if (subaddr_indices.empty())
+    return picks;
+
   // try to find a rct input of enough size
-  for (size_t i = 0; i < m_transfers.size(); ++i)
+  for (size_t i: get_unspent_transfers(subaddr_account, subaddr_indices, true, needed_money))
   {
     const transfer_details& td = m_transfers[i];
     if (!is_spent(td, false) && !td.m_frozen && td.is_rct() && td.amount() >= needed_money && is_transfer_unlocked(td) && td.m_subaddr_index.major == subaddr_account && subaddr_indices.count(td.m_subaddr_index.minor) == 1)
@@ -10462,8 +11329,10 @@ std::vector<size_t> wallet2::pick_preferred_rct_inputs(uint64_t needed_money, ui
   // this could be made better by picking one of the outputs to be a small one, since those
   // are less useful since often below the needed money, so if one can be used in a pair,
   // it gets rid of it for the future
-  for (size_t i = 0; i < m_transfers.size(); ++i)
+  const std::vector<size_t> candidates = get_unspent_transfers(subaddr_account, subaddr_indices, true);
+  for (size_t n = 0; n < candidates.size(); ++n)
   {
+    const size_t i = candidates[n];
     const transfer_details& td = m_transfers[i];
     if (!is_spent(td, false) && !td.m_frozen && !td.m_key_image_partial && td.is_rct() && is_transfer_unlocked(td) && td.m_subaddr_index.major == subaddr_account && subaddr_indices.count(td.m_subaddr_index.minor) == 1)
     {
@@ -10473,8 +11342,9 @@ std::vector<size_t> wallet2::pick_preferred_rct_inputs(uint64_t needed_money, ui
         continue;
       }
       LOG_PRINT_L2("Considering input " << i << ", " << print_money(td.amount()));
-      for (size_t j = i + 1; j < m_transfers.size(); ++j)
+      for (size_t m = n + 1; m < candidates.size(); ++m)
       {
+        const size_t j = candidates[m];
         const transfer_details& td2 = m_transfers[j];
         if (td2.amount() > m_ignore_outputs_above || td2.amount() < m_ignore_outputs_below)
         {
@@ -10644,6 +11514,7 @@ void wallet2::light_wallet_get_unspent_outs()
   
   // Clear old outputs
   m_transfers.clear();
+  journal_transfers_from(0);
   
   for (const auto &o: ores.outputs) {
     bool spent = false;
@@ -10758,7 +11629,10 @@ void wallet2::light_wallet_get_unspent_outs()
       set_unspent(m_transfers.size()-1);
     m_key_images[td.m_key_image] = m_transfers.size()-1;
     m_pub_keys[td.get_public_key()] = m_transfers.size()-1;
+    journal_key(m_key_images, td.m_key_image);
+    journal_key(m_pub_keys, td.get_public_key());
   }
+  rebuild_balances();
 }
 
 bool wallet2::light_wallet_get_address_info(tools::COMMAND_RPC_GET_ADDRESS_INFO::response &response)
@@ -10883,7 +11757,7 @@ void wallet2::light_wallet_get_address_txs()
         }
       } else {
         if (std::find(payments_txs.begin(), payments_txs.end(), tx_hash) == payments_txs.end()) {
-          m_payments.emplace(tx_hash, payment);
+          journal_added(m_payments, *m_payments.emplace(tx_hash, payment));
           if (0 != m_callback) {
             m_callback->on_lw_money_received(t.height, payment.m_tx_hash, payment.m_amount);
           }
@@ -10932,6 +11806,7 @@ void wallet2::light_wallet_get_address_txs()
             ctd.m_block_height = t.height;
             ctd.m_timestamp = t.timestamp;
             m_confirmed_txs.emplace(tx_hash,ctd);
+            journal_key(m_confirmed_txs, tx_hash);
           }
           if (0 != m_callback)
           {
@@ -10948,6 +11823,7 @@ void wallet2::light_wallet_get_address_txs()
             confirmed_tx->second.m_amount_in = amount_sent;
             confirmed_tx->second.m_amount_out = amount_sent;
             confirmed_tx->second.m_change = 0;
+            journal_key(m_confirmed_txs, tx_hash);
           }
         }
       }
@@ -11254,7 +12130,7 @@ std::vector<wallet2::pending_tx> wallet2::create_transactions_2(std::vector<cryp
   // gather all dust and non-dust outputs belonging to specified subaddresses
   size_t num_nondust_outputs = 0;
   size_t num_dust_outputs = 0;
-  for (size_t i = 0; i < m_transfers.size(); ++i)
+  for (size_t i: get_unspent_transfers(subaddr_account, subaddr_indices, true))
   {
     const transfer_details& td = m_transfers[i];
     if (m_ignore_fractional_outputs && td.amount() < fractional_threshold)
@@ -11848,7 +12724,7 @@ std::vector<wallet2::pending_tx> wallet2::create_transactions_all(uint64_t below
 
   // gather all dust and non-dust outputs of specified subaddress (if any) and below specified threshold (if any)
   bool fund_found = false;
-  for (size_t i = 0; i < m_transfers.size(); ++i)
+  for (size_t i: get_unspent_transfers(subaddr_account, subaddr_indices, true))
   {
     const transfer_details& td = m_transfers[i];
     if (m_ignore_fractional_outputs && td.amount() < fractional_threshold)
@@ -12271,18 +13147,12 @@ uint64_t wallet2::get_upper_transaction_weight_limit()
 std::vector<size_t> wallet2::select_available_outputs(const std::function<bool(const transfer_details &td)> &f)
 {
   std::vector<size_t> outputs;
-  size_t n = 0;
-  for (transfer_container::const_iterator i = m_transfers.begin(); i != m_transfers.end(); ++i, ++n)
+  for (size_t n: get_unspent_transfers(boost::none, {}, true))
   {
-    if (is_spent(*i, false))
-      continue;
-    if (i->m_frozen)
-      continue;
-    if (i->m_key_image_partial)
-      continue;
-    if (!is_transfer_unlocked(*i))
+    const transfer_details &td = m_transfers[n];
+    if (td.m_key_image_partial)
       continue;
-    if (f(*i))
+    if (f(td))
       outputs.push_back(n);
   }
   return outputs;
@@ -12587,6 +13457,8 @@ void wallet2::set_tx_key(const crypto::hash &txid, const crypto::secret_key &tx_
   THROW_WALLET_EXCEPTION_IF(additional_tx_keys.size() != additional_tx_pub_keys.data.size(), error::wallet_internal_error, "The number of additional tx secret keys doesn't agree with the number of additional tx public keys in the blockchain" );
   m_tx_keys[txid] = tx_key;
   m_additional_tx_keys[txid] = additional_tx_keys;
+  journal_key(m_tx_keys, txid);
+  journal_key(m_additional_tx_keys, txid);
 }
 //----------------------------------------------------------------------------------------------------
 std::string wallet2::get_spend_proof(const crypto::hash &txid, const std::string &message)
@@ -13621,6 +14493,7 @@ uint64_t wallet2::get_approximate_blockchain_height() const
 void wallet2::set_tx_note(const crypto::hash &txid, const std::string &note)
 {
   m_tx_notes[txid] = note;
+  journal_key(m_tx_notes, txid);
 }
 
 std::string wallet2::get_tx_note(const crypto::hash &txid) const
@@ -14111,6 +14984,8 @@ uint64_t wallet2::import_key_images(const std::vector<std::pair<crypto::key_imag
     m_transfers[n + offset].m_key_image_known = true;
     m_transfers[n + offset].m_key_image_request = false;
     m_transfers[n + offset].m_key_image_partial = false;
+    journal_key(m_key_images, m_transfers[n + offset].m_key_image);
+    journal_transfer(n + offset);
   }
   PERF_TIMER_STOP(import_key_images_B);
 
@@ -14133,6 +15008,8 @@ uint64_t wallet2::import_key_images(const std::vector<std::pair<crypto::key_imag
     {
       transfer_details &td = m_transfers[n + offset];
       td.m_spent = daemon_resp.spent_status[n] != COMMAND_RPC_IS_KEY_IMAGE_SPENT::UNSPENT;
+      journal_transfer(n + offset);
+      update_balance(n + offset);
     }
   }
   spent = 0;
@@ -14311,6 +15188,7 @@ uint64_t wallet2::import_key_images(const std::vector<std::pair<crypto::key_imag
       {
         if (j->second.m_tx_hash == *spent_txid)
         {
+          journal_erased(m_payments, *j);
           m_payments.erase(j);
           break;
         }
@@ -14330,6 +15208,7 @@ uint64_t wallet2::import_key_images(const std::vector<std::pair<crypto::key_imag
       pd.m_block_height = 0;  // spent block height is unknown
       const crypto::hash &spent_txid = crypto::null_hash; // spent txid is unknown
       m_confirmed_txs.insert(std::make_pair(spent_txid, pd));
+      journal_key(m_confirmed_txs, spent_txid);
     }
     PERF_TIMER_STOP(import_key_images_G);
   }
@@ -14360,6 +15239,9 @@ bool wallet2::import_key_images(std::vector<crypto::key_image> key_images, size_
     td.m_key_image_request = false;
     td.m_key_image_partial = false;
     m_pub_keys[td.get_public_key()] = transfer_idx;
+    journal_key(m_key_images, td.m_key_image);
+    journal_key(m_pub_keys, td.get_public_key());
+    journal_transfer(transfer_idx);
   }
 
   return true;
@@ -14497,6 +15379,7 @@ void wallet2::process_background_cache(const background_sync_data_t &background_
         dbd.detached_confirmed_txs_dests.find(bgs_tx.first) != dbd.detached_confirmed_txs_dests.end())
     {
       m_confirmed_txs[bgs_tx.first].m_dests = std::move(dbd.detached_confirmed_txs_dests[bgs_tx.first]);
+      journal_key(m_confirmed_txs, bgs_tx.first);
     }
   }
 
@@ -14803,6 +15686,7 @@ void wallet2::import_payments(const payment_container &payments)
   {
     m_payments.emplace(p);
   }
+  journal_all(m_payments);
 }
 void wallet2::import_payments_out(const std::list<std::pair<crypto::hash,wallet2::confirmed_transfer_details>> &confirmed_payments)
 {
@@ -14811,6 +15695,7 @@ void wallet2::import_payments_out(const std::list<std::pair<crypto::hash,wallet2
   {
     m_confirmed_txs.emplace(p);
   }
+  journal_all(m_confirmed_txs);
 }
 
 std::tuple<size_t,crypto::hash,std::vector<crypto::hash>> wallet2::export_blockchain() const
@@ -14935,7 +15820,11 @@ size_t wallet2::import_outputs(const std::tuple<uint64_t, uint64_t, std::vector<
   if (offset + output_array.size() > m_transfers.size())
     m_transfers.resize(offset + output_array.size());
   else if (num_outputs < m_transfers.size())
+  {
     m_transfers.resize(num_outputs);
+    journal_transfers_from(num_outputs);
+  }
+  auto balances_rebuilder = epee::misc_utils::create_scope_leave_handler([this](){ rebuild_balances(); });
 
   for (size_t i = 0; i < output_array.size(); ++i)
   {
@@ -14958,6 +15847,7 @@ size_t wallet2::import_outputs(const std::tuple<uint64_t, uint64_t, std::vector<
 
       // copy anyway, since the comparison does not include ancillary fields which may have changed
       m_transfers[i + offset] = std::move(td);
+      journal_transfer(i + offset);
       continue;
     }
 
@@ -14987,7 +15877,10 @@ process:
 
     m_key_images[td.m_key_image] = i + offset;
     m_pub_keys[td.get_public_key()] = i + offset;
+    journal_key(m_key_images, td.m_key_image);
+    journal_key(m_pub_keys, td.get_public_key());
     m_transfers[i + offset] = std::move(td);
+    journal_transfer(i + offset);
   }
 
   return m_transfers.size();
@@ -15015,12 +15908,17 @@ size_t wallet2::import_outputs(const std::tuple<uint64_t, uint64_t, std::vector<
   if (offset + output_array.size() > m_transfers.size())
     m_transfers.resize(offset + output_array.size());
   else if (num_outputs < m_transfers.size())
+  {
     m_transfers.resize(num_outputs);
+    journal_transfers_from(num_outputs);
+  }
+  auto balances_rebuilder = epee::misc_utils::create_scope_leave_handler([this](){ rebuild_balances(); });
 
   for (size_t i = 0; i < output_array.size(); ++i)
   {
     exported_transfer_details etd = output_array[i];
     transfer_details &td = m_transfers[i + offset];
+    journal_transfer(i + offset);
 
     // setup td with "cheap" loaded data
     td.m_block_height = 0;
@@ -15091,6 +15989,8 @@ size_t wallet2::import_outputs(const std::tuple<uint64_t, uint64_t, std::vector<
 
     m_key_images[td.m_key_image] = i + offset;
     m_pub_keys[td.get_public_key()] = i + offset;
+    journal_key(m_key_images, td.m_key_image);
+    journal_key(m_pub_keys, td.get_public_key());
   }
 
   return m_transfers.size();
@@ -15226,6 +16126,7 @@ void wallet2::get_multisig_k(size_t idx, const std::unordered_set<rct::key> &use
     {
       nonce = k;
       memwipe(static_cast<rct::key *>(&k), sizeof(rct::key));  //CRITICAL: a nonce may only be used once!
+      journal_transfer(idx);
       return;
     }
   }
@@ -15342,6 +16243,7 @@ cryptonote::blobdata wallet2::export_multisig()
       const rct::multisig_kLRki kLRki = get_multisig_kLRki(n, td.m_multisig_k.back());
       info[n].m_LR.push_back({kLRki.L, kLRki.R});
     }
+    journal_transfer(n);
 
     info[n].m_signer = signer;
   }
@@ -15373,6 +16275,7 @@ void wallet2::update_multisig_rescan_info(const std::vector<std::vector<rct::key
     CHECK_AND_ASSERT_THROW_MES(n < pi.size(), "Bad pi size");
     td.m_multisig_info.push_back(pi[n]);
   }
+  journal_key(m_key_images, td.m_key_image);
   m_key_images.erase(td.m_key_image);
   td.m_key_image = get_multisig_composite_key_image(n);
   td.m_key_image_known = true;
@@ -15380,6 +16283,8 @@ void wallet2::update_multisig_rescan_info(const std::vector<std::vector<rct::key
   td.m_key_image_partial = false;
   td.m_multisig_k = multisig_k[n];
   m_key_images[td.m_key_image] = n;
+  journal_key(m_key_images, td.m_key_image);
+  journal_transfer(n);
 }
 //----------------------------------------------------------------------------------------------------
 size_t wallet2::import_multisig(std::vector<cryptonote::blobdata> blobs, bool refresh_after_import)
@@ -16136,6 +17041,7 @@ void wallet2::finish_rescan_bc_keep_key_images(uint64_t transfer_height, const c
                                   "Key images cache contains illegal transfer offset");
         m_transfers[it->second].m_key_image = it->first;
         m_transfers[it->second].m_key_image_known = true;
+        journal_transfer(it->second);
       }
 
       return;
@@ -70,6 +70,7 @@
 #include "common/password.h"
 #include "node_rpc_proxy.h"
 #include "message_store.h"
+#include "cache_journal.h"
 #include "wallet_light_rpc.h"
 #include "wallet_rpc_helpers.h"
 
@@ -1021,6 +1022,11 @@ private:
      * Normally the keys file is not overwritten when storing, except when force_rewrite_keys is true
      * or when `path` is a new wallet file.
      *
+     * Storing in place to a large cache only appends the changes to a "<path>.journal" file next to
+     * it, which belongs with the wallet files until the wallet is closed, when it is folded back into
+     * the cache file. Storing to a new path, or with force_rewrite_keys (as `change_password()` does),
+     * always writes the whole cache, with no journal.
+     *
      * \throw error::invalid_password If storing keys file and old password is incorrect
      */
     void store_to(const std::string &path, const epee::wipeable_string &password, bool force_rewrite_keys = false);
@@ -1147,6 +1153,36 @@ private:
     void refresh(bool trusted_daemon, uint64_t start_height, uint64_t & blocks_fetched, bool& received_money, bool check_pool = true, bool try_incremental = true, uint64_t max_blocks = std::numeric_limits<uint64_t>::max());
     bool refresh(bool trusted_daemon, uint64_t & blocks_fetched, bool& received_money, bool& ok);
 
+    // Where the last refresh spent its time. A stall is time one stage sat
+    // waiting on another: blocks not yet received from the daemon (network)
+    // or not yet parsed (parse), or the prefetcher holding a full window of
+    // blocks waiting for them to be processed (process).
+    struct refresh_stats
+    {
+      uint64_t batches = 0;
+      uint64_t network_stall_us = 0;
+      uint64_t parse_stall_us = 0;
+      uint64_t process_stall_us = 0;
+      uint64_t process_us = 0;
+      size_t depth = 0; // batches fetched ahead, as last adapted
+      uint64_t block_count = 0; // blocks asked for per batch, as last adapted
+    };
+    const refresh_stats &get_refresh_stats() const { return m_refresh_stats; }
+
+    // Shared scanning: blocks are fetched, parsed and have their tx extra
+    // parsed once, then several wallets scan them (see WalletManager).
+    // process_shared_blocks wants tx cache data made with this wallet's
+    // refresh type, and returns false if the blocks don't reach back to the
+    // wallet's top block, or don't go past it.
+    static void parse_blocks(const std::vector<cryptonote::block_complete_entry> &blocks, std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> &o_indices, std::vector<parsed_block> &parsed_blocks, bool &error);
+    static void cache_blocks_tx_data(const std::vector<parsed_block> &parsed_blocks, RefreshType refresh_type, std::vector<tx_cache_data> &tx_cache_data);
+    bool process_shared_blocks(uint64_t start_height, const std::vector<cryptonote::block_complete_entry> &blocks, const std::vector<parsed_block> &parsed_blocks, const std::vector<tx_cache_data> &tx_cache_data, uint64_t &blocks_added);
+    void get_scan_chain_history(std::list<crypto::hash> &ids) const { get_short_chain_history(ids); }
+    // Pulls only block hashes up to the height the wallet was restored or
+    // told to skip to, like refresh does, so it scans no block below it.
+    // Returns false if the wallet is still short of that height after.
+    bool fast_refresh_to_scan_height(bool trusted_daemon);
+
     void set_refresh_type(RefreshType refresh_type) { m_refresh_type = refresh_type; }
     RefreshType get_refresh_type() const { return m_refresh_type; }
 
@@ -1369,6 +1405,7 @@ private:
       a & m_background_sync_data;
     }
 
+    // fields added here also go in cache_rest, unless they are journaled
     BEGIN_SERIALIZE_OBJECT()
       MAGIC_FIELD("wownero wallet cache")
       VERSION_FIELD(2)
@@ -1503,6 +1540,8 @@ private:
     void enable_multisig(bool enable) { m_enable_multisig = enable; }
     bool is_mismatched_daemon_version_allowed() const { return m_allow_mismatched_daemon_version; }
     void allow_mismatched_daemon_version(bool allow_mismatch) { m_allow_mismatched_daemon_version = allow_mismatch; }
+    bool check_balance_cache() const { return m_check_balance_cache; }
+    void check_balance_cache(bool check) { m_check_balance_cache = check; }
 
     bool get_tx_key_cached(const crypto::hash &txid, crypto::secret_key &tx_key, std::vector<crypto::secret_key> &additional_tx_keys) const;
     void set_tx_key(const crypto::hash &txid, const crypto::secret_key &tx_key, const std::vector<crypto::secret_key> &additional_tx_keys, const boost::optional<cryptonote::account_public_address> &single_destination_subaddress = boost::none);
@@ -1847,6 +1886,56 @@ private:
     bool load_keys_buf(const std::string& keys_buf, const epee::wipeable_string& password);
     bool load_keys_buf(const std::string& keys_buf, const epee::wipeable_string& password, boost::optional<crypto::chacha_key>& keys_to_encrypt);
     void load_wallet_cache(const bool use_fs, const std::string& cache_buf = "");
+    void load_cache_journal(const crypto::chacha_iv &snapshot, uint64_t snapshot_size);
+    bool store_cache_journal();
+    void reset_cache_journal(const crypto::chacha_iv &snapshot, uint64_t snapshot_size);
+    void reset_cache_journal_state(uint64_t snapshot_size);
+    bool serialize_cache_rest(std::string &blob, bool loading);
+    // the fields of the cache which are not journaled per element, in the order
+    // of the full cache; it only reads from the wallet when storing
+    struct cache_rest
+    {
+      wallet2 &w;
+
+      BEGIN_SERIALIZE_OBJECT()
+        VERSION_FIELD(0)
+        FIELD(w.m_account_public_address)
+        FIELD(w.m_unconfirmed_txs)
+        FIELD(w.m_unconfirmed_payments)
+        FIELD(w.m_address_book)
+        FIELD(w.m_scanned_pool_txs[0])
+        FIELD(w.m_scanned_pool_txs[1])
+        FIELD(w.m_subaddress_labels)
+        FIELD(w.m_attributes)
+        FIELD(w.m_account_tags)
+        FIELD(w.m_ring_history_saved)
+        FIELD(w.m_last_block_reward)
+        FIELD(w.m_tx_device)
+        FIELD(w.m_device_last_key_image_sync)
+        FIELD(w.m_rpc_client_secret_key)
+        FIELD(w.m_has_ever_refreshed_from_node)
+        FIELD(w.m_background_sync_data)
+      END_SERIALIZE()
+    };
+    bool apply_cache_journal_frame(cache_journal::frame &f);
+    static bool fold_cache_journal(const std::string &snapshot, std::vector<cache_journal::frame> &frames, std::string &cache_data);
+    // containers journaled per element, besides m_blockchain and m_transfers; the order is part of the journal format
+    auto journaled_containers() { return std::tie(m_key_images, m_pub_keys, m_payments, m_confirmed_txs, m_tx_keys, m_tx_notes, m_additional_tx_keys, m_subaddresses, m_cold_key_images); }
+    // every change to m_transfers and the journaled containers goes through
+    // one of these, or the next store misses it
+    void journal_transfer(size_t idx) { if (m_cache_journal_ready) m_cache_journal_transfers.touch(idx); }
+    void journal_transfers_from(size_t idx) { if (m_cache_journal_ready) m_cache_journal_transfers.touch_from(idx); }
+    template<typename C, typename F> void journal_container(const C &c, F f)
+    {
+      if (!m_cache_journal_ready)
+        return;
+      size_t i = 0;
+      std::apply([&](const auto&... jc) { ((static_cast<const void*>(&jc) == static_cast<const void*>(&c) ? f(m_cache_journal_sets[i]) : void(), ++i), ...); }, journaled_containers());
+    }
+    template<typename C, typename K> void journal_key(const C &c, const K &k) { journal_container(c, [&k](cache_journal::set_section &s) { s.touch(k); }); }
+    template<typename C> void journal_all(const C &c) { journal_container(c, [](cache_journal::set_section &s) { s.touch_all(); }); }
+    template<typename C, typename E> void journal_added(const C &c, E &e) { journal_container(c, [&e](cache_journal::set_section &s) { s.add((typename C::value_type&)e); }); }
+    template<typename C, typename E> void journal_erased(const C &c, E &e) { journal_container(c, [&e](cache_journal::set_section &s) { s.erase((typename C::value_type&)e); }); }
     void process_new_transaction(const crypto::hash &txid, const cryptonote::transaction& tx, const std::vector<uint64_t> &o_indices, uint64_t height, uint8_t block_version, uint64_t ts, bool miner_tx, bool pool, bool double_spend_seen, const tx_cache_data &tx_cache_data, std::map<std::pair<uint64_t, uint64_t>, size_t> *output_tracker_cache = NULL, bool ignore_callbacks = false);
     bool should_skip_block(const cryptonote::block &b, uint64_t height) const;
     void process_new_blockchain_entry(const cryptonote::block& b, const cryptonote::block_complete_entry& bche, const parsed_block &parsed_block, const crypto::hash& bl_id, uint64_t height, const std::vector<tx_cache_data> &tx_cache_data, size_t tx_cache_data_offset, std::map<std::pair<uint64_t, uint64_t>, size_t> *output_tracker_cache = NULL);
@@ -1864,11 +1953,14 @@ private:
      * that this function deletes data that is not useful for background syncing
      */
     void clear_user_data();
-    void pull_blocks(bool first, bool try_incremental, uint64_t start_height, uint64_t& blocks_start_height, const std::list<crypto::hash> &short_chain_history, std::vector<cryptonote::block_complete_entry> &blocks, std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> &o_indices, uint64_t &current_height);
+    void pull_blocks(bool first, bool try_incremental, uint64_t start_height, uint64_t& blocks_start_height, const std::list<crypto::hash> &short_chain_history, std::vector<cryptonote::block_complete_entry> &blocks, std::vector<cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices> &o_indices, uint64_t &current_height, uint64_t max_block_count = 0);
     void pull_hashes(uint64_t start_height, uint64_t& blocks_start_height, const std::list<crypto::hash> &short_chain_history, std::vector<crypto::hash> &hashes);
     void fast_refresh(uint64_t stop_height, uint64_t &blocks_start_height, std::list<crypto::hash> &short_chain_history, bool force = false);
-    void pull_and_parse_next_blocks(bool first, bool try_incremental, uint64_t start_height, uint64_t &blocks_start_height, std::list<crypto::hash> &short_chain_history, const std::vector<cryptonote::block_complete_entry> &prev_blocks, const std::vector<parsed_block> &prev_parsed_blocks, std::vector<cryptonote::block_complete_entry> &blocks, std::vector<parsed_block> &parsed_blocks, bool &last, bool &error, std::exception_ptr &exception);
+    struct blocks_batch;
+    struct refresh_window;
+    void check_block_versions(uint64_t start_height, const std::vector<parsed_block> &parsed_blocks) const;
     void process_parsed_blocks(uint64_t start_height, const std::vector<cryptonote::block_complete_entry> &blocks, const std::vector<parsed_block> &parsed_blocks, uint64_t& blocks_added, std::map<std::pair<uint64_t, uint64_t>, size_t> *output_tracker_cache = NULL);
+    void process_cached_blocks(uint64_t start_height, const std::vector<cryptonote::block_complete_entry> &blocks, const std::vector<parsed_block> &parsed_blocks, size_t first, std::vector<tx_cache_data> &tx_cache_data, uint64_t& blocks_added, std::map<std::pair<uint64_t, uint64_t>, size_t> *output_tracker_cache = NULL);
     bool accept_pool_tx_for_processing(const crypto::hash &txid);
     void process_unconfirmed_transfer(bool incremental, const crypto::hash &txid, wallet2::unconfirmed_transfer_details &tx_details, bool seen_in_pool, std::chrono::system_clock::time_point now, bool refreshed);
     void process_pool_info_extent(const cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::response &res, std::vector<std::tuple<cryptonote::transaction, crypto::hash, bool>> &process_txs, bool refreshed);
@@ -1887,7 +1979,6 @@ private:
     void check_acc_out_precomp(const cryptonote::tx_out &o, const crypto::key_derivation &derivation, const std::vector<crypto::key_derivation> &additional_derivations, size_t i, tx_scan_info_t &tx_scan_info) const;
     void check_acc_out_precomp(const cryptonote::tx_out &o, const crypto::key_derivation &derivation, const std::vector<crypto::key_derivation> &additional_derivations, size_t i, const is_out_data *is_out_data, tx_scan_info_t &tx_scan_info) const;
     void check_acc_out_precomp_once(const cryptonote::tx_out &o, const crypto::key_derivation &derivation, const std::vector<crypto::key_derivation> &additional_derivations, size_t i, const is_out_data *is_out_data, tx_scan_info_t &tx_scan_info, bool &already_seen) const;
-    void parse_block_round(const cryptonote::blobdata &blob, cryptonote::block &bl, crypto::hash &bl_id, bool &error) const;
     uint64_t get_upper_transaction_weight_limit();
     std::vector<uint64_t> get_unspent_amounts_vector(bool strict);
     uint64_t get_dynamic_base_fee_estimate();
@@ -1897,6 +1988,15 @@ private:
     void set_unspent(size_t idx);
     bool is_spent(const transfer_details &td, bool strict = true) const;
     bool is_spent(size_t idx, bool strict = true) const;
+    void update_balance(size_t idx);
+    void truncate_balances(size_t size);
+    void rebuild_balances();
+    void sync_balances();
+    std::vector<size_t> get_unspent_transfers(const boost::optional<uint32_t> &subaddr_account, const std::set<uint32_t> &subaddr_indices, bool unlocked, uint64_t min_amount = 0);
+    void account_balance_entry(size_t idx, bool add);
+    void add_unconfirmed_balance_per_subaddress(std::map<uint32_t, uint64_t> &amount_per_subaddr, uint32_t index_major) const;
+    std::map<uint32_t, uint64_t> balance_per_subaddress_scan(uint32_t index_major, bool strict) const;
+    std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> unlocked_balance_per_subaddress_scan(uint32_t index_major, bool strict);
     void get_outs(std::vector<std::vector<get_outs_entry>> &outs, const std::vector<size_t> &selected_transfers, size_t fake_outputs_count, bool rct, std::unordered_set<crypto::public_key> &valid_public_keys_cache);
     void get_outs(std::vector<std::vector<get_outs_entry>> &outs, const std::vector<size_t> &selected_transfers, size_t fake_outputs_count, std::vector<uint64_t> &rct_offsets, std::unordered_set<crypto::public_key> &valid_public_keys_cache);
     bool tx_add_fake_output(std::vector<std::vector<tools::wallet2::get_outs_entry>> &outs, uint64_t global_index, const crypto::public_key& tx_public_key, const rct::key& mask, uint64_t real_index, bool unlocked, std::unordered_set<crypto::public_key> &valid_public_keys_cache) const;
@@ -1941,6 +2041,7 @@ private:
     uint64_t get_segregation_fork_height() const;
 
     void cache_tx_data(const cryptonote::transaction& tx, const crypto::hash &txid, tx_cache_data &tx_cache_data) const;
+    static void cache_tx_data(const cryptonote::transaction& tx, const crypto::hash &txid, tx_cache_data &tx_cache_data, RefreshType refresh_type);
     std::shared_ptr<std::map<std::pair<uint64_t, uint64_t>, size_t>> create_output_tracker_cache() const;
 
     void init_type(hw::device::device_type device_type);
@@ -2122,6 +2223,44 @@ private:
     bool m_background_syncing;
     bool m_processing_background_cache;
     background_sync_data_t m_background_sync_data;
+
+    cache_journal::journal m_cache_journal;
+    bool m_cache_journal_ready;
+    uint64_t m_cache_journal_min_snapshot_size;
+    uint64_t m_cache_journal_rest;
+    cache_journal::hashchain_section m_cache_journal_blockchain;
+    cache_journal::sequence_section m_cache_journal_transfers;
+    std::vector<cache_journal::set_section> m_cache_journal_sets;
+
+    // What each transfer currently adds to the running balances, indexed
+    // like m_transfers, so it can be taken back out when the transfer changes
+    struct balance_entry
+    {
+      bool counted[2]; // by strict
+      cryptonote::subaddress_index index;
+      uint64_t amount;
+      uint64_t unlocked_at; // first height at which a height locked output is spendable
+      uint64_t unlock_height; // unlock height as reported to the user
+      bool time_locked;
+    };
+    // Running balances of one subaddress. Height locked outputs are kept in an
+    // unlock schedule so the locked part is what lies above the current height;
+    // the rare time locked outputs are checked one by one.
+    struct balance_totals
+    {
+      uint64_t count = 0;
+      uint64_t amount = 0;
+      std::map<std::pair<uint64_t, uint64_t>, std::pair<uint64_t, uint64_t>> schedule; // (unlocked_at, unlock_height) -> (amount, count)
+      std::set<size_t> time_locked;
+      // coin selection indexes, only kept for the non-strict totals
+      std::set<std::pair<uint64_t, size_t>> by_amount; // (amount, transfer index)
+      std::set<std::pair<uint64_t, size_t>> by_unlock; // (unlocked_at, transfer index), height locked only
+    };
+    std::vector<balance_entry> m_balance_entries;
+    std::map<uint32_t, std::map<uint32_t, balance_totals>> m_balance_totals[2]; // by strict, major, minor
+    bool m_check_balance_cache;
+
+    refresh_stats m_refresh_stats;
   };
 }
 BOOST_CLASS_VERSION(tools::wallet2, 31)
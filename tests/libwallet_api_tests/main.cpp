@@ -1030,6 +1030,82 @@ TEST_F(WalletTest2, WalletCallbackNewBlock)
 
 }
 
+TEST_F(WalletTest2, SharedScanSkipsBlocksBelowRestoreHeight)
+{
+    Monero::Wallet * wallet1 = wmgr->openWallet(TESTNET_WALLET1_NAME, TESTNET_WALLET_PASS, Monero::NetworkType::TESTNET);
+    // make sure testnet daemon is running
+    ASSERT_TRUE(wallet1->init(TESTNET_DAEMON_ADDRESS, 0));
+    ASSERT_TRUE(wallet1->refresh());
+    const uint64_t daemon_height = wallet1->daemonBlockChainHeight();
+    ASSERT_TRUE(daemon_height > 20);
+
+    // a wallet restored near the top, which has no block at all yet
+    Monero::Wallet * wallet2 = wmgr->createWallet(WALLET_NAME, "", WALLET_LANG, Monero::NetworkType::TESTNET);
+    const std::string seed = wallet2->seed();
+    wmgr->closeWallet(wallet2);
+    Utils::deleteWallet(WALLET_NAME);
+    const uint64_t restore_height = daemon_height - 10;
+    wallet2 = wmgr->recoveryWallet(WALLET_NAME, seed, Monero::NetworkType::TESTNET, restore_height);
+    ASSERT_TRUE(wallet2->status() == Monero::Wallet::Status_Ok);
+    ASSERT_TRUE(wallet2->init(TESTNET_DAEMON_ADDRESS, 0));
+
+    wmgr->setDaemonAddress(TESTNET_DAEMON_ADDRESS);
+    ASSERT_TRUE(wmgr->addSharedScanWallet(wallet1));
+    ASSERT_TRUE(wmgr->addSharedScanWallet(wallet2));
+    const uint64_t blocks_fetched = wmgr->scanSharedWallets();
+
+    // the group is fetched from the restore height, not from genesis
+    const uint64_t top_height = wallet1->daemonBlockChainHeight();
+    ASSERT_TRUE(blocks_fetched <= top_height - restore_height + 1);
+    for (Monero::Wallet *wallet: {wallet1, wallet2})
+    {
+        uint64_t height, blocks_scanned;
+        std::string error;
+        ASSERT_TRUE(wmgr->sharedScanStatus(wallet, height, blocks_scanned, error));
+        ASSERT_TRUE(error.empty());
+        ASSERT_TRUE(height == top_height);
+        ASSERT_TRUE(wallet->blockChainHeight() == top_height);
+    }
+
+    ASSERT_TRUE(wmgr->closeWallet(wallet2));
+    ASSERT_TRUE(wmgr->closeWallet(wallet1));
+    ASSERT_FALSE(wmgr->removeSharedScanWallet(wallet1));
+}
+
+TEST_F(WalletTest2, SharedScanLetsWalletsBeClosedWhileScanning)
+{
+    Monero::Wallet * wallet1 = wmgr->openWallet(TESTNET_WALLET1_NAME, TESTNET_WALLET_PASS, Monero::NetworkType::TESTNET);
+    // make sure testnet daemon is running
+    ASSERT_TRUE(wallet1->init(TESTNET_DAEMON_ADDRESS, 0));
+
+    // a wallet restored from genesis, so there is a long scan to run
+    Monero::Wallet * wallet2 = wmgr->createWallet(WALLET_NAME, "", WALLET_LANG, Monero::NetworkType::TESTNET);
+    const std::string seed = wallet2->seed();
+    wmgr->closeWallet(wallet2);
+    Utils::deleteWallet(WALLET_NAME);
+    wallet2 = wmgr->recoveryWallet(WALLET_NAME, seed, Monero::NetworkType::TESTNET, 0);
+    ASSERT_TRUE(wallet2->init(TESTNET_DAEMON_ADDRESS, 0));
+
+    wmgr->setDaemonAddress(TESTNET_DAEMON_ADDRESS);
+    ASSERT_TRUE(wmgr->addSharedScanWallet(wallet1));
+    ASSERT_TRUE(wmgr->addSharedScanWallet(wallet2));
+    boost::thread scanner([this]() { wmgr->scanSharedWallets(); });
+
+    // none of these wait for the whole scan, closing waits for the current batch at most
+    uint64_t height, blocks_scanned;
+    std::string error;
+    ASSERT_TRUE(wmgr->sharedScanStatus(wallet2, height, blocks_scanned, error));
+    ASSERT_TRUE(wmgr->removeSharedScanWallet(wallet2));
+    ASSERT_FALSE(wmgr->sharedScanStatus(wallet2, height, blocks_scanned, error));
+    ASSERT_TRUE(wmgr->closeWallet(wallet2));
+    scanner.join();
+
+    ASSERT_TRUE(wmgr->sharedScanStatus(wallet1, height, blocks_scanned, error));
+    ASSERT_TRUE(error.empty());
+    ASSERT_TRUE(height == wallet1->daemonBlockChainHeight());
+    ASSERT_TRUE(wmgr->closeWallet(wallet1));
+}
+
 TEST_F(WalletManagerMainnetTest, CreateOpenAndRefreshWalletMainNetSync)
 {
 
@@ -0,0 +1,294 @@
+// Copyright (c) 2014-2022, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_basic/hardfork.h"
+#include "ringct/rctOps.h"
+#include "blockchain_db/lmdb/db_lmdb.h"
+
+enum test_blockchain_db_op
+{
+  db_add_block,
+  db_get_output_key,
+  db_has_key_image_hit,
+  db_has_key_image_miss,
+  db_get_blocks_from,
+  db_get_output_distribution,
+  db_pop_block,
+};
+
+// named, so the test names show them
+enum test_blockchain_db_sync_mode
+{
+  db_sync_safe = DBF_SAFE,
+  db_sync_fast = DBF_FAST,
+  db_sync_fastest = DBF_FASTEST,
+};
+
+// Runs one BlockchainDB operation on a synthetic chain of the given size in
+// a temporary BlockchainLMDB, opened in the given sync mode. The txes have
+// random keys, key images and commitments and no signatures, which the
+// database doesn't look at. Their outputs are RingCT ones, while each miner
+// tx has a single pre-RingCT output of MINER_OUTPUT_AMOUNT, which
+// get_output_distribution is timed on. Every block is added in a write txn
+// of its own, as when blocks come in one at a time. The blocks added are
+// all made in init, and popping blocks starts from a chain long enough for
+// every call, so only the database work is timed.
+template<test_blockchain_db_op op, test_blockchain_db_sync_mode sync_mode, size_t blocks, size_t txs_per_block, size_t inputs_per_tx, size_t outputs_per_tx>
+class test_blockchain_db
+{
+public:
+  static const size_t loop_count = op == db_add_block || op == db_pop_block || op == db_get_blocks_from || op == db_get_output_distribution ? 100 : 10000;
+
+  ~test_blockchain_db()
+  {
+    if (m_db)
+    {
+      try { m_db->close(); }
+      catch (...) {}
+      m_db.reset();
+    }
+    if (!m_dir.empty())
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(m_dir, ec);
+    }
+  }
+
+  bool init(size_t calls)
+  {
+    static_assert(blocks > 0, "the chain needs at least one block");
+    static_assert(op != db_get_output_key || txs_per_block * outputs_per_tx > 0, "the chain needs RingCT outputs");
+
+    m_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("performance-tests-db-%%%%-%%%%-%%%%");
+    m_db.reset(new cryptonote::BlockchainLMDB());
+    m_hardfork.reset(new cryptonote::HardFork(*m_db, 1, 0));
+    try
+    {
+      m_db->open(m_dir.string(), sync_mode);
+      m_hardfork->init();
+      m_db->set_hard_fork(m_hardfork.get());
+
+      // built in batches, which only the timed additions don't use
+      const size_t chain_size = op == db_pop_block ? std::max(blocks, calls + 1) : blocks;
+      crypto::hash prev_id = crypto::null_hash;
+      for (size_t added = 0; added < chain_size; )
+      {
+        const size_t batch = std::min<size_t>(chain_size - added, 1000);
+        m_db->batch_start(batch);
+        for (size_t i = 0; i < batch; ++i)
+        {
+          const synthetic_block sb = make_block(added + i, prev_id);
+          add_block(sb);
+          prev_id = cryptonote::get_block_hash(sb.blk.first);
+          for (const auto &tx: sb.txs)
+            for (const auto &in: tx.first.vin)
+              m_key_images.push_back(boost::get<cryptonote::txin_to_key>(in).k_image);
+          m_num_outputs += txs_per_block * outputs_per_tx;
+        }
+        m_db->batch_stop();
+        added += batch;
+      }
+
+      if (op == db_add_block)
+      {
+        m_new_blocks.reserve(calls);
+        for (size_t i = 0; i < calls; ++i)
+        {
+          m_new_blocks.push_back(make_block(chain_size + i, prev_id));
+          prev_id = cryptonote::get_block_hash(m_new_blocks.back().blk.first);
+        }
+      }
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << "Failed to build the synthetic chain: " << e.what() << std::endl;
+      return false;
+    }
+
+    // what the lookups ask for, picked beforehand so picking isn't timed
+    m_lookups.resize(loop_count);
+    for (uint64_t &lookup: m_lookups)
+      lookup = crypto::rand<uint64_t>();
+    m_missing_key_images.resize(loop_count);
+    for (crypto::key_image &ki: m_missing_key_images)
+      ki = crypto::rand<crypto::key_image>();
+    m_call = 0;
+    return true;
+  }
+
+  bool test()
+  {
+    const uint64_t lookup = m_lookups[m_call % m_lookups.size()];
+    const size_t call = m_call++;
+    try
+    {
+      switch (op)
+      {
+        case db_add_block:
+        {
+          cryptonote::db_wtxn_guard guard(m_db.get());
+          add_block(m_new_blocks[call]);
+          return true;
+        }
+        case db_get_output_key:
+          return m_db->get_output_key(0, lookup % m_num_outputs, true).height < m_db->height();
+        case db_has_key_image_hit:
+          return inputs_per_tx == 0 || m_db->has_key_image(m_key_images[lookup % m_key_images.size()]);
+        case db_has_key_image_miss:
+          return !m_db->has_key_image(m_missing_key_images[call % m_missing_key_images.size()]);
+        case db_get_blocks_from:
+        {
+          std::vector<std::pair<std::pair<cryptonote::blobdata, crypto::hash>, std::vector<std::pair<crypto::hash, cryptonote::blobdata>>>> bs;
+          return m_db->get_blocks_from(lookup % m_db->height(), 1, 100, std::numeric_limits<size_t>::max(), std::numeric_limits<size_t>::max(), bs, false, false, true) && !bs.empty();
+        }
+        case db_get_output_distribution:
+        {
+          std::vector<uint64_t> distribution;
+          uint64_t base;
+          return m_db->get_output_distribution(MINER_OUTPUT_AMOUNT, 0, m_db->height() - 1, distribution, base) && distribution.size() == m_db->height();
+        }
+        case db_pop_block:
+        {
+          cryptonote::block blk;
+          std::vector<cryptonote::transaction> txs;
+          cryptonote::db_wtxn_guard guard(m_db.get());
+          m_db->pop_block(blk, txs);
+          return txs.size() == txs_per_block;
+        }
+        default:
+          return false;
+      }
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << "BlockchainDB operation failed: " << e.what() << std::endl;
+      return false;
+    }
+  }
+
+private:
+  static const uint64_t MINER_OUTPUT_AMOUNT = 1000;
+
+  struct synthetic_block
+  {
+    std::pair<cryptonote::block, cryptonote::blobdata> blk; // and its blob
+    std::vector<std::pair<cryptonote::transaction, cryptonote::blobdata>> txs;
+  };
+
+  cryptonote::transaction make_tx(uint64_t height, bool miner, cryptonote::blobdata &blob)
+  {
+    cryptonote::transaction tx;
+    tx.version = miner ? 1 : 2;
+    tx.unlock_time = 0;
+    if (miner)
+    {
+      tx.vin.push_back(cryptonote::txin_gen{(size_t)height});
+    }
+    else
+    {
+      for (size_t i = 0; i < inputs_per_tx; ++i)
+      {
+        cryptonote::txin_to_key in;
+        in.amount = 0;
+        in.key_offsets.push_back(0);
+        in.k_image = crypto::rand<crypto::key_image>();
+        tx.vin.push_back(in);
+      }
+    }
+    for (size_t i = 0; i < (miner ? 1 : outputs_per_tx); ++i)
+    {
+      cryptonote::tx_out out;
+      out.amount = miner ? MINER_OUTPUT_AMOUNT : 0;
+      out.target = cryptonote::txout_to_key(crypto::rand<crypto::public_key>());
+      tx.vout.push_back(out);
+    }
+    if (!miner)
+      tx.rct_signatures.type = rct::RCTTypeNull;
+
+    // parsed back for the sizes the database splits the blob with. The
+    // commitments aren't serialized for RCTTypeNull, so they're set after.
+    blob = cryptonote::tx_to_blob(tx);
+    cryptonote::transaction parsed;
+    if (!cryptonote::parse_and_validate_tx_from_blob(blob, parsed))
+      throw std::runtime_error("Failed to parse a synthetic tx");
+    if (!miner)
+    {
+      parsed.rct_signatures.outPk.resize(outputs_per_tx);
+      for (rct::ctkey &pk: parsed.rct_signatures.outPk)
+        pk.mask = rct::pkGen();
+    }
+    return parsed;
+  }
+
+  synthetic_block make_block(uint64_t height, const crypto::hash &prev_id)
+  {
+    synthetic_block sb;
+    sb.txs.resize(txs_per_block);
+    cryptonote::block &blk = sb.blk.first;
+    blk.major_version = 1;
+    blk.minor_version = 1;
+    blk.timestamp = height;
+    blk.prev_id = prev_id;
+    blk.nonce = 0;
+    cryptonote::blobdata miner_blob;
+    blk.miner_tx = make_tx(height, true, miner_blob);
+    for (auto &tx: sb.txs)
+    {
+      tx.first = make_tx(height, false, tx.second);
+      blk.tx_hashes.push_back(cryptonote::get_transaction_hash(tx.first));
+    }
+    sb.blk.second = cryptonote::block_to_blob(blk);
+    return sb;
+  }
+
+  void add_block(const synthetic_block &sb)
+  {
+    const uint64_t height = m_db->height();
+    m_db->add_block(sb.blk, sb.blk.second.size(), sb.blk.second.size(), height + 1, MINER_OUTPUT_AMOUNT, sb.txs);
+  }
+
+  boost::filesystem::path m_dir;
+  std::unique_ptr<cryptonote::BlockchainDB> m_db;
+  std::unique_ptr<cryptonote::HardFork> m_hardfork;
+  std::vector<synthetic_block> m_new_blocks; // added by the timed calls
+  std::vector<crypto::key_image> m_key_images; // spent in the chain
+  std::vector<crypto::key_image> m_missing_key_images;
+  std::vector<uint64_t> m_lookups;
+  uint64_t m_num_outputs = 0; // RingCT ones
+  size_t m_call;
+};
@@ -62,6 +62,7 @@
 #include "bulletproof.h"
 #include "bulletproof_plus.h"
 #include "crypto_ops.h"
+#include "blockchain_db.h"
 #include "multiexp.h"
 #include "sig_mlsag.h"
 #include "sig_clsag.h"
@@ -314,6 +315,23 @@ int main(int argc, char** argv)
   TEST_PERFORMANCE1(filter, p, test_crypto_ops, op_zeroCommitUncached);
   TEST_PERFORMANCE1(filter, p, test_crypto_ops, op_zeroCommitCached);
 
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_add_block, db_sync_safe, 1000, 10, 2, 2); // on 1000 blocks of 10 txes with 2 inputs and 2 outputs
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_add_block, db_sync_fast, 1000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_add_block, db_sync_fastest, 1000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_add_block, db_sync_fast, 1000, 100, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_get_output_key, db_sync_fast, 1000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_get_output_key, db_sync_fast, 10000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_has_key_image_hit, db_sync_fast, 1000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_has_key_image_hit, db_sync_fast, 10000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_has_key_image_miss, db_sync_fast, 1000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_has_key_image_miss, db_sync_fast, 10000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_get_blocks_from, db_sync_fast, 1000, 10, 2, 2); // 100 blocks per call
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_get_output_distribution, db_sync_fast, 1000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_get_output_distribution, db_sync_fast, 10000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_pop_block, db_sync_safe, 1000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_pop_block, db_sync_fast, 1000, 10, 2, 2);
+  TEST_PERFORMANCE6(filter, p, test_blockchain_db, db_pop_block, db_sync_fastest, 1000, 10, 2, 2);
+
   TEST_PERFORMANCE2(filter, p, test_multiexp, multiexp_bos_coster, 2);
   TEST_PERFORMANCE2(filter, p, test_multiexp, multiexp_bos_coster, 4);
   TEST_PERFORMANCE2(filter, p, test_multiexp, multiexp_bos_coster, 8);
@@ -75,6 +75,19 @@ struct Params
   unsigned loop_multiplier;
 };
 
+// tests which prepare something for each call can take the number of calls
+template <typename T>
+auto init_test(T &test, size_t calls, int) -> decltype(test.init(calls))
+{
+  return test.init(calls);
+}
+
+template <typename T>
+bool init_test(T &test, size_t calls, long)
+{
+  return test.init();
+}
+
 template <typename T>
 class test_runner
 {
@@ -91,7 +104,7 @@ public:
     static_assert(0 < T::loop_count, "T::loop_count must be greater than 0");
 
     T test;
-    if (!test.init())
+    if (!init_test(test, T::loop_count * m_params.loop_multiplier, 0))
       return false;
 
     performance_timer timer;
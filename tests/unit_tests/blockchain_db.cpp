@@ -30,6 +30,7 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <cstdio>
 #include <iostream>
+#include <set>
 #include <chrono>
 #include <thread>
 
@@ -38,6 +39,7 @@
 #include "string_tools.h"
 #include "blockchain_db/blockchain_db.h"
 #include "blockchain_db/lmdb/db_lmdb.h"
+#include "common/pruning.h"
 #include "cryptonote_basic/cryptonote_format_utils.h"
 
 using namespace cryptonote;
@@ -149,6 +151,25 @@ std::string h2b(const std::string& s)
   return result;
 }
 
+// a block with only a miner tx, whose prunable part is empty, for tests
+// which need long chains
+std::pair<block, blobdata> make_block(uint64_t height, const crypto::hash &prev_id)
+{
+  block b;
+  b.major_version = 1;
+  b.minor_version = 0;
+  b.timestamp = height;
+  b.prev_id = prev_id;
+  b.nonce = 0;
+  txin_gen in;
+  in.height = height;
+  b.miner_tx.version = 2;
+  b.miner_tx.unlock_time = height + CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW;
+  b.miner_tx.vin.push_back(in);
+  b.miner_tx.rct_signatures.type = rct::RCTTypeNull;
+  return std::make_pair(b, block_to_blob(b));
+}
+
 template <typename T>
 class BlockchainDBTest : public testing::Test
 {
@@ -341,4 +362,667 @@ TYPED_TEST(BlockchainDBTest, RetrieveBlockData)
   ASSERT_HASH_EQ(get_block_hash(this->m_blocks[1].first), hashes[1]);
 }
 
+TYPED_TEST(BlockchainDBTest, GetOutputKeys)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  db_wtxn_guard guard(this->m_db);
+
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+
+  // every output of every amount, in reverse order, with a duplicate and
+  // a missing one thrown in
+  std::vector<std::pair<uint64_t, uint64_t>> requests;
+  for (const auto &bl : this->m_blocks)
+    for (const auto &out : bl.first.miner_tx.vout)
+      for (uint64_t i = 0; i < this->m_db->get_num_outputs(out.amount); ++i)
+        requests.push_back({out.amount, i});
+  std::sort(requests.begin(), requests.end());
+  requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+  ASSERT_FALSE(requests.empty());
+  std::reverse(requests.begin(), requests.end());
+  requests.push_back(requests.front());
+  requests.push_back({requests.front().first, 1000000});
+
+  std::vector<output_data_t> outputs;
+  std::vector<bool> found;
+  ASSERT_NO_THROW(this->m_db->get_output_keys(epee::to_span(requests), outputs, found));
+  ASSERT_EQ(requests.size(), outputs.size());
+  ASSERT_EQ(requests.size(), found.size());
+  ASSERT_FALSE(found.back());
+  for (size_t i = 0; i + 1 < requests.size(); ++i)
+  {
+    ASSERT_TRUE(found[i]);
+    const output_data_t expected = this->m_db->get_output_key(requests[i].first, requests[i].second);
+    ASSERT_HASH_EQ(expected.pubkey, outputs[i].pubkey);
+    ASSERT_HASH_EQ(expected.commitment, outputs[i].commitment);
+    ASSERT_EQ(expected.unlock_time, outputs[i].unlock_time);
+    ASSERT_EQ(expected.height, outputs[i].height);
+  }
+}
+
+TYPED_TEST(BlockchainDBTest, OutputDistribution)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  db_wtxn_guard guard(this->m_db);
+
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+
+  // the index must agree with the outputs themselves, before and after a pop
+  const auto check = [this](uint64_t db_height) {
+    std::set<uint64_t> amounts;
+    for (const auto &bl : this->m_blocks)
+      for (const auto &out : bl.first.miner_tx.vout)
+        if (out.amount)
+          amounts.insert(out.amount);
+    ASSERT_FALSE(amounts.empty());
+    for (uint64_t amount: amounts)
+    {
+      std::vector<uint64_t> expected(db_height, 0);
+      for (uint64_t i = 0; i < this->m_db->get_num_outputs(amount); ++i)
+        for (uint64_t h = this->m_db->get_output_key(amount, i).height; h < db_height; ++h)
+          ++expected[h];
+      for (uint64_t from = 0; from < db_height; ++from)
+      {
+        std::vector<uint64_t> distribution;
+        uint64_t base;
+        ASSERT_TRUE(this->m_db->get_output_distribution(amount, from, 0, distribution, base));
+        ASSERT_EQ(std::vector<uint64_t>(expected.begin() + from, expected.end()), distribution);
+        ASSERT_EQ(from ? expected[from - 1] : 0, base);
+        ASSERT_TRUE(this->m_db->get_output_distribution(amount, from, from, distribution, base));
+        ASSERT_EQ(std::vector<uint64_t>(1, expected[from]), distribution);
+      }
+    }
+  };
+  check(2);
+
+  block b;
+  std::vector<transaction> txs;
+  ASSERT_NO_THROW(this->m_db->pop_block(b, txs));
+  check(1);
+}
+
+TYPED_TEST(BlockchainDBTest, BlockPow)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+
+  db_wtxn_guard guard(this->m_db);
+
+  // two blocks at the same height, as for an alternative chain
+  crypto::hash pow;
+  ASSERT_FALSE(this->m_db->get_block_pow(0, crypto::hash{{1}}, pow));
+  ASSERT_NO_THROW(this->m_db->add_block_pow(0, crypto::hash{{1}}, crypto::hash{{10}}));
+  ASSERT_NO_THROW(this->m_db->add_block_pow(0, crypto::hash{{2}}, crypto::hash{{20}}));
+  ASSERT_NO_THROW(this->m_db->add_block_pow(0, crypto::hash{{2}}, crypto::hash{{20}}));
+  ASSERT_NO_THROW(this->m_db->add_block_pow(1, crypto::hash{{3}}, crypto::hash{{30}}));
+  ASSERT_TRUE(this->m_db->get_block_pow(0, crypto::hash{{1}}, pow));
+  ASSERT_HASH_EQ(crypto::hash{{10}}, pow);
+  ASSERT_TRUE(this->m_db->get_block_pow(0, crypto::hash{{2}}, pow));
+  ASSERT_HASH_EQ(crypto::hash{{20}}, pow);
+  ASSERT_FALSE(this->m_db->get_block_pow(1, crypto::hash{{1}}, pow));
+
+  // the lowest heights go first
+  ASSERT_EQ(0, this->m_db->trim_block_pow(3));
+  ASSERT_EQ(2, this->m_db->trim_block_pow(1));
+  ASSERT_FALSE(this->m_db->get_block_pow(0, crypto::hash{{1}}, pow));
+  ASSERT_FALSE(this->m_db->get_block_pow(0, crypto::hash{{2}}, pow));
+  ASSERT_TRUE(this->m_db->get_block_pow(1, crypto::hash{{3}}, pow));
+  ASSERT_HASH_EQ(crypto::hash{{30}}, pow);
+}
+
+TYPED_TEST(BlockchainDBTest, BlockInfoCache)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+  }
+  ASSERT_HASH_EQ(get_block_hash(this->m_blocks[1].first), this->m_db->get_block_hash_from_height(1));
+  ASSERT_EQ(t_diffs[1], this->m_db->get_block_cumulative_difficulty(1));
+
+  // a popped block is gone at once
+  block b;
+  std::vector<transaction> txs;
+  ASSERT_NO_THROW(this->m_db->pop_block(b, txs));
+  ASSERT_THROW(this->m_db->get_block_hash_from_height(1), BLOCK_DNE);
+  ASSERT_THROW(this->m_db->get_block_weight(1), BLOCK_DNE);
+  ASSERT_EQ(t_sizes[0], this->m_db->get_block_weight(0));
+
+  // an aborted block never shows up
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+    ASSERT_HASH_EQ(get_block_hash(this->m_blocks[1].first), this->m_db->get_block_hash_from_height(1));
+    guard.abort();
+  }
+  ASSERT_THROW(this->m_db->get_block_hash_from_height(1), BLOCK_DNE);
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+  }
+  ASSERT_HASH_EQ(get_block_hash(this->m_blocks[1].first), this->m_db->get_block_hash_from_height(1));
+
+  // and the cache is filled again on open
+  ASSERT_NO_THROW(this->m_db->close());
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->init_hard_fork();
+  ASSERT_HASH_EQ(get_block_hash(this->m_blocks[0].first), this->m_db->get_block_hash_from_height(0));
+  ASSERT_EQ(t_coins[1], this->m_db->get_block_already_generated_coins(1));
+}
+
+TYPED_TEST(BlockchainDBTest, OnlinePruning)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+  }
+
+  // the first step with no budget only records the seed and where to start
+  uint64_t height;
+  ASSERT_FALSE(this->m_db->get_pruning_progress(height));
+  ASSERT_FALSE(this->m_db->prune_blockchain_incremental(0, 0));
+  ASSERT_NE(0, this->m_db->get_blockchain_pruning_seed());
+  ASSERT_TRUE(this->m_db->get_pruning_progress(height));
+  ASSERT_EQ(0, height);
+
+  // and the progress survives a restart
+  ASSERT_NO_THROW(this->m_db->close());
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->init_hard_fork();
+  ASSERT_TRUE(this->m_db->get_pruning_progress(height));
+
+  // all blocks are within the tip, so nothing gets pruned
+  ASSERT_TRUE(this->m_db->prune_blockchain_incremental(0, 1024 * 1024));
+  ASSERT_FALSE(this->m_db->get_pruning_progress(height));
+  ASSERT_TRUE(this->m_db->prune_blockchain_incremental(0, 1024 * 1024));
+  ASSERT_TRUE(this->m_db->check_pruning());
+  for (const auto &tx: this->m_txs[1])
+  {
+    blobdata bd;
+    ASSERT_TRUE(this->m_db->get_prunable_tx_blob(get_transaction_hash(tx.first), bd));
+  }
+}
+
+TYPED_TEST(BlockchainDBTest, OnlinePruningResumes)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  // past the tip by a stripe and a bit, so the first stripe gets pruned and
+  // the start of the second one, which this seed keeps, does not
+  const uint64_t blockchain_height = CRYPTONOTE_PRUNING_TIP_BLOCKS + CRYPTONOTE_PRUNING_STRIPE_SIZE + 100;
+  const uint32_t pruning_seed = tools::make_pruning_seed(2, CRYPTONOTE_PRUNING_LOG_STRIPES);
+  std::vector<crypto::hash> miner_tx_hashes;
+  {
+    db_wtxn_guard guard(this->m_db);
+    crypto::hash prev_id = crypto::null_hash;
+    for (uint64_t height = 0; height < blockchain_height; ++height)
+    {
+      const std::pair<block, blobdata> b = make_block(height, prev_id);
+      ASSERT_NO_THROW(this->m_db->add_block(b, 100, 100, height + 1, height, {}));
+      prev_id = get_block_hash(b.first);
+      miner_tx_hashes.push_back(get_transaction_hash(b.first.miner_tx));
+    }
+  }
+  auto check_pruned = [&](uint64_t pruned_height) {
+    blobdata bd;
+    for (uint64_t height = 0; height < blockchain_height; ++height)
+      ASSERT_EQ(height >= pruned_height, this->m_db->get_prunable_tx_blob(miner_tx_hashes[height], bd)) << "at height " << height;
+  };
+
+  // a record with an empty prunable part costs its key, so this stops
+  // within the first stripe
+  ASSERT_FALSE(this->m_db->prune_blockchain_incremental(pruning_seed, 1000 * sizeof(uint64_t)));
+  check_pruned(1000);
+
+  // and picks up there after a restart
+  ASSERT_NO_THROW(this->m_db->close());
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->init_hard_fork();
+  uint64_t height;
+  ASSERT_TRUE(this->m_db->get_pruning_progress(height));
+  ASSERT_EQ(0, height);
+  ASSERT_FALSE(this->m_db->prune_blockchain_incremental(pruning_seed, 1000 * sizeof(uint64_t)));
+  check_pruned(2000);
+
+  size_t steps = 0;
+  while (!this->m_db->prune_blockchain_incremental(pruning_seed, 1024 * 1024))
+    ASSERT_LT(++steps, 10);
+  ASSERT_FALSE(this->m_db->get_pruning_progress(height));
+  ASSERT_EQ(pruning_seed, this->m_db->get_blockchain_pruning_seed());
+  check_pruned(CRYPTONOTE_PRUNING_STRIPE_SIZE);
+  ASSERT_TRUE(this->m_db->check_pruning());
+}
+
+TYPED_TEST(BlockchainDBTest, CompressedBlobs)
+{
+  if (!blob_compressor::is_supported())
+    return;
+
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+  }
+
+  // reads are the same whether the tables are compressed or not
+  for (unsigned compression: {DB_COMPRESS_ALL, DB_COMPRESS_BLOCKS, 0})
+  {
+    ASSERT_NO_THROW(this->m_db->close());
+    this->m_db->set_blob_compression(compression, 1);
+    ASSERT_NO_THROW(this->m_db->open(dirPath));
+    this->init_hard_fork();
+    ASSERT_EQ(compression, this->m_db->get_blob_compression());
+    for (size_t i = 0; i < 2; ++i)
+    {
+      ASSERT_EQ(this->m_blocks[i].second, this->m_db->get_block_blob_from_height(i));
+      for (const auto &tx: this->m_txs[i])
+      {
+        blobdata bd;
+        ASSERT_TRUE(this->m_db->get_tx_blob(get_transaction_hash(tx.first), bd));
+        ASSERT_EQ(tx.second, bd);
+      }
+    }
+  }
+}
+
+TYPED_TEST(BlockchainDBTest, CompressionWaitsForValues)
+{
+  if (!blob_compressor::is_supported())
+    return;
+
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  // nothing to train a dictionary on in a new database
+  this->m_db->set_blob_compression(DB_COMPRESS_ALL, 2);
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+  ASSERT_EQ(0, this->m_db->get_blob_compression());
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  }
+  ASSERT_NO_THROW(this->m_db->close());
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->init_hard_fork();
+  ASSERT_EQ(DB_COMPRESS_TXS_PRUNED | DB_COMPRESS_TXS_PRUNABLE, this->m_db->get_blob_compression());
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+  }
+  ASSERT_NO_THROW(this->m_db->close());
+
+  // still wanted without being asked for again
+  std::unique_ptr<BlockchainDB> db(new TypeParam());
+  ASSERT_NO_THROW(db->open(dirPath));
+  ASSERT_EQ(DB_COMPRESS_ALL, db->get_blob_compression());
+  for (size_t i = 0; i < 2; ++i)
+    ASSERT_EQ(this->m_blocks[i].second, db->get_block_blob_from_height(i));
+  ASSERT_NO_THROW(db->close());
+}
+
+TYPED_TEST(BlockchainDBTest, ColdStorage)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  // everything below the top block goes to cold storage
+  this->m_db->set_cold_storage((tempPath / "cold").string(), 1, DB_COLD_ALL);
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+  }
+
+  // a tiny budget moves one value per step
+  ASSERT_FALSE(this->m_db->move_to_cold_storage(1));
+  bool done = false;
+  {
+    // a kept read txn also finds values moved after its cold storage txn started
+    db_rtxn_guard guard(this->m_db);
+    ASSERT_EQ(this->m_blocks[0].second, this->m_db->get_block_blob_from_height(0));
+    std::thread mover([&]() {
+      try { for (int i = 0; i < 16 && !done; ++i) done = this->m_db->move_to_cold_storage(1); }
+      catch (const std::exception &e) {}
+    });
+    mover.join();
+    ASSERT_TRUE(done);
+    for (size_t i = 0; i < 2; ++i)
+    {
+      ASSERT_EQ(this->m_blocks[i].second, this->m_db->get_block_blob_from_height(i));
+      for (const auto &tx: this->m_txs[i])
+      {
+        blobdata bd;
+        ASSERT_TRUE(this->m_db->get_tx_blob(get_transaction_hash(tx.first), bd));
+        ASSERT_EQ(tx.second, bd);
+      }
+    }
+  }
+
+  // reads are the same wherever the data is, across restarts too
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    if (pass)
+    {
+      ASSERT_NO_THROW(this->m_db->close());
+      ASSERT_NO_THROW(this->m_db->open(dirPath));
+      this->init_hard_fork();
+    }
+    ASSERT_EQ(2, this->m_db->height());
+    for (size_t i = 0; i < 2; ++i)
+    {
+      ASSERT_EQ(this->m_blocks[i].second, this->m_db->get_block_blob_from_height(i));
+      for (const auto &tx: this->m_txs[i])
+      {
+        blobdata bd;
+        ASSERT_TRUE(this->m_db->get_tx_blob(get_transaction_hash(tx.first), bd));
+        ASSERT_EQ(tx.second, bd);
+      }
+    }
+    std::vector<std::pair<std::pair<blobdata, crypto::hash>, std::vector<std::pair<crypto::hash, blobdata>>>> blocks;
+    ASSERT_TRUE(this->m_db->get_blocks_from(0, 2, 2, 1000, 1024 * 1024, blocks, false, true, false));
+    ASSERT_EQ(2, blocks.size());
+    for (size_t i = 0; i < 2; ++i)
+    {
+      ASSERT_EQ(this->m_blocks[i].second, blocks[i].first.first);
+      ASSERT_EQ(this->m_txs[i].size(), blocks[i].second.size());
+      for (size_t j = 0; j < blocks[i].second.size(); ++j)
+        ASSERT_EQ(this->m_txs[i][j].second, blocks[i].second[j].second);
+    }
+    size_t n_blocks = 0;
+    ASSERT_TRUE(this->m_db->for_blocks_range(0, 1, [&](uint64_t height, const crypto::hash &hash, const block &b) {
+      return height == n_blocks++ && hash == get_block_hash(this->m_blocks[height].first);
+    }));
+    ASSERT_EQ(2, n_blocks);
+  }
+
+  // the top block is still in the main database, the one below it is not
+  block b;
+  std::vector<transaction> txs;
+  ASSERT_NO_THROW(this->m_db->pop_block(b, txs));
+  ASSERT_THROW(this->m_db->pop_block(b, txs), DB_ERROR);
+}
+
+TYPED_TEST(BlockchainDBTest, Compaction)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  }
+
+  const auto get_blocks_entries = [this]() {
+    db_stats stats;
+    this->m_db->get_db_stats(stats);
+    EXPECT_LE(stats.free_pages, stats.used_pages);
+    for (const auto &table: stats.tables)
+      if (table.name == "blocks")
+        return table.entries;
+    return (uint64_t)-1;
+  };
+  ASSERT_EQ(1, get_blocks_entries());
+
+  const auto wait_for_copy = [this]() {
+    for (int i = 0; i < 1000; ++i)
+    {
+      const db_compaction_status::state_t state = this->m_db->get_compaction_status().state;
+      if (state != db_compaction_status::copying)
+        return state;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return db_compaction_status::copying;
+  };
+
+  ASSERT_TRUE(this->m_db->start_compaction());
+  ASSERT_FALSE(this->m_db->start_compaction());
+  ASSERT_EQ(db_compaction_status::ready, wait_for_copy());
+
+  // a block added meanwhile gets the copy made again
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+  }
+  ASSERT_FALSE(this->m_db->finish_compaction());
+  ASSERT_EQ(db_compaction_status::ready, wait_for_copy());
+
+  // while txpool changes are carried over to it
+  const transaction &pool_tx = this->m_txs[1][0].first;
+  txpool_tx_meta_t meta{};
+  meta.weight = 1;
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_txpool_tx(get_transaction_hash(pool_tx), this->m_txs[1][0].second, meta));
+  }
+  ASSERT_TRUE(this->m_db->finish_compaction());
+  const db_compaction_status status = this->m_db->get_compaction_status();
+  ASSERT_EQ(db_compaction_status::done, status.state);
+  ASSERT_EQ(2, status.attempts);
+
+  ASSERT_EQ(2, this->m_db->height());
+  ASSERT_EQ(2, get_blocks_entries());
+  for (size_t i = 0; i < 2; ++i)
+    ASSERT_EQ(this->m_blocks[i].second, this->m_db->get_block_blob_from_height(i));
+  txpool_tx_meta_t pool_meta;
+  ASSERT_TRUE(this->m_db->get_txpool_tx_meta(get_transaction_hash(pool_tx), pool_meta));
+  ASSERT_EQ(1, pool_meta.weight);
+  ASSERT_FALSE(boost::filesystem::exists(tempPath / "compact"));
+
+  // and it's the database from now on
+  ASSERT_NO_THROW(this->m_db->close());
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->init_hard_fork();
+  ASSERT_EQ(2, this->m_db->height());
+  ASSERT_EQ(1, this->m_db->get_txpool_tx_count(relay_category::all));
+}
+
+TYPED_TEST(BlockchainDBTest, TxpoolWriteCache)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  const crypto::hash txid0 = get_transaction_hash(this->m_txs[0][0].first);
+  const crypto::hash txid1 = get_transaction_hash(this->m_txs[1][0].first);
+  txpool_tx_meta_t meta{};
+  meta.weight = 1;
+
+  // additions are seen at once, and dropped with an aborted txn
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_txpool_tx(txid0, this->m_txs[0][0].second, meta));
+    ASSERT_TRUE(this->m_db->txpool_has_tx(txid0, relay_category::all));
+    ASSERT_THROW(this->m_db->add_txpool_tx(txid0, this->m_txs[0][0].second, meta), DB_ERROR);
+  }
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_txpool_tx(txid1, this->m_txs[1][0].second, meta));
+    guard.abort();
+  }
+  ASSERT_FALSE(this->m_db->txpool_has_tx(txid1, relay_category::all));
+  ASSERT_EQ(1, this->m_db->get_txpool_tx_count(relay_category::all));
+
+  // so are metadata updates
+  meta.weight = 2;
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->update_txpool_tx(txid0, meta));
+    ASSERT_THROW(this->m_db->update_txpool_tx(txid1, meta), DB_ERROR);
+  }
+  txpool_tx_meta_t pool_meta;
+  ASSERT_TRUE(this->m_db->get_txpool_tx_meta(txid0, pool_meta));
+  ASSERT_EQ(2, pool_meta.weight);
+  cryptonote::blobdata bd;
+  ASSERT_TRUE(this->m_db->get_txpool_tx_blob(txid0, bd, relay_category::all));
+  ASSERT_EQ(this->m_txs[0][0].second, bd);
+  size_t seen = 0;
+  ASSERT_TRUE(this->m_db->for_all_txpool_txes([&](const crypto::hash &txid, const txpool_tx_meta_t &meta, const cryptonote::blobdata_ref *blob) {
+    ++seen;
+    EXPECT_EQ(txid0, txid);
+    EXPECT_EQ(2, meta.weight);
+    EXPECT_EQ(this->m_txs[0][0].second.size(), blob->size());
+    return true;
+  }, true, relay_category::all));
+  ASSERT_EQ(1, seen);
+
+  // changes after a flush go on top of what it wrote
+  ASSERT_NO_THROW(this->m_db->flush_txpool_updates());
+  meta.weight = 3;
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->update_txpool_tx(txid0, meta));
+    ASSERT_NO_THROW(this->m_db->add_txpool_tx(txid1, this->m_txs[1][0].second, meta));
+  }
+  ASSERT_EQ(2, this->m_db->get_txpool_tx_count(relay_category::all));
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->remove_txpool_tx(txid1));
+  }
+  ASSERT_FALSE(this->m_db->txpool_has_tx(txid1, relay_category::all));
+
+  // and what's left is written on close
+  ASSERT_NO_THROW(this->m_db->close());
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->init_hard_fork();
+  ASSERT_EQ(1, this->m_db->get_txpool_tx_count(relay_category::all));
+  ASSERT_TRUE(this->m_db->get_txpool_tx_meta(txid0, pool_meta));
+  ASSERT_EQ(3, pool_meta.weight);
+  ASSERT_TRUE(this->m_db->get_txpool_tx_blob(txid0, bd, relay_category::all));
+  ASSERT_EQ(this->m_txs[0][0].second, bd);
+}
+
+TYPED_TEST(BlockchainDBTest, TxpoolFlushKeptSnapshot)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  const crypto::hash txid0 = get_transaction_hash(this->m_txs[0][0].first);
+  txpool_tx_meta_t meta{};
+  meta.weight = 1;
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->add_txpool_tx(txid0, this->m_txs[0][0].second, meta));
+  }
+
+  // a read txn kept from before a flush does not see what it wrote,
+  // so the tx must still be served from memory
+  cryptonote::blobdata bd;
+  {
+    db_rtxn_guard guard(this->m_db);
+    ASSERT_TRUE(this->m_db->txpool_has_tx(txid0, relay_category::all));
+    bool flushed = false;
+    std::thread flusher([&]() {
+      try { this->m_db->flush_txpool_updates(); flushed = true; }
+      catch (const std::exception &e) {}
+    });
+    flusher.join();
+    ASSERT_TRUE(flushed);
+    ASSERT_TRUE(this->m_db->txpool_has_tx(txid0, relay_category::all));
+    ASSERT_TRUE(this->m_db->get_txpool_tx_blob(txid0, bd, relay_category::all));
+    ASSERT_EQ(this->m_txs[0][0].second, bd);
+    ASSERT_EQ(1, this->m_db->get_txpool_tx_count(relay_category::all));
+  }
+
+  // a later one reads it from the db
+  ASSERT_TRUE(this->m_db->txpool_has_tx(txid0, relay_category::all));
+  ASSERT_EQ(1, this->m_db->get_txpool_tx_count(relay_category::all));
+
+  // and once that reader is gone, a removal leaves nothing behind
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(this->m_db->remove_txpool_tx(txid0));
+  }
+  ASSERT_NO_THROW(this->m_db->flush_txpool_updates());
+  ASSERT_FALSE(this->m_db->txpool_has_tx(txid0, relay_category::all));
+  ASSERT_EQ(0, this->m_db->get_txpool_tx_count(relay_category::all));
+}
+
 }  // anonymous namespace
@@ -0,0 +1,80 @@
+// Copyright (c) 2022, The Monero Project
+
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <random>
+#include <vector>
+#include "gtest/gtest.h"
+#include "crypto/hash.h"
+#include "common/bloom_filter.h"
+
+namespace
+{
+  std::vector<crypto::hash> make_hashes(size_t n, uint32_t seed)
+  {
+    std::mt19937_64 rng(seed);
+    std::vector<crypto::hash> hashes(n);
+    for (crypto::hash &h: hashes)
+      for (size_t i = 0; i < sizeof(h.data); ++i)
+        h.data[i] = rng();
+    return hashes;
+  }
+}
+
+TEST(bloom_filter, no_false_negatives)
+{
+  tools::bloom_filter<crypto::hash> filter(10000, 16);
+  const std::vector<crypto::hash> hashes = make_hashes(10000, 0);
+  for (const crypto::hash &h: hashes)
+    filter.add(h);
+  for (const crypto::hash &h: hashes)
+    ASSERT_TRUE(filter.has(h));
+  ASSERT_EQ(filter.get_num_values(), 10000);
+  ASSERT_EQ(filter.get_memory_usage(), 10000 * 16 / 8);
+}
+
+TEST(bloom_filter, false_positive_rate)
+{
+  tools::bloom_filter<crypto::hash> filter(10000, 16);
+  for (const crypto::hash &h: make_hashes(10000, 0))
+    filter.add(h);
+  size_t false_positives = 0;
+  for (const crypto::hash &h: make_hashes(100000, 1))
+    false_positives += filter.has(h);
+  ASSERT_LT(false_positives, 100000 / 200);
+}
+
+TEST(bloom_filter, tiny)
+{
+  tools::bloom_filter<crypto::hash> filter(0, 0);
+  const std::vector<crypto::hash> hashes = make_hashes(10, 0);
+  for (const crypto::hash &h: hashes)
+    filter.add(h);
+  for (const crypto::hash &h: hashes)
+    ASSERT_TRUE(filter.has(h));
+}
@@ -0,0 +1,253 @@
+// Copyright (c) 2022, The Monero Project
+
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <random>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "gtest/gtest.h"
+#include "blockchain_utilities/bootstrap_file.h"
+
+namespace
+{
+  class bootstrap_writer: public BootstrapFile
+  {
+  public:
+    bootstrap_writer() { set_format(2, false); }
+    bool open(const boost::filesystem::path &path, uint64_t start_block) { return open_writer(path, start_block, 0); }
+    void write(const blobdata &blob) { write_block_package(blob); }
+    bool close() { return BootstrapFile::close(); }
+    // stops as if the process died: blocks not yet in a chunk are lost
+    void abandon() { delete m_output_stream; delete m_raw_data_file; }
+  };
+
+  // big enough that every 4 blocks fill a chunk
+  std::vector<blobdata> make_blocks(size_t n, uint32_t seed)
+  {
+    std::mt19937 rng(seed);
+    std::vector<blobdata> blocks(n);
+    for (blobdata &b: blocks)
+    {
+      b.resize(300000);
+      for (char &c: b)
+        c = rng();
+    }
+    return blocks;
+  }
+
+  void check_blocks(const BootstrapReader &reader, uint64_t block_first, const std::vector<blobdata> &expected)
+  {
+    ASSERT_EQ(reader.get_block_first(), block_first);
+    ASSERT_EQ(reader.get_num_blocks(), expected.size());
+    std::vector<blobdata> blocks, all;
+    for (size_t i = 0; i < reader.get_num_chunks(); ++i)
+    {
+      ASSERT_EQ(reader.get_chunk_height(i), block_first + all.size());
+      ASSERT_EQ(reader.get_chunk(block_first + all.size()), i);
+      ASSERT_TRUE(reader.read_chunk(i, blocks));
+      all.insert(all.end(), blocks.begin(), blocks.end());
+    }
+    ASSERT_EQ(reader.get_chunk(block_first + all.size()), reader.get_num_chunks());
+    ASSERT_TRUE(all == expected);
+  }
+
+  void write_blocks(const boost::filesystem::path &path, uint64_t start_block, const std::vector<blobdata> &blocks)
+  {
+    bootstrap_writer writer;
+    ASSERT_TRUE(writer.open(path, start_block));
+    for (const blobdata &b: blocks)
+      writer.write(b);
+    ASSERT_TRUE(writer.close());
+  }
+
+  class bootstrap_file: public ::testing::Test
+  {
+  protected:
+    bootstrap_file():
+      dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()),
+      path(dir / "blockchain.raw"),
+      journal_path(path.string() + ".append")
+    {
+    }
+    ~bootstrap_file()
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(dir, ec);
+    }
+
+    const boost::filesystem::path dir;
+    const boost::filesystem::path path;
+    const boost::filesystem::path journal_path;
+  };
+}
+
+TEST_F(bootstrap_file, round_trip)
+{
+  const std::vector<blobdata> blocks = make_blocks(10, 0);
+  write_blocks(path, 100, blocks);
+  ASSERT_FALSE(boost::filesystem::exists(journal_path));
+
+  BootstrapReader reader;
+  ASSERT_TRUE(reader.open(path.string()));
+  ASSERT_EQ(reader.get_num_chunks(), 3);
+  check_blocks(reader, 100, blocks);
+}
+
+TEST_F(bootstrap_file, empty)
+{
+  write_blocks(path, 100, {});
+
+  BootstrapReader reader;
+  ASSERT_TRUE(reader.open(path.string()));
+  ASSERT_EQ(reader.get_num_chunks(), 0);
+  check_blocks(reader, 100, {});
+}
+
+TEST_F(bootstrap_file, checksum_mismatch)
+{
+  write_blocks(path, 0, make_blocks(8, 0));
+
+  BootstrapReader reader;
+  ASSERT_TRUE(reader.open(path.string()));
+  const uint64_t offset = reader.get_index().chunks[1].offset + 1000;
+  {
+    std::fstream file(path.string(), std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    file.seekg(offset);
+    const char c = file.get();
+    file.seekp(offset);
+    file.put(c ^ 1);
+    ASSERT_TRUE(file.good());
+  }
+
+  ASSERT_TRUE(reader.open(path.string()));
+  std::vector<blobdata> blocks;
+  ASSERT_TRUE(reader.read_chunk(0, blocks));
+  ASSERT_FALSE(reader.read_chunk(1, blocks));
+}
+
+TEST_F(bootstrap_file, truncated_trailer)
+{
+  write_blocks(path, 0, make_blocks(8, 0));
+  boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 3);
+
+  BootstrapReader reader;
+  ASSERT_FALSE(reader.open(path.string()));
+}
+
+TEST_F(bootstrap_file, append)
+{
+  const std::vector<blobdata> blocks = make_blocks(10, 0);
+  write_blocks(path, 0, std::vector<blobdata>(blocks.begin(), blocks.begin() + 6));
+  write_blocks(path, 6, std::vector<blobdata>(blocks.begin() + 6, blocks.end()));
+  ASSERT_FALSE(boost::filesystem::exists(journal_path));
+
+  BootstrapReader reader;
+  ASSERT_TRUE(reader.open(path.string()));
+  ASSERT_EQ(reader.get_num_chunks(), 4);
+  check_blocks(reader, 0, blocks);
+}
+
+TEST_F(bootstrap_file, interrupted_export)
+{
+  const std::vector<blobdata> blocks = make_blocks(14, 0);
+  bootstrap_writer writer;
+  ASSERT_TRUE(writer.open(path, 0));
+  for (size_t i = 0; i < 10; ++i)
+    writer.write(blocks[i]);
+  writer.abandon();
+  ASSERT_TRUE(boost::filesystem::exists(journal_path));
+
+  // the provisional index has the two chunks written
+  BootstrapReader reader;
+  ASSERT_TRUE(reader.open(path.string()));
+  check_blocks(reader, 0, std::vector<blobdata>(blocks.begin(), blocks.begin() + 8));
+
+  // the export resumes after them
+  write_blocks(path, 8, std::vector<blobdata>(blocks.begin() + 8, blocks.end()));
+  ASSERT_FALSE(boost::filesystem::exists(journal_path));
+  ASSERT_TRUE(reader.open(path.string()));
+  check_blocks(reader, 0, blocks);
+}
+
+TEST_F(bootstrap_file, crash_mid_append)
+{
+  const std::vector<blobdata> blocks = make_blocks(18, 0);
+  write_blocks(path, 0, std::vector<blobdata>(blocks.begin(), blocks.begin() + 6));
+  const uint64_t size = boost::filesystem::file_size(path);
+
+  bootstrap_writer writer;
+  ASSERT_TRUE(writer.open(path, 6));
+  for (size_t i = 6; i < 14; ++i)
+    writer.write(blocks[i]);
+  writer.abandon();
+
+  // the process died while a third chunk was going over the provisional index
+  const uint64_t end = boost::filesystem::file_size(path);
+  {
+    std::fstream file(path.string(), std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    file.seekp(end - 10);
+    file << std::string(5000, 'x');
+    ASSERT_TRUE(file.good());
+  }
+
+  // readers only see what was there before the append
+  BootstrapReader reader;
+  ASSERT_TRUE(reader.open(path.string()));
+  ASSERT_LT(reader.get_index_offset(), size);
+  check_blocks(reader, 0, std::vector<blobdata>(blocks.begin(), blocks.begin() + 6));
+
+  // the next append keeps the chunks the journal recorded, and goes on after them
+  write_blocks(path, 14, std::vector<blobdata>(blocks.begin() + 14, blocks.end()));
+  ASSERT_FALSE(boost::filesystem::exists(journal_path));
+  ASSERT_TRUE(reader.open(path.string()));
+  check_blocks(reader, 0, blocks);
+}
+
+TEST_F(bootstrap_file, torn_journal)
+{
+  const std::vector<blobdata> blocks = make_blocks(12, 0);
+  bootstrap_writer writer;
+  ASSERT_TRUE(writer.open(path, 0));
+  for (size_t i = 0; i < 8; ++i)
+    writer.write(blocks[i]);
+  writer.abandon();
+
+  // the record of the second chunk was cut short, so that chunk is dropped
+  boost::filesystem::resize_file(journal_path, boost::filesystem::file_size(journal_path) - 1);
+  bootstrap_writer resumed;
+  ASSERT_TRUE(resumed.open(path, 4));
+  ASSERT_EQ(boost::filesystem::file_size(journal_path), 4 + 8);
+  for (size_t i = 4; i < 12; ++i)
+    resumed.write(blocks[i]);
+  ASSERT_TRUE(resumed.close());
+
+  BootstrapReader reader;
+  ASSERT_TRUE(reader.open(path.string()));
+  ASSERT_EQ(reader.get_num_chunks(), 3);
+  check_blocks(reader, 0, blocks);
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2022, The Monero Project
+
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "common/data_cache.h"
+
+TEST(data_cache, add_has)
+{
+  tools::data_cache<int, 4> cache(16);
+  ASSERT_FALSE(cache.has(1));
+  cache.add(1);
+  ASSERT_TRUE(cache.has(1));
+  ASSERT_FALSE(cache.has(2));
+  ASSERT_EQ(cache.size(), 1);
+  ASSERT_EQ(cache.hits(), 1);
+  ASSERT_EQ(cache.misses(), 2);
+}
+
+TEST(data_cache, evicts_oldest)
+{
+  tools::data_cache<int, 1> cache(4);
+  for (int i = 0; i < 6; ++i)
+    cache.add(i);
+  ASSERT_EQ(cache.size(), 4);
+  ASSERT_FALSE(cache.has(0));
+  ASSERT_FALSE(cache.has(1));
+  for (int i = 2; i < 6; ++i)
+    ASSERT_TRUE(cache.has(i));
+  ASSERT_EQ(cache.get_entries(), std::vector<int>({2, 3, 4, 5}));
+}
+
+TEST(data_cache, resize)
+{
+  tools::data_cache<int, 1> cache(8);
+  for (int i = 0; i < 8; ++i)
+    cache.add(i);
+  cache.resize(3);
+  ASSERT_EQ(cache.capacity(), 3);
+  ASSERT_EQ(cache.get_entries(), std::vector<int>({5, 6, 7}));
+  cache.add(8);
+  ASSERT_EQ(cache.get_entries(), std::vector<int>({6, 7, 8}));
+  cache.resize(5);
+  cache.add(9);
+  cache.add(10);
+  ASSERT_EQ(cache.get_entries(), std::vector<int>({6, 7, 8, 9, 10}));
+  cache.resize(0);
+  cache.add(11);
+  ASSERT_EQ(cache.size(), 0);
+}
+
+TEST(data_cache, round_trip)
+{
+  tools::data_cache<int, 4> cache(16), copy(16);
+  for (int i = 0; i < 40; ++i)
+    cache.add(i);
+  for (int i: cache.get_entries())
+    copy.add(i);
+  ASSERT_EQ(copy.get_entries(), cache.get_entries());
+}
+
+TEST(data_cache, shards_spread_on_high_bits)
+{
+  // values with the same low bits must not all land in one shard
+  tools::data_cache<int, 16> cache(16);
+  for (int i = 0; i < 16; ++i)
+    cache.add(i * 16);
+  ASSERT_GE(cache.size(), 8);
+}
+
+TEST(data_cache, concurrent)
+{
+  tools::data_cache<int> cache(1024);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([&cache, t]() {
+      for (int i = 0; i < 1000; ++i)
+      {
+        cache.add(t * 1000 + i);
+        cache.has(i);
+      }
+    });
+  for (auto &t: threads)
+    t.join();
+  ASSERT_LE(cache.size(), cache.capacity());
+  ASSERT_EQ(cache.hits() + cache.misses(), 4000);
+}
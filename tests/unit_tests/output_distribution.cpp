@@ -184,3 +184,35 @@ TEST(output_distribution, part_noncumulative)
   ASSERT_EQ(res->distribution.size(), 5);
   ASSERT_EQ(res->distribution, std::vector<uint64_t>({0, 1, 5, 1, 4}));
 }
+
+TEST(output_distribution, nonzero_amount_base)
+{
+  // a non zero amount, counted the way BlockchainDB::get_output_distribution does
+  auto f = [](uint64_t amount, uint64_t from, uint64_t to, uint64_t &start_height, std::vector<uint64_t> &distribution, uint64_t &base) {
+    start_height = from;
+    base = 0;
+    for (uint64_t h = 0; h < from; ++h)
+      base += test_distribution[h];
+    distribution.clear();
+    uint64_t c = base;
+    for (uint64_t h = from; h <= to; ++h)
+      distribution.push_back(c += test_distribution[h]);
+    return true;
+  };
+  boost::optional<cryptonote::rpc::output_distribution_data> res;
+
+  res = cryptonote::rpc::RpcHandler::get_output_distribution(f, 1, 6, 8, ::get_block_hash, false, test_distribution_size);
+  ASSERT_TRUE(res != boost::none);
+  ASSERT_EQ(res->base, 0);
+  ASSERT_EQ(res->distribution, std::vector<uint64_t>({6, 1, 4}));
+
+  res = cryptonote::rpc::RpcHandler::get_output_distribution(f, 1, 6, 8, ::get_block_hash, false, test_distribution_size, true);
+  ASSERT_TRUE(res != boost::none);
+  ASSERT_EQ(res->base, 1);
+  ASSERT_EQ(res->distribution, std::vector<uint64_t>({5, 1, 4}));
+
+  res = cryptonote::rpc::RpcHandler::get_output_distribution(f, 1, 6, 8, ::get_block_hash, true, test_distribution_size);
+  ASSERT_TRUE(res != boost::none);
+  ASSERT_EQ(res->base, 0);
+  ASSERT_EQ(res->distribution, std::vector<uint64_t>({6, 7, 11}));
+}
@@ -28,6 +28,7 @@
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <atomic>
+#include <thread>
 #include "gtest/gtest.h"
 #include "misc_language.h"
 #include "common/threadpool.h"
@@ -145,3 +146,66 @@ TEST(threadpool, leaf_reentrancy)
   waiter.wait();
   ASSERT_EQ(counter, 500000);
 }
+
+TEST(threadpool, high_priority_first)
+{
+  std::shared_ptr<tools::threadpool> tpool(tools::threadpool::getNewForUnitTests(1));
+  tools::threadpool::waiter waiter(*tpool);
+
+  std::vector<int> order;
+  for (int i = 0; i < 8; ++i)
+    tpool->submit(&waiter, [&order](){ order.push_back(0); }, true);
+  for (int i = 0; i < 8; ++i)
+    tpool->submit(&waiter, [&order](){ order.push_back(1); }, true, tools::threadpool::PRIORITY_HIGH);
+  waiter.wait();
+  ASSERT_EQ(order.size(), 16);
+  for (size_t i = 0; i < order.size(); ++i)
+    ASSERT_EQ(order[i], i < 8 ? 1 : 0);
+}
+
+TEST(threadpool, stats)
+{
+  std::shared_ptr<tools::threadpool> tpool(tools::threadpool::getNewForUnitTests(4));
+  tools::threadpool::waiter waiter(*tpool);
+
+  std::atomic<unsigned int> counter(0);
+  for (size_t n = 0; n < 1000; ++n)
+    tpool->submit(&waiter, [&counter](){++counter;}, n % 2, n % 3 ? tools::threadpool::PRIORITY_NORMAL : tools::threadpool::PRIORITY_HIGH);
+  waiter.wait();
+  ASSERT_EQ(counter, 1000);
+
+  const tools::threadpool::stats stats = tpool->get_stats();
+  ASSERT_EQ(stats.threads, 3);
+  ASSERT_EQ(stats.queue_depth[tools::threadpool::PRIORITY_HIGH], 0);
+  ASSERT_EQ(stats.queue_depth[tools::threadpool::PRIORITY_NORMAL], 0);
+  ASSERT_EQ(stats.submitted, 1000);
+  ASSERT_EQ(stats.executed + stats.inlined, 1000);
+  uint64_t histogram_total = 0;
+  for (size_t b = 0; b < tools::threadpool::NUM_LATENCY_BUCKETS; ++b)
+    histogram_total += stats.latency_histogram[b];
+  ASSERT_EQ(histogram_total, stats.executed);
+}
+
+TEST(threadpool, recycle_while_busy)
+{
+  std::shared_ptr<tools::threadpool> tpool(tools::threadpool::getNewForUnitTests(4));
+
+  // outside threads steal from the worker queues while they're recreated
+  std::atomic<unsigned int> counter(0);
+  std::vector<std::thread> submitters;
+  for (int t = 0; t < 2; ++t)
+    submitters.emplace_back([&tpool, &counter](){
+      for (int i = 0; i < 50; ++i)
+      {
+        tools::threadpool::waiter waiter(*tpool);
+        for (int n = 0; n < 20; ++n)
+          tpool->submit(&waiter, [&counter](){++counter;}, true);
+        waiter.wait();
+      }
+    });
+  for (int i = 0; i < 10; ++i)
+    tpool->recycle();
+  for (auto &t: submitters)
+    t.join();
+  ASSERT_EQ(counter, 2000);
+}
@@ -0,0 +1,78 @@
+// Copyright (c) 2023, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "crypto/crypto.h"
+#include "wallet/wallet2.h"
+
+// wallet2 declares this class a friend, so tests can set wallets up the way
+// scanning would, and call what wallets call on their own
+class wallet_accessor_test
+{
+public:
+    static void set_cache_journal_min_snapshot_size(tools::wallet2 &w, uint64_t size) { w.m_cache_journal_min_snapshot_size = size; }
+
+    // a new block on top of the wallet's chain
+    static void add_block(tools::wallet2 &w) { w.m_blockchain.push_back(crypto::rand<crypto::hash>()); }
+
+    // an output received in the top block, as scanning records it
+    static size_t receive(tools::wallet2 &w, const cryptonote::subaddress_index &index, uint64_t amount, uint64_t unlock_time = 0)
+    {
+        tools::wallet2::transfer_details td = AUTO_VAL_INIT(td);
+        td.m_block_height = w.m_blockchain.size() - 1;
+        td.m_tx.unlock_time = unlock_time;
+        td.m_tx.vout.push_back(cryptonote::tx_out{0, cryptonote::txout_to_key(crypto::rand<crypto::public_key>())});
+        td.m_txid = crypto::rand<crypto::hash>();
+        td.m_internal_output_index = 0;
+        td.m_global_output_index = w.m_transfers.size();
+        td.m_key_image = crypto::rand<crypto::key_image>();
+        td.m_key_image_known = true;
+        td.m_amount = amount;
+        td.m_rct = true;
+        td.m_subaddr_index = index;
+        const size_t idx = w.m_transfers.size();
+        w.m_key_images[td.m_key_image] = idx;
+        w.m_pub_keys[td.get_public_key()] = idx;
+        w.m_transfers.push_back(td);
+        return idx;
+    }
+
+    static const tools::wallet2::transfer_details &get_transfer(const tools::wallet2 &w, size_t idx) { return w.m_transfers[idx]; }
+    static void set_spent(tools::wallet2 &w, size_t idx, uint64_t height) { w.set_spent(idx, height); }
+    static void set_unspent(tools::wallet2 &w, size_t idx) { w.set_unspent(idx); }
+    static void detach_blockchain(tools::wallet2 &w, uint64_t height) { w.detach_blockchain(height); }
+
+    // what import_key_images does with the daemon's answer on whether they are spent
+    static void set_spent_status(tools::wallet2 &w, size_t idx, bool spent) { w.m_transfers[idx].m_spent = spent; w.update_balance(idx); }
+
+    static std::vector<size_t> get_unspent_transfers(tools::wallet2 &w, const boost::optional<uint32_t> &subaddr_account, const std::set<uint32_t> &subaddr_indices, bool unlocked, uint64_t min_amount) { return w.get_unspent_transfers(subaddr_account, subaddr_indices, unlocked, min_amount); }
+    static bool is_transfer_unlocked(tools::wallet2 &w, size_t idx) { return w.is_transfer_unlocked(w.m_transfers[idx]); }
+    static std::map<uint32_t, uint64_t> balance_per_subaddress_scan(const tools::wallet2 &w, uint32_t index_major, bool strict) { return w.balance_per_subaddress_scan(index_major, strict); }
+    static std::map<uint32_t, std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> unlocked_balance_per_subaddress_scan(tools::wallet2 &w, uint32_t index_major, bool strict) { return w.unlocked_balance_per_subaddress_scan(index_major, strict); }
+};
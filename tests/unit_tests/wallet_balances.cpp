@@ -0,0 +1,296 @@
+// Copyright (c) 2023, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <boost/filesystem.hpp>
+#include "wallet/wallet2.h"
+#include "wallet_accessor_test.h"
+
+namespace
+{
+  // the cached balances, read the way the wallet reads them, must match a scan of all transfers
+  void check_balances(tools::wallet2 &w)
+  {
+    for (uint32_t major = 0; major < 2; ++major)
+    {
+      for (bool strict: {false, true})
+      {
+        // unlocked_balance_per_subaddress syncs the cache, which balance_per_subaddress relies on
+        const auto unlocked = w.unlocked_balance_per_subaddress(major, strict);
+        const auto unlocked_scan = wallet_accessor_test::unlocked_balance_per_subaddress_scan(w, major, strict);
+        ASSERT_EQ(unlocked_scan.size(), unlocked.size());
+        for (const auto &e: unlocked_scan)
+        {
+          const auto i = unlocked.find(e.first);
+          ASSERT_TRUE(i != unlocked.end());
+          EXPECT_EQ(e.second.first, i->second.first);
+          EXPECT_EQ(e.second.second.first, i->second.second.first);
+          // time locks are counted down from the current time, which may tick between both calls
+          EXPECT_LE(i->second.second.second, e.second.second.second + 1);
+          EXPECT_LE(e.second.second.second, i->second.second.second + 1);
+        }
+        EXPECT_EQ(wallet_accessor_test::balance_per_subaddress_scan(w, major, strict), w.balance_per_subaddress(major, strict));
+      }
+    }
+  }
+
+  // the outputs coin selection could use, the way it found them by walking all transfers
+  std::vector<size_t> scan_unspent_transfers(tools::wallet2 &w, const boost::optional<uint32_t> &subaddr_account, const std::set<uint32_t> &subaddr_indices, bool unlocked, uint64_t min_amount)
+  {
+    std::vector<size_t> outputs;
+    for (size_t i = 0; i < w.get_num_transfer_details(); ++i)
+    {
+      const tools::wallet2::transfer_details &td = wallet_accessor_test::get_transfer(w, i);
+      if (td.m_spent || td.m_frozen || td.amount() < min_amount || (unlocked && !wallet_accessor_test::is_transfer_unlocked(w, i)))
+        continue;
+      if ((subaddr_account && td.m_subaddr_index.major != *subaddr_account) || (!subaddr_indices.empty() && subaddr_indices.count(td.m_subaddr_index.minor) == 0))
+        continue;
+      outputs.push_back(i);
+    }
+    return outputs;
+  }
+
+  void check_unspent_transfers(tools::wallet2 &w)
+  {
+    const std::vector<boost::optional<uint32_t>> accounts = {boost::none, 0u, 1u};
+    const std::vector<std::set<uint32_t>> subaddresses = {{}, {0}, {1, 2}};
+    for (const auto &account: accounts)
+      for (const auto &indices: subaddresses)
+        for (bool unlocked: {false, true})
+          for (uint64_t min_amount: {0, 1500, 5000, 100000})
+            EXPECT_EQ(scan_unspent_transfers(w, account, indices, unlocked, min_amount), wallet_accessor_test::get_unspent_transfers(w, account, indices, unlocked, min_amount));
+  }
+
+  void add_blocks(tools::wallet2 &w, size_t n)
+  {
+    while (n--)
+      wallet_accessor_test::add_block(w);
+  }
+
+  struct wallet_balances: public ::testing::Test
+  {
+    wallet_balances()
+    {
+      w.set_offline();
+      w.generate("", "");
+    }
+
+    tools::wallet2 w;
+  };
+}
+
+TEST_F(wallet_balances, receive)
+{
+  const uint64_t height = w.get_blockchain_current_height();
+  add_blocks(w, 1);
+  wallet_accessor_test::receive(w, {0, 0}, 1000);
+  wallet_accessor_test::receive(w, {0, 1}, 2000);
+  wallet_accessor_test::receive(w, {1, 0}, 4000);
+  check_balances(w);
+  EXPECT_EQ(3000, w.balance(0, false));
+  EXPECT_EQ(0, w.unlocked_balance(0, false));
+
+  add_blocks(w, 1);
+  wallet_accessor_test::receive(w, {0, 0}, 8000, height + 100);
+  wallet_accessor_test::receive(w, {0, 2}, 16000, time(NULL) + 3600);
+  wallet_accessor_test::receive(w, {1, 1}, 32000, time(NULL) - 3600);
+  check_balances(w);
+
+  add_blocks(w, CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE);
+  check_balances(w);
+  EXPECT_EQ(3000, w.unlocked_balance(0, false));
+
+  add_blocks(w, 100);
+  check_balances(w);
+  EXPECT_EQ(27000, w.balance(0, false));
+  EXPECT_EQ(11000, w.unlocked_balance(0, false));
+  EXPECT_EQ(36000, w.unlocked_balance(1, false));
+}
+
+TEST_F(wallet_balances, spend_and_unspend)
+{
+  add_blocks(w, 1);
+  const size_t a = wallet_accessor_test::receive(w, {0, 0}, 1000);
+  const size_t b = wallet_accessor_test::receive(w, {0, 1}, 2000);
+  add_blocks(w, CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE + 1);
+  check_balances(w);
+
+  // spent in the pool, only a strict balance still counts it
+  wallet_accessor_test::set_spent(w, a, 0);
+  check_balances(w);
+  EXPECT_EQ(2000, w.balance(0, false));
+  EXPECT_EQ(3000, w.balance(0, true));
+
+  wallet_accessor_test::set_spent(w, b, w.get_blockchain_current_height() - 1);
+  check_balances(w);
+  EXPECT_EQ(0, w.balance(0, false));
+  EXPECT_EQ(1000, w.balance(0, true));
+
+  wallet_accessor_test::set_unspent(w, a);
+  wallet_accessor_test::set_unspent(w, b);
+  check_balances(w);
+  EXPECT_EQ(3000, w.balance(0, false));
+}
+
+TEST_F(wallet_balances, freeze_and_thaw)
+{
+  add_blocks(w, 1);
+  const size_t a = wallet_accessor_test::receive(w, {0, 0}, 1000);
+  wallet_accessor_test::receive(w, {0, 0}, 2000);
+  add_blocks(w, CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE + 1);
+
+  w.freeze(a);
+  check_balances(w);
+  EXPECT_EQ(2000, w.balance(0, true));
+  EXPECT_EQ(2000, w.unlocked_balance(0, true));
+
+  w.thaw(a);
+  check_balances(w);
+  EXPECT_EQ(3000, w.balance(0, true));
+}
+
+TEST_F(wallet_balances, detach_blockchain)
+{
+  add_blocks(w, 1);
+  const size_t a = wallet_accessor_test::receive(w, {0, 0}, 1000);
+  const size_t b = wallet_accessor_test::receive(w, {0, 1}, 2000, time(NULL) + 3600);
+  add_blocks(w, 5);
+  const uint64_t height = w.get_blockchain_current_height();
+  wallet_accessor_test::receive(w, {0, 0}, 4000);
+  wallet_accessor_test::receive(w, {1, 0}, 8000);
+  add_blocks(w, 1);
+  wallet_accessor_test::set_spent(w, a, w.get_blockchain_current_height() - 1);
+  w.freeze(b);
+  add_blocks(w, 10);
+  check_balances(w);
+  EXPECT_EQ(4000, w.balance(0, true));
+
+  // outputs received from the detached height go, and those spent there are unspent again
+  wallet_accessor_test::detach_blockchain(w, height - 1);
+  EXPECT_EQ(height - 1, w.get_blockchain_current_height());
+  EXPECT_EQ(2, w.get_num_transfer_details());
+  check_balances(w);
+  EXPECT_EQ(3000, w.balance(0, true));
+  EXPECT_EQ(0, w.balance(1, true));
+
+  add_blocks(w, 1);
+  wallet_accessor_test::receive(w, {1, 0}, 16000);
+  check_balances(w);
+  EXPECT_EQ(16000, w.balance(1, true));
+}
+
+TEST_F(wallet_balances, key_image_spent_status)
+{
+  add_blocks(w, 1);
+  const size_t a = wallet_accessor_test::receive(w, {0, 0}, 1000);
+  const size_t b = wallet_accessor_test::receive(w, {0, 1}, 2000);
+  add_blocks(w, CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE + 1);
+
+  wallet_accessor_test::set_spent_status(w, a, true);
+  wallet_accessor_test::set_spent_status(w, b, true);
+  check_balances(w);
+  EXPECT_EQ(0, w.balance(0, false));
+
+  wallet_accessor_test::set_spent_status(w, b, false);
+  check_balances(w);
+  EXPECT_EQ(2000, w.balance(0, false));
+}
+
+TEST(wallet_balances_reload, cache_is_rebuilt_on_load)
+{
+  const boost::filesystem::path wallet_file = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  const epee::wipeable_string password("beepbeep");
+
+  {
+    tools::wallet2 w;
+    w.set_offline();
+    w.generate(wallet_file.string(), password);
+    add_blocks(w, 1);
+    const size_t a = wallet_accessor_test::receive(w, {0, 0}, 1000);
+    const size_t b = wallet_accessor_test::receive(w, {0, 1}, 2000, time(NULL) + 3600);
+    wallet_accessor_test::receive(w, {1, 0}, 4000);
+    add_blocks(w, 1);
+    wallet_accessor_test::set_spent(w, a, w.get_blockchain_current_height() - 1);
+    w.freeze(b);
+    add_blocks(w, CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE);
+    check_balances(w);
+    w.store();
+  }
+
+  {
+    tools::wallet2 w;
+    w.set_offline();
+    w.load(wallet_file.string(), password);
+    check_balances(w);
+    EXPECT_EQ(0, w.balance(0, true));
+    EXPECT_EQ(4000, w.balance(1, true));
+
+    w.thaw(size_t(1));
+    check_balances(w);
+    EXPECT_EQ(2000, w.balance(0, true));
+  }
+
+  boost::filesystem::remove(wallet_file);
+  boost::filesystem::remove(wallet_file.string() + ".keys");
+}
+
+TEST_F(wallet_balances, unspent_transfers)
+{
+  const uint64_t height = w.get_blockchain_current_height();
+  add_blocks(w, 1);
+  const size_t a = wallet_accessor_test::receive(w, {0, 0}, 1000);
+  wallet_accessor_test::receive(w, {0, 1}, 2000);
+  wallet_accessor_test::receive(w, {1, 2}, 4000);
+  const size_t b = wallet_accessor_test::receive(w, {0, 2}, 8000);
+  add_blocks(w, 1);
+  wallet_accessor_test::receive(w, {0, 0}, 16000, height + 20);
+  wallet_accessor_test::receive(w, {0, 1}, 32000, time(NULL) + 3600);
+  wallet_accessor_test::receive(w, {1, 1}, 64000, time(NULL) - 3600);
+  wallet_accessor_test::receive(w, {0, 0}, 1000);
+  check_unspent_transfers(w);
+
+  add_blocks(w, CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE);
+  check_unspent_transfers(w);
+  EXPECT_EQ(std::vector<size_t>({0, 1, 3, 7}), wallet_accessor_test::get_unspent_transfers(w, 0u, {}, true, 0));
+  EXPECT_EQ(std::vector<size_t>({3}), wallet_accessor_test::get_unspent_transfers(w, 0u, {}, true, 5000));
+
+  wallet_accessor_test::set_spent(w, a, w.get_blockchain_current_height() - 1);
+  wallet_accessor_test::set_spent(w, b, 0);
+  w.freeze(size_t(1));
+  check_unspent_transfers(w);
+
+  add_blocks(w, 20);
+  check_unspent_transfers(w);
+  EXPECT_EQ(std::vector<size_t>({4, 7}), wallet_accessor_test::get_unspent_transfers(w, 0u, {}, true, 0));
+
+  w.thaw(size_t(1));
+  wallet_accessor_test::set_unspent(w, b);
+  check_unspent_transfers(w);
+  EXPECT_EQ(std::vector<size_t>({1, 3, 4, 5, 7}), wallet_accessor_test::get_unspent_transfers(w, 0u, {}, false, 0));
+}
@@ -27,6 +27,7 @@
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "unit_tests_utils.h"
+#include "wallet_accessor_test.h"
 #include "gtest/gtest.h"
 
 #include "file_io_utils.h"
@@ -265,3 +266,42 @@ TEST(wallet_storage, change_password_mem2file)
 
     EXPECT_EQ(primary_address_1, primary_address_2);
 }
+
+TEST(wallet_storage, store_journaled)
+{
+    const path source_wallet_file = unit_test::data_dir / "wallet_00fd416a";
+    const path wallet_file = unit_test::data_dir / "wallet_00fd416a_copy_journaled";
+    const std::string journal_file = wallet_file.string() + ".journal";
+
+    tools::copy_file(source_wallet_file.string(), wallet_file.string());
+    tools::copy_file(source_wallet_file.string() + ".keys", wallet_file.string() + ".keys");
+    if (is_file_exist(journal_file))
+        remove(journal_file);
+
+    epee::wipeable_string password("beepbeep");
+    crypto::hash txid = crypto::null_hash;
+    txid.data[0] = 1;
+
+    {
+        tools::wallet2 w;
+        w.load(wallet_file.string(), password);
+        wallet_accessor_test::set_cache_journal_min_snapshot_size(w, 0);
+        w.store();
+        EXPECT_FALSE(is_file_exist(journal_file));
+
+        w.set_tx_note(txid, "journaled note");
+        w.set_attribute("journaled", "attribute");
+        w.store();
+        EXPECT_TRUE(is_file_exist(journal_file));
+    }
+
+    {
+        tools::wallet2 w;
+        w.load(wallet_file.string(), password);
+        EXPECT_EQ(WALLET_00fd416a_PRIMARY_ADDRESS, w.get_address_as_str());
+        EXPECT_EQ("journaled note", w.get_tx_note(txid));
+        std::string value;
+        EXPECT_TRUE(w.get_attribute("journaled", value));
+        EXPECT_EQ("attribute", value);
+    }
+}